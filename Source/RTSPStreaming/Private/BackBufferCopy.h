@@ -0,0 +1,11 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RHI.h"
+#include "RHIResources.h"
+
+// copies the back buffer into a render target the encoder reads from, render thread only
+// - a plain resolve when format and size match
+// - otherwise a full screen draw, which converts the format and scales bilinearly to the encoder size
+void CopyBackBuffer(const FTexture2DRHIRef& BackBuffer, const FTexture2DRHIRef& ResolvedBackBuffer);
@@ -0,0 +1,65 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "CapturePacer.h"
+#include "Controller.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("CaptureSkippedDeadlines"), STAT_RTSPStreaming_CaptureSkippedDeadlines, STATGROUP_RTSPStreaming);
+
+// a back buffer this close to the next deadline is taken for it, absorbs vsync jitter when both rates are equal
+static const double CaptureTolerance = 0.25;
+
+FCapturePacer::FCapturePacer()
+	: FrameRate(60)
+	, StartTime(-1.0)
+	, StartTimestamp(0)
+	, NextIndex(0)
+	, PendingFrameRate(0)
+{}
+
+void FCapturePacer::SetFrameRate(uint32 InFrameRate)
+{
+	check(InFrameRate > 0);
+	if (InFrameRate != FrameRate)
+	{
+		PendingFrameRate = InFrameRate;
+	}
+}
+
+bool FCapturePacer::ShouldCapture(double Now, uint64& OutTimestamp)
+{
+	// the first presented frame starts the clock
+	if (StartTime < 0.0)
+	{
+		if (PendingFrameRate)
+		{
+			FrameRate = PendingFrameRate;
+			PendingFrameRate = 0;
+		}
+		StartTime = Now;
+		NextIndex = 0;
+	}
+
+	const double Deadline = GetDeadline(NextIndex);
+	if (Now + CaptureTolerance / FrameRate < Deadline)
+	{
+		return false;
+	}
+
+	// a new rate starts counting from this deadline
+	if (PendingFrameRate)
+	{
+		StartTimestamp += NextIndex * RTP_VIDEO_CLOCK_RATE / FrameRate;
+		StartTime = Deadline;
+		NextIndex = 0;
+		FrameRate = PendingFrameRate;
+		PendingFrameRate = 0;
+	}
+
+	// the most recent deadline that has passed, earlier ones were missed by the game
+	const uint64 Index = FMath::Max(NextIndex, static_cast<uint64>(FMath::Max((Now - StartTime) * FrameRate + CaptureTolerance, 0.0)));
+	INC_DWORD_STAT_BY(STAT_RTSPStreaming_CaptureSkippedDeadlines, static_cast<uint32>(Index - NextIndex));
+
+	OutTimestamp = StartTimestamp + Index * RTP_VIDEO_CLOCK_RATE / FrameRate;
+	NextIndex = Index + 1;
+	return true;
+}
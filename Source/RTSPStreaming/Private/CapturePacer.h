@@ -0,0 +1,39 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#define RTP_VIDEO_CLOCK_RATE 90000		// RTP clock of video payloads, Hz
+
+// samples presented back buffers at the stream frame rate, independent of the game frame rate
+// capture deadlines are computed from the start of the current rate as Start + N / FrameRate rather than by adding
+// an interval to the previous capture, so rounding and late frames never accumulate into drift. A back buffer is
+// taken when it is presented within a quarter interval of the next deadline, deadlines the game missed entirely
+// are skipped. Every captured frame is stamped with its deadline on the 90 kHz RTP clock, so timestamps are spaced
+// exactly 90000 / FrameRate apart however unevenly the game presents.
+class FCapturePacer final
+{
+public:
+	FCapturePacer();
+
+	void SetFrameRate(uint32 InFrameRate);				// takes effect at the next deadline, timestamps stay monotonic
+	uint32 GetFrameRate() const
+	{
+		return FrameRate;
+	}
+
+	bool ShouldCapture(double Now, uint64& OutTimestamp);	// true if the back buffer presented at Now should be encoded
+
+private:
+	double GetDeadline(uint64 Index) const
+	{
+		return StartTime + static_cast<double>(Index) / FrameRate;
+	}
+
+	uint32		FrameRate;
+	double		StartTime;				// time of frame 0 at the current rate, negative until the first capture
+	uint64		StartTimestamp;			// 90 kHz timestamp of frame 0 at the current rate
+	uint64		NextIndex;				// next frame to capture, counted from StartTime
+	uint32		PendingFrameRate;		// rate switched to at the next deadline, 0 if none
+};
@@ -0,0 +1,393 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ColorConversion.h"
+
+#if PLATFORM_CPU_X86_FAMILY
+#	if defined(_MSC_VER)
+#		include <intrin.h>
+#		define COLOR_CONVERSION_SSE41
+#		define COLOR_CONVERSION_AVX2
+#	else
+#		include <cpuid.h>
+#		include <immintrin.h>
+#		define COLOR_CONVERSION_SSE41	__attribute__((target("sse4.1")))
+#		define COLOR_CONVERSION_AVX2	__attribute__((target("avx2")))
+#	endif
+#endif
+
+// BT.709 studio swing with 8 fractional bits, e.g. Y = 16 + (47 R + 157 G + 16 B) / 256 for 8 bit channels.
+// the chroma rows sum to 0 so grey stays at 128
+static const int32 YR = 47, YG = 157, YB = 16;
+static const int32 UR = -26, UG = -86, UB = 112;
+static const int32 VR = 112, VG = -102, VB = -10;
+
+// where the channels of a 32 bit source pixel are
+struct FSourceLayout
+{
+	int32	RShift;
+	int32	GShift;
+	int32	BShift;
+	int32	Mask;
+	int32	Bits;				// per channel, the fixed point results are shifted by this
+};
+
+static FSourceLayout GetSourceLayout(EPixelFormat Format)
+{
+	checkf(Format == PF_B8G8R8A8 || Format == PF_A2B10G10R10, TEXT("Can't convert pixel format %d to YUV"), static_cast<int32>(Format));
+	return Format == PF_B8G8R8A8 ? FSourceLayout{ 16, 8, 0, 0xFF, 8 } : FSourceLayout{ 0, 10, 20, 0x3FF, 10 };
+}
+
+// converts columns [Begin, End) of a row pair, also finishes the columns the vector versions leave over
+// ChromaStep is 1 for separate U and V planes and 2 for interleaved UV
+static void ConvertRowPairScalar(const FSourceLayout& Layout, const uint8* Src0, const uint8* Src1, int32 Begin, int32 End,
+	uint8* Y0, uint8* Y1, uint8* U, uint8* V, int32 ChromaStep)
+{
+	const int32 LumaRound = 1 << (Layout.Bits - 1);
+	const int32 ChromaRound = 1 << (Layout.Bits + 1);
+	for (int32 Col = Begin; Col < End; Col += 2)
+	{
+		int32 SumR = 0, SumG = 0, SumB = 0;
+		const uint8* Rows[2] = { Src0, Src1 };
+		uint8* Luma[2] = { Y0, Y1 };
+		for (int32 Row = 0; Row < 2; ++Row)
+		{
+			for (int32 Pixel = Col; Pixel < Col + 2; ++Pixel)
+			{
+				uint32 Value;
+				FMemory::Memcpy(&Value, Rows[Row] + Pixel * 4, sizeof(Value));
+				const int32 R = (Value >> Layout.RShift) & Layout.Mask;
+				const int32 G = (Value >> Layout.GShift) & Layout.Mask;
+				const int32 B = (Value >> Layout.BShift) & Layout.Mask;
+				Luma[Row][Pixel] = static_cast<uint8>(16 + ((YR * R + YG * G + YB * B + LumaRound) >> Layout.Bits));
+				SumR += R;
+				SumG += G;
+				SumB += B;
+			}
+		}
+
+		// the 2x2 average is folded into the final shift so it's rounded once
+		const int32 Chroma = (Col / 2) * ChromaStep;
+		U[Chroma] = static_cast<uint8>(128 + ((UR * SumR + UG * SumG + UB * SumB + ChromaRound) >> (Layout.Bits + 2)));
+		V[Chroma] = static_cast<uint8>(128 + ((VR * SumR + VG * SumG + VB * SumB + ChromaRound) >> (Layout.Bits + 2)));
+	}
+}
+
+static void Downscale2xRowScalar(const uint8* Src0, const uint8* Src1, int32 Begin, int32 End, uint8* Dst)
+{
+	for (int32 Col = Begin; Col < End; ++Col)
+	{
+		Dst[Col] = static_cast<uint8>((Src0[Col * 2] + Src0[Col * 2 + 1] + Src1[Col * 2] + Src1[Col * 2 + 1] + 2) >> 2);
+	}
+}
+
+#if PLATFORM_CPU_X86_FAMILY
+
+static void GetCpuId(int32 Leaf, int32 SubLeaf, int32 OutRegisters[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex(OutRegisters, Leaf, SubLeaf);
+#else
+	uint32 Eax = 0, Ebx = 0, Ecx = 0, Edx = 0;
+	__cpuid_count(Leaf, SubLeaf, Eax, Ebx, Ecx, Edx);
+	OutRegisters[0] = Eax;
+	OutRegisters[1] = Ebx;
+	OutRegisters[2] = Ecx;
+	OutRegisters[3] = Edx;
+#endif
+}
+
+static EColorConversionIsa DetectColorConversionIsa()
+{
+	int32 Registers[4];
+	GetCpuId(0, 0, Registers);
+	const int32 MaxLeaf = Registers[0];
+
+	GetCpuId(1, 0, Registers);
+	const bool bSse41 = (Registers[2] & (1 << 19)) != 0;
+	const bool bOsXSave = (Registers[2] & (1 << 27)) != 0;
+	const bool bAvx = (Registers[2] & (1 << 28)) != 0;
+
+	// AVX2 also needs the OS to save the upper halves of the YMM registers
+	bool bAvx2 = false;
+	if (MaxLeaf >= 7 && bOsXSave && bAvx)
+	{
+#if defined(_MSC_VER)
+		const uint64 XCR0 = _xgetbv(0);
+#else
+		uint32 XCR0Low = 0, XCR0High = 0;
+		__asm__ volatile("xgetbv" : "=a"(XCR0Low), "=d"(XCR0High) : "c"(0));
+		const uint64 XCR0 = (static_cast<uint64>(XCR0High) << 32) | XCR0Low;
+#endif
+		GetCpuId(7, 0, Registers);
+		bAvx2 = (XCR0 & 0x6) == 0x6 && (Registers[1] & (1 << 5)) != 0;
+	}
+
+	return bAvx2 ? EColorConversionIsa::Avx2 : bSse41 ? EColorConversionIsa::Sse41 : EColorConversionIsa::Scalar;
+}
+
+// 4 pixels per vector, two vectors per row and iteration
+COLOR_CONVERSION_SSE41 static void ConvertRowPairSse41(const FSourceLayout& Layout, const uint8* Src0, const uint8* Src1, int32 Width,
+	uint8* Y0, uint8* Y1, uint8* U, uint8* V, int32 ChromaStep)
+{
+	const __m128i Mask = _mm_set1_epi32(Layout.Mask);
+	const __m128i RShift = _mm_cvtsi32_si128(Layout.RShift);
+	const __m128i GShift = _mm_cvtsi32_si128(Layout.GShift);
+	const __m128i BShift = _mm_cvtsi32_si128(Layout.BShift);
+	const __m128i LumaShift = _mm_cvtsi32_si128(Layout.Bits);
+	const __m128i ChromaShift = _mm_cvtsi32_si128(Layout.Bits + 2);
+	const __m128i LumaRound = _mm_set1_epi32(1 << (Layout.Bits - 1));
+	const __m128i ChromaRound = _mm_set1_epi32(1 << (Layout.Bits + 1));
+	const __m128i LumaOffset = _mm_set1_epi32(16);
+	const __m128i ChromaOffset = _mm_set1_epi32(128);
+	const __m128i InterleaveUV = _mm_setr_epi8(0, 4, 1, 5, 2, 6, 3, 7, -1, -1, -1, -1, -1, -1, -1, -1);
+
+	int32 Col = 0;
+	for (; Col + 8 <= Width; Col += 8)
+	{
+		__m128i R[4], G[4], B[4];
+		const uint8* Sources[4] = { Src0 + Col * 4, Src0 + Col * 4 + 16, Src1 + Col * 4, Src1 + Col * 4 + 16 };
+		__m128i Luma[4];
+		for (int32 Index = 0; Index < 4; ++Index)
+		{
+			const __m128i Pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(Sources[Index]));
+			R[Index] = _mm_and_si128(_mm_srl_epi32(Pixels, RShift), Mask);
+			G[Index] = _mm_and_si128(_mm_srl_epi32(Pixels, GShift), Mask);
+			B[Index] = _mm_and_si128(_mm_srl_epi32(Pixels, BShift), Mask);
+
+			__m128i Sum = _mm_add_epi32(_mm_mullo_epi32(R[Index], _mm_set1_epi32(YR)), _mm_mullo_epi32(G[Index], _mm_set1_epi32(YG)));
+			Sum = _mm_add_epi32(Sum, _mm_mullo_epi32(B[Index], _mm_set1_epi32(YB)));
+			Luma[Index] = _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(Sum, LumaRound), LumaShift), LumaOffset);
+		}
+
+		const __m128i Luma0 = _mm_packs_epi32(Luma[0], Luma[1]);
+		const __m128i Luma1 = _mm_packs_epi32(Luma[2], Luma[3]);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Y0 + Col), _mm_packus_epi16(Luma0, Luma0));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(Y1 + Col), _mm_packus_epi16(Luma1, Luma1));
+
+		// vertical sums first, then adjacent pixels give the four 2x2 sums in order
+		const __m128i SumR = _mm_hadd_epi32(_mm_add_epi32(R[0], R[2]), _mm_add_epi32(R[1], R[3]));
+		const __m128i SumG = _mm_hadd_epi32(_mm_add_epi32(G[0], G[2]), _mm_add_epi32(G[1], G[3]));
+		const __m128i SumB = _mm_hadd_epi32(_mm_add_epi32(B[0], B[2]), _mm_add_epi32(B[1], B[3]));
+
+		__m128i SumU = _mm_add_epi32(_mm_mullo_epi32(SumR, _mm_set1_epi32(UR)), _mm_mullo_epi32(SumG, _mm_set1_epi32(UG)));
+		SumU = _mm_add_epi32(SumU, _mm_mullo_epi32(SumB, _mm_set1_epi32(UB)));
+		__m128i SumV = _mm_add_epi32(_mm_mullo_epi32(SumR, _mm_set1_epi32(VR)), _mm_mullo_epi32(SumG, _mm_set1_epi32(VG)));
+		SumV = _mm_add_epi32(SumV, _mm_mullo_epi32(SumB, _mm_set1_epi32(VB)));
+		const __m128i ChromaU = _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(SumU, ChromaRound), ChromaShift), ChromaOffset);
+		const __m128i ChromaV = _mm_add_epi32(_mm_sra_epi32(_mm_add_epi32(SumV, ChromaRound), ChromaShift), ChromaOffset);
+
+		// U0-3 then V0-3
+		const __m128i Chroma16 = _mm_packs_epi32(ChromaU, ChromaV);
+		const __m128i Chroma = _mm_packus_epi16(Chroma16, Chroma16);
+		if (ChromaStep == 1)
+		{
+			const int32 ValueU = _mm_cvtsi128_si32(Chroma);
+			const int32 ValueV = _mm_extract_epi32(Chroma, 1);
+			FMemory::Memcpy(U + Col / 2, &ValueU, sizeof(ValueU));
+			FMemory::Memcpy(V + Col / 2, &ValueV, sizeof(ValueV));
+		}
+		else
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(U + Col), _mm_shuffle_epi8(Chroma, InterleaveUV));
+		}
+	}
+
+	ConvertRowPairScalar(Layout, Src0, Src1, Col, Width, Y0, Y1, U, V, ChromaStep);
+}
+
+// 8 pixels per vector, two vectors per row and iteration
+COLOR_CONVERSION_AVX2 static void ConvertRowPairAvx2(const FSourceLayout& Layout, const uint8* Src0, const uint8* Src1, int32 Width,
+	uint8* Y0, uint8* Y1, uint8* U, uint8* V, int32 ChromaStep)
+{
+	const __m256i Mask = _mm256_set1_epi32(Layout.Mask);
+	const __m128i RShift = _mm_cvtsi32_si128(Layout.RShift);
+	const __m128i GShift = _mm_cvtsi32_si128(Layout.GShift);
+	const __m128i BShift = _mm_cvtsi32_si128(Layout.BShift);
+	const __m128i LumaShift = _mm_cvtsi32_si128(Layout.Bits);
+	const __m128i ChromaShift = _mm_cvtsi32_si128(Layout.Bits + 2);
+	const __m256i LumaRound = _mm256_set1_epi32(1 << (Layout.Bits - 1));
+	const __m256i ChromaRound = _mm256_set1_epi32(1 << (Layout.Bits + 1));
+	const __m256i LumaOffset = _mm256_set1_epi32(16);
+	const __m256i ChromaOffset = _mm256_set1_epi32(128);
+
+	int32 Col = 0;
+	for (; Col + 16 <= Width; Col += 16)
+	{
+		__m256i R[4], G[4], B[4];
+		const uint8* Sources[4] = { Src0 + Col * 4, Src0 + Col * 4 + 32, Src1 + Col * 4, Src1 + Col * 4 + 32 };
+		__m256i Luma[4];
+		for (int32 Index = 0; Index < 4; ++Index)
+		{
+			const __m256i Pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Sources[Index]));
+			R[Index] = _mm256_and_si256(_mm256_srl_epi32(Pixels, RShift), Mask);
+			G[Index] = _mm256_and_si256(_mm256_srl_epi32(Pixels, GShift), Mask);
+			B[Index] = _mm256_and_si256(_mm256_srl_epi32(Pixels, BShift), Mask);
+
+			__m256i Sum = _mm256_add_epi32(_mm256_mullo_epi32(R[Index], _mm256_set1_epi32(YR)), _mm256_mullo_epi32(G[Index], _mm256_set1_epi32(YG)));
+			Sum = _mm256_add_epi32(Sum, _mm256_mullo_epi32(B[Index], _mm256_set1_epi32(YB)));
+			Luma[Index] = _mm256_add_epi32(_mm256_sra_epi32(_mm256_add_epi32(Sum, LumaRound), LumaShift), LumaOffset);
+		}
+
+		// packs work within 128 bit lanes, the permute puts the 64 bit quarters back in pixel order
+		for (int32 Row = 0; Row < 2; ++Row)
+		{
+			const __m256i Luma16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(Luma[Row * 2], Luma[Row * 2 + 1]), 0xD8);
+			const __m128i Luma8 = _mm_packus_epi16(_mm256_castsi256_si128(Luma16), _mm256_extracti128_si256(Luma16, 1));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>((Row ? Y1 : Y0) + Col), Luma8);
+		}
+
+		const __m256i SumR = _mm256_permute4x64_epi64(_mm256_hadd_epi32(_mm256_add_epi32(R[0], R[2]), _mm256_add_epi32(R[1], R[3])), 0xD8);
+		const __m256i SumG = _mm256_permute4x64_epi64(_mm256_hadd_epi32(_mm256_add_epi32(G[0], G[2]), _mm256_add_epi32(G[1], G[3])), 0xD8);
+		const __m256i SumB = _mm256_permute4x64_epi64(_mm256_hadd_epi32(_mm256_add_epi32(B[0], B[2]), _mm256_add_epi32(B[1], B[3])), 0xD8);
+
+		__m256i SumU = _mm256_add_epi32(_mm256_mullo_epi32(SumR, _mm256_set1_epi32(UR)), _mm256_mullo_epi32(SumG, _mm256_set1_epi32(UG)));
+		SumU = _mm256_add_epi32(SumU, _mm256_mullo_epi32(SumB, _mm256_set1_epi32(UB)));
+		__m256i SumV = _mm256_add_epi32(_mm256_mullo_epi32(SumR, _mm256_set1_epi32(VR)), _mm256_mullo_epi32(SumG, _mm256_set1_epi32(VG)));
+		SumV = _mm256_add_epi32(SumV, _mm256_mullo_epi32(SumB, _mm256_set1_epi32(VB)));
+		const __m256i ChromaU = _mm256_add_epi32(_mm256_sra_epi32(_mm256_add_epi32(SumU, ChromaRound), ChromaShift), ChromaOffset);
+		const __m256i ChromaV = _mm256_add_epi32(_mm256_sra_epi32(_mm256_add_epi32(SumV, ChromaRound), ChromaShift), ChromaOffset);
+
+		// U0-7 then V0-7
+		const __m256i Chroma16 = _mm256_permute4x64_epi64(_mm256_packs_epi32(ChromaU, ChromaV), 0xD8);
+		const __m128i Chroma = _mm_packus_epi16(_mm256_castsi256_si128(Chroma16), _mm256_extracti128_si256(Chroma16, 1));
+		if (ChromaStep == 1)
+		{
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(U + Col / 2), Chroma);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(V + Col / 2), _mm_unpackhi_epi64(Chroma, Chroma));
+		}
+		else
+		{
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(U + Col), _mm_unpacklo_epi8(Chroma, _mm_unpackhi_epi64(Chroma, Chroma)));
+		}
+	}
+
+	// avoids the AVX to SSE transition penalty in code compiled without VEX encoding
+	_mm256_zeroupper();
+	ConvertRowPairScalar(Layout, Src0, Src1, Col, Width, Y0, Y1, U, V, ChromaStep);
+}
+
+COLOR_CONVERSION_SSE41 static void Downscale2xRowSse41(const uint8* Src0, const uint8* Src1, int32 Width, uint8* Dst)
+{
+	const __m128i Ones = _mm_set1_epi8(1);
+	const __m128i Round = _mm_set1_epi16(2);
+
+	int32 Col = 0;
+	for (; Col + 16 <= Width; Col += 16)
+	{
+		__m128i Sums[2];
+		for (int32 Half = 0; Half < 2; ++Half)
+		{
+			// multiply-add with ones sums horizontal pairs
+			const __m128i Row0 = _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Src0 + Col * 2 + Half * 16)), Ones);
+			const __m128i Row1 = _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(Src1 + Col * 2 + Half * 16)), Ones);
+			Sums[Half] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(Row0, Row1), Round), 2);
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Dst + Col), _mm_packus_epi16(Sums[0], Sums[1]));
+	}
+
+	Downscale2xRowScalar(Src0, Src1, Col, Width, Dst);
+}
+
+COLOR_CONVERSION_AVX2 static void Downscale2xRowAvx2(const uint8* Src0, const uint8* Src1, int32 Width, uint8* Dst)
+{
+	const __m256i Ones = _mm256_set1_epi8(1);
+	const __m256i Round = _mm256_set1_epi16(2);
+
+	int32 Col = 0;
+	for (; Col + 32 <= Width; Col += 32)
+	{
+		__m256i Sums[2];
+		for (int32 Half = 0; Half < 2; ++Half)
+		{
+			const __m256i Row0 = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Src0 + Col * 2 + Half * 32)), Ones);
+			const __m256i Row1 = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(Src1 + Col * 2 + Half * 32)), Ones);
+			Sums[Half] = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(Row0, Row1), Round), 2);
+		}
+		const __m256i Packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(Sums[0], Sums[1]), 0xD8);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(Dst + Col), Packed);
+	}
+
+	_mm256_zeroupper();
+	Downscale2xRowScalar(Src0, Src1, Col, Width, Dst);
+}
+
+#endif
+
+EColorConversionIsa GetBestColorConversionIsa()
+{
+#if PLATFORM_CPU_X86_FAMILY
+	static const EColorConversionIsa Isa = DetectColorConversionIsa();
+	return Isa;
+#else
+	return EColorConversionIsa::Scalar;
+#endif
+}
+
+static void ConvertRowPair(EColorConversionIsa Isa, const FSourceLayout& Layout, const uint8* Src0, const uint8* Src1, int32 Width,
+	uint8* Y0, uint8* Y1, uint8* U, uint8* V, int32 ChromaStep)
+{
+#if PLATFORM_CPU_X86_FAMILY
+	if (Isa == EColorConversionIsa::Avx2)
+	{
+		ConvertRowPairAvx2(Layout, Src0, Src1, Width, Y0, Y1, U, V, ChromaStep);
+		return;
+	}
+	if (Isa == EColorConversionIsa::Sse41)
+	{
+		ConvertRowPairSse41(Layout, Src0, Src1, Width, Y0, Y1, U, V, ChromaStep);
+		return;
+	}
+#endif
+	ConvertRowPairScalar(Layout, Src0, Src1, 0, Width, Y0, Y1, U, V, ChromaStep);
+}
+
+void ConvertToI420(EPixelFormat Format, const uint8* Src, int32 SrcPitch, int32 Width, int32 Height, uint8* Y, uint8* U, uint8* V, EColorConversionIsa Isa)
+{
+	check(!(Width & 1) && !(Height & 1));
+
+	const FSourceLayout Layout = GetSourceLayout(Format);
+	for (int32 Row = 0; Row < Height; Row += 2)
+	{
+		const uint8* Src0 = Src + Row * SrcPitch;
+		uint8* Y0 = Y + Row * Width;
+		const int32 ChromaOffset = (Row / 2) * (Width / 2);
+		ConvertRowPair(Isa, Layout, Src0, Src0 + SrcPitch, Width, Y0, Y0 + Width, U + ChromaOffset, V + ChromaOffset, 1);
+	}
+}
+
+void ConvertToNV12(EPixelFormat Format, const uint8* Src, int32 SrcPitch, int32 Width, int32 Height, uint8* Y, uint8* UV, EColorConversionIsa Isa)
+{
+	check(!(Width & 1) && !(Height & 1));
+
+	const FSourceLayout Layout = GetSourceLayout(Format);
+	for (int32 Row = 0; Row < Height; Row += 2)
+	{
+		const uint8* Src0 = Src + Row * SrcPitch;
+		uint8* Y0 = Y + Row * Width;
+		uint8* Chroma = UV + (Row / 2) * Width;
+		ConvertRowPair(Isa, Layout, Src0, Src0 + SrcPitch, Width, Y0, Y0 + Width, Chroma, Chroma + 1, 2);
+	}
+}
+
+void Downscale2x(const uint8* Src, int32 SrcPitch, int32 Width, int32 Height, uint8* Dst, int32 DstPitch, EColorConversionIsa Isa)
+{
+	const int32 DstWidth = Width / 2;
+	for (int32 Row = 0; Row < Height / 2; ++Row)
+	{
+		const uint8* Src0 = Src + Row * 2 * SrcPitch;
+		uint8* DstRow = Dst + Row * DstPitch;
+#if PLATFORM_CPU_X86_FAMILY
+		if (Isa == EColorConversionIsa::Avx2)
+		{
+			Downscale2xRowAvx2(Src0, Src0 + SrcPitch, DstWidth, DstRow);
+			continue;
+		}
+		if (Isa == EColorConversionIsa::Sse41)
+		{
+			Downscale2xRowSse41(Src0, Src0 + SrcPitch, DstWidth, DstRow);
+			continue;
+		}
+#endif
+		Downscale2xRowScalar(Src0, Src0 + SrcPitch, 0, DstWidth, DstRow);
+	}
+}
@@ -0,0 +1,44 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PixelFormat.h"
+
+// CPU kernels that turn read back frames into the 8 bit YUV 4:2:0 input of software encoders
+// - sources are PF_B8G8R8A8 or PF_A2B10G10R10, the format of the NVENC input buffers
+// - BT.709 studio swing coefficients in fixed point, chroma is the average of each 2x2 block
+// - SSE4.1 and AVX2 versions are picked at runtime, every version gives the same result as the scalar one
+enum class EColorConversionIsa : uint8
+{
+	Scalar,
+	Sse41,
+	Avx2,
+};
+
+/**
+* Best instruction set of this CPU, detected once.
+*/
+EColorConversionIsa GetBestColorConversionIsa();
+
+/**
+* Converts to I420, planes Y, U, V with pitches of Width, Width / 2 and Width / 2 bytes. Width and Height must be even.
+* @param Src - first row of the source, e.g. a mapped readback texture or a synthetic frame
+* @param SrcPitch - bytes between source rows, at least Width * 4
+*/
+void ConvertToI420(EPixelFormat Format, const uint8* Src, int32 SrcPitch, int32 Width, int32 Height, uint8* Y, uint8* U, uint8* V,
+	EColorConversionIsa Isa = GetBestColorConversionIsa());
+
+/**
+* Converts to NV12, plane Y and interleaved plane UV, both with a pitch of Width bytes. Width and Height must be even.
+*/
+void ConvertToNV12(EPixelFormat Format, const uint8* Src, int32 SrcPitch, int32 Width, int32 Height, uint8* Y, uint8* UV,
+	EColorConversionIsa Isa = GetBestColorConversionIsa());
+
+/**
+* Halves an 8 bit plane, e.g. Y, U or V of an I420 frame, each output is the rounded average of a 2x2 block.
+* At exactly half size a bilinear filter samples between the same four pixels, so this is both box and bilinear.
+* The last column or row of an odd size is dropped.
+*/
+void Downscale2x(const uint8* Src, int32 SrcPitch, int32 Width, int32 Height, uint8* Dst, int32 DstPitch,
+	EColorConversionIsa Isa = GetBestColorConversionIsa());
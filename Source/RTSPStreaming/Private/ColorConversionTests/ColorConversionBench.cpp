@@ -0,0 +1,93 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// throughput of the color conversion kernels in Mpix/s, source pixels per second, for every ISA this CPU runs
+// usage: ColorConversionBench [<width> <height> [<seconds per kernel>]], 1920x1080 and 3840x2160 for 1 second each by default
+
+// UBT compiles every source of the module, the benchmark is only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "ColorConversion.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+// runs Kernel for about Seconds and returns the source pixels converted per second, in millions
+static double MeasureMpixPerSecond(int64 PixelsPerRun, double Seconds, const std::function<void()>& Kernel)
+{
+	using FClock = std::chrono::steady_clock;
+
+	// warm up caches and the page tables of the destination
+	Kernel();
+
+	int64 Runs = 0;
+	const FClock::time_point Start = FClock::now();
+	double Elapsed = 0;
+	do
+	{
+		Kernel();
+		Runs++;
+		Elapsed = std::chrono::duration<double>(FClock::now() - Start).count();
+	}
+	while (Elapsed < Seconds);
+	return PixelsPerRun * Runs / Elapsed / 1e6;
+}
+
+static void Bench(int32 Width, int32 Height, double Seconds)
+{
+	std::mt19937 Random(1);
+	std::vector<uint8> Src(static_cast<size_t>(Width) * Height * 4);
+	for (uint8& Byte : Src)
+	{
+		Byte = static_cast<uint8>(Random());
+	}
+	const size_t LumaSize = static_cast<size_t>(Width) * Height;
+	std::vector<uint8> Y(LumaSize), U(LumaSize / 4), V(LumaSize / 4), UV(LumaSize / 2), Half(LumaSize / 4);
+	const int64 Pixels = static_cast<int64>(Width) * Height;
+
+	printf("%dx%d, Mpix/s\n", Width, Height);
+	printf("%-8s %14s %14s %14s %14s %14s\n", "", "BGRA8>I420", "BGRA8>NV12", "ABGR10>I420", "ABGR10>NV12", "Downscale2x");
+
+	std::vector<EColorConversionIsa> Isas = { EColorConversionIsa::Scalar };
+	const EColorConversionIsa Best = GetBestColorConversionIsa();
+	if (Best >= EColorConversionIsa::Sse41)
+	{
+		Isas.push_back(EColorConversionIsa::Sse41);
+	}
+	if (Best >= EColorConversionIsa::Avx2)
+	{
+		Isas.push_back(EColorConversionIsa::Avx2);
+	}
+
+	for (EColorConversionIsa Isa : Isas)
+	{
+		const double Results[] =
+		{
+			MeasureMpixPerSecond(Pixels, Seconds, [&]() { ConvertToI420(PF_B8G8R8A8, Src.data(), Width * 4, Width, Height, Y.data(), U.data(), V.data(), Isa); }),
+			MeasureMpixPerSecond(Pixels, Seconds, [&]() { ConvertToNV12(PF_B8G8R8A8, Src.data(), Width * 4, Width, Height, Y.data(), UV.data(), Isa); }),
+			MeasureMpixPerSecond(Pixels, Seconds, [&]() { ConvertToI420(PF_A2B10G10R10, Src.data(), Width * 4, Width, Height, Y.data(), U.data(), V.data(), Isa); }),
+			MeasureMpixPerSecond(Pixels, Seconds, [&]() { ConvertToNV12(PF_A2B10G10R10, Src.data(), Width * 4, Width, Height, Y.data(), UV.data(), Isa); }),
+			MeasureMpixPerSecond(Pixels, Seconds, [&]() { Downscale2x(Y.data(), Width, Width, Height, Half.data(), Width / 2, Isa); }),
+		};
+		const char* Name = Isa == EColorConversionIsa::Avx2 ? "AVX2" : Isa == EColorConversionIsa::Sse41 ? "SSE4.1" : "scalar";
+		printf("%-8s %14.0f %14.0f %14.0f %14.0f %14.0f\n", Name, Results[0], Results[1], Results[2], Results[3], Results[4]);
+	}
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	const double Seconds = argc > 3 ? atof(argv[3]) : 1.0;
+	if (argc > 2)
+	{
+		Bench(atoi(argv[1]) & ~1, atoi(argv[2]) & ~1, Seconds);
+		return 0;
+	}
+	Bench(1920, 1080, Seconds);
+	Bench(3840, 2160, Seconds);
+	return 0;
+}
+
+#endif
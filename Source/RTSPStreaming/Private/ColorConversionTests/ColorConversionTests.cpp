@@ -0,0 +1,206 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// checks that every vectorized color conversion kernel this CPU runs gives exactly the scalar result, and the scalar
+// kernels against the BT.709 studio swing formula. Exits with the number of failed checks
+// - random sources of both formats, widths around the vector sizes and padded pitches, so the vector loops and their
+//   scalar tails are both covered
+// - grey, black and white land on their nominal YUV values
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "ColorConversion.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static int32 Failures = 0;
+
+static void Check(bool bCondition, const char* What, const char* Isa, EPixelFormat Format, int32 Width, int32 Height)
+{
+	if (!bCondition)
+	{
+		printf("FAIL %s, %s, format %d, %dx%d\n", What, Isa, static_cast<int32>(Format), Width, Height);
+		Failures++;
+	}
+}
+
+static const char* IsaToString(EColorConversionIsa Isa)
+{
+	return Isa == EColorConversionIsa::Avx2 ? "AVX2" : Isa == EColorConversionIsa::Sse41 ? "SSE4.1" : "scalar";
+}
+
+// ISAs this CPU can run, the scalar one first
+static std::vector<EColorConversionIsa> GetSupportedIsas()
+{
+	std::vector<EColorConversionIsa> Isas = { EColorConversionIsa::Scalar };
+	const EColorConversionIsa Best = GetBestColorConversionIsa();
+	if (Best >= EColorConversionIsa::Sse41)
+	{
+		Isas.push_back(EColorConversionIsa::Sse41);
+	}
+	if (Best >= EColorConversionIsa::Avx2)
+	{
+		Isas.push_back(EColorConversionIsa::Avx2);
+	}
+	return Isas;
+}
+
+static uint32 PackPixel(EPixelFormat Format, uint32 R, uint32 G, uint32 B)
+{
+	return Format == PF_B8G8R8A8 ? 0xFF000000 | R << 16 | G << 8 | B : 0xC0000000 | B << 20 | G << 10 | R;
+}
+
+static std::vector<uint8> MakeRandomSource(std::mt19937& Random, int32 Pitch, int32 Height)
+{
+	std::vector<uint8> Src(static_cast<size_t>(Pitch) * Height);
+	for (uint8& Byte : Src)
+	{
+		Byte = static_cast<uint8>(Random());
+	}
+	return Src;
+}
+
+static void TestMatchesScalar(std::mt19937& Random, EPixelFormat Format, int32 Width, int32 Height, int32 PitchPadding)
+{
+	const int32 SrcPitch = Width * 4 + PitchPadding;
+	const std::vector<uint8> Src = MakeRandomSource(Random, SrcPitch, Height);
+	const size_t LumaSize = static_cast<size_t>(Width) * Height;
+
+	std::vector<uint8> RefY(LumaSize), RefU(LumaSize / 4), RefV(LumaSize / 4), RefNV12Y(LumaSize), RefUV(LumaSize / 2);
+	ConvertToI420(Format, Src.data(), SrcPitch, Width, Height, RefY.data(), RefU.data(), RefV.data(), EColorConversionIsa::Scalar);
+	ConvertToNV12(Format, Src.data(), SrcPitch, Width, Height, RefNV12Y.data(), RefUV.data(), EColorConversionIsa::Scalar);
+
+	// the two layouts hold the same samples
+	bool bSameSamples = RefNV12Y == RefY;
+	for (size_t Index = 0; Index < RefU.size(); ++Index)
+	{
+		bSameSamples &= RefUV[Index * 2] == RefU[Index] && RefUV[Index * 2 + 1] == RefV[Index];
+	}
+	Check(bSameSamples, "NV12 holds the I420 samples", "scalar", Format, Width, Height);
+
+	// a luma plane with a padded pitch for the downscale, odd sizes drop the last column and row
+	const int32 PlaneWidth = Width + 1;
+	const int32 PlaneHeight = Height + 1;
+	const int32 PlanePitch = PlaneWidth + PitchPadding;
+	const std::vector<uint8> Plane = MakeRandomSource(Random, PlanePitch, PlaneHeight);
+	const int32 DstPitch = PlaneWidth / 2 + PitchPadding;
+	std::vector<uint8> RefHalf(static_cast<size_t>(DstPitch) * (PlaneHeight / 2), 0xCD);
+	Downscale2x(Plane.data(), PlanePitch, PlaneWidth, PlaneHeight, RefHalf.data(), DstPitch, EColorConversionIsa::Scalar);
+
+	for (EColorConversionIsa Isa : GetSupportedIsas())
+	{
+		if (Isa == EColorConversionIsa::Scalar)
+		{
+			continue;
+		}
+
+		std::vector<uint8> Y(LumaSize), U(LumaSize / 4), V(LumaSize / 4), NV12Y(LumaSize), UV(LumaSize / 2);
+		ConvertToI420(Format, Src.data(), SrcPitch, Width, Height, Y.data(), U.data(), V.data(), Isa);
+		ConvertToNV12(Format, Src.data(), SrcPitch, Width, Height, NV12Y.data(), UV.data(), Isa);
+		Check(Y == RefY && U == RefU && V == RefV, "I420 matches scalar", IsaToString(Isa), Format, Width, Height);
+		Check(NV12Y == RefNV12Y && UV == RefUV, "NV12 matches scalar", IsaToString(Isa), Format, Width, Height);
+
+		// bytes of the destination pitch past the row are left alone
+		std::vector<uint8> Half(RefHalf.size(), 0xCD);
+		Downscale2x(Plane.data(), PlanePitch, PlaneWidth, PlaneHeight, Half.data(), DstPitch, Isa);
+		Check(Half == RefHalf, "Downscale2x matches scalar", IsaToString(Isa), PF_Unknown, PlaneWidth, PlaneHeight);
+	}
+}
+
+// the scalar kernels against BT.709 studio swing in floating point. The 8 bit fixed point coefficients, which also
+// scale 10 bit channels as 8 bit ones with two more fractional bits, and the rounding are a little over 1 off at most
+static void TestScalarAgainstFormula(std::mt19937& Random, EPixelFormat Format)
+{
+	const int32 Width = 64, Height = 2;
+	const std::vector<uint8> Src = MakeRandomSource(Random, Width * 4, Height);
+	std::vector<uint8> Y(Width * Height), U(Width / 2), V(Width / 2);
+	ConvertToI420(Format, Src.data(), Width * 4, Width, Height, Y.data(), U.data(), V.data(), EColorConversionIsa::Scalar);
+
+	const double Max = Format == PF_B8G8R8A8 ? 255.0 : 1023.0;
+	const double MaxError = 1.5;
+	bool bLumaClose = true, bChromaClose = true;
+	for (int32 Col = 0; Col < Width; Col += 2)
+	{
+		double SumU = 0, SumV = 0;
+		for (int32 Row = 0; Row < Height; ++Row)
+		{
+			for (int32 Pixel = Col; Pixel < Col + 2; ++Pixel)
+			{
+				uint32 Value;
+				memcpy(&Value, &Src[(Row * Width + Pixel) * 4], sizeof(Value));
+				const double R = (Format == PF_B8G8R8A8 ? (Value >> 16) & 0xFF : Value & 0x3FF) / Max;
+				const double G = (Format == PF_B8G8R8A8 ? (Value >> 8) & 0xFF : (Value >> 10) & 0x3FF) / Max;
+				const double B = (Format == PF_B8G8R8A8 ? Value & 0xFF : (Value >> 20) & 0x3FF) / Max;
+				const double Luma = 16 + 219 * (0.2126 * R + 0.7152 * G + 0.0722 * B);
+				bLumaClose &= std::fabs(Luma - Y[Row * Width + Pixel]) <= MaxError;
+				SumU += 224 * (-0.1146 * R - 0.3854 * G + 0.5 * B);
+				SumV += 224 * (0.5 * R - 0.4542 * G - 0.0458 * B);
+			}
+		}
+		bChromaClose &= std::fabs(128 + SumU / 4 - U[Col / 2]) <= MaxError && std::fabs(128 + SumV / 4 - V[Col / 2]) <= MaxError;
+	}
+	Check(bLumaClose, "scalar luma follows BT.709", "scalar", Format, Width, Height);
+	Check(bChromaClose, "scalar chroma follows BT.709", "scalar", Format, Width, Height);
+}
+
+static void TestNominalLevels(EPixelFormat Format)
+{
+	const uint32 Max = Format == PF_B8G8R8A8 ? 0xFF : 0x3FF;
+	const struct
+	{
+		const char*	Name;
+		uint32		Level;
+		uint8		Luma;
+	} Levels[] = { { "black", 0, 16 }, { "grey", Max / 2 + 1, 126 }, { "white", Max, 235 } };
+
+	for (const auto& Level : Levels)
+	{
+		const int32 Width = 40, Height = 4;
+		std::vector<uint32> Src(Width * Height, PackPixel(Format, Level.Level, Level.Level, Level.Level));
+		for (EColorConversionIsa Isa : GetSupportedIsas())
+		{
+			std::vector<uint8> Y(Width * Height), U(Width * Height / 4), V(Width * Height / 4);
+			ConvertToI420(Format, reinterpret_cast<const uint8*>(Src.data()), Width * 4, Width, Height, Y.data(), U.data(), V.data(), Isa);
+			bool bNominal = true;
+			for (uint8 Luma : Y)
+			{
+				bNominal &= std::abs(Luma - Level.Luma) <= 1;
+			}
+			for (size_t Index = 0; Index < U.size(); ++Index)
+			{
+				bNominal &= U[Index] == 128 && V[Index] == 128;
+			}
+			Check(bNominal, Level.Name, IsaToString(Isa), Format, Width, Height);
+		}
+	}
+}
+
+int main()
+{
+	std::mt19937 Random(20190401);
+	for (EColorConversionIsa Isa : GetSupportedIsas())
+	{
+		printf("testing %s\n", IsaToString(Isa));
+	}
+
+	const EPixelFormat Formats[] = { PF_B8G8R8A8, PF_A2B10G10R10 };
+	for (EPixelFormat Format : Formats)
+	{
+		for (int32 Width = 2; Width <= 72; Width += 2)
+		{
+			TestMatchesScalar(Random, Format, Width, 4, (Width % 3) * 4);
+		}
+		TestMatchesScalar(Random, Format, 1920, 1080, 0);
+		TestMatchesScalar(Random, Format, 1282, 722, 64);
+		TestScalarAgainstFormula(Random, Format);
+		TestNominalLevels(Format);
+	}
+
+	printf(Failures ? "%d checks failed\n" : "all checks passed\n", Failures);
+	return Failures;
+}
+
+#endif
@@ -0,0 +1,25 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+// the parts of the engine's CoreMinimal.h the color conversion kernels use, for the standalone build only
+#include "RTSPCore/RTSPCoreTypes.h"
+#include <cstddef>
+#include <cstring>
+
+#define TEXT(x)					x
+#define checkf(expr, ...)		assert(expr)
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#	define PLATFORM_CPU_X86_FAMILY	1
+#else
+#	define PLATFORM_CPU_X86_FAMILY	0
+#endif
+
+struct FMemory
+{
+	static void* Memcpy(void* Dest, const void* Src, size_t Size)
+	{
+		return memcpy(Dest, Src, Size);
+	}
+};
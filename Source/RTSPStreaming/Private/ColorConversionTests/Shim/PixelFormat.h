@@ -0,0 +1,11 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+// the source formats of the color conversion kernels, for the standalone build only. Only the names matter to them
+enum EPixelFormat
+{
+	PF_Unknown			= 0,
+	PF_B8G8R8A8			= 2,
+	PF_A2B10G10R10		= 18,
+};
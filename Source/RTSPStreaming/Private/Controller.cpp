@@ -8,14 +8,21 @@
 #include "HAL/PlatformTime.h"
 #include "Misc/ConfigCacheIni.h"
 #include "Async/Async.h"
+#include "Async/Future.h"
 #include "Engine/Engine.h"
 #include "NvVideoEncoder.h"
 #include "RTSPStreamingCommon.h"
 #include "Utils.h"
 #include "Server.h"
+#include "RTSPCore/RTPPacketizer.h"
 
 DECLARE_DWORD_COUNTER_STAT(TEXT("EncodingFramerate"), STAT_RTSPStreaming_EncodingFramerate, STATGROUP_RTSPStreaming);
 DECLARE_DWORD_COUNTER_STAT(TEXT("EncodingBitrate"), STAT_RTSPStreaming_EncodingBitrate, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("EncoderInitMs"), STAT_RTSPStreaming_EncoderInitMs, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("EncoderNotReadyFrames"), STAT_RTSPStreaming_EncoderNotReadyFrames, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("EncoderSessionOpen"), STAT_RTSPStreaming_EncoderSessionOpen, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("FallbackEncoder"), STAT_RTSPStreaming_FallbackEncoder, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("TimeToFirstFrameMs"), STAT_RTSPStreaming_TimeToFirstFrameMs, STATGROUP_RTSPStreaming);
 
 TAutoConsoleVariable<int32> CVarEncoderAverageBitRate(
 	TEXT("Encoder.AverageBitRate"),
@@ -29,6 +36,36 @@ TAutoConsoleVariable<float> CVarEncoderMaxBitrate(
 	TEXT("Max bitrate no matter what WebRTC says, in Mbps"),
 	ECVF_RenderThreadSafe);
 
+static TAutoConsoleVariable<FString> CVarEncoderRateControl(
+	TEXT("Encoder.RateControl"),
+	TEXT("CBR_LD_HQ"),
+	TEXT("CBR_LD_HQ (low-delay high quality CBR), CBR, VBR (peaking at Encoder.VbrPeakFactor times the bitrate) or CQP (every frame at Encoder.ConstQP, for testing). Unknown modes are CBR_LD_HQ"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarEncoderVbrPeakFactor(
+	TEXT("Encoder.VbrPeakFactor"),
+	1.5f,
+	TEXT("Max bitrate of VBR as a multiple of the average bitrate"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarEncoderConstQP(
+	TEXT("Encoder.ConstQP"),
+	28,
+	TEXT("QP of every frame with CQP rate control, 0-51"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarEncoderVbvFrames(
+	TEXT("Encoder.VbvFrames"),
+	1.0f,
+	TEXT("VBV buffer size and initial delay in frames of the bitrate (the max bitrate with VBR). No frame, IDR frames included, is larger, which bounds how long one takes to send. 0 for the encoder's default"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarEncoderMaxFrameSize(
+	TEXT("Encoder.MaxFrameSize"),
+	0,
+	TEXT("Caps the VBV buffer, and so the largest frame, at this many bytes, 0 for no cap beyond Encoder.VbvFrames"),
+	ECVF_RenderThreadSafe);
+
 static TAutoConsoleVariable<FString> CVarEncoderTargetSize(
 	TEXT("Encoder.TargetSize"),
 	TEXT("1280x720"),
@@ -65,6 +102,42 @@ TAutoConsoleVariable<int32> CVarStreamerMinFPS(
 	TEXT("Minimal FPS for quality adaptation"),
 	ECVF_Default);
 
+static TAutoConsoleVariable<int32> CVarEncoderStreamFPS(
+	TEXT("Encoder.StreamFPS"),
+	0,
+	TEXT("Frame rate back buffers are captured and streamed at, independent of the game frame rate. 0 uses the initial max FPS of the game"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarEncoderIdleReleaseSeconds(
+	TEXT("Encoder.IdleReleaseSeconds"),
+	30.0,
+	TEXT("Seconds without playing clients after which the encoder session is released for other instances on the GPU, negative keeps it open"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarEncoderWarmStandby(
+	TEXT("Encoder.WarmStandby"),
+	0,
+	TEXT("Opens the encoder session at startup with its resources registered and keeps it while nobody plays, so the first client gets frames sooner"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarEncoderSoftwareFallback(
+	TEXT("Encoder.SoftwareFallback"),
+	1,
+	TEXT("Streams with the software encoder when the hardware encoder can't be initialized, e.g. without NVENC or when all its sessions are taken"),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<FString> CVarEncoderRenditions(
+	TEXT("Encoder.Renditions"),
+	TEXT(""),
+	TEXT("Simulcast ladder as comma separated heights, e.g. 1080p,720p,360p. Every rendition scales the back buffer to its height and has an encoder session of its own, clients pick one with ?rendition= or get one by congestion feedback. Empty streams the back buffer or Encoder.TargetSize only. Read at startup"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarStreamerMounts(
+	TEXT("Streamer.Mounts"),
+	TEXT("stream/1=h264"),
+	TEXT("Streams clients can DESCRIBE as comma separated path=codec pairs, e.g. stream/1=h264,stream/2=hevc,stream/3=hevc10. Codecs are h264, hevc and hevc10 (HEVC Main10), each one mounted encodes the simulcast ladder with encoders of its own. Read at startup"),
+	ECVF_Default);
+
 TAutoConsoleVariable<float> CVarStreamerBitrateReduction(
 	TEXT("Streamer.BitrateReduction"),
 	50.0,
@@ -73,8 +146,101 @@ TAutoConsoleVariable<float> CVarStreamerBitrateReduction(
 
 const int32 DefaultFPS = 60;
 
-FController::FController(const TCHAR* ServerIP, uint16 ServerPort, const FTexture2DRHIRef& FrameBuffer)
-	: bResizingWindowBackBuffer(false)
+// heights of the simulcast ladder, largest first, empty if there is none
+static TArray<uint32> ParseRenditionLadder(const FString& Ladder)
+{
+	TArray<FString> Entries;
+	Ladder.ParseIntoArray(Entries, TEXT(","));
+
+	TArray<uint32> Heights;
+	for (FString& Entry : Entries)
+	{
+		Entry.TrimStartAndEndInline();
+		Entry.RemoveFromEnd(TEXT("p"), ESearchCase::IgnoreCase);
+		const int32 Height = Entry.IsNumeric() ? FCString::Atoi(*Entry) : 0;
+		if (Height < 2)
+		{
+			UE_LOG(RTSPStreaming, Warning, TEXT("Ignoring rendition '%s' of Encoder.Renditions"), *Entry);
+			continue;
+		}
+		Heights.AddUnique(Height & ~1);
+	}
+
+	Heights.Sort(TGreater<uint32>());
+	if (Heights.Num() > FController::MaxRenditions)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("Encoder.Renditions has %d renditions, only the largest %d are encoded"), Heights.Num(), FController::MaxRenditions);
+		Heights.SetNum(FController::MaxRenditions);
+	}
+	return Heights;
+}
+
+static EVideoRateControl ParseRateControl(const FString& Mode)
+{
+	if (Mode == TEXT("CBR"))
+	{
+		return EVideoRateControl::Cbr;
+	}
+	else if (Mode == TEXT("VBR"))
+	{
+		return EVideoRateControl::Vbr;
+	}
+	else if (Mode == TEXT("CQP"))
+	{
+		return EVideoRateControl::ConstQp;
+	}
+	return EVideoRateControl::CbrLowDelayHq;
+}
+
+// paths of Streamer.Mounts without leading slashes and the codec of each, in order
+static TArray<TPair<FString, EVideoCodec>> ParseMounts(const FString& MountList)
+{
+	TArray<FString> Entries;
+	MountList.ParseIntoArray(Entries, TEXT(","));
+
+	TArray<TPair<FString, EVideoCodec>> Mounts;
+	for (FString& Entry : Entries)
+	{
+		FString Path, CodecName;
+		EVideoCodec Codec;
+		if (!Entry.Split(TEXT("="), &Path, &CodecName) || !ParseVideoCodec(TCHAR_TO_ANSI(*CodecName.TrimStartAndEnd()), Codec))
+		{
+			UE_LOG(RTSPStreaming, Warning, TEXT("Ignoring mount '%s' of Streamer.Mounts"), *Entry);
+			continue;
+		}
+		Path.TrimStartAndEndInline();
+		while (Path.RemoveFromStart(TEXT("/"))) {}
+		Mounts.Emplace(Path, Codec);
+	}
+	return Mounts;
+}
+
+FController::FRendition::FRendition(int32 InIndex, uint32 InHeight, EVideoCodec InCodec)
+	: Index(InIndex)
+	, Height(InHeight)
+	, Name(InHeight ? FString::Printf(TEXT("%up"), InHeight) : FString(TEXT("source")))
+	, bResizingWindowBackBuffer(false)
+	, AverageBitRate(static_cast<int32>(Settings.AverageBitRate))
+	, Codec(static_cast<int32>(InCodec))
+	, bUseFallbackVideoEncoder(false)
+	, bVideoEncoderReady(false)
+	, bVideoEncoderFailed(false)
+	, IdleSince(0)
+	, bForceIdrFrame(false)
+	, bFrameLost(false)
+	, LostFrameTimestamp(0)
+{
+	Settings.Codec = InCodec;
+}
+
+FController::FController(const TCHAR* ServerIP, uint16 ServerPort, const FTexture2DRHIRef& FrameBuffer, const FVideoEncoderFactory& InVideoEncoderFactory,
+	const FVideoEncoderFactory& InFallbackVideoEncoderFactory)
+	: LadderSize(1)
+	, WatchedRenditions(1)
+	, VideoEncoderFactory(InVideoEncoderFactory)
+	, FallbackVideoEncoderFactory(InFallbackVideoEncoderFactory)
+	, StreamingStartTime(0)
+	, bTimingFirstFrame(false)
 	, bStreamingStarted(false)
 	, InitialMaxFPS(GEngine->GetMaxFPS())
 {
@@ -91,95 +257,437 @@ FController::FController(const TCHAR* ServerIP, uint16 ServerPort, const FTextur
 		});
 	}
 
+	//the ladder and the mounts are fixed before the server can take clients asking for them. Every codec mounted
+	//encodes the whole ladder, so its renditions are at the same index of each codec's ladder
+	TArray<uint32> Ladder = ParseRenditionLadder(CVarEncoderRenditions.GetValueOnAnyThread());
+	if (!Ladder.Num())
+	{
+		Ladder.Add(0);
+	}
+	LadderSize = Ladder.Num();
+
+	TArray<TPair<FString, EVideoCodec>> MountList = ParseMounts(CVarStreamerMounts.GetValueOnAnyThread());
+	if (!MountList.Num())
+	{
+		MountList.Emplace(TEXT("stream/1"), EVideoCodec::H264);
+	}
+	TArray<EVideoCodec> Codecs;
+	for (const TPair<FString, EVideoCodec>& Mount : MountList)
+	{
+		Mounts.Add(Mount.Key, Codecs.AddUnique(Mount.Value) * LadderSize);
+	}
+	for (EVideoCodec Codec : Codecs)
+	{
+		for (uint32 Height : Ladder)
+		{
+			Renditions.Add(MakeUnique<FRendition>(Renditions.Num(), Height, Codec));
+		}
+	}
+
 	//creates new server
 	Server.Reset(new FServer(ServerIP, ServerPort, *this));
 
-	//creates and updates video encoder
-	UpdateEncoderSettings(FrameBuffer, InitialMaxFPS);
-	CreateVideoEncoder(FrameBuffer);
+	//encoder sessions are opened on the first PLAY, or right away in warm standby
+	UpdateEncoderSettings(FrameBuffer, GetStreamFrameRate());
+	if (CVarEncoderWarmStandby.GetValueOnRenderThread())
+	{
+		for (TUniquePtr<FRendition>& Rendition : Renditions)
+		{
+			CreateVideoEncoder(*Rendition);
+		}
+	}
 
-	UE_LOG(RTSPStreaming, Log, TEXT("Server created: %dx%d %d FPS%s"),
-		VideoEncoderSettings.Width, VideoEncoderSettings.Height,
-		InitialMaxFPS,
-		CVarStreamerPrioritiseQuality.GetValueOnAnyThread() != 0 ? TEXT("FController::FController  , prioritise quality") : TEXT(""));
+	for (const TUniquePtr<FRendition>& Rendition : Renditions)
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("Server created: %s %s %dx%d %d FPS%s"), *Rendition->Name, ANSI_TO_TCHAR(VideoCodecToString(Rendition->Settings.Codec)),
+			Rendition->Settings.Width, Rendition->Settings.Height,
+			Rendition->Settings.FrameRate,
+			CVarStreamerPrioritiseQuality.GetValueOnAnyThread() != 0 ? TEXT("FController::FController  , prioritise quality") : TEXT(""));
+	}
 }
 
 // must be in cpp file cos TUniquePtr incomplete type
 FController::~FController()
-{}
+{
+	for (TUniquePtr<FRendition>& Rendition : Renditions)
+	{
+		ReleaseVideoEncoder(*Rendition);
+	}
+}
+
+void FController::StartStreaming()
+{
+	//times the first frame of a session, later clients join a running stream
+	if (!bStreamingStarted)
+	{
+		StreamingStartTime = FPlatformTime::Seconds();
+		bTimingFirstFrame = true;
+	}
+	bStreamingStarted = true;
+	ForceIdrFrame();
+}
+
+void FController::StopStreaming()
+{
+	bStreamingStarted = false;
+
+	//the next client is sent the largest rendition until the server knows better
+	WatchedRenditions.Set(1);
+}
+
+int32 FController::FindRendition(const FString& Name) const
+{
+	for (int32 Index = 0; Index < LadderSize; ++Index)
+	{
+		const FRendition& Rendition = *Renditions[Index];
+		if (Rendition.Name == Name || (Rendition.Height && FString::FromInt(Rendition.Height) == Name))
+		{
+			return Index;
+		}
+	}
+	return INDEX_NONE;
+}
+
+uint32 FController::GetAverageBitRate(int32 Rendition) const
+{
+	return Renditions.IsValidIndex(Rendition) ? static_cast<uint32>(Renditions[Rendition]->AverageBitRate.GetValue()) : 0;
+}
+
+int32 FController::FindMount(const FString& Path, EVideoCodec& OutCodec) const
+{
+	const int32* Rendition = Mounts.Find(Path);
+	if (!Rendition)
+	{
+		return INDEX_NONE;
+	}
+	OutCodec = static_cast<EVideoCodec>(Renditions[*Rendition]->Codec.GetValue());
+	return *Rendition;
+}
+
+bool FController::GetParameterSets(int32 Rendition, std::vector<uint8>& OutParameterSets) const
+{
+	if (!Renditions.IsValidIndex(Rendition))
+	{
+		return false;
+	}
+	FScopeLock Lock(&Renditions[Rendition]->ParameterSetsMt);
+	OutParameterSets = Renditions[Rendition]->ParameterSets;
+	return !OutParameterSets.empty();
+}
+
+void FController::SetWatchedRenditions(uint32 Mask)
+{
+	WatchedRenditions.Set(static_cast<int32>(Mask));
+}
+
+void FController::CreateVideoEncoder(FRendition& Rendition)
+{
+	//creates encoder, the fallback one is kept until the session is released and the hardware encoder is tried again
+	const FVideoEncoderFactory& Factory = Rendition.bUseFallbackVideoEncoder ? FallbackVideoEncoderFactory : VideoEncoderFactory;
+	const int32 Index = Rendition.Index;
+	Rendition.VideoEncoder = Factory(Rendition.Settings, [this, Index](const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame)
+	{
+		Stream(Index, Info, Frame);
+	});
+	check(Rendition.VideoEncoder);
+	Rendition.bVideoEncoderReady = false;
+
+	//loading the encoder runtime and opening a session take hundreds of ms, which would hitch the render thread
+	IVideoEncoder* Encoder = Rendition.VideoEncoder.Get();
+	const double StartTime = FPlatformTime::Seconds();
+	Rendition.VideoEncoderInit = Async(EAsyncExecution::ThreadPool, [Encoder, StartTime]()
+	{
+		const bool bResult = Encoder->Initialize();
+		SET_DWORD_STAT(STAT_RTSPStreaming_EncoderInitMs, static_cast<uint32>((FPlatformTime::Seconds() - StartTime) * 1000));
+		return bResult;
+	});
+
+	UpdateEncoderSessionStats();
+	UE_LOG(RTSPStreaming, Log, TEXT("FController::CreateVideoEncoder  Opening %s session for %s %s"), *Rendition.VideoEncoder->GetName(), *Rendition.Name, ANSI_TO_TCHAR(VideoCodecToString(Rendition.Settings.Codec)));
+}
 
-void FController::CreateVideoEncoder(const FTexture2DRHIRef& FrameBuffer)
+void FController::ReleaseVideoEncoder(FRendition& Rendition)
 {
-	//creates encoder
-	VideoEncoder.Reset(new FNvVideoEncoder(VideoEncoderSettings, FrameBuffer, [this](uint64 Timestamp, bool KeyFrame, const uint8* Data, uint32 Size)
+	//the worker thread initializing the encoder must be done with it before it's destroyed
+	if (Rendition.VideoEncoderInit.IsValid())
 	{
-		Stream(Timestamp, KeyFrame, Data, Size);
-	}));
+		Rendition.VideoEncoderInit.Wait();
+		Rendition.VideoEncoderInit = TFuture<bool>();
+	}
+
+	if (Rendition.VideoEncoder)
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("FController::ReleaseVideoEncoder  Closing %s session for %s"), *Rendition.VideoEncoder->GetName(), *Rendition.Name);
+		Rendition.bVideoEncoderReady = false;
+		Rendition.bVideoEncoderFailed = false;
+		Rendition.bResizingWindowBackBuffer = false;
+		Rendition.bUseFallbackVideoEncoder = false;
+		Rendition.VideoEncoder.Reset();
+		UpdateEncoderSessionStats();
+	}
+}
+
+void FController::UpdateEncoderSessionStats()
+{
+	uint32 NumOpen = 0;
+	uint32 NumFallback = 0;
+	for (const TUniquePtr<FRendition>& Rendition : Renditions)
+	{
+		NumOpen += Rendition->VideoEncoder.IsValid();
+		NumFallback += Rendition->VideoEncoder.IsValid() && Rendition->bUseFallbackVideoEncoder;
+	}
+	SET_DWORD_STAT(STAT_RTSPStreaming_EncoderSessionOpen, NumOpen);
+	SET_DWORD_STAT(STAT_RTSPStreaming_FallbackEncoder, NumFallback);
+}
+
+void FController::UpdateIdleEncoder(FRendition& Rendition, const FTexture2DRHIRef& FrameBuffer)
+{
+	const double Now = FPlatformTime::Seconds();
+	if (Rendition.IdleSince == 0)
+	{
+		Rendition.IdleSince = Now;
+	}
+
+	if (CVarEncoderWarmStandby.GetValueOnRenderThread())
+	{
+		//opens the session and registers resources ahead of the first client
+		if (!Rendition.VideoEncoder)
+		{
+			CreateVideoEncoder(Rendition);
+		}
+		IsVideoEncoderReady(Rendition, FrameBuffer);
+		return;
+	}
 
-	checkf(VideoEncoder->IsSupported(), TEXT("FController::CreateVideoEncoder  Failed to initialize NvEnc"));
-	UE_LOG(RTSPStreaming, Log, TEXT("FController::CreateVideoEncoder  NvEnc initialised"));
+	const float IdleReleaseSeconds = CVarEncoderIdleReleaseSeconds.GetValueOnRenderThread();
+	if (Rendition.VideoEncoder && IdleReleaseSeconds >= 0 && Now - Rendition.IdleSince >= IdleReleaseSeconds)
+	{
+		//another instance on this GPU can use the session until a client plays again
+		ReleaseVideoEncoder(Rendition);
+	}
+}
+
+bool FController::IsVideoEncoderReady(FRendition& Rendition, const FTexture2DRHIRef& FrameBuffer)
+{
+	if (Rendition.bVideoEncoderReady)
+	{
+		return true;
+	}
+
+	//frames are skipped rather than waiting for the worker thread
+	if (Rendition.bVideoEncoderFailed || !Rendition.VideoEncoderInit.IsReady())
+	{
+		return false;
+	}
+
+	if (!Rendition.VideoEncoderInit.Get())
+	{
+		OnVideoEncoderFailed(Rendition);
+		return false;
+	}
+
+	//only registering resources is left for the render thread
+	Rendition.VideoEncoder->InitializeResources(Rendition.Settings, FrameBuffer);
+	if (!Rendition.VideoEncoder->IsSupported())
+	{
+		OnVideoEncoderFailed(Rendition);
+		return false;
+	}
+	Rendition.bVideoEncoderReady = true;
+	UE_LOG(RTSPStreaming, Log, TEXT("FController::IsVideoEncoderReady  %s initialised for %s"), *Rendition.VideoEncoder->GetName(), *Rendition.Name);
+
+	//clients DESCRIBE-ing the stream from now on are told the codec it's sent in, e.g. HEVC Main after a GPU without
+	//10 bit support fell back from Main10. It's kept when the encoder is released, the next one falls back the same way
+	const EVideoCodec Codec = Rendition.VideoEncoder->GetCodec(Rendition.Settings.Codec);
+	if (Rendition.Codec.Set(static_cast<int32>(Codec)) != static_cast<int32>(Codec))
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("FController::IsVideoEncoderReady  %s is encoded in %s"), *Rendition.Name, ANSI_TO_TCHAR(VideoCodecToString(Codec)));
+	}
+
+	//clients that started playing while the encoder was initializing need an IDR frame to start decoding
+	Rendition.bForceIdrFrame = true;
+	return true;
+}
+
+void FController::OnVideoEncoderFailed(FRendition& Rendition)
+{
+	if (Rendition.bUseFallbackVideoEncoder || !FallbackVideoEncoderFactory || !CVarEncoderSoftwareFallback.GetValueOnRenderThread())
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("FController::OnVideoEncoderFailed  Failed to initialize %s, %s will not be streamed"), *Rendition.VideoEncoder->GetName(), *Rendition.Name);
+		Rendition.bVideoEncoderFailed = true;
+		return;
+	}
+
+	//streams at a lower quality rather than not at all, frames are skipped until the fallback encoder is ready.
+	//With a ladder this is usually the GPU running out of sessions, the renditions that got one keep it
+	UE_LOG(RTSPStreaming, Warning, TEXT("FController::OnVideoEncoderFailed  Failed to initialize %s for %s, falling back to the software encoder"), *Rendition.VideoEncoder->GetName(), *Rendition.Name);
+	ReleaseVideoEncoder(Rendition);
+	Rendition.bUseFallbackVideoEncoder = true;
+	CreateVideoEncoder(Rendition);
 }
 
 void FController::OnFrameBufferReady(const FTexture2DRHIRef& FrameBuffer)
 {
 	//stops passing data if no connected clients
 	if (!bStreamingStarted)
+	{
+		if (CVarEncoderWarmStandby.GetValueOnRenderThread())
+		{
+			UpdateEncoderSettings(FrameBuffer);
+		}
+		for (TUniquePtr<FRendition>& Rendition : Renditions)
+		{
+			UpdateIdleEncoder(*Rendition, FrameBuffer);
+		}
+		return;
+	}
+
+	//samples the back buffer at the stream rate, frames presented in between are left to the game
+	uint64 Timestamp = 0;
+	CapturePacer.SetFrameRate(GetStreamFrameRate());
+	if (!CapturePacer.ShouldCapture(FPlatformTime::Seconds(), Timestamp))
 	{
 		return;
 	}
 
-	//get time for encoder latency logging
-	uint64 CaptureMs = NowMs();
+	//every rendition encodes the same back buffer with the same timestamp, so a client switching between them stays
+	//on one RTP clock. Renditions no client is sent idle as if nobody played
+	UpdateEncoderSettings(FrameBuffer);
+	const uint32 Watched = static_cast<uint32>(WatchedRenditions.GetValue());
+	for (TUniquePtr<FRendition>& Rendition : Renditions)
+	{
+		if (Watched & (1u << Rendition->Index))
+		{
+			Rendition->IdleSince = 0;
+			EncodeFrame(*Rendition, FrameBuffer, Timestamp);
+		}
+		else
+		{
+			UpdateIdleEncoder(*Rendition, FrameBuffer);
+		}
+	}
+}
 
+void FController::EncodeFrame(FRendition& Rendition, const FTexture2DRHIRef& FrameBuffer, uint64 Timestamp)
+{
 	// VideoEncoder is reset on disconnection
-	if (!VideoEncoder)
+	if (!Rendition.VideoEncoder)
 	{
-		CreateVideoEncoder(FrameBuffer);
-		check(VideoEncoder);
+		CreateVideoEncoder(Rendition);
 	}
 
-	if (bResizingWindowBackBuffer)
+	if (!IsVideoEncoderReady(Rendition, FrameBuffer))
 	{
-		// Re-initialize video encoder if it has been destroyed by OnPreResizeWindowBackbuffer()
-		VideoEncoder->PostResizeBackBuffer();
-		bResizingWindowBackBuffer = false;
+		INC_DWORD_STAT(STAT_RTSPStreaming_EncoderNotReadyFrames);
+		return;
 	}
 
-	//encodes a frame from backbuffer
-	UpdateEncoderSettings(FrameBuffer);
-	VideoEncoder->EncodeFrame(VideoEncoderSettings, FrameBuffer, CaptureMs);
-}
+	if (Rendition.bResizingWindowBackBuffer)
+	{
+		// Re-initialize video encoder if it has been destroyed by OnPreResizeWindowBackbuffer()
+		Rendition.VideoEncoder->PostResizeBackBuffer();
+		Rendition.bResizingWindowBackBuffer = false;
+	}
 
+	//an IDR frame also recovers from any loss, otherwise the encoder picks how to recover
+	bool bRecoverLoss = false;
+	uint32 LostTimestamp = 0;
+	{
+		FScopeLock Lock(&Rendition.LostFrameMt);
+		bRecoverLoss = Rendition.bFrameLost;
+		LostTimestamp = Rendition.LostFrameTimestamp;
+		Rendition.bFrameLost = false;
+	}
+	if (Rendition.bForceIdrFrame)
+	{
+		Rendition.bForceIdrFrame = false;
+		Rendition.VideoEncoder->ForceIdrFrame();
+	}
+	else if (bRecoverLoss)
+	{
+		Rendition.VideoEncoder->ReportLoss(LostTimestamp);
+	}
 
+	//encodes a frame from backbuffer, the encoder scales it to the rendition's size
+	Rendition.VideoEncoder->EncodeFrame(Rendition.Settings, FrameBuffer, Timestamp);
+}
 
 void FController::OnPreResizeWindowBackbuffer()
 {
 	// Destroy video encoder before resizing window so it releases usage of graphics device & back buffer.
 	// It's recreated later on in OnFrameBufferReady().
-	VideoEncoder->PreResizeBackBuffer();
-	bResizingWindowBackBuffer = true;
+	for (TUniquePtr<FRendition>& Rendition : Renditions)
+	{
+		if (Rendition->bVideoEncoderReady)
+		{
+			Rendition->VideoEncoder->PreResizeBackBuffer();
+			Rendition->bResizingWindowBackBuffer = true;
+		}
+	}
 }
 
-void FController::Stream(uint64 Timestamp, bool Keyframe, const uint8* Data, uint32 Size)
+void FController::Stream(int32 Rendition, const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame)
 {
+	//announced to clients DESCRIBE-ing the rendition's stream, they change with its size. The first part of a frame
+	//sent in parts has them
+	if (Info.bKeyframe && Info.bFirstPart)
+	{
+		FRendition& Encoded = *Renditions[Rendition];
+		std::vector<uint8> ParameterSets;
+		if (ExtractParameterSets(Encoded.Settings.Codec, Frame->GetData(), Frame->Num(), ParameterSets))
+		{
+			FScopeLock Lock(&Encoded.ParameterSetsMt);
+			Encoded.ParameterSets.swap(ParameterSets);
+		}
+	}
+
 	if (bStreamingStarted)
 	{
+		if (bTimingFirstFrame.AtomicSet(false))
+		{
+			const uint32 TimeToFirstFrameMs = static_cast<uint32>((FPlatformTime::Seconds() - StreamingStartTime) * 1000);
+			SET_DWORD_STAT(STAT_RTSPStreaming_TimeToFirstFrameMs, TimeToFirstFrameMs);
+			UE_LOG(RTSPStreaming, Log, TEXT("First frame encoded %u ms after streaming started"), TimeToFirstFrameMs);
+		}
+
 		//passes encoded frame to server
-		if (!Server->Send(Timestamp, Data, Size))
+		if (!Server->Send(Rendition, Info, Frame))
 		{
-			UE_LOG(RTSPStreaming, Log, TEXT("Could not send %s, %d bytes"), Keyframe ? "IDRFrame" : "", Size);
+			UE_LOG(RTSPStreaming, Log, TEXT("Could not send %s, %d bytes"), Info.bKeyframe ? "IDRFrame" : "", Frame->Num());
 		}
 	}
 }
 
-void FController::ForceIdrFrame()
+void FController::ForceIdrFrame(int32 Rendition)
 {
-	if (VideoEncoder)
+	//applied on the render thread, which owns the encoders and may be releasing them
+	for (TUniquePtr<FRendition>& Each : Renditions)
 	{
-		VideoEncoder->ForceIdrFrame();
+		if (Rendition == INDEX_NONE || Rendition == Each->Index)
+		{
+			Each->bForceIdrFrame = true;
+		}
 	}
 }
 
+void FController::ReportLoss(int32 Rendition, uint32 RtpTimestamp)
+{
+	//a client that hasn't been sent a frame yet has nothing to recover
+	if (!Renditions.IsValidIndex(Rendition))
+	{
+		return;
+	}
+
+	//losses of several clients between two frames are recovered together, from the oldest frame
+	FRendition& Lost = *Renditions[Rendition];
+	FScopeLock Lock(&Lost.LostFrameMt);
+	if (!Lost.bFrameLost || static_cast<int32>(RtpTimestamp - Lost.LostFrameTimestamp) < 0)
+	{
+		Lost.LostFrameTimestamp = RtpTimestamp;
+	}
+	Lost.bFrameLost = true;
+}
+
 void FController::UpdateEncoderSettings(const FTexture2DRHIRef& FrameBuffer, int32 Fps)
 {
 	float MaxBitrateMbps = CVarEncoderMaxBitrate.GetValueOnRenderThread();
@@ -202,17 +710,17 @@ void FController::UpdateEncoderSettings(const FTexture2DRHIRef& FrameBuffer, int
 	uint32 Bitrate = CVarEncoderAverageBitRate.GetValueOnRenderThread();
 	uint32 ReducedBitrate = static_cast<uint32>(Bitrate / 100.0 * (100.0 - BitrateReduction));
 	ReducedBitrate = FMath::Min(ReducedBitrate, static_cast<uint32>(MaxBitrateMbps * 1000 * 1000));
-	VideoEncoderSettings.AverageBitRate = ReducedBitrate;
-	SET_DWORD_STAT(STAT_RTSPStreaming_EncodingBitrate, VideoEncoderSettings.AverageBitRate);
 
-	VideoEncoderSettings.FrameRate = Fps >= 0 ? Fps : GEngine->GetMaxFPS();
-	SET_DWORD_STAT(STAT_RTSPStreaming_EncodingFramerate, VideoEncoderSettings.FrameRate);
+	//the full size the ladder scales down from, a failed Encoder.TargetSize keeps the previous size
+	FVideoEncoderSettings& Source = Renditions[0]->Settings;
+	Source.FrameRate = Fps >= 0 ? Fps : GetStreamFrameRate();
+	SET_DWORD_STAT(STAT_RTSPStreaming_EncodingFramerate, Source.FrameRate);
 
 	bool bUseBackBufferSize = CVarEncoderUseBackBufferSize.GetValueOnAnyThread() > 0;
 	if (bUseBackBufferSize)
 	{
-		VideoEncoderSettings.Width = FrameBuffer->GetSizeX();
-		VideoEncoderSettings.Height = FrameBuffer->GetSizeY();
+		Source.Width = FrameBuffer->GetSizeX();
+		Source.Height = FrameBuffer->GetSizeY();
 	}
 	else
 	{
@@ -221,10 +729,54 @@ void FController::UpdateEncoderSettings(const FTexture2DRHIRef& FrameBuffer, int
 		bool bValidSize = EncoderTargetSize.Split(TEXT("x"), &TargetWidth, &TargetHeight);
 		if (bValidSize)
 		{
-			VideoEncoderSettings.Width = FCString::Atoi(*TargetWidth);
-			VideoEncoderSettings.Height = FCString::Atoi(*TargetHeight);
+			Source.Width = FCString::Atoi(*TargetWidth);
+			Source.Height = FCString::Atoi(*TargetHeight);
 		}
 	}
+
+	const EVideoRateControl RateControl = ParseRateControl(CVarEncoderRateControl.GetValueOnRenderThread().TrimStartAndEnd());
+	const float VbrPeakFactor = FMath::Max(CVarEncoderVbrPeakFactor.GetValueOnRenderThread(), 1.0f);
+	const uint32 ConstQp = FMath::Clamp(CVarEncoderConstQP.GetValueOnRenderThread(), 0, 51);
+	const float VbvFrames = FMath::Max(CVarEncoderVbvFrames.GetValueOnRenderThread(), 0.0f);
+	const uint64 MaxFrameBits = static_cast<uint64>(FMath::Max(CVarEncoderMaxFrameSize.GetValueOnRenderThread(), 0)) * 8;
+
+	//renditions keep the aspect ratio and are never scaled up. The largest one is encoded at the configured bitrate,
+	//the smaller ones at a share of it that shrinks slower than their pixel count, as small pictures need more bits
+	//per pixel for the same quality
+	const uint32 SourceWidth = Source.Width;
+	const uint32 SourceHeight = Source.Height;
+	uint64 LargestPixels = 0;
+	for (TUniquePtr<FRendition>& Rendition : Renditions)
+	{
+		FVideoEncoderSettings& Settings = Rendition->Settings;
+		Settings.FrameRate = Source.FrameRate;
+		Settings.Width = SourceWidth;
+		Settings.Height = SourceHeight;
+		if (Rendition->Height && SourceHeight && Rendition->Height < SourceHeight)
+		{
+			Settings.Width = FMath::Max<uint32>(static_cast<uint32>(static_cast<uint64>(SourceWidth) * Rendition->Height / SourceHeight) & ~1u, 2);
+			Settings.Height = Rendition->Height;
+		}
+
+		const uint64 Pixels = static_cast<uint64>(Settings.Width) * Settings.Height;
+		LargestPixels = LargestPixels ? LargestPixels : Pixels;
+		Settings.AverageBitRate = LargestPixels ? static_cast<uint32>(ReducedBitrate * FMath::Pow(static_cast<float>(Pixels) / LargestPixels, 0.75f)) : ReducedBitrate;
+		Rendition->AverageBitRate.Set(static_cast<int32>(Settings.AverageBitRate));
+
+		//a VBV buffer of about a frame's bits keeps IDR frames from spiking, so no frame takes much longer than a frame
+		//interval to send
+		Settings.RateControl = RateControl;
+		Settings.MaxBitRate = static_cast<uint32>(FMath::Min<double>(static_cast<double>(Settings.AverageBitRate) * VbrPeakFactor, MAX_uint32));
+		Settings.ConstQp = ConstQp;
+		const uint32 DrainRate = RateControl == EVideoRateControl::Vbr ? Settings.MaxBitRate : Settings.AverageBitRate;
+		uint64 VbvBits = static_cast<uint64>(DrainRate * VbvFrames / FMath::Max<uint32>(Settings.FrameRate, 1));
+		if (MaxFrameBits)
+		{
+			VbvBits = VbvBits ? FMath::Min(VbvBits, MaxFrameBits) : MaxFrameBits;
+		}
+		Settings.VbvBufferSize = static_cast<uint32>(FMath::Min<uint64>(VbvBits, MAX_uint32));
+	}
+	SET_DWORD_STAT(STAT_RTSPStreaming_EncodingBitrate, Source.AverageBitRate);
 }
 
 void FController::SetBitrate(uint16 Kbps)
@@ -271,8 +823,17 @@ void FController::SetFramerate(int32 Fps)
 {
 	UE_LOG(RTSPStreaming, Log, TEXT("Set Framerate to %d Fps"), Fps);
 
-	AsyncTask(ENamedThreads::GameThread, [Fps]()
-		{
-			GEngine->SetMaxFPS(Fps);
-		});
+	// the capture pacer picks the new rate up with the next frame
+	AdaptedFPS.Set(FMath::Max(Fps, 1));
+}
+
+uint32 FController::GetStreamFrameRate() const
+{
+	if (AdaptedFPS.GetValue() > 0)
+	{
+		return AdaptedFPS.GetValue();
+	}
+
+	const int32 StreamFPS = CVarEncoderStreamFPS.GetValueOnAnyThread();
+	return StreamFPS > 0 ? StreamFPS : InitialMaxFPS;
 }
\ No newline at end of file
@@ -3,10 +3,14 @@
 #pragma once
 
 #include "VideoEncoder.h"
+#include "CapturePacer.h"
 #include "RHI.h"
 #include "RHIResources.h"
 #include "Engine/GameViewportClient.h"
 #include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Async/Future.h"
+#include <vector>
 
 DECLARE_STATS_GROUP(TEXT("RTSPStreaming"), STATGROUP_RTSPStreaming, STATCAT_Advanced);
 
@@ -21,36 +25,85 @@ private:
 	FController& operator=(const FController&) = delete;
 
 public:
-	FController(const TCHAR* ServerIP, uint16 ServerPort, const FTexture2DRHIRef& FrameBuffer);
+	static const int32 MaxRenditions = 8;
+
+	FController(const TCHAR* ServerIP, uint16 ServerPort, const FTexture2DRHIRef& FrameBuffer, const FVideoEncoderFactory& InVideoEncoderFactory,
+		const FVideoEncoderFactory& InFallbackVideoEncoderFactory = FVideoEncoderFactory());
 	virtual ~FController();
 
 	void OnFrameBufferReady(const FTexture2DRHIRef& FrameBuffer);	// attached from render thread - at each frame
 	void OnPreResizeWindowBackbuffer();								// attached from render thread - at buffer resize from res change, etc.
-	void ForceIdrFrame();											// forces encoder to make next available frame I-Frame
+	void ForceIdrFrame(int32 Rendition = INDEX_NONE);				// forces the next frame of a rendition, or of all of them, to be an IDR frame, any thread
+	void ReportLoss(int32 Rendition, uint32 RtpTimestamp);			// a client lost the rendition's frame with this RTP timestamp, any thread
+
+	void StartStreaming();											// called when a client starts playing
+	void StopStreaming();											// called when no active clients connected
 
-	void StartStreaming()											// called when client connects
+	uint32 GetAverageBitRate(int32 Rendition) const;				// current average bitrate of a rendition, bps, 0 for none. Any thread
+
+	int32 GetNumRenditions() const									// renditions of the simulcast ladder each mounted codec encodes, fixed at startup
 	{
-		bStreamingStarted = true;
-		ForceIdrFrame();
+		return LadderSize;
 	}
-
-	void StopStreaming()											// called when no active clients connected
+	const FString& GetRenditionName(int32 Rendition) const
 	{
-		bStreamingStarted = false;
+		return Renditions[Rendition]->Name;
 	}
+	int32 FindRendition(const FString& Name) const;					// rendition of the ladder a client asked for, e.g. "720p", INDEX_NONE if there is none
+	int32 FindMount(const FString& Path, EVideoCodec& OutCodec) const;	// largest rendition of the stream mounted at Path, e.g. "stream/1", INDEX_NONE if none is
+	bool GetParameterSets(int32 Rendition, std::vector<uint8>& OutParameterSets) const;	// of the rendition's last IDR frame, false before its first one, any thread
+	void SetWatchedRenditions(uint32 Mask);							// bit per rendition sent to a client, the others aren't encoded, any thread
 
 	void SetBitrate(uint16 Kbps);									// changes encoder params
-	void SetFramerate(int32 Fps);									// changes encoder params
+	void SetFramerate(int32 Fps);									// changes stream frame rate, the game keeps its own
+	uint32 GetStreamFrameRate() const;								// rate back buffers are captured at, any thread
 
 private:
-	void CreateVideoEncoder(const FTexture2DRHIRef& FrameBuffer);						// creates encoder
-	void UpdateEncoderSettings(const FTexture2DRHIRef& FrameBuffer, int32 Fps = -1);	// updates encoder
-	void Stream(uint64 Timestamp, bool Keyframe, const uint8* Data, uint32 Size);		// passes data to Server
+	// one rung of the simulcast ladder, the back buffer scaled to its size and encoded by an encoder of its own
+	struct FRendition
+	{
+		FRendition(int32 InIndex, uint32 InHeight, EVideoCodec InCodec);
+
+		int32						Index;								// in Renditions, the ladder of each codec largest first
+		uint32						Height;								// 0 for the size of the back buffer or Encoder.TargetSize
+		FString						Name;								// what clients ask for, e.g. "720p"
+		bool						bResizingWindowBackBuffer;			// true when encoder needs to be updated from buffer resize
+		FVideoEncoderSettings		Settings;							// struct for holding encoder params
+		FThreadSafeCounter			Codec;								// EVideoCodec clients are sent, Settings.Codec unless the encoder fell back to another
+		FThreadSafeCounter			AverageBitRate;						// Settings.AverageBitRate for other threads, set with it on the render thread
+		bool						bUseFallbackVideoEncoder;			// true until the fallback encoder is released, render thread only
+		TUniquePtr<IVideoEncoder>	VideoEncoder;
+		TFuture<bool>				VideoEncoderInit;					// result of the worker thread initialization phase of VideoEncoder
+		FThreadSafeBool				bVideoEncoderReady;					// true once both initialization phases of VideoEncoder are done
+		bool						bVideoEncoderFailed;				// true if VideoEncoder couldn't be initialized, render thread only
+		double						IdleSince;							// time the rendition stopped being streamed, 0 while streamed, render thread only
+		FThreadSafeBool				bForceIdrFrame;						// next encoded frame must be an IDR frame
+		FCriticalSection			LostFrameMt;						// thread lock for bFrameLost and LostFrameTimestamp
+		bool						bFrameLost;							// a client reported a loss the encoder hasn't been told about
+		uint32						LostFrameTimestamp;					// RTP timestamp of the oldest frame lost since
+		mutable FCriticalSection	ParameterSetsMt;					// thread lock for ParameterSets
+		std::vector<uint8>			ParameterSets;						// Annex-B parameter sets of the last IDR frame, announced at DESCRIBE
+	};
+
+	void CreateVideoEncoder(FRendition& Rendition);											// creates encoder and starts initializing it on a worker thread
+	bool IsVideoEncoderReady(FRendition& Rendition, const FTexture2DRHIRef& FrameBuffer);	// finishes encoder initialization on the render thread once possible
+	void ReleaseVideoEncoder(FRendition& Rendition);										// closes the encoder session
+	void OnVideoEncoderFailed(FRendition& Rendition);										// switches to the fallback encoder if there is one
+	void UpdateIdleEncoder(FRendition& Rendition, const FTexture2DRHIRef& FrameBuffer);		// keeps the encoder warm or releases it while the rendition isn't streamed
+	void UpdateEncoderSessionStats();														// publishes how many sessions are open
+	void EncodeFrame(FRendition& Rendition, const FTexture2DRHIRef& FrameBuffer, uint64 Timestamp);	// encodes the back buffer at the rendition's size
+	void UpdateEncoderSettings(const FTexture2DRHIRef& FrameBuffer, int32 Fps = -1);		// updates the settings of all renditions
+	void Stream(int32 Rendition, const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame);	// passes data to Server
 
 private:
-	bool						bResizingWindowBackBuffer;			// true when encoder needs to be updated from buffer resize
-	FVideoEncoderSettings		VideoEncoderSettings;				// struct for holding encoder params
-	TUniquePtr<IVideoEncoder>	VideoEncoder;				
+	TArray<TUniquePtr<FRendition>>	Renditions;					// simulcast ladder from Encoder.Renditions of each codec mounted, a single rendition without one
+	int32						LadderSize;							// renditions of each codec
+	TMap<FString, int32>		Mounts;								// paths of Streamer.Mounts and the largest rendition of the codec mounted there
+	FThreadSafeCounter			WatchedRenditions;					// bit per rendition sent to a client, set by the server
+	FVideoEncoderFactory		VideoEncoderFactory;				// creates VideoEncoder
+	FVideoEncoderFactory		FallbackVideoEncoderFactory;		// creates VideoEncoder if VideoEncoderFactory's failed, may be unset
+	double						StreamingStartTime;					// FPlatformTime::Seconds() when streaming started, read once bTimingFirstFrame is set
+	FThreadSafeBool				bTimingFirstFrame;					// true from the start of streaming until its first frame was encoded
 	TUniquePtr<FServer>			Server;
 
 	// we shouldn't start streaming immediately after client is connected because
@@ -58,4 +111,6 @@ private:
 	// instead wait for an explicit command to start streaming
 	FThreadSafeBool				bStreamingStarted;					// true when at least one active client connected
 	int32						InitialMaxFPS;						// 60 FPS
+	FCapturePacer				CapturePacer;						// picks the back buffers to encode, render thread only
+	FThreadSafeCounter			AdaptedFPS;							// stream frame rate set by quality adaptation, 0 if none
 };
\ No newline at end of file
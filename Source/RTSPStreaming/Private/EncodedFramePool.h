@@ -0,0 +1,44 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VideoEncoder.h"
+
+// recycles the buffers encoded frames are copied into
+// the encoder copies the locked bitstream into a pooled buffer once, the packetizer, every client and pending
+// zero-copy sends share it through FEncodedFrameRef. A buffer is reused as soon as the pool holds the only
+// reference, its allocation is kept so steady state encoding doesn't allocate.
+class FEncodedFramePool final
+{
+public:
+	using FBufferRef = TSharedRef<TArray<uint8>, ESPMode::ThreadSafe>;
+
+	explicit FEncodedFramePool(int32 InMaxBuffers)
+		: MaxBuffers(InMaxBuffers)
+	{}
+
+	FBufferRef Acquire()										// only called from one encoder thread, the completion thread with slice streaming
+	{
+		for (FBufferRef& Buffer : Buffers)
+		{
+			// nobody else can add a reference once only the pool holds one
+			if (Buffer.IsUnique())
+			{
+				return Buffer;
+			}
+		}
+
+		// every buffer is still in flight, grows up to MaxBuffers and hands out one-off buffers beyond that
+		FBufferRef Buffer = MakeShared<TArray<uint8>, ESPMode::ThreadSafe>();
+		if (Buffers.Num() < MaxBuffers)
+		{
+			Buffers.Add(Buffer);
+		}
+		return Buffer;
+	}
+
+private:
+	const int32				MaxBuffers;
+	TArray<FBufferRef>		Buffers;
+};
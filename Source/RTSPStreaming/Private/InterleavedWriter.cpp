@@ -0,0 +1,245 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "InterleavedWriter.h"
+#include "NativeSocket.h"
+#include "RTSPStreamingCommon.h"
+
+#if PLATFORM_LINUX
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/errqueue.h>
+
+// not every sysroot we build against knows about these yet
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
+#endif
+
+static TAutoConsoleVariable<int32> CVarStreamerZeroCopyThreshold(
+	TEXT("Streamer.ZeroCopyThreshold"),
+	32768,
+	TEXT("Frames at least this large are sent with MSG_ZEROCOPY on the TCP interleaved path (Linux only), bytes. 0 disables zero-copy"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarStreamerTcpNotSentLowat(
+	TEXT("Streamer.TcpNotSentLowat"),
+	131072,
+	TEXT("TCP_NOTSENT_LOWAT of the RTSP connection when RTP is interleaved, keeps the kernel send queue short, bytes. 0 leaves the OS default"),
+	ECVF_Default);
+
+// max number of buffers handed to a single gather write, Linux IOV_MAX
+static const int32 MaxGatherBuffers = 1024;
+
+// zero-copy sends the kernel is allowed to keep pinned before we fall back to copying
+static const int32 MaxPendingSends = 64;
+
+FInterleavedWriter::FInterleavedWriter(FSocket* InSocket)
+	: Socket(InSocket)
+	, bZeroCopy(false)
+	, NextZeroCopyId(0)
+{}
+
+void FInterleavedWriter::Configure()
+{
+#if PLATFORM_LINUX
+	const SOCKET NativeSocket = GetNativeSocket(Socket);
+
+	int32 NotSentLowat = CVarStreamerTcpNotSentLowat.GetValueOnAnyThread();
+	if (NotSentLowat > 0 && setsockopt(NativeSocket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &NotSentLowat, sizeof(NotSentLowat)) != 0)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("Failed to set TCP_NOTSENT_LOWAT (errno: %d)"), errno);
+	}
+
+	int32 Enable = 1;
+	bZeroCopy = CVarStreamerZeroCopyThreshold.GetValueOnAnyThread() > 0 &&
+		setsockopt(NativeSocket, SOL_SOCKET, SO_ZEROCOPY, &Enable, sizeof(Enable)) == 0;
+	UE_LOG(RTSPStreaming, Log, TEXT("Interleaved RTP writer configured, zero-copy %s"), bZeroCopy ? TEXT("enabled") : TEXT("unavailable"));
+#endif
+}
+
+bool FInterleavedWriter::Write(FRTPPacketArray& Packets, uint8 Channel, const FEncodedFrameRef& Frame)
+{
+	for (FRTPPacket& Packet : Packets)
+	{
+		Packet.SetInterleavedHeader(Channel);
+	}
+
+#if PLATFORM_LINUX
+	ReapZeroCopyCompletions();
+
+	const int32 Threshold = CVarStreamerZeroCopyThreshold.GetValueOnAnyThread();
+	const bool bUseZeroCopy = bZeroCopy && Threshold > 0 && Frame->Num() >= Threshold && PendingSends.Num() < MaxPendingSends;
+
+	TArray<iovec> Buffers;
+	Buffers.Reserve(static_cast<int32>(Packets.size()) * 2);
+	for (FRTPPacket& Packet : Packets)
+	{
+		Buffers.Add({ Packet.Header, RTP_INTERLEAVED_HEADER_SIZE + Packet.HeaderSize });
+		if (Packet.PayloadSize)
+		{
+			Buffers.Add({ const_cast<uint8*>(Packet.Payload), Packet.PayloadSize });
+		}
+	}
+
+	const SOCKET NativeSocket = GetNativeSocket(Socket);
+	int32 Flags = MSG_NOSIGNAL | (bUseZeroCopy ? MSG_ZEROCOPY : 0);
+	int32 ZeroCopyCalls = 0;
+	int32 First = 0;
+	while (First < Buffers.Num())
+	{
+		msghdr Message;
+		FMemory::Memzero(Message);
+		Message.msg_iov = &Buffers[First];
+		Message.msg_iovlen = FMath::Min(Buffers.Num() - First, MaxGatherBuffers);
+
+		ssize_t BytesSent = sendmsg(NativeSocket, &Message, Flags);
+		if (BytesSent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == ENOBUFS && (Flags & MSG_ZEROCOPY))
+			{
+				// out of optmem for zero-copy notifications, send the rest by copying
+				Flags &= ~MSG_ZEROCOPY;
+				continue;
+			}
+			UE_LOG(RTSPStreaming, Log, TEXT("Interleaved RTP send failed (errno: %d)"), errno);
+			return false;
+		}
+		if (Flags & MSG_ZEROCOPY)
+		{
+			ZeroCopyCalls++;
+		}
+
+		// skip what went out, blocking sockets can still return short on signals
+		while (BytesSent > 0 && First < Buffers.Num())
+		{
+			iovec& Buffer = Buffers[First];
+			if (static_cast<size_t>(BytesSent) >= Buffer.iov_len)
+			{
+				BytesSent -= Buffer.iov_len;
+				First++;
+			}
+			else
+			{
+				Buffer.iov_base = static_cast<uint8*>(Buffer.iov_base) + BytesSent;
+				Buffer.iov_len -= BytesSent;
+				BytesSent = 0;
+			}
+		}
+	}
+
+	// the kernel notifies completion of every zero-copy call, pin headers and payload until the last one
+	if (ZeroCopyCalls)
+	{
+		NextZeroCopyId += ZeroCopyCalls;
+		PendingSends.Add({ NextZeroCopyId - 1, MoveTemp(Packets), Frame });
+	}
+	return true;
+
+#elif PLATFORM_WINDOWS
+	TArray<WSABUF> Buffers;
+	Buffers.Reserve(static_cast<int32>(Packets.size()) * 2);
+	for (FRTPPacket& Packet : Packets)
+	{
+		Buffers.Add({ RTP_INTERLEAVED_HEADER_SIZE + Packet.HeaderSize, reinterpret_cast<CHAR*>(Packet.Header) });
+		if (Packet.PayloadSize)
+		{
+			Buffers.Add({ Packet.PayloadSize, reinterpret_cast<CHAR*>(const_cast<uint8*>(Packet.Payload)) });
+		}
+	}
+
+	// blocking WSASend returns once all buffers are sent
+	const SOCKET NativeSocket = GetNativeSocket(Socket);
+	for (int32 First = 0; First < Buffers.Num(); First += MaxGatherBuffers)
+	{
+		DWORD BytesSent = 0;
+		if (WSASend(NativeSocket, &Buffers[First], FMath::Min(Buffers.Num() - First, MaxGatherBuffers), &BytesSent, 0, nullptr, nullptr) != 0)
+		{
+			UE_LOG(RTSPStreaming, Log, TEXT("Interleaved RTP send failed (error: %d)"), WSAGetLastError());
+			return false;
+		}
+	}
+	return true;
+
+#else
+	return WriteCopy(Packets);
+#endif
+}
+
+bool FInterleavedWriter::WriteCopy(FRTPPacketArray& Packets)
+{
+	CopyBuffer.Reset();
+	for (FRTPPacket& Packet : Packets)
+	{
+		CopyBuffer.Append(Packet.Header, RTP_INTERLEAVED_HEADER_SIZE + Packet.HeaderSize);
+		CopyBuffer.Append(Packet.Payload, Packet.PayloadSize);
+	}
+
+	int32 BytesSent = 0;
+	return Socket->Send(CopyBuffer.GetData(), CopyBuffer.Num(), BytesSent);
+}
+
+void FInterleavedWriter::ReapZeroCopyCompletions()
+{
+#if PLATFORM_LINUX
+	const SOCKET NativeSocket = GetNativeSocket(Socket);
+	while (PendingSends.Num())
+	{
+		uint8 Control[128];
+		msghdr Message;
+		FMemory::Memzero(Message);
+		Message.msg_control = Control;
+		Message.msg_controllen = sizeof(Control);
+
+		// error queue reads never block
+		if (recvmsg(NativeSocket, &Message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+		{
+			return;
+		}
+
+		for (cmsghdr* Cmsg = CMSG_FIRSTHDR(&Message); Cmsg; Cmsg = CMSG_NXTHDR(&Message, Cmsg))
+		{
+			const bool bRecvErr = (Cmsg->cmsg_level == SOL_IP && Cmsg->cmsg_type == IP_RECVERR) ||
+				(Cmsg->cmsg_level == SOL_IPV6 && Cmsg->cmsg_type == IPV6_RECVERR);
+			if (!bRecvErr)
+			{
+				continue;
+			}
+
+			const sock_extended_err* Error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(Cmsg));
+			if (Error->ee_errno != 0 || Error->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			{
+				continue;
+			}
+
+			// notifications cover the inclusive range [ee_info, ee_data], sends complete in order
+			const uint32 Last = Error->ee_data;
+			PendingSends.RemoveAll([Last](const FPendingSend& Send) { return static_cast<int32>(Last - Send.Id) >= 0; });
+
+			// the kernel had to copy anyway (e.g. loopback), zero-copy only costs us here
+			if (Error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			{
+				bZeroCopy = false;
+			}
+		}
+	}
+#endif
+}
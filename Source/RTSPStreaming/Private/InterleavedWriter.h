@@ -0,0 +1,41 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RTSPCore/RTPPacketizer.h"
+#include "VideoEncoder.h"
+
+class FSocket;
+
+// writes RTP packets interleaved on the RTSP connection (RFC 2326 10.12)
+// interleave headers, RTP headers and payload slices of a whole frame go out with a single gather write
+// (sendmsg on Linux, WSASend on Windows) instead of one blocking Send per packet. On Linux frames larger than
+// Streamer.ZeroCopyThreshold are sent with MSG_ZEROCOPY, the frame and its packet headers stay pinned until
+// the kernel reports completion on the socket error queue.
+// not thread safe, callers serialise access together with the rest of the RTSP socket traffic
+class FInterleavedWriter final
+{
+public:
+	explicit FInterleavedWriter(FSocket* InSocket);
+
+	void Configure();														// applies TCP_NOTSENT_LOWAT and enables zero-copy
+	bool Write(FRTPPacketArray& Packets, uint8 Channel, const FEncodedFrameRef& Frame);	// may take ownership of Packets
+
+private:
+	bool WriteCopy(FRTPPacketArray& Packets);							// fallback, copies into one buffer and sends
+	void ReapZeroCopyCompletions();											// releases frames the kernel is done with
+
+	struct FPendingSend
+	{
+		uint32				Id;				// zero-copy notification id of the sendmsg call
+		FRTPPacketArray		Packets;		// headers referenced by the send
+		FEncodedFrameRef	Frame;			// payload referenced by the send
+	};
+
+	FSocket*				Socket;
+	bool					bZeroCopy;			// true if SO_ZEROCOPY is enabled on the socket
+	uint32					NextZeroCopyId;		// the kernel numbers MSG_ZEROCOPY calls per socket starting at 0
+	TArray<FPendingSend>	PendingSends;		// zero-copy sends not completed yet, in Id order
+	TArray<uint8>			CopyBuffer;			// scratch buffer of the fallback path
+};
@@ -0,0 +1,404 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "IoUringBackend.h"
+
+#if WITH_LIBURING
+
+#include "NativeSocket.h"
+#include "RTSPStreamingCommon.h"
+#include "IPAddress.h"
+#include "HAL/IConsoleManager.h"
+#include "RTSPCore/RTPPacketizer.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+
+static const uint32 QueueDepth = 4096;				// submission queue entries, completion queue is twice as large
+static const uint16 RecvBufferGroup = 0;			// buffer group id of the provided recv buffer ring
+static const uint32 NumRecvBuffers = 256;			// power of two, required by the buffer ring
+static const uint32 RecvBufferSize = 4096;			// RTSP requests and RTCP compounds fit comfortably
+static const uint32 MinSendPacketSize = 1472;		// Ethernet MTU less IPv4 and UDP headers, where path MTU discovery gets at least
+static const uint32 NumSendPackets = 4096;			// datagrams in flight, e.g. 50 clients * 80 packets per 4K keyframe
+static const uint32 JumboPacketSize = 9216;			// jumbo frames, path MTU discovery probes up to Streamer.PathMtuMax
+static const uint32 NumJumboPackets = 192;			// jumbo datagrams in flight, few as registered buffers are locked memory
+static const uint64 SendTag = 1;					// low bit of user data marks send slots
+
+// datagram size of the send pool's packets, from the RTP payload size streamers start at
+static uint32 GetSendPacketSize()
+{
+	const uint32 MaxHeaderSize = FRTPPacketizer::MaxHeaderSize;
+	IConsoleVariable* MaxPayloadSize = IConsoleManager::Get().FindConsoleVariable(TEXT("Streamer.MaxPayloadSize"));
+	const uint32 PayloadSize = static_cast<uint32>(FMath::Max(MaxPayloadSize ? MaxPayloadSize->GetInt() : 1400, 64));
+	return FMath::Clamp(PayloadSize + MaxHeaderSize, MinSendPacketSize, JumboPacketSize);
+}
+
+// registered buffers are pinned and count against RLIMIT_MEMLOCK unless the process has CAP_IPC_LOCK. Raises the soft
+// limit to the hard one if it's lower than Required, false if it still is
+static bool RaiseMemlockLimit(uint64 Required, uint64& OutLimit)
+{
+	rlimit Limit;
+	if (getrlimit(RLIMIT_MEMLOCK, &Limit) != 0)
+	{
+		OutLimit = 0;
+		return false;
+	}
+	if (Limit.rlim_cur != RLIM_INFINITY && Limit.rlim_cur < Required && Limit.rlim_max != Limit.rlim_cur)
+	{
+		rlimit Raised = Limit;
+		Raised.rlim_cur = Limit.rlim_max;
+		if (setrlimit(RLIMIT_MEMLOCK, &Raised) == 0)
+		{
+			Limit = Raised;
+		}
+	}
+	OutLimit = Limit.rlim_cur;
+	return Limit.rlim_cur == RLIM_INFINITY || Limit.rlim_cur >= Required;
+}
+
+FIoUringBackend::FIoUringBackend()
+	: bValid(false)
+	, PendingSubmissions(0)
+	, RecvBufferRing(nullptr)
+	, SendPool(GetSendPacketSize(), NumSendPackets)
+	, JumboPool(JumboPacketSize, NumJumboPackets)
+{
+	FMemory::Memzero(Ring);
+
+	io_uring_params Params;
+	FMemory::Memzero(Params);
+	Params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+	int Result = io_uring_queue_init_params(QueueDepth, &Ring, &Params);
+	if (Result < 0)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("io_uring_queue_init failed (errno: %d)"), -Result);
+		return;
+	}
+
+	// waiting with a timeout must not need a submission entry, otherwise Poll() would race with senders
+	if (!(Params.features & IORING_FEAT_EXT_ARG))
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("io_uring lacks IORING_FEAT_EXT_ARG, kernel too old"));
+		io_uring_queue_exit(&Ring);
+		return;
+	}
+
+	// provided buffers for multishot recv
+	RecvBuffers.SetNumUninitialized(NumRecvBuffers * RecvBufferSize);
+	RecvBufferRing = io_uring_setup_buf_ring(&Ring, NumRecvBuffers, RecvBufferGroup, 0, &Result);
+	if (!RecvBufferRing)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("io_uring_setup_buf_ring failed (errno: %d)"), -Result);
+		io_uring_queue_exit(&Ring);
+		return;
+	}
+	for (uint16 BufferId = 0; BufferId < NumRecvBuffers; ++BufferId)
+	{
+		io_uring_buf_ring_add(RecvBufferRing, RecvBuffers.GetData() + BufferId * RecvBufferSize, RecvBufferSize, BufferId, io_uring_buf_ring_mask(NumRecvBuffers), BufferId);
+	}
+	io_uring_buf_ring_advance(RecvBufferRing, NumRecvBuffers);
+
+	// each send pool is one fixed buffer, packets are addressed inside it
+	const uint64 RegisteredKB = (SendPool.GetMemorySize() + JumboPool.GetMemorySize() + 1023) / 1024;
+	uint64 MemlockLimit = 0;
+	if (!RaiseMemlockLimit(RegisteredKB * 1024, MemlockLimit))
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("io_uring registers %llu KB of send buffers but RLIMIT_MEMLOCK is %llu KB, raise it (ulimit -l, LimitMEMLOCK=) or grant CAP_IPC_LOCK"),
+			RegisteredKB, MemlockLimit / 1024);
+	}
+	iovec SendPoolVecs[2] = { { SendPool.GetMemory(), SendPool.GetMemorySize() }, { JumboPool.GetMemory(), JumboPool.GetMemorySize() } };
+	Result = io_uring_register_buffers(&Ring, SendPoolVecs, 2);
+	if (Result < 0)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("io_uring_register_buffers failed (errno: %d), it needs an RLIMIT_MEMLOCK of at least %llu KB"), -Result, RegisteredKB);
+		io_uring_free_buf_ring(&Ring, RecvBufferRing, NumRecvBuffers, RecvBufferGroup);
+		io_uring_queue_exit(&Ring);
+		return;
+	}
+	UE_LOG(RTSPStreaming, Log, TEXT("io_uring registered %llu KB of send buffers, %u packets of %u bytes and %u of %u bytes"),
+		RegisteredKB, NumSendPackets, SendPool.GetPacketSize(), NumJumboPackets, JumboPacketSize);
+	SendSlots.SetNum(NumSendPackets + NumJumboPackets);
+
+	bValid = true;
+}
+
+FIoUringBackend::~FIoUringBackend()
+{
+	if (!bValid)
+	{
+		return;
+	}
+
+	io_uring_unregister_buffers(&Ring);
+	io_uring_free_buf_ring(&Ring, RecvBufferRing, NumRecvBuffers, RecvBufferGroup);
+	io_uring_queue_exit(&Ring);
+
+	for (FMultishot* Multishot : Multishots)
+	{
+		delete Multishot;
+	}
+}
+
+io_uring_sqe* FIoUringBackend::GetSqe()
+{
+	io_uring_sqe* Sqe = io_uring_get_sqe(&Ring);
+	if (!Sqe)
+	{
+		// ring is full, push what we have to the kernel and try again
+		io_uring_submit(&Ring);
+		PendingSubmissions = 0;
+		Sqe = io_uring_get_sqe(&Ring);
+	}
+	if (Sqe)
+	{
+		PendingSubmissions++;
+	}
+	return Sqe;
+}
+
+bool FIoUringBackend::ArmMultishot(FMultishot* Multishot)
+{
+	io_uring_sqe* Sqe = GetSqe();
+	if (!Sqe)
+	{
+		return false;
+	}
+
+	const SOCKET NativeSocket = GetNativeSocket(Multishot->Socket);
+	if (Multishot->Operation == EOperation::Accept)
+	{
+		io_uring_prep_multishot_accept(Sqe, NativeSocket, nullptr, nullptr, 0);
+	}
+	else
+	{
+		io_uring_prep_recv_multishot(Sqe, NativeSocket, nullptr, 0, 0);
+		Sqe->flags |= IOSQE_BUFFER_SELECT;
+		Sqe->buf_group = RecvBufferGroup;
+	}
+	io_uring_sqe_set_data(Sqe, Multishot);
+	io_uring_submit(&Ring);
+	PendingSubmissions = 0;
+	return true;
+}
+
+bool FIoUringBackend::AcceptMultishot(FSocket* Listener, const FAcceptCallback& Callback)
+{
+	FMultishot* Multishot = new FMultishot{ EOperation::Accept, Listener, Callback, nullptr };
+
+	FScopeLock Lock(&RingMt);
+	Multishots.Add(Multishot);
+	return ArmMultishot(Multishot);
+}
+
+bool FIoUringBackend::RecvMultishot(FSocket* Socket, const FRecvCallback& Callback)
+{
+	FMultishot* Multishot = new FMultishot{ EOperation::Recv, Socket, nullptr, Callback };
+
+	FScopeLock Lock(&RingMt);
+	Multishots.Add(Multishot);
+	return ArmMultishot(Multishot);
+}
+
+void FIoUringBackend::Cancel(FSocket* Socket)
+{
+	FScopeLock Lock(&RingMt);
+
+	// callbacks stop right away, the operation is freed once the kernel confirms it is done with it
+	bool bArmed = false;
+	for (FMultishot* Multishot : Multishots)
+	{
+		if (Multishot->Socket == Socket && !Multishot->bCancelled)
+		{
+			Multishot->bCancelled = true;
+			Multishot->AcceptCallback = nullptr;
+			Multishot->RecvCallback = nullptr;
+			bArmed = true;
+		}
+	}
+
+	if (bArmed)
+	{
+		if (io_uring_sqe* Sqe = GetSqe())
+		{
+			io_uring_prep_cancel_fd(Sqe, GetNativeSocket(Socket), IORING_ASYNC_CANCEL_ALL);
+			io_uring_sqe_set_data(Sqe, nullptr);
+			io_uring_submit(&Ring);
+			PendingSubmissions = 0;
+		}
+	}
+}
+
+uint32 FIoUringBackend::GetMaxDatagramSize() const
+{
+	return JumboPool.GetPacketSize();
+}
+
+bool FIoUringBackend::QueueSendTo(FSocket* Socket, const FInternetAddr& Addr, const FIoSlice* Slices, int32 NumSlices)
+{
+	uint32 DatagramSize = 0;
+	for (int32 Index = 0; Index < NumSlices; ++Index)
+	{
+		DatagramSize += Slices[Index].Size;
+	}
+	check(DatagramSize <= JumboPool.GetPacketSize());
+
+	// datagrams larger than the path MTU streamers start at go to the jumbo pool, path MTU probes and jumbo frame paths
+	const uint16 BufferIndex = DatagramSize > SendPool.GetPacketSize() ? 1 : 0;
+	FPacketPool& Pool = BufferIndex ? JumboPool : SendPool;
+	const int32 PacketIndex = Pool.Alloc();
+	if (PacketIndex == INDEX_NONE)
+	{
+		// every packet is in flight, the client can't keep up anyway
+		return false;
+	}
+
+	// gather slices into the registered packet
+	uint8* Packet = Pool.GetPacket(PacketIndex);
+	uint32 PacketSize = 0;
+	for (int32 Index = 0; Index < NumSlices; ++Index)
+	{
+		FMemory::Memcpy(Packet + PacketSize, Slices[Index].Data, Slices[Index].Size);
+		PacketSize += Slices[Index].Size;
+	}
+
+	FSendSlot& Slot = SendSlots[BufferIndex ? NumSendPackets + PacketIndex : PacketIndex];
+	Slot.PacketIndex = PacketIndex;
+	Slot.BufferIndex = BufferIndex;
+	sockaddr_in& SockAddr = reinterpret_cast<sockaddr_in&>(Slot.Addr);
+	FMemory::Memzero(SockAddr);
+	uint32 Ip = 0;
+	Addr.GetIp(Ip);
+	SockAddr.sin_family = AF_INET;
+	SockAddr.sin_addr.s_addr = htonl(Ip);
+	SockAddr.sin_port = htons(static_cast<uint16>(Addr.GetPort()));
+	Slot.AddrSize = sizeof(sockaddr_in);
+
+	FScopeLock Lock(&RingMt);
+	io_uring_sqe* Sqe = GetSqe();
+	if (!Sqe)
+	{
+		Pool.Free(PacketIndex);
+		return false;
+	}
+	io_uring_prep_send_zc_fixed(Sqe, GetNativeSocket(Socket), Packet, PacketSize, 0, 0, BufferIndex);
+	io_uring_prep_send_set_addr(Sqe, reinterpret_cast<const sockaddr*>(&Slot.Addr), Slot.AddrSize);
+	io_uring_sqe_set_data64(Sqe, reinterpret_cast<uint64>(&Slot) | SendTag);
+	return true;
+}
+
+void FIoUringBackend::Flush()
+{
+	FScopeLock Lock(&RingMt);
+	if (PendingSubmissions)
+	{
+		io_uring_submit(&Ring);
+		PendingSubmissions = 0;
+	}
+}
+
+void FIoUringBackend::Poll(int32 TimeoutMs)
+{
+	__kernel_timespec Timeout;
+	Timeout.tv_sec = TimeoutMs / 1000;
+	Timeout.tv_nsec = (TimeoutMs % 1000) * 1000000ll;
+
+	io_uring_cqe* Cqe = nullptr;
+	if (io_uring_wait_cqe_timeout(&Ring, &Cqe, &Timeout) < 0)
+	{
+		return;
+	}
+
+	// reap everything that is ready in one go
+	unsigned Head;
+	unsigned NumReaped = 0;
+	io_uring_for_each_cqe(&Ring, Head, Cqe)
+	{
+		NumReaped++;
+		const uint64 UserData = io_uring_cqe_get_data64(Cqe);
+		if (!UserData)
+		{
+			continue;	// cancel request
+		}
+
+		if (UserData & SendTag)
+		{
+			HandleSendCompletion(reinterpret_cast<FSendSlot*>(UserData & ~SendTag), Cqe);
+		}
+		else
+		{
+			HandleMultishotCompletion(reinterpret_cast<FMultishot*>(UserData), Cqe);
+		}
+	}
+	io_uring_cq_advance(&Ring, NumReaped);
+}
+
+void FIoUringBackend::HandleMultishotCompletion(FMultishot* Multishot, io_uring_cqe* Cqe)
+{
+	const bool bMore = (Cqe->flags & IORING_CQE_F_MORE) != 0;
+
+	if (Multishot->Operation == EOperation::Accept)
+	{
+		if (Cqe->res >= 0)
+		{
+			if (Multishot->AcceptCallback)
+			{
+				Multishot->AcceptCallback(WrapNativeStreamSocket(Cqe->res, TEXT("Client")));
+			}
+			else
+			{
+				close(Cqe->res);
+			}
+		}
+	}
+	else
+	{
+		const bool bHasBuffer = (Cqe->flags & IORING_CQE_F_BUFFER) != 0;
+		const uint16 BufferId = static_cast<uint16>(Cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+
+		// ENOBUFS only means the buffer ring ran dry, the operation is re-armed below
+		if (Multishot->RecvCallback && Cqe->res != -ENOBUFS)
+		{
+			const uint8* Data = bHasBuffer ? RecvBuffers.GetData() + BufferId * RecvBufferSize : nullptr;
+			Multishot->RecvCallback(Data, Cqe->res);
+		}
+		if (bHasBuffer)
+		{
+			RecycleRecvBuffer(BufferId);
+		}
+		if (Cqe->res == 0 || (Cqe->res < 0 && Cqe->res != -ENOBUFS))
+		{
+			// peer closed or socket failed, nothing to re-arm
+			Multishot->RecvCallback = nullptr;
+		}
+	}
+
+	if (!bMore)
+	{
+		FScopeLock Lock(&RingMt);
+		const bool bRearm = !Multishot->bCancelled && (Multishot->AcceptCallback || Multishot->RecvCallback);
+		if (!bRearm || !ArmMultishot(Multishot))
+		{
+			Multishots.Remove(Multishot);
+			delete Multishot;
+		}
+	}
+}
+
+void FIoUringBackend::HandleSendCompletion(FSendSlot* Slot, io_uring_cqe* Cqe)
+{
+	// zero-copy sends complete twice, the packet can only be reused after the notification
+	if (Cqe->flags & IORING_CQE_F_MORE)
+	{
+		return;
+	}
+	(Slot->BufferIndex ? JumboPool : SendPool).Free(Slot->PacketIndex);
+}
+
+void FIoUringBackend::RecycleRecvBuffer(uint16 BufferId)
+{
+	io_uring_buf_ring_add(RecvBufferRing, RecvBuffers.GetData() + BufferId * RecvBufferSize, RecvBufferSize, BufferId, io_uring_buf_ring_mask(NumRecvBuffers), 0);
+	io_uring_buf_ring_advance(RecvBufferRing, 1);
+}
+
+#endif
@@ -0,0 +1,95 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "NetworkBackend.h"
+
+#if WITH_LIBURING
+
+#include "PacketPool.h"
+#include "Misc/ScopeLock.h"
+
+THIRD_PARTY_INCLUDES_START
+#include <liburing.h>
+THIRD_PARTY_INCLUDES_END
+
+// Linux io_uring backend, needs kernel 6.0+ (multishot accept/recv, provided buffer rings, send zero-copy)
+// - accept and recv are armed once in multishot mode, RTSP and RTCP receive from a provided buffer ring
+// - RTP datagrams are copied into a packet pool that is registered with the ring and sent with
+//   IORING_OP_SEND_ZC on the fixed buffer, Flush() submits all packets queued for a frame with one syscall.
+//   Its packets fit the path MTU streamers start at, a small second pool takes larger datagrams. Registered
+//   buffers are locked memory, RLIMIT_MEMLOCK must allow both pools
+// - completions are reaped by Poll() on the server network thread; submissions are serialised by RingMt so the
+//   encoder thread can queue sends while the network thread waits
+class FIoUringBackend final : public INetworkBackend
+{
+public:
+	FIoUringBackend();
+	virtual ~FIoUringBackend();
+
+	bool IsValid() const
+	{ return bValid; }
+
+	virtual const TCHAR* GetName() const override
+	{ return TEXT("io_uring"); }
+
+	virtual bool IsCompletionBased() const override
+	{ return true; }
+
+	virtual bool AcceptMultishot(FSocket* Listener, const FAcceptCallback& Callback) override;
+	virtual bool RecvMultishot(FSocket* Socket, const FRecvCallback& Callback) override;
+	virtual void Cancel(FSocket* Socket) override;
+	virtual void Poll(int32 TimeoutMs) override;
+	virtual uint32 GetMaxDatagramSize() const override;
+	virtual bool QueueSendTo(FSocket* Socket, const FInternetAddr& Addr, const FIoSlice* Slices, int32 NumSlices) override;
+	virtual void Flush() override;
+
+private:
+	enum class EOperation : uint8
+	{
+		Accept,
+		Recv
+	};
+
+	// one armed multishot operation, freed when its last completion arrives
+	struct FMultishot
+	{
+		EOperation			Operation;
+		FSocket*			Socket;
+		FAcceptCallback		AcceptCallback;
+		FRecvCallback		RecvCallback;
+		bool				bCancelled = false;
+	};
+
+	// in flight datagram, one per packet of the send pool, user data of send entries has the low bit set
+	struct FSendSlot
+	{
+		int32				PacketIndex;
+		uint16				BufferIndex;		// registered buffer, 0 for SendPool and 1 for JumboPool
+		sockaddr_storage	Addr;
+		socklen_t			AddrSize;
+	};
+
+	io_uring_sqe* GetSqe();											// next free submission entry, submits if the ring is full, RingMt held
+	bool ArmMultishot(FMultishot* Multishot);						// RingMt held
+	void HandleMultishotCompletion(FMultishot* Multishot, io_uring_cqe* Cqe);
+	void HandleSendCompletion(FSendSlot* Slot, io_uring_cqe* Cqe);
+	void RecycleRecvBuffer(uint16 BufferId);
+
+	bool							bValid;
+	io_uring						Ring;
+	FCriticalSection				RingMt;				// thread lock for the submission queue
+	TSet<FMultishot*>				Multishots;			// armed operations, only touched on the network thread or with RingMt held
+	uint32							PendingSubmissions;	// queued entries not submitted yet, guarded by RingMt
+
+	// provided buffer ring multishot recv picks buffers from
+	io_uring_buf_ring*				RecvBufferRing;
+	TArray<uint8>					RecvBuffers;
+
+	// registered buffers RTP datagrams are sent from
+	FPacketPool						SendPool;
+	FPacketPool						JumboPool;			// datagrams larger than SendPool's packets
+	TArray<FSendSlot>				SendSlots;			// SendPool's packets followed by JumboPool's
+};
+
+#endif
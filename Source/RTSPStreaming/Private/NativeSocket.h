@@ -0,0 +1,21 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "BSDSockets/SocketsBSD.h"
+
+// gives access to the OS socket handle behind an FSocket for calls FSocket doesn't expose (sendmsg, setsockopt, ...)
+// all socket subsystems the plugin runs on are BSD based
+inline SOCKET GetNativeSocket(FSocket* Socket)
+{
+	return static_cast<FSocketBSD*>(Socket)->GetNativeSocket();
+}
+
+// wraps a connected stream socket handle obtained outside of FSocket (e.g. io_uring accept) so the rest of the
+// server can keep using FSocket, ownership passes to the returned socket
+inline FSocket* WrapNativeStreamSocket(SOCKET NativeSocket, const TCHAR* Description)
+{
+	return new FSocketBSD(NativeSocket, SOCKTYPE_Streaming, Description, ESocketProtocolFamily::IPv4, ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM));
+}
@@ -0,0 +1,113 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "NetworkBackend.h"
+#include "IoUringBackend.h"
+#include "RTSPStreamingCommon.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Parse.h"
+#include "NativeSocket.h"
+#include "IPAddress.h"
+
+#if PLATFORM_LINUX
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#endif
+
+// max number of slices of one datagram
+static const int32 MaxDatagramSlices = 8;
+
+// sends right away, one syscall per datagram. Slices are handed to the kernel with a gather write (sendmsg,
+// WSASendTo) so the payload is read straight from the shared encoded frame
+class FBlockingNetworkBackend final : public INetworkBackend
+{
+public:
+	virtual const TCHAR* GetName() const override
+	{ return TEXT("blocking"); }
+
+	virtual bool IsCompletionBased() const override
+	{ return false; }
+
+	virtual uint32 GetMaxDatagramSize() const override
+	{ return 65507; }	// largest UDP payload over IPv4
+
+	virtual bool QueueSendTo(FSocket* Socket, const FInternetAddr& Addr, const FIoSlice* Slices, int32 NumSlices) override
+	{
+		check(NumSlices <= MaxDatagramSlices);
+
+#if PLATFORM_LINUX || PLATFORM_WINDOWS
+		uint32 Ip = 0;
+		Addr.GetIp(Ip);
+		sockaddr_in SockAddr;
+		FMemory::Memzero(SockAddr);
+		SockAddr.sin_family = AF_INET;
+		SockAddr.sin_addr.s_addr = htonl(Ip);
+		SockAddr.sin_port = htons(static_cast<uint16>(Addr.GetPort()));
+#endif
+
+#if PLATFORM_LINUX
+		iovec Buffers[MaxDatagramSlices];
+		for (int32 Index = 0; Index < NumSlices; ++Index)
+		{
+			Buffers[Index] = { const_cast<uint8*>(Slices[Index].Data), Slices[Index].Size };
+		}
+
+		msghdr Message;
+		FMemory::Memzero(Message);
+		Message.msg_name = &SockAddr;
+		Message.msg_namelen = sizeof(SockAddr);
+		Message.msg_iov = Buffers;
+		Message.msg_iovlen = NumSlices;
+		return sendmsg(GetNativeSocket(Socket), &Message, 0) >= 0;
+
+#elif PLATFORM_WINDOWS
+		WSABUF Buffers[MaxDatagramSlices];
+		for (int32 Index = 0; Index < NumSlices; ++Index)
+		{
+			Buffers[Index] = { Slices[Index].Size, reinterpret_cast<CHAR*>(const_cast<uint8*>(Slices[Index].Data)) };
+		}
+
+		DWORD BytesSent = 0;
+		return WSASendTo(GetNativeSocket(Socket), Buffers, NumSlices, &BytesSent, 0, reinterpret_cast<const sockaddr*>(&SockAddr), sizeof(SockAddr), nullptr, nullptr) == 0;
+
+#else
+		TArray<uint8, TInlineAllocator<2048>> Datagram;
+		for (int32 Index = 0; Index < NumSlices; ++Index)
+		{
+			Datagram.Append(Slices[Index].Data, Slices[Index].Size);
+		}
+
+		int32 BytesSent = 0;
+		return Socket->SendTo(Datagram.GetData(), Datagram.Num(), BytesSent, Addr);
+#endif
+	}
+
+	virtual void Flush() override
+	{}
+};
+
+TUniquePtr<INetworkBackend> CreateNetworkBackend()
+{
+	FString BackendName = TEXT("blocking");
+	FParse::Value(FCommandLine::Get(), TEXT("RTSPStreamingNetworkBackend="), BackendName);
+
+#if WITH_LIBURING
+	if (BackendName == TEXT("io_uring"))
+	{
+		TUniquePtr<FIoUringBackend> IoUringBackend = MakeUnique<FIoUringBackend>();
+		if (IoUringBackend->IsValid())
+		{
+			UE_LOG(RTSPStreaming, Log, TEXT("Using io_uring network backend"));
+			return MoveTemp(IoUringBackend);
+		}
+		UE_LOG(RTSPStreaming, Warning, TEXT("io_uring network backend unavailable, falling back to blocking sockets"));
+	}
+#else
+	if (BackendName != TEXT("blocking"))
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("Network backend %s is not available in this build, using blocking sockets"), *BackendName);
+	}
+#endif
+
+	return MakeUnique<FBlockingNetworkBackend>();
+}
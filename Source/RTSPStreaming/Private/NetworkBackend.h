@@ -0,0 +1,76 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FSocket;
+class FInternetAddr;
+
+// contiguous piece of a packet, packets are described by a few slices instead of being copied together
+struct FIoSlice
+{
+	const uint8*	Data;
+	uint32			Size;
+};
+
+// pluggable I/O layer of the server
+// blocking backends leave accepting and receiving to the listener and per client threads and send immediately.
+// Completion based backends own the accept and receive loops: the server arms multishot accept/recv once and
+// drives completions from its network thread with Poll(), sends are queued and submitted in batches by Flush().
+class INetworkBackend
+{
+public:
+	using FAcceptCallback = TFunction<void(FSocket* ClientSocket)>;
+	using FRecvCallback = TFunction<void(const uint8* Data, int32 Size)>;	// Size <= 0 when the socket closed or failed
+
+	virtual ~INetworkBackend() = default;
+
+	/**
+	* Return name of the backend.
+	*/
+	virtual const TCHAR* GetName() const = 0;
+
+	/**
+	* If accept and receive are completion driven, see AcceptMultishot(), RecvMultishot() and Poll().
+	*/
+	virtual bool IsCompletionBased() const = 0;
+
+	/**
+	* Calls Callback on the network thread for every connection accepted on Listener until Cancel().
+	*/
+	virtual bool AcceptMultishot(FSocket* Listener, const FAcceptCallback& Callback) { return false; }
+
+	/**
+	* Calls Callback on the network thread for every datagram or stream chunk received on Socket until Cancel().
+	*/
+	virtual bool RecvMultishot(FSocket* Socket, const FRecvCallback& Callback) { return false; }
+
+	/**
+	* Stops callbacks for Socket, must be called on the network thread before the socket is destroyed.
+	*/
+	virtual void Cancel(FSocket* Socket) {}
+
+	/**
+	* Waits up to TimeoutMs for completions and dispatches their callbacks.
+	*/
+	virtual void Poll(int32 TimeoutMs) {}
+
+	/**
+	* Largest datagram QueueSendTo() accepts.
+	*/
+	virtual uint32 GetMaxDatagramSize() const = 0;
+
+	/**
+	* Queues a datagram made of Slices, it goes out at the latest with the next Flush().
+	*/
+	virtual bool QueueSendTo(FSocket* Socket, const FInternetAddr& Addr, const FIoSlice* Slices, int32 NumSlices) = 0;
+
+	/**
+	* Submits all queued sends.
+	*/
+	virtual void Flush() = 0;
+};
+
+// creates the backend selected by -RTSPStreamingNetworkBackend= (blocking or io_uring), falls back to blocking
+TUniquePtr<INetworkBackend> CreateNetworkBackend();
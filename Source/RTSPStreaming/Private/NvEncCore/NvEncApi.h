@@ -0,0 +1,18 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCore/RTSPCoreTypes.h"
+
+// NVENC API header for the NvEnc core, nvEncodeAPI.h pulls in windows.h on Windows which the engine wants wrapped
+#if defined(RTSP_CORE_STANDALONE) || !PLATFORM_WINDOWS
+#	include "NvEncoder/nvEncodeAPI.h"
+#else
+// Disable macro redefinition warning for compatibility with Windows SDK 8+
+#	pragma warning(push)
+#		pragma warning(disable : 4005)	// macro redefinition
+#		include "Windows/AllowWindowsPlatformTypes.h"
+#			include "NvEncoder/nvEncodeAPI.h"
+#		include "Windows/HideWindowsPlatformTypes.h"
+#	pragma warning(pop)
+#endif
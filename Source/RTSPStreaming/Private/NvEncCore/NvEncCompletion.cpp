@@ -0,0 +1,186 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "NvEncCompletion.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+const char* CompletionModeToString(ENvEncCompletionMode Mode)
+{
+	switch (Mode)
+	{
+	case ENvEncCompletionMode::Inline:
+		return "Inline";
+	case ENvEncCompletionMode::Event:
+		return "Event";
+	case ENvEncCompletionMode::BlockingLock:
+		return "BlockingLock";
+	}
+	return "Unknown";
+}
+
+namespace
+{
+#if defined(_WIN32)
+	// auto reset Win32 events the driver signals, one per slot
+	class FEventCompletion final : public INvEncCompletion
+	{
+	public:
+		FEventCompletion(const NV_ENCODE_API_FUNCTION_LIST& InApi, void* InEncoder)
+			: Api(InApi)
+			, Encoder(InEncoder)
+			, bWoken(false)
+		{}
+
+		~FEventCompletion()
+		{
+			for (void* Event : Events)
+			{
+				NV_ENC_EVENT_PARAMS EventParams;
+				std::memset(&EventParams, 0, sizeof(EventParams));
+				EventParams.version = NV_ENC_EVENT_PARAMS_VER;
+				EventParams.completionEvent = Event;
+				Api.nvEncUnregisterAsyncEvent(Encoder, &EventParams);
+				CloseHandle(Event);
+			}
+		}
+
+		NVENCSTATUS Register(int32 NumSlots)
+		{
+			for (int32 Slot = 0; Slot < NumSlots; ++Slot)
+			{
+				NV_ENC_EVENT_PARAMS EventParams;
+				std::memset(&EventParams, 0, sizeof(EventParams));
+				EventParams.version = NV_ENC_EVENT_PARAMS_VER;
+				EventParams.completionEvent = CreateEvent(nullptr, false, false, nullptr);
+				if (!EventParams.completionEvent)
+				{
+					return NV_ENC_ERR_OUT_OF_MEMORY;
+				}
+
+				NVENCSTATUS Result = Api.nvEncRegisterAsyncEvent(Encoder, &EventParams);
+				if (Result != NV_ENC_SUCCESS)
+				{
+					CloseHandle(EventParams.completionEvent);
+					return Result;
+				}
+				Events.push_back(EventParams.completionEvent);
+			}
+			return NV_ENC_SUCCESS;
+		}
+
+		virtual void* GetEvent(int32 Slot) const override
+		{
+			return Events[Slot];
+		}
+
+		virtual void Submitted(int32 Slot, bool bAccepted) override
+		{
+			// the driver won't signal a frame it didn't take
+			if (!bAccepted)
+			{
+				SetEvent(Events[Slot]);
+			}
+		}
+
+		virtual bool Wait(int32 Slot) override
+		{
+			DWORD Result = WaitForSingleObject(Events[Slot], INFINITE);
+			return Result == WAIT_OBJECT_0 && !bWoken;
+		}
+
+		virtual void Wake() override
+		{
+			bWoken = true;
+			// we don't know which slot it's waiting for
+			for (void* Event : Events)
+			{
+				SetEvent(Event);
+			}
+		}
+
+	private:
+		const NV_ENCODE_API_FUNCTION_LIST&	Api;
+		void*								Encoder;
+		std::vector<void*>					Events;
+		std::atomic<bool>					bWoken;
+	};
+#endif
+
+	// the driver has no events to offer, the completion thread learns about submissions from the session instead
+	class FSubmissionCompletion final : public INvEncCompletion
+	{
+	public:
+		explicit FSubmissionCompletion(int32 NumSlots)
+			: bSubmitted(NumSlots, 0)
+			, bWoken(false)
+		{}
+
+		virtual void* GetEvent(int32) const override
+		{
+			return nullptr;
+		}
+
+		virtual void Submitted(int32 Slot, bool) override
+		{
+			{
+				std::lock_guard<std::mutex> Lock(Mutex);
+				bSubmitted[Slot] = 1;
+			}
+			Cond.notify_one();
+		}
+
+		virtual bool Wait(int32 Slot) override
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Cond.wait(Lock, [this, Slot]() { return bWoken || bSubmitted[Slot]; });
+			if (bWoken)
+			{
+				return false;
+			}
+			bSubmitted[Slot] = 0;
+			return true;
+		}
+
+		virtual void Wake() override
+		{
+			{
+				std::lock_guard<std::mutex> Lock(Mutex);
+				bWoken = true;
+			}
+			Cond.notify_all();
+		}
+
+	private:
+		std::mutex				Mutex;
+		std::condition_variable	Cond;
+		std::vector<uint8>		bSubmitted;		// per slot, set until the completion thread picked the frame up
+		bool					bWoken;
+	};
+}
+
+std::unique_ptr<INvEncCompletion> CreateEventCompletion(const NV_ENCODE_API_FUNCTION_LIST& Api, void* Encoder, int32 NumSlots, NVENCSTATUS& OutResult)
+{
+#if defined(_WIN32)
+	std::unique_ptr<FEventCompletion> Completion(new FEventCompletion(Api, Encoder));
+	OutResult = Completion->Register(NumSlots);
+	if (OutResult != NV_ENC_SUCCESS)
+	{
+		return nullptr;
+	}
+	return std::move(Completion);
+#else
+	(void)Api;
+	(void)Encoder;
+	(void)NumSlots;
+	OutResult = NV_ENC_ERR_UNSUPPORTED_PARAM;
+	return nullptr;
+#endif
+}
+
+std::unique_ptr<INvEncCompletion> CreateSubmissionCompletion(int32 NumSlots)
+{
+	return std::unique_ptr<INvEncCompletion>(new FSubmissionCompletion(NumSlots));
+}
@@ -0,0 +1,48 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "NvEncApi.h"
+#include <memory>
+
+// how finished frames get from the driver to the owner of an FNvEncSession
+enum class ENvEncCompletionMode : uint8
+{
+	Inline,				// the owner completes each frame right after submitting it, blocking in nvEncLockBitstream
+	Event,				// async driver mode, the driver signals a Win32 event per slot. Windows only
+	BlockingLock,		// sync driver mode, a completion thread blocks in nvEncLockBitstream in submission order
+};
+
+const char* CompletionModeToString(ENvEncCompletionMode Mode);
+
+// wakes the completion thread when the frame of a slot is done, the part of the completion path that differs
+// between the Event and BlockingLock modes. Submitted() is called from the submitting thread, Wait() from the
+// completion thread in ring order and Wake() from any thread
+class INvEncCompletion
+{
+public:
+	virtual ~INvEncCompletion() {}
+
+	// event for NV_ENC_PIC_PARAMS::completionEvent, null if the driver encodes synchronously
+	virtual void* GetEvent(int32 Slot) const = 0;
+
+	// the frame of the slot was handed to the driver, or failed to be and completes right away
+	virtual void Submitted(int32 Slot, bool bAccepted) = 0;
+
+	// blocks until the driver signalled the slot, or until its frame was submitted in BlockingLock mode.
+	// Returns false once Wake() was called
+	virtual bool Wait(int32 Slot) = 0;
+
+	virtual void Wake() = 0;
+};
+
+/**
+* Creates and registers one Win32 event per slot, they are unregistered before the completion is destroyed so it
+* must go before the encoder. Null with the failing status on other platforms or if the driver refuses an event.
+*/
+std::unique_ptr<INvEncCompletion> CreateEventCompletion(const NV_ENCODE_API_FUNCTION_LIST& Api, void* Encoder, int32 NumSlots, NVENCSTATUS& OutResult);
+
+/**
+* Counts submitted frames per slot with a condition variable, the session locks the bitstream once Wait() returned.
+*/
+std::unique_ptr<INvEncCompletion> CreateSubmissionCompletion(int32 NumSlots);
@@ -0,0 +1,989 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "NvEncSession.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+	template<typename T>
+	void Zero(T& Value)
+	{
+		std::memset(&Value, 0, sizeof(T));
+	}
+}
+
+// std::chrono binds it to a reference, which needs a definition before C++17
+const uint32 FNvEncSession::SlicePollIntervalUs;
+
+FNvEncSession::FNvEncSession(const NV_ENCODE_API_FUNCTION_LIST& InApi)
+	: Api(InApi)
+	, Encoder(nullptr)
+	, Codec(EVideoCodec::H264)
+	, SupportedRateControlModes(0)
+	, bForceIdrFrame(false)
+	, CompletionMode(ENvEncCompletionMode::Inline)
+	, FrameCount(0)
+	, PipelineDepth(1)
+	, bAdaptivePipelineDepth(false)
+	, InFlightFrames(0)
+	, PeakInFlightFrames(0)
+	, FramesSinceDepthChange(0)
+	, LtrInterval(0)
+	, bFrameLost(false)
+	, LostFrameTimestamp(0)
+	, NumSubmittedFrames(0)
+	, LtrValidMask(0)
+	, NextLtrIdx(0)
+	, LastLtrMarkFrameIdx(0)
+	, RecoveredFrameIdx(0)
+	, NumTemporalLayers(1)
+	, FramesSinceIdr(0)
+	, MaxSliceSize(0)
+{
+	Zero(InitializeParams);
+	Zero(Config);
+	Zero(SubmittedFrames);
+	Zero(LtrFrameIdx);
+}
+
+FNvEncSession::~FNvEncSession()
+{
+	Close();
+}
+
+uint64 FNvEncSession::GetTimeMs()
+{
+	return static_cast<uint64>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+NVENCSTATUS FNvEncSession::Open(void* Device, NV_ENC_DEVICE_TYPE DeviceType, const FNvEncSettings& Settings, ENvEncCompletionMode Mode, const FConfigureFunction& Configure)
+{
+	check(!Encoder);
+	Codec = Settings.Codec;
+
+	// Open an encoding session
+	{
+		NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS OpenEncodeSessionExParams;
+		Zero(OpenEncodeSessionExParams);
+		OpenEncodeSessionExParams.version = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
+		OpenEncodeSessionExParams.device = Device;
+		OpenEncodeSessionExParams.deviceType = DeviceType;
+		OpenEncodeSessionExParams.apiVersion = NVENCAPI_VERSION;
+		NVENCSTATUS Result = Api.nvEncOpenEncodeSessionEx(&OpenEncodeSessionExParams, &Encoder);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			// whatever a failed open left behind is not ours to destroy
+			Encoder = nullptr;
+			return Result;
+		}
+	}
+	// Set initialization parameters
+	{
+		InitializeParams.version = NV_ENC_INITIALIZE_PARAMS_VER;
+		InitializeParams.encodeWidth = Settings.Width;
+		InitializeParams.encodeHeight = Settings.Height;
+		InitializeParams.darWidth = Settings.Width;
+		InitializeParams.darHeight = Settings.Height;
+		InitializeParams.encodeGUID = IsH265(Codec) ? NV_ENC_CODEC_HEVC_GUID : NV_ENC_CODEC_H264_GUID;
+		InitializeParams.presetGUID = NV_ENC_PRESET_LOW_LATENCY_HQ_GUID;
+		InitializeParams.frameRateNum = Settings.FrameRate;
+		InitializeParams.frameRateDen = 1;
+		InitializeParams.enablePTD = 1;
+		InitializeParams.reportSliceOffsets = 0;
+		InitializeParams.enableSubFrameWrite = 0;
+		InitializeParams.encodeConfig = &Config;
+		InitializeParams.maxEncodeWidth = 3840;
+		InitializeParams.maxEncodeHeight = 2160;
+	}
+	// Get preset config and tweak it accordingly
+	{
+		NV_ENC_PRESET_CONFIG PresetConfig;
+		Zero(PresetConfig);
+		PresetConfig.version = NV_ENC_PRESET_CONFIG_VER;
+		PresetConfig.presetCfg.version = NV_ENC_CONFIG_VER;
+		NVENCSTATUS Result = Api.nvEncGetEncodePresetConfig(Encoder, InitializeParams.encodeGUID, InitializeParams.presetGUID, &PresetConfig);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+		std::memcpy(&Config, &PresetConfig.presetCfg, sizeof(NV_ENC_CONFIG));
+
+		Config.gopLength = 3;
+
+		if (IsH265(Codec))
+		{
+			NV_ENC_CONFIG_HEVC& HevcConfig = Config.encodeCodecConfig.hevcConfig;
+			Config.profileGUID = NV_ENC_HEVC_PROFILE_MAIN_GUID;
+			HevcConfig.idrPeriod = Config.gopLength;
+			// a single slice per frame unless slices are streamed, see below
+			HevcConfig.sliceMode = 0;
+			HevcConfig.sliceModeData = 0;
+			HevcConfig.repeatSPSPPS = 1;
+			HevcConfig.level = NV_ENC_LEVEL_HEVC_51;
+			HevcConfig.tier = NV_ENC_TIER_HEVC_MAIN;
+			HevcConfig.chromaFormatIDC = 1;
+			HevcConfig.pixelBitDepthMinus8 = 0;
+		}
+		else
+		{
+			Config.profileGUID = NV_ENC_H264_PROFILE_BASELINE_GUID;
+			Config.encodeCodecConfig.h264Config.idrPeriod = Config.gopLength;
+
+			// a single slice per frame unless slices are streamed, see below. Frames of several slices decode as long as
+			// every slice goes out under the frame's RTP timestamp with the marker bit on the last packet of the frame
+			// only, which the packetizer does when the slices of a frame are sent apart too
+			Config.encodeCodecConfig.h264Config.sliceMode = 0;
+			Config.encodeCodecConfig.h264Config.sliceModeData = 0;
+
+			// repeat SPS/PPS with each key-frame for a case when the first frame (with mandatory SPS/PPS) was dropped
+			Config.encodeCodecConfig.h264Config.repeatSPSPPS = 1;
+
+			// maybe doesn't have an effect, high level is chosen because we aim at high bitrate
+			Config.encodeCodecConfig.h264Config.level = NV_ENC_LEVEL_H264_51;
+		}
+	}
+
+	// Rate control, the low-delay modes keep each frame within the VBV buffer so a frame never takes much longer than
+	// a frame interval to send
+	{
+		NV_ENC_CAPS_PARAM CapsParam;
+		Zero(CapsParam);
+		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
+		CapsParam.capsToQuery = NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES;
+		int Modes = 0;
+		NVENCSTATUS Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &Modes);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+		SupportedRateControlModes = static_cast<uint32>(Modes);
+		ApplyRateControl(Settings);
+	}
+
+	// Main10 encodes the 10 bit input as it is, Main has the driver convert it to 8 bit
+	if (Codec == EVideoCodec::H265Main10)
+	{
+		NV_ENC_CAPS_PARAM CapsParam;
+		Zero(CapsParam);
+		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
+		CapsParam.capsToQuery = NV_ENC_CAPS_SUPPORT_10BIT_ENCODE;
+		int TenBit = 0;
+		NVENCSTATUS Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &TenBit);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+
+		if (TenBit)
+		{
+			Config.profileGUID = NV_ENC_HEVC_PROFILE_MAIN10_GUID;
+			Config.encodeCodecConfig.hevcConfig.pixelBitDepthMinus8 = 2;
+		}
+		else
+		{
+			Codec = EVideoCodec::H265;
+		}
+	}
+
+	// the SDK has no temporal SVC for HEVC, frames of all layers would look alike to the clients
+	if (IsH265(Codec))
+	{
+		NumTemporalLayers = 1;
+	}
+
+	// Hierarchical-P temporal layers, a frame dropped for a client of the layers above the base one costs it frame
+	// rate rather than the frames up to the next IDR frame, so there are no periodic ones
+	if (NumTemporalLayers > 1)
+	{
+		NV_ENC_CAPS_PARAM CapsParam;
+		Zero(CapsParam);
+		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
+		CapsParam.capsToQuery = NV_ENC_CAPS_SUPPORT_TEMPORAL_SVC;
+		int TemporalSvc = 0;
+		NVENCSTATUS Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &TemporalSvc);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+		CapsParam.capsToQuery = NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS;
+		int MaxLayers = 0;
+		Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &MaxLayers);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+
+		NumTemporalLayers = TemporalSvc ? std::min<uint32>(NumTemporalLayers, static_cast<uint32>(std::max(MaxLayers, 1))) : 1;
+		if (NumTemporalLayers > 1)
+		{
+			Config.encodeCodecConfig.h264Config.enableTemporalSVC = 1;
+			Config.encodeCodecConfig.h264Config.hierarchicalPFrames = 1;
+			Config.encodeCodecConfig.h264Config.numTemporalLayers = NumTemporalLayers;
+			Config.gopLength = NVENC_INFINITE_GOPLENGTH;
+			Config.frameIntervalP = 1;
+			Config.encodeCodecConfig.h264Config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+
+			// the layers decide what each frame references, explicit long-term references would get in the way
+			LtrInterval = 0;
+		}
+	}
+
+	// Long-term references instead of periodic IDR frames
+	if (LtrInterval)
+	{
+		NV_ENC_CAPS_PARAM CapsParam;
+		Zero(CapsParam);
+		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
+		CapsParam.capsToQuery = NV_ENC_CAPS_SUPPORT_REF_PIC_INVALIDATION;
+		int RefPicInvalidation = 0;
+		NVENCSTATUS Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &RefPicInvalidation);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+
+		if (RefPicInvalidation && Api.nvEncInvalidateRefFrames)
+		{
+			// the references are marked and used explicitly, the encoder doesn't pick them by itself
+			if (IsH265(Codec))
+			{
+				Config.encodeCodecConfig.hevcConfig.enableLTR = 1;
+				Config.encodeCodecConfig.hevcConfig.ltrNumFrames = NumLtrFrames;
+				Config.encodeCodecConfig.hevcConfig.ltrTrustMode = 0;
+				Config.encodeCodecConfig.hevcConfig.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+			}
+			else
+			{
+				Config.encodeCodecConfig.h264Config.enableLTR = 1;
+				Config.encodeCodecConfig.h264Config.ltrNumFrames = NumLtrFrames;
+				Config.encodeCodecConfig.h264Config.ltrTrustMode = 0;
+				Config.encodeCodecConfig.h264Config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+			}
+			Config.gopLength = NVENC_INFINITE_GOPLENGTH;
+			Config.frameIntervalP = 1;
+		}
+		else
+		{
+			LtrInterval = 0;
+		}
+	}
+
+	// Slice streaming, slices of at most MaxSliceSize bytes fit into an RTP packet each and are read back while the rest
+	// of the frame is encoded. The driver only reports slice offsets when it encodes synchronously, so a completion
+	// thread polls the bitstream in BlockingLock mode
+	if (MaxSliceSize)
+	{
+		NV_ENC_CAPS_PARAM CapsParam;
+		Zero(CapsParam);
+		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
+		CapsParam.capsToQuery = NV_ENC_CAPS_SUPPORT_SUBFRAME_READBACK;
+		int SubFrameReadback = 0;
+		NVENCSTATUS Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &SubFrameReadback);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+
+		if (SubFrameReadback && Mode != ENvEncCompletionMode::Inline)
+		{
+			Mode = ENvEncCompletionMode::BlockingLock;
+			if (IsH265(Codec))
+			{
+				Config.encodeCodecConfig.hevcConfig.sliceMode = 1;
+				Config.encodeCodecConfig.hevcConfig.sliceModeData = MaxSliceSize;
+			}
+			else
+			{
+				Config.encodeCodecConfig.h264Config.sliceMode = 1;
+				Config.encodeCodecConfig.h264Config.sliceModeData = MaxSliceSize;
+			}
+			InitializeParams.reportSliceOffsets = 1;
+			InitializeParams.enableSubFrameWrite = 1;
+		}
+		else
+		{
+			MaxSliceSize = 0;
+		}
+	}
+
+	if (Configure)
+	{
+		Configure(InitializeParams, Config);
+		InitializeParams.encodeConfig = &Config;
+	}
+
+	// Get encoder capability
+	{
+		NV_ENC_CAPS_PARAM CapsParam;
+		Zero(CapsParam);
+		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
+		CapsParam.capsToQuery = NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT;
+		int AsyncMode = 0;
+		NVENCSTATUS Result = Api.nvEncGetEncodeCaps(Encoder, InitializeParams.encodeGUID, &CapsParam, &AsyncMode);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+#if !defined(_WIN32)
+		// completion events are Win32 events, elsewhere the driver only encodes synchronously
+		AsyncMode = 0;
+#endif
+		if (Mode == ENvEncCompletionMode::Event && !AsyncMode)
+		{
+			Mode = ENvEncCompletionMode::BlockingLock;
+		}
+		InitializeParams.enableEncodeAsync = Mode == ENvEncCompletionMode::Event ? 1 : 0;
+	}
+
+	NVENCSTATUS Result = Api.nvEncInitializeEncoder(Encoder, &InitializeParams);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		return Result;
+	}
+
+	CompletionMode = Mode;
+	if (Mode == ENvEncCompletionMode::Event)
+	{
+		Completion = CreateEventCompletion(Api, Encoder, MaxSlots, Result);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+	}
+	else if (Mode == ENvEncCompletionMode::BlockingLock)
+	{
+		Completion = CreateSubmissionCompletion(MaxSlots);
+	}
+
+	return UpdateSpsPpsHeader();
+}
+
+void FNvEncSession::Close()
+{
+	if (!Encoder)
+	{
+		return;
+	}
+
+	// statuses are ignored, there is nothing left to do about a failure
+	for (int32 Index = 0; Index < MaxSlots; ++Index)
+	{
+		FSlot& Slot = Slots[Index];
+
+		UnregisterInput(Index);
+
+		// a frame the completion thread locked but nobody completed
+		if (Slot.bLocked)
+		{
+			Api.nvEncUnlockBitstream(Encoder, Slot.BitstreamBuffer);
+			Slot.bLocked = false;
+		}
+
+		if (Slot.BitstreamBuffer)
+		{
+			Api.nvEncDestroyBitstreamBuffer(Encoder, Slot.BitstreamBuffer);
+			Slot.BitstreamBuffer = nullptr;
+		}
+	}
+
+	// unregisters its events, so before the encoder goes
+	Completion.reset();
+
+	Api.nvEncDestroyEncoder(Encoder);
+	Encoder = nullptr;
+}
+
+NVENCSTATUS FNvEncSession::UpdateSpsPpsHeader()
+{
+	uint8 SpsPpsBuffer[NV_MAX_SEQ_HDR_LEN];
+	uint32 PayloadSize = 0;
+
+	NV_ENC_SEQUENCE_PARAM_PAYLOAD SequenceParamPayload;
+	Zero(SequenceParamPayload);
+	SequenceParamPayload.version = NV_ENC_SEQUENCE_PARAM_PAYLOAD_VER;
+	SequenceParamPayload.inBufferSize = NV_MAX_SEQ_HDR_LEN;
+	SequenceParamPayload.spsppsBuffer = &SpsPpsBuffer;
+	SequenceParamPayload.outSPSPPSPayloadSize = &PayloadSize;
+
+	NVENCSTATUS Result = Api.nvEncGetSequenceParams(Encoder, &SequenceParamPayload);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		return Result;
+	}
+
+	PayloadSize = std::min<uint32>(PayloadSize, NV_MAX_SEQ_HDR_LEN);
+	SpsPpsHeader.assign(SpsPpsBuffer, SpsPpsBuffer + PayloadSize);
+	return NV_ENC_SUCCESS;
+}
+
+NVENCSTATUS FNvEncSession::Reconfigure(const FNvEncSettings& Settings, bool& bOutResolutionChanged)
+{
+	bOutResolutionChanged = false;
+
+	const NV_ENC_INITIALIZE_PARAMS PreviousInitializeParams = InitializeParams;
+	const NV_ENC_CONFIG PreviousConfig = Config;
+
+	bool bSettingsChanged = ApplyRateControl(Settings);
+	if (InitializeParams.frameRateNum != Settings.FrameRate)
+	{
+		InitializeParams.frameRateNum = Settings.FrameRate;
+		bSettingsChanged = true;
+	}
+	if (InitializeParams.encodeWidth != Settings.Width || InitializeParams.encodeHeight != Settings.Height)
+	{
+		InitializeParams.encodeWidth = Settings.Width;
+		InitializeParams.darWidth = Settings.Width;
+		InitializeParams.encodeHeight = Settings.Height;
+		InitializeParams.darHeight = Settings.Height;
+		bOutResolutionChanged = true;
+		bSettingsChanged = true;
+	}
+
+	if (!bSettingsChanged)
+	{
+		return NV_ENC_SUCCESS;
+	}
+
+	NV_ENC_RECONFIGURE_PARAMS ReconfigureParams;
+	Zero(ReconfigureParams);
+	std::memcpy(&ReconfigureParams.reInitEncodeParams, &InitializeParams, sizeof(InitializeParams));
+	ReconfigureParams.version = NV_ENC_RECONFIGURE_PARAMS_VER;
+	ReconfigureParams.forceIDR = bOutResolutionChanged;
+
+	NVENCSTATUS Result = Api.nvEncReconfigureEncoder(Encoder, &ReconfigureParams);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		InitializeParams = PreviousInitializeParams;
+		Config = PreviousConfig;
+		bOutResolutionChanged = false;
+		return Result;
+	}
+
+	if (bOutResolutionChanged && (LtrInterval || NumTemporalLayers > 1))
+	{
+		// the forced IDR frame drops the long-term references and restarts the layer pattern, going through
+		// ForceIdrFrame() lets SubmitFrame() know
+		ForceIdrFrame();
+	}
+
+	return bOutResolutionChanged ? UpdateSpsPpsHeader() : NV_ENC_SUCCESS;
+}
+
+bool FNvEncSession::ApplyRateControl(const FNvEncSettings& Settings)
+{
+	NV_ENC_RC_PARAMS& RcParams = Config.rcParams;
+
+	// modes the GPU lacks fall back to plain CBR, which every NVENC GPU has
+	NV_ENC_PARAMS_RC_MODE Mode = Settings.RateControlMode;
+	if (Mode != NV_ENC_PARAMS_RC_CONSTQP && !(SupportedRateControlModes & Mode))
+	{
+		Mode = NV_ENC_PARAMS_RC_CBR;
+	}
+	const uint32 MaxBitRate = Mode == NV_ENC_PARAMS_RC_VBR ? std::max(Settings.MaxBitRate, Settings.AverageBitRate) : 0;
+	const uint32 VbvBufferSize = Mode == NV_ENC_PARAMS_RC_CONSTQP ? 0 : Settings.VbvBufferSize;
+	const bool bQpChanged = Mode == NV_ENC_PARAMS_RC_CONSTQP
+		&& (RcParams.constQP.qpInterP != Settings.ConstQp || RcParams.constQP.qpIntra != Settings.ConstQp);
+
+	if (RcParams.rateControlMode == Mode && RcParams.averageBitRate == Settings.AverageBitRate && RcParams.maxBitRate == MaxBitRate
+		&& RcParams.vbvBufferSize == VbvBufferSize && RcParams.vbvInitialDelay == VbvBufferSize && !bQpChanged)
+	{
+		return false;
+	}
+
+	RcParams.rateControlMode = Mode;
+	RcParams.averageBitRate = Settings.AverageBitRate;
+	RcParams.maxBitRate = MaxBitRate;
+	// the VBV buffer bounds the largest frame, starting it full lets the first IDR frame use all of it
+	RcParams.vbvBufferSize = VbvBufferSize;
+	RcParams.vbvInitialDelay = VbvBufferSize;
+	if (Mode == NV_ENC_PARAMS_RC_CONSTQP)
+	{
+		RcParams.constQP.qpInterP = Settings.ConstQp;
+		RcParams.constQP.qpInterB = Settings.ConstQp;
+		RcParams.constQP.qpIntra = Settings.ConstQp;
+	}
+	return true;
+}
+
+void FNvEncSession::SetPipelineDepth(int32 Depth)
+{
+	Depth = std::min(std::max(Depth, 1), static_cast<int32>(MaxSlots));
+	if (Depth != PipelineDepth)
+	{
+		PipelineDepth = Depth;
+		PeakInFlightFrames = 0;
+		FramesSinceDepthChange = 0;
+	}
+}
+
+void FNvEncSession::SetAdaptivePipelineDepth(bool bAdaptive)
+{
+	bAdaptivePipelineDepth = bAdaptive;
+}
+
+void FNvEncSession::UpdatePipelineDepth(bool bDropped)
+{
+	if (!bAdaptivePipelineDepth)
+	{
+		return;
+	}
+
+	PeakInFlightFrames = std::max(PeakInFlightFrames, static_cast<int32>(InFlightFrames));
+	FramesSinceDepthChange++;
+
+	if (bDropped && PipelineDepth < MaxSlots)
+	{
+		// the encoder fell behind, buffer more rather than drop
+		PipelineDepth++;
+		PeakInFlightFrames = 0;
+		FramesSinceDepthChange = 0;
+	}
+	else if (FramesSinceDepthChange >= AdaptiveShrinkFrames)
+	{
+		// the encoder kept up with a slot to spare, fewer frames in flight means less queueing latency
+		if (PeakInFlightFrames < PipelineDepth && PipelineDepth > 1)
+		{
+			PipelineDepth--;
+		}
+		PeakInFlightFrames = 0;
+		FramesSinceDepthChange = 0;
+	}
+}
+
+int32 FNvEncSession::BeginFrame(uint64 Timestamp)
+{
+	const int32 Index = static_cast<int32>(FrameCount % MaxSlots);
+	FSlot& Slot = Slots[Index];
+
+	// If we don't have any free buffers, then we skip this rendered frame
+	const bool bDropped = Slot.bEncoding || InFlightFrames >= PipelineDepth;
+	UpdatePipelineDepth(bDropped);
+	if (bDropped)
+	{
+		return INDEX_NONE;
+	}
+
+	Slot.bEncoding = true;
+	InFlightFrames++;
+	Slot.Status = NV_ENC_SUCCESS;
+	Slot.Info = FNvEncFrameInfo();
+	Slot.Info.FrameIdx = FrameCount;
+	Slot.Info.Timestamp = Timestamp;
+	Slot.Info.CaptureTimeMs = GetTimeMs();
+	FrameCount++;
+	return Index;
+}
+
+void FNvEncSession::AbortFrame(int32 Slot)
+{
+	check(Slots[Slot].bEncoding && static_cast<int32>((FrameCount - 1) % MaxSlots) == Slot);
+
+	// nothing was submitted, the next frame takes the slot again so the completion thread stays in step
+	Slots[Slot].bEncoding = false;
+	InFlightFrames--;
+	FrameCount--;
+}
+
+bool FNvEncSession::HasInput(int32 Slot) const
+{
+	const FSlot& Entry = Slots[Slot];
+	return Entry.MappedResource && Entry.InputWidth == InitializeParams.encodeWidth && Entry.InputHeight == InitializeParams.encodeHeight;
+}
+
+NVENCSTATUS FNvEncSession::RegisterInput(int32 Slot, void* Resource, NV_ENC_INPUT_RESOURCE_TYPE ResourceType, NV_ENC_BUFFER_FORMAT BufferFormat)
+{
+	FSlot& Entry = Slots[Slot];
+	check(!Entry.RegisteredResource);
+
+	if (!Entry.BitstreamBuffer)
+	{
+		NV_ENC_CREATE_BITSTREAM_BUFFER CreateBitstreamBuffer;
+		Zero(CreateBitstreamBuffer);
+		CreateBitstreamBuffer.version = NV_ENC_CREATE_BITSTREAM_BUFFER_VER;
+		CreateBitstreamBuffer.size = BitstreamBufferSize;
+		CreateBitstreamBuffer.memoryHeap = NV_ENC_MEMORY_HEAP_SYSMEM_CACHED;
+		NVENCSTATUS Result = Api.nvEncCreateBitstreamBuffer(Encoder, &CreateBitstreamBuffer);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+		Entry.BitstreamBuffer = CreateBitstreamBuffer.bitstreamBuffer;
+	}
+
+	NV_ENC_REGISTER_RESOURCE RegisterResource;
+	Zero(RegisterResource);
+	RegisterResource.version = NV_ENC_REGISTER_RESOURCE_VER;
+	RegisterResource.resourceType = ResourceType;
+	RegisterResource.resourceToRegister = Resource;
+	RegisterResource.width = InitializeParams.encodeWidth;
+	RegisterResource.height = InitializeParams.encodeHeight;
+	RegisterResource.bufferFormat = BufferFormat;
+	NVENCSTATUS Result = Api.nvEncRegisterResource(Encoder, &RegisterResource);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		return Result;
+	}
+
+	NV_ENC_MAP_INPUT_RESOURCE MapInputResource;
+	Zero(MapInputResource);
+	MapInputResource.version = NV_ENC_MAP_INPUT_RESOURCE_VER;
+	MapInputResource.registeredResource = RegisterResource.registeredResource;
+	Result = Api.nvEncMapInputResource(Encoder, &MapInputResource);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		Api.nvEncUnregisterResource(Encoder, RegisterResource.registeredResource);
+		return Result;
+	}
+
+	// a slice can start at every macroblock, HEVC's coding tree units are larger
+	if (MaxSliceSize)
+	{
+		Entry.SliceOffsets.resize(((InitializeParams.encodeWidth + 15) / 16) * ((InitializeParams.encodeHeight + 15) / 16));
+	}
+
+	Entry.RegisteredResource = RegisterResource.registeredResource;
+	Entry.MappedResource = MapInputResource.mappedResource;
+	Entry.BufferFormat = BufferFormat;
+	Entry.InputWidth = InitializeParams.encodeWidth;
+	Entry.InputHeight = InitializeParams.encodeHeight;
+	return NV_ENC_SUCCESS;
+}
+
+void FNvEncSession::UnregisterInput(int32 Slot)
+{
+	FSlot& Entry = Slots[Slot];
+	if (Entry.MappedResource)
+	{
+		Api.nvEncUnmapInputResource(Encoder, Entry.MappedResource);
+		Entry.MappedResource = nullptr;
+	}
+	if (Entry.RegisteredResource)
+	{
+		Api.nvEncUnregisterResource(Encoder, Entry.RegisteredResource);
+		Entry.RegisteredResource = nullptr;
+	}
+	Entry.InputWidth = 0;
+	Entry.InputHeight = 0;
+}
+
+NVENCSTATUS FNvEncSession::SubmitFrame(int32 Slot)
+{
+	FSlot& Entry = Slots[Slot];
+	check(Entry.bEncoding && Entry.MappedResource);
+
+	NV_ENC_PIC_PARAMS PicParams;
+	Zero(PicParams);
+	PicParams.version = NV_ENC_PIC_PARAMS_VER;
+	PicParams.inputBuffer = Entry.MappedResource;
+	PicParams.bufferFmt = Entry.BufferFormat;
+	PicParams.inputWidth = Entry.InputWidth;
+	PicParams.inputHeight = Entry.InputHeight;
+	PicParams.outputBitstream = Entry.BitstreamBuffer;
+	PicParams.completionEvent = Completion ? Completion->GetEvent(Slot) : nullptr;
+	PicParams.inputTimeStamp = Entry.Info.FrameIdx;
+	PicParams.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+
+	bool bForceIdr = bForceIdrFrame.exchange(false);
+	if (LtrInterval)
+	{
+		ApplyLossRecovery(Entry, PicParams, bForceIdr);
+	}
+	if (bForceIdr)
+	{
+		PicParams.encodePicFlags |= NV_ENC_PIC_FLAG_FORCEIDR;
+		FramesSinceIdr = 0;
+	}
+	Entry.Info.TemporalLayer = GetTemporalLayer(FramesSinceIdr, static_cast<uint8>(NumTemporalLayers));
+
+	Entry.Info.EncodeStartTimeMs = GetTimeMs();
+	Entry.Status = Api.nvEncEncodePicture(Encoder, &PicParams);
+	if (Entry.Status == NV_ENC_SUCCESS)
+	{
+		// the driver counts the frames it took, a frame it refused doesn't move the pattern on
+		FramesSinceIdr++;
+	}
+	if (LtrInterval && Entry.Status == NV_ENC_SUCCESS)
+	{
+		OnFrameSubmitted(Entry, bForceIdr);
+	}
+	if (Completion)
+	{
+		// a frame the driver didn't take completes right away, the completion thread must not get stuck on it
+		Completion->Submitted(Slot, Entry.Status == NV_ENC_SUCCESS);
+	}
+	return Entry.Status;
+}
+
+void FNvEncSession::ReportLoss(uint32 RtpTimestamp)
+{
+	if (!LtrInterval)
+	{
+		ForceIdrFrame();
+		return;
+	}
+
+	std::lock_guard<std::mutex> Lock(LostFrameMutex);
+	if (!bFrameLost || static_cast<int32>(RtpTimestamp - LostFrameTimestamp) < 0)
+	{
+		LostFrameTimestamp = RtpTimestamp;
+	}
+	bFrameLost = true;
+}
+
+void FNvEncSession::ApplyLossRecovery(FSlot& Slot, NV_ENC_PIC_PARAMS& PicParams, bool& bInOutForceIdrFrame)
+{
+	bool bLost = false;
+	uint32 LostTimestamp = 0;
+	{
+		std::lock_guard<std::mutex> Lock(LostFrameMutex);
+		bLost = bFrameLost;
+		LostTimestamp = LostFrameTimestamp;
+		bFrameLost = false;
+	}
+
+	if (bLost && !bInOutForceIdrFrame)
+	{
+		// the newest submitted frame with that timestamp, an unknown one is too old to recover without an IDR frame
+		uint64 LostFrameIdx = 0;
+		bool bKnown = false;
+		const uint64 NumKnown = std::min<uint64>(NumSubmittedFrames, LossHistoryFrames);
+		for (uint64 Age = 1; Age <= NumKnown && !bKnown; ++Age)
+		{
+			const FSubmittedFrame& Frame = SubmittedFrames[(NumSubmittedFrames - Age) % LossHistoryFrames];
+			if (Frame.RtpTimestamp == LostTimestamp)
+			{
+				LostFrameIdx = Frame.FrameIdx;
+				bKnown = true;
+			}
+		}
+
+		if (!bKnown)
+		{
+			bInOutForceIdrFrame = true;
+		}
+		else if (LostFrameIdx >= RecoveredFrameIdx)
+		{
+			// the client has the long-term references from before the loss, none of the frames since
+			int32 UseLtrIdx = INDEX_NONE;
+			for (int32 LtrIdx = 0; LtrIdx < NumLtrFrames; ++LtrIdx)
+			{
+				if (!(LtrValidMask & (1u << LtrIdx)))
+				{
+					continue;
+				}
+				if (LtrFrameIdx[LtrIdx] >= LostFrameIdx)
+				{
+					LtrValidMask &= ~(1u << LtrIdx);
+				}
+				else if (UseLtrIdx == INDEX_NONE || LtrFrameIdx[LtrIdx] > LtrFrameIdx[UseLtrIdx])
+				{
+					UseLtrIdx = LtrIdx;
+				}
+			}
+
+			bool bInvalidated = UseLtrIdx != INDEX_NONE;
+			for (uint64 Age = 1; Age <= NumKnown && bInvalidated; ++Age)
+			{
+				const FSubmittedFrame& Frame = SubmittedFrames[(NumSubmittedFrames - Age) % LossHistoryFrames];
+				if (Frame.FrameIdx < LostFrameIdx)
+				{
+					break;
+				}
+				bInvalidated = Api.nvEncInvalidateRefFrames(Encoder, Frame.FrameIdx) == NV_ENC_SUCCESS;
+			}
+
+			if (bInvalidated)
+			{
+				if (IsH265(Codec))
+				{
+					PicParams.codecPicParams.hevcPicParams.ltrUseFrames = 1;
+					PicParams.codecPicParams.hevcPicParams.ltrUseFrameBitmap = 1u << UseLtrIdx;
+				}
+				else
+				{
+					PicParams.codecPicParams.h264PicParams.ltrUseFrames = 1;
+					PicParams.codecPicParams.h264PicParams.ltrUseFrameBitmap = 1u << UseLtrIdx;
+				}
+				RecoveredFrameIdx = Slot.Info.FrameIdx;
+			}
+			else
+			{
+				bInOutForceIdrFrame = true;
+			}
+		}
+	}
+
+	// an IDR frame recovers from everything and drops the long-term references, it becomes the first new one
+	if (bInOutForceIdrFrame)
+	{
+		LtrValidMask = 0;
+		RecoveredFrameIdx = Slot.Info.FrameIdx;
+	}
+
+	Slot.LtrMarkIdx = INDEX_NONE;
+	if (!LtrValidMask || Slot.Info.FrameIdx - LastLtrMarkFrameIdx >= LtrInterval)
+	{
+		Slot.LtrMarkIdx = NextLtrIdx;
+		if (IsH265(Codec))
+		{
+			PicParams.codecPicParams.hevcPicParams.ltrMarkFrame = 1;
+			PicParams.codecPicParams.hevcPicParams.ltrMarkFrameIdx = static_cast<uint32>(NextLtrIdx);
+		}
+		else
+		{
+			PicParams.codecPicParams.h264PicParams.ltrMarkFrame = 1;
+			PicParams.codecPicParams.h264PicParams.ltrMarkFrameIdx = static_cast<uint32>(NextLtrIdx);
+		}
+	}
+}
+
+void FNvEncSession::OnFrameSubmitted(const FSlot& Slot, bool bIdrFrame)
+{
+	FSubmittedFrame& Frame = SubmittedFrames[NumSubmittedFrames % LossHistoryFrames];
+	Frame.FrameIdx = Slot.Info.FrameIdx;
+	Frame.RtpTimestamp = static_cast<uint32>(Slot.Info.Timestamp);
+	NumSubmittedFrames++;
+
+	if (bIdrFrame)
+	{
+		LtrValidMask = 0;
+	}
+	if (Slot.LtrMarkIdx != INDEX_NONE)
+	{
+		LtrFrameIdx[Slot.LtrMarkIdx] = Slot.Info.FrameIdx;
+		LtrValidMask |= 1u << Slot.LtrMarkIdx;
+		LastLtrMarkFrameIdx = Slot.Info.FrameIdx;
+		NextLtrIdx = (NextLtrIdx + 1) % NumLtrFrames;
+	}
+}
+
+bool FNvEncSession::WaitForCompletion(int32 Slot, const FSliceFunction& OnSlices)
+{
+	check(Completion);
+	FSlot& Entry = Slots[Slot];
+
+	if (!Completion->Wait(Slot))
+	{
+		return false;
+	}
+
+	// the driver encodes synchronously, so the lock blocks until the frame is done. Frames are locked in
+	// submission order while the submitting thread carries on with the next ones
+	if (CompletionMode == ENvEncCompletionMode::BlockingLock && Entry.Status == NV_ENC_SUCCESS)
+	{
+		Entry.Status = MaxSliceSize ? ReadSlices(Entry, OnSlices) : LockSlotBitstream(Entry, false);
+	}
+
+	Entry.Info.EncodeEndTimeMs = GetTimeMs();
+	return true;
+}
+
+void FNvEncSession::WakeCompletionWaiter()
+{
+	if (Completion)
+	{
+		Completion->Wake();
+	}
+}
+
+NVENCSTATUS FNvEncSession::LockSlotBitstream(FSlot& Slot, bool bDoNotWait)
+{
+	Zero(Slot.LockBitstream);
+	Slot.LockBitstream.version = NV_ENC_LOCK_BITSTREAM_VER;
+	Slot.LockBitstream.outputBitstream = Slot.BitstreamBuffer;
+	Slot.LockBitstream.doNotWait = bDoNotWait ? 1 : 0;
+	Slot.LockBitstream.sliceOffsets = Slot.SliceOffsets.empty() ? nullptr : Slot.SliceOffsets.data();
+
+	NVENCSTATUS Result = Api.nvEncLockBitstream(Encoder, &Slot.LockBitstream);
+	Slot.bLocked = Result == NV_ENC_SUCCESS;
+	return Result;
+}
+
+NVENCSTATUS FNvEncSession::ReadSlices(FSlot& Slot, const FSliceFunction& OnSlices)
+{
+	// hwEncodeStatus of a frame the driver is done with, before that the bitstream holds the slices written so far
+	static const uint32 EncodeStatusComplete = 2;
+
+	uint32 ReadSize = 0;
+	while (true)
+	{
+		NVENCSTATUS Result = LockSlotBitstream(Slot, true);
+		if (Result == NV_ENC_ERR_LOCK_BUSY || Result == NV_ENC_ERR_ENCODER_BUSY)
+		{
+			// not a slice written yet
+			std::this_thread::sleep_for(std::chrono::microseconds(SlicePollIntervalUs));
+			continue;
+		}
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+
+		// the newest slice may still be being written, it's whole once the next one starts. Held back until then it's
+		// also never clear too late that a run was the frame's last
+		const NV_ENC_LOCK_BITSTREAM& Lock = Slot.LockBitstream;
+		const bool bComplete = Lock.hwEncodeStatus == EncodeStatusComplete;
+		uint32 WholeSize = bComplete ? Lock.bitstreamSizeInBytes : 0;
+		if (!bComplete && Lock.numSlices > 1 && Lock.numSlices <= Slot.SliceOffsets.size())
+		{
+			WholeSize = std::min(Slot.SliceOffsets[Lock.numSlices - 1], Lock.bitstreamSizeInBytes);
+		}
+
+		Slot.Info.bIdrFrame = Lock.pictureType == NV_ENC_PIC_TYPE_IDR;
+		if (WholeSize > ReadSize || bComplete)
+		{
+			if (OnSlices)
+			{
+				OnSlices(static_cast<const uint8*>(Lock.bitstreamBufferPtr) + ReadSize, WholeSize - std::min(ReadSize, WholeSize), Slot.Info, bComplete);
+			}
+			ReadSize = std::max(ReadSize, WholeSize);
+		}
+		if (bComplete)
+		{
+			// stays locked for CompleteFrame()
+			Slot.Info.NumSlices = std::max<uint32>(Lock.numSlices, 1);
+			return NV_ENC_SUCCESS;
+		}
+
+		Slot.bLocked = false;
+		Result = Api.nvEncUnlockBitstream(Encoder, Slot.BitstreamBuffer);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(SlicePollIntervalUs));
+	}
+}
+
+NVENCSTATUS FNvEncSession::CompleteFrame(int32 Slot, const FCopyFunction& Copy, FNvEncFrameInfo& OutInfo)
+{
+	FSlot& Entry = Slots[Slot];
+	check(Entry.bEncoding);
+
+	if (!Entry.Info.EncodeEndTimeMs)
+	{
+		Entry.Info.EncodeEndTimeMs = GetTimeMs();
+	}
+
+	NVENCSTATUS Result = Entry.Status;
+	if (Result == NV_ENC_SUCCESS && !Entry.bLocked)
+	{
+		// in Event mode the frame is done already, waiting would only hide a driver problem
+		Result = LockSlotBitstream(Entry, CompletionMode == ENvEncCompletionMode::Event);
+	}
+	if (Result == NV_ENC_SUCCESS)
+	{
+		Copy(static_cast<const uint8*>(Entry.LockBitstream.bitstreamBufferPtr), Entry.LockBitstream.bitstreamSizeInBytes);
+		Entry.Info.bIdrFrame = Entry.LockBitstream.pictureType == NV_ENC_PIC_TYPE_IDR;
+		Entry.bLocked = false;
+		Result = Api.nvEncUnlockBitstream(Encoder, Entry.BitstreamBuffer);
+	}
+
+	OutInfo = Entry.Info;
+	Entry.bEncoding = false;
+	InFlightFrames--;
+	return Result;
+}
@@ -0,0 +1,319 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "NvEncApi.h"
+#include "NvEncCompletion.h"
+#include "RTSPCore/TemporalLayers.h"
+#include "RTSPCore/VideoCodec.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// what a session encodes, the subset of FVideoEncoderSettings NVENC is reconfigured with
+struct FNvEncSettings
+{
+	uint32	Width = 1920;
+	uint32	Height = 1080;
+	uint32	FrameRate = 60;
+	uint32	AverageBitRate = 20000000;
+	EVideoCodec	Codec = EVideoCodec::H264;	// only applied by Open()
+	NV_ENC_PARAMS_RC_MODE	RateControlMode = NV_ENC_PARAMS_RC_2_PASS_QUALITY;	// SDK 7's name of CBR low-delay HQ
+	uint32	MaxBitRate = 0;				// peak of VBR, the average if lower
+	uint32	ConstQp = 28;				// QP of every frame with CONSTQP
+	uint32	VbvBufferSize = 0;			// VBV buffer size and initial delay in bits, 0 for the driver's default
+};
+
+// what CompleteFrame() reports about an encoded frame, times are GetTimeMs()
+struct FNvEncFrameInfo
+{
+	uint64	FrameIdx = 0;
+	uint64	Timestamp = 0;				// as passed to BeginFrame()
+	bool	bIdrFrame = false;
+	uint8	TemporalLayer = 0;
+	uint32	NumSlices = 1;				// more than one with slice streaming
+	uint64	CaptureTimeMs = 0;			// BeginFrame()
+	uint64	EncodeStartTimeMs = 0;		// SubmitFrame()
+	uint64	EncodeEndTimeMs = 0;		// WaitForCompletion(), or CompleteFrame() in Inline mode
+};
+
+// NVENC session, frame ring, reconfiguration and completion without any graphics API
+// - talks to the driver only through the NV_ENCODE_API_FUNCTION_LIST it's given, so it runs against the stub
+//   library in NvEncCore/Stub as well as against the real driver
+// - input resources are opaque, the owner creates them on its device and registers them with a slot
+// - frames go round a ring of MaxSlots slots, the pipeline depth limits how many of them are in flight and
+//   captured frames are dropped when all of them are busy. In adaptive mode the depth grows on drops and shrinks
+//   while the encoder keeps up with a slot to spare
+// - unless frames complete inline, the owner's completion thread waits on the slots in ring order. How it learns
+//   about finished frames is up to an INvEncCompletion: Win32 events signalled by the driver in Event mode, or a
+//   blocking bitstream lock in submission order in BlockingLock mode, which works wherever the driver does
+// - with loss recovery every LtrInterval-th frame is marked as a long-term reference and there are no periodic IDR
+//   frames. A reported loss invalidates the lost frame and the ones submitted since, and the next frame is predicted
+//   from the newest long-term reference before the loss. Without one it's an IDR frame
+// - with temporal layers the frames are hierarchical-P in the pattern of RTSPCore/TemporalLayers.h, the session
+//   counts frames since the last IDR frame to tell each frame's layer. Loss recovery with long-term references is
+//   off then, losses are recovered with IDR frames
+// - with slice streaming frames are split into slices of a byte budget and the driver writes each one out as soon as
+//   it's encoded. The completion thread polls the bitstream and hands out the slices written so far, the newest one
+//   is held back until the next one starts or the frame is done so the last slices of a frame are always handed out
+//   on their own, once it's known they are the last
+// errors are returned as NVENCSTATUS, the session stays usable after a failed frame
+// BeginFrame(), AbortFrame(), CompleteFrame(), the input functions and Reconfigure() are called from one thread,
+// SubmitFrame() from the thread that owns the device, e.g. the render thread and the RHI thread. ReportLoss() and
+// ForceIdrFrame() from any thread
+class FNvEncSession final
+{
+public:
+	static const int32 MaxSlots = 6;
+	static const uint32 BitstreamBufferSize = 1280 * 720 * 2;
+	static const int32 AdaptiveShrinkFrames = 300;		// frames without drops and with headroom before the depth shrinks
+	static const int32 NumLtrFrames = 2;				// long-term references kept, marked in turn
+	static const int32 LossHistoryFrames = 64;			// submitted frames a loss can be reported for, older ones need an IDR frame
+	static const uint32 SlicePollIntervalUs = 250;		// between polls of a frame's bitstream with slice streaming
+
+	using FConfigureFunction = std::function<void(NV_ENC_INITIALIZE_PARAMS& InitializeParams, NV_ENC_CONFIG& Config)>;
+	using FCopyFunction = std::function<void(const uint8* Bitstream, uint32 Size)>;
+	using FSliceFunction = std::function<void(const uint8* Slices, uint32 Size, const FNvEncFrameInfo& Info, bool bLastSlices)>;
+
+	explicit FNvEncSession(const NV_ENCODE_API_FUNCTION_LIST& InApi);
+	~FNvEncSession();
+
+	FNvEncSession(const FNvEncSession&) = delete;
+	FNvEncSession& operator=(const FNvEncSession&) = delete;
+
+	static uint64 GetTimeMs();
+
+	/**
+	* Opens the session on Device, sets up H.264 or HEVC low latency encoding and the completion path. HEVC Main10 falls
+	* back to Main if the GPU can't encode 10 bit, see GetCodec(), and rate control modes it lacks to CBR, see GetConfig()
+	* @param Mode - Event falls back to BlockingLock if the driver can't encode asynchronously, see GetCompletionMode()
+	* @param Configure - tweaks the initialize params and config before the encoder is initialized, optional
+	* @return the status of the first call that failed, the session must be destroyed then
+	*/
+	NVENCSTATUS Open(void* Device, NV_ENC_DEVICE_TYPE DeviceType, const FNvEncSettings& Settings, ENvEncCompletionMode Mode,
+		const FConfigureFunction& Configure = FConfigureFunction());
+
+	/**
+	* Applies changed rate control, bitrate, frame rate and resolution, a resolution change forces an IDR frame and
+	* updates the SPS/PPS header. Keeps the previous settings if the driver refuses the new ones.
+	*/
+	NVENCSTATUS Reconfigure(const FNvEncSettings& Settings, bool& bOutResolutionChanged);
+
+	/**
+	* Enables loss recovery with a long-term reference every Interval frames, 0 disables it. Call before Open(), which
+	* disables it again if the driver can't invalidate reference frames.
+	*/
+	void SetLtrInterval(uint32 Interval)
+	{
+		LtrInterval = Interval;
+	}
+	uint32 GetLtrInterval() const
+	{
+		return LtrInterval;
+	}
+
+	/**
+	* Encodes NumLayers hierarchical-P temporal layers, 1 disables them. Call before Open(), which caps it at what the
+	* driver supports and disables loss recovery with long-term references if there is more than one.
+	*/
+	void SetTemporalLayers(uint32 NumLayers)
+	{
+		NumTemporalLayers = std::min<uint32>(std::max<uint32>(NumLayers, 1), MaxTemporalLayers);
+	}
+	uint32 GetTemporalLayers() const
+	{
+		return NumTemporalLayers;
+	}
+
+	/**
+	* Encodes slices of at most MaxSize bytes and hands them out while the rest of the frame is encoded, 0 encodes every
+	* frame as a single slice. Call before Open(), which disables it if the driver can't read back sub-frames or frames
+	* complete inline, and completes frames in BlockingLock mode instead of Event mode as slice offsets are only
+	* reported when the driver encodes synchronously.
+	*/
+	void SetSliceStreaming(uint32 MaxSize)
+	{
+		MaxSliceSize = MaxSize;
+	}
+	uint32 GetMaxSliceSize() const
+	{
+		return MaxSliceSize;
+	}
+	bool IsSliceStreaming() const
+	{
+		return MaxSliceSize != 0;
+	}
+
+	EVideoCodec GetCodec() const						// what Open() set up
+	{
+		return Codec;
+	}
+
+	/**
+	* A client lost the frame whose Timestamp passed to BeginFrame() has these low 32 bits, applied to the next
+	* submitted frame. Reports of frames a recovery already covers are ignored.
+	*/
+	void ReportLoss(uint32 RtpTimestamp);
+
+	void SetPipelineDepth(int32 Depth);					// clamped to 1..MaxSlots
+	void SetAdaptivePipelineDepth(bool bAdaptive);
+
+	/**
+	* Claims the next slot of the ring for a frame, INDEX_NONE if the frame has to be dropped.
+	*/
+	int32 BeginFrame(uint64 Timestamp);
+
+	/**
+	* Releases a slot claimed by BeginFrame() that won't be submitted, as if the frame had never begun.
+	*/
+	void AbortFrame(int32 Slot);
+
+	/**
+	* True if a resource of the current encode size is registered with the slot.
+	*/
+	bool HasInput(int32 Slot) const;
+
+	/**
+	* Registers and maps Resource as the slot's input, of the current encode size. Creates the slot's bitstream
+	* buffer the first time. Unregister the previous input first.
+	*/
+	NVENCSTATUS RegisterInput(int32 Slot, void* Resource, NV_ENC_INPUT_RESOURCE_TYPE ResourceType, NV_ENC_BUFFER_FORMAT BufferFormat);
+	void UnregisterInput(int32 Slot);
+
+	/**
+	* Sends the slot's input to the encoder. The frame completes in CompleteFrame() even if this fails.
+	*/
+	NVENCSTATUS SubmitFrame(int32 Slot);
+
+	/**
+	* Waits until the frame of the slot is encoded, on the completion thread and not in Inline mode. In BlockingLock
+	* mode this locks the bitstream for CompleteFrame(). False when woken up by WakeCompletionWaiter().
+	* @param OnSlices - with slice streaming, handed each run of whole slices in bitstream order as soon as the driver
+	* wrote it, the last run with bLastSlices. Runs of a frame that fails part way through are never followed by a last one
+	*/
+	bool WaitForCompletion(int32 Slot, const FSliceFunction& OnSlices = FSliceFunction());
+	void WakeCompletionWaiter();
+
+	/**
+	* Locks the slot's bitstream unless WaitForCompletion() did, hands it to Copy and releases the slot.
+	* @return NV_ENC_SUCCESS if the frame was copied, otherwise the frame is lost
+	*/
+	NVENCSTATUS CompleteFrame(int32 Slot, const FCopyFunction& Copy, FNvEncFrameInfo& OutInfo);
+
+	void ForceIdrFrame()
+	{
+		bForceIdrFrame = true;
+	}
+
+	// frames complete on a completion thread
+	bool IsAsync() const
+	{
+		return CompletionMode != ENvEncCompletionMode::Inline;
+	}
+
+	ENvEncCompletionMode GetCompletionMode() const
+	{
+		return CompletionMode;
+	}
+
+	bool IsEncoding(int32 Slot) const
+	{
+		return Slots[Slot].bEncoding;
+	}
+
+	const NV_ENC_INITIALIZE_PARAMS& GetInitializeParams() const
+	{
+		return InitializeParams;
+	}
+
+	const NV_ENC_CONFIG& GetConfig() const
+	{
+		return Config;
+	}
+
+	const std::vector<uint8>& GetSpsPpsHeader() const
+	{
+		return SpsPpsHeader;
+	}
+
+	int32 GetPipelineDepth() const
+	{
+		return PipelineDepth;
+	}
+
+	int32 GetInFlightFrames() const
+	{
+		return InFlightFrames;
+	}
+
+private:
+	struct FSlot
+	{
+		void*					RegisteredResource = nullptr;
+		NV_ENC_INPUT_PTR		MappedResource = nullptr;
+		NV_ENC_BUFFER_FORMAT	BufferFormat = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+		uint32					InputWidth = 0;
+		uint32					InputHeight = 0;
+		NV_ENC_OUTPUT_PTR		BitstreamBuffer = nullptr;
+		NVENCSTATUS				Status = NV_ENC_SUCCESS;		// of the submission, or of the lock in BlockingLock mode
+		NV_ENC_LOCK_BITSTREAM	LockBitstream;					// valid while bLocked
+		std::vector<uint32>		SliceOffsets;					// reported with slice streaming, one per macroblock as the driver wants
+		bool					bLocked = false;
+		int32					LtrMarkIdx = INDEX_NONE;		// long-term reference index the frame is marked with
+		FNvEncFrameInfo			Info;
+		std::atomic<bool>		bEncoding{ false };
+	};
+
+	NVENCSTATUS UpdateSpsPpsHeader();
+	bool ApplyRateControl(const FNvEncSettings& Settings);	// true if it changed Config
+	void Close();									// releases everything the session registered and destroys the encoder
+	void UpdatePipelineDepth(bool bDropped);
+	NVENCSTATUS LockSlotBitstream(FSlot& Slot, bool bDoNotWait);
+	NVENCSTATUS ReadSlices(FSlot& Slot, const FSliceFunction& OnSlices);	// returns with the whole frame locked
+	void ApplyLossRecovery(FSlot& Slot, NV_ENC_PIC_PARAMS& PicParams, bool& bInOutForceIdrFrame);
+	void OnFrameSubmitted(const FSlot& Slot, bool bIdrFrame);
+
+	NV_ENCODE_API_FUNCTION_LIST	Api;
+	void*						Encoder;
+	NV_ENC_INITIALIZE_PARAMS	InitializeParams;
+	NV_ENC_CONFIG				Config;
+	EVideoCodec					Codec;
+	uint32						SupportedRateControlModes;	// NV_ENC_PARAMS_RC_MODE bits, CONSTQP is always supported
+	std::vector<uint8>			SpsPpsHeader;		// with start codes, the VPS too with HEVC
+	std::atomic<bool>			bForceIdrFrame;
+	ENvEncCompletionMode		CompletionMode;
+	std::unique_ptr<INvEncCompletion>	Completion;		// null in Inline mode
+	uint64						FrameCount;
+	FSlot						Slots[MaxSlots];
+	int32						PipelineDepth;
+	bool						bAdaptivePipelineDepth;
+	std::atomic<int32>			InFlightFrames;
+	int32						PeakInFlightFrames;		// since the last depth change, adaptive mode
+	int32						FramesSinceDepthChange;
+
+	// loss recovery, SubmitFrame() only unless noted
+	struct FSubmittedFrame
+	{
+		uint64	FrameIdx;
+		uint32	RtpTimestamp;
+	};
+	uint32						LtrInterval;						// 0 if disabled, set before Open()
+	std::mutex					LostFrameMutex;						// guards bFrameLost and LostFrameTimestamp
+	bool						bFrameLost;
+	uint32						LostFrameTimestamp;					// oldest frame reported lost since the last submission
+	FSubmittedFrame				SubmittedFrames[LossHistoryFrames];	// ring, the frame index is the encoder's inputTimeStamp
+	uint64						NumSubmittedFrames;
+	uint64						LtrFrameIdx[NumLtrFrames];
+	uint32						LtrValidMask;						// bit per long-term reference index
+	int32						NextLtrIdx;
+	uint64						LastLtrMarkFrameIdx;
+	uint64						RecoveredFrameIdx;					// losses of earlier frames are recovered already
+
+	uint32						NumTemporalLayers;					// 1 if disabled, set before Open()
+	uint64						FramesSinceIdr;						// frames submitted since the last IDR frame, SubmitFrame() only
+
+	uint32						MaxSliceSize;						// 0 if slices aren't streamed, set before Open()
+};
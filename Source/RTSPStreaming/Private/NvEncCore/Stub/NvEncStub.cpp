@@ -0,0 +1,1356 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// stand-in for the NVENC driver library, built as libnvidia-encode.so.1 / nvEncodeAPI64.dll by NvEncCore/CMakeLists.txt
+// so the encoder core, or the whole plugin, runs on machines without an NVIDIA GPU
+// - implements the calls FNvEncSession makes, the other entry points of the function list stay null
+// - frames are "encoded" on one worker thread per session, in submission order, taking NVENC_STUB_LATENCY_MS each
+// - bitstreams are synthetic parameter sets and filler slices, H.264 or HEVC as the session asked, or the access units
+//   of the H.264 Annex-B file NVENC_STUB_BITSTREAM in a loop. HEVC sessions always get synthetic frames. Frames are
+//   sized by bitrate and frame rate and capped at the VBV buffer, or by QP in constant QP mode
+// - frames are a single slice, or slices of at most sliceModeData bytes with byte based slices (sliceMode 1). With
+//   enableSubFrameWrite the slices are written one by one over the latency, a non-blocking lock of a frame being
+//   encoded returns the ones written so far with their offsets if reportSliceOffsets is set
+// - completion events are signalled on Windows, elsewhere async mode is reported as unsupported like the real driver
+// - with temporal SVC each slice is preceded by a prefix NAL unit carrying its temporal_id, and slices of the top
+//   layer are non-reference, as the driver writes them
+// - NVENC_STUB_MAX_SESSIONS limits concurrent sessions as consumer GPUs do, opening one more fails with
+//   NV_ENC_ERR_OUT_OF_MEMORY
+// - NVENC_STUB_FAIL injects errors, a comma separated list of <function>[:<call>[+]][:<status>], e.g.
+//   "nvEncEncodePicture:100:1,nvEncLockBitstream:20+" fails the 100th EncodePicture with NV_ENC_ERR_NO_ENCODE_DEVICE
+//   and every LockBitstream from the 20th on with NV_ENC_ERR_GENERIC. Calls are counted per function from 1 across
+//   all sessions, without a call number every call fails
+// the checks are stricter than the driver's where that catches client bugs, e.g. a picture of the wrong size
+
+// UBT compiles every source of the module, the stub is only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "NvEncCore/NvEncApi.h"
+#include "RTSPCore/TemporalLayers.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#	define NVENC_STUB_EXPORT __declspec(dllexport)
+#else
+#	define NVENC_STUB_EXPORT __attribute__((visibility("default")))
+#endif
+
+namespace
+{
+	template<typename T>
+	void Zero(T& Value)
+	{
+		std::memset(&Value, 0, sizeof(T));
+	}
+
+	uint32 GetEnvUInt(const char* Name, uint32 Default)
+	{
+		const char* Value = std::getenv(Name);
+		return Value && *Value ? static_cast<uint32>(std::strtoul(Value, nullptr, 10)) : Default;
+	}
+
+	struct FFailRule
+	{
+		std::string		Function;
+		uint64			Call = 0;			// 0 for every call
+		bool			bAndLater = false;
+		NVENCSTATUS		Status = NV_ENC_ERR_GENERIC;
+	};
+
+	// NVENC_STUB_FAIL and the call counters it's checked against
+	class FErrorInjection
+	{
+	public:
+		FErrorInjection()
+		{
+			const char* Spec = std::getenv("NVENC_STUB_FAIL");
+			std::string Rules = Spec ? Spec : "";
+			size_t Start = 0;
+			while (Start < Rules.size())
+			{
+				size_t End = Rules.find(',', Start);
+				if (End == std::string::npos)
+				{
+					End = Rules.size();
+				}
+				ParseRule(Rules.substr(Start, End - Start));
+				Start = End + 1;
+			}
+		}
+
+		bool ShouldFail(const char* Function, NVENCSTATUS& OutStatus)
+		{
+			if (FailRules.empty())
+			{
+				return false;
+			}
+
+			std::lock_guard<std::mutex> Lock(Mutex);
+			const uint64 Call = ++Calls[Function];
+			for (const FFailRule& Rule : FailRules)
+			{
+				if (Rule.Function == Function && (Rule.Call == 0 || Rule.Call == Call || (Rule.bAndLater && Call > Rule.Call)))
+				{
+					OutStatus = Rule.Status;
+					return true;
+				}
+			}
+			return false;
+		}
+
+	private:
+		void ParseRule(const std::string& Text)
+		{
+			if (Text.empty())
+			{
+				return;
+			}
+
+			FFailRule Rule;
+			const size_t FirstColon = Text.find(':');
+			Rule.Function = Text.substr(0, FirstColon);
+			if (FirstColon != std::string::npos)
+			{
+				const size_t SecondColon = Text.find(':', FirstColon + 1);
+				const std::string Call = Text.substr(FirstColon + 1, SecondColon == std::string::npos ? std::string::npos : SecondColon - FirstColon - 1);
+				Rule.Call = std::strtoull(Call.c_str(), nullptr, 10);
+				Rule.bAndLater = !Call.empty() && Call.back() == '+';
+				if (SecondColon != std::string::npos)
+				{
+					Rule.Status = static_cast<NVENCSTATUS>(std::strtol(Text.c_str() + SecondColon + 1, nullptr, 10));
+				}
+			}
+			FailRules.push_back(Rule);
+		}
+
+		std::vector<FFailRule>			FailRules;
+		std::mutex						Mutex;
+		std::map<std::string, uint64>	Calls;
+	};
+
+	FErrorInjection& GetErrorInjection()
+	{
+		static FErrorInjection ErrorInjection;
+		return ErrorInjection;
+	}
+
+#define NVENC_STUB_INJECT_ERROR(Function) \
+	{ \
+		NVENCSTATUS InjectedStatus; \
+		if (GetErrorInjection().ShouldFail(#Function, InjectedStatus)) \
+		{ \
+			return InjectedStatus; \
+		} \
+	}
+
+	// MSB first bit writer for the synthetic parameter sets
+	class FBitWriter
+	{
+	public:
+		void WriteBits(uint32 Value, int32 NumBits)
+		{
+			for (int32 Bit = NumBits - 1; Bit >= 0; --Bit)
+			{
+				WriteBit((Value >> Bit) & 1);
+			}
+		}
+
+		void WriteUe(uint32 Value)
+		{
+			const uint64 CodeNum = static_cast<uint64>(Value) + 1;
+			int32 NumBits = 0;
+			while ((CodeNum >> NumBits) > 1)
+			{
+				NumBits++;
+			}
+			WriteBits(0, NumBits);
+			for (int32 Bit = NumBits; Bit >= 0; --Bit)
+			{
+				WriteBit(static_cast<uint32>((CodeNum >> Bit) & 1));
+			}
+		}
+
+		void WriteSe(int32 Value)
+		{
+			WriteUe(Value > 0 ? static_cast<uint32>(Value) * 2 - 1 : static_cast<uint32>(-Value) * 2);
+		}
+
+		// rbsp_trailing_bits and emulation prevention, appended to Out as a NAL unit with a start code
+		void FinishNal(uint8 Header, std::vector<uint8>& Out)
+		{
+			FinishNal(&Header, 1, Out);
+		}
+
+		// same for the 2 byte NAL unit header of HEVC
+		void FinishNal(uint8 Header0, uint8 Header1, std::vector<uint8>& Out)
+		{
+			const uint8 Header[] = { Header0, Header1 };
+			FinishNal(Header, sizeof(Header), Out);
+		}
+
+	private:
+		void FinishNal(const uint8* Header, uint32 HeaderSize, std::vector<uint8>& Out)
+		{
+			WriteBit(1);
+			while (BitCount % 8)
+			{
+				WriteBit(0);
+			}
+
+			static const uint8 StartCode[] = { 0, 0, 0, 1 };
+			Out.insert(Out.end(), StartCode, StartCode + sizeof(StartCode));
+			Out.insert(Out.end(), Header, Header + HeaderSize);
+			int32 Zeros = 0;
+			for (uint8 Byte : Bytes)
+			{
+				if (Zeros == 2 && Byte <= 3)
+				{
+					Out.push_back(3);
+					Zeros = 0;
+				}
+				Out.push_back(Byte);
+				Zeros = Byte == 0 ? Zeros + 1 : 0;
+			}
+		}
+
+		void WriteBit(uint32 Bit)
+		{
+			if (BitCount % 8 == 0)
+			{
+				Bytes.push_back(0);
+			}
+			Bytes.back() |= static_cast<uint8>(Bit << (7 - BitCount % 8));
+			BitCount++;
+		}
+
+		std::vector<uint8>	Bytes;
+		uint32				BitCount = 0;
+	};
+
+	// baseline profile SPS and PPS of the encode size, with start codes
+	std::vector<uint8> MakeSpsPps(uint32 Width, uint32 Height, uint32 Level)
+	{
+		const uint32 WidthInMbs = (Width + 15) / 16;
+		const uint32 HeightInMbs = (Height + 15) / 16;
+		std::vector<uint8> Out;
+
+		FBitWriter Sps;
+		Sps.WriteBits(66, 8);							// profile_idc, baseline
+		Sps.WriteBits(0xC0, 8);							// constraint_set0_flag, constraint_set1_flag
+		Sps.WriteBits(Level ? Level : 51, 8);			// level_idc
+		Sps.WriteUe(0);									// seq_parameter_set_id
+		Sps.WriteUe(0);									// log2_max_frame_num_minus4
+		Sps.WriteUe(2);									// pic_order_cnt_type
+		Sps.WriteUe(1);									// max_num_ref_frames
+		Sps.WriteBits(0, 1);							// gaps_in_frame_num_value_allowed_flag
+		Sps.WriteUe(WidthInMbs - 1);
+		Sps.WriteUe(HeightInMbs - 1);
+		Sps.WriteBits(1, 1);							// frame_mbs_only_flag
+		Sps.WriteBits(1, 1);							// direct_8x8_inference_flag
+		const bool bCrop = WidthInMbs * 16 != Width || HeightInMbs * 16 != Height;
+		Sps.WriteBits(bCrop ? 1 : 0, 1);
+		if (bCrop)
+		{
+			// 4:2:0 crops in units of 2 pixels
+			Sps.WriteUe(0);
+			Sps.WriteUe((WidthInMbs * 16 - Width) / 2);
+			Sps.WriteUe(0);
+			Sps.WriteUe((HeightInMbs * 16 - Height) / 2);
+		}
+		Sps.WriteBits(0, 1);							// vui_parameters_present_flag
+		Sps.FinishNal(0x67, Out);
+
+		FBitWriter Pps;
+		Pps.WriteUe(0);									// pic_parameter_set_id
+		Pps.WriteUe(0);									// seq_parameter_set_id
+		Pps.WriteBits(0, 1);							// entropy_coding_mode_flag, CAVLC
+		Pps.WriteBits(0, 1);							// bottom_field_pic_order_in_frame_present_flag
+		Pps.WriteUe(0);									// num_slice_groups_minus1
+		Pps.WriteUe(0);									// num_ref_idx_l0_default_active_minus1
+		Pps.WriteUe(0);									// num_ref_idx_l1_default_active_minus1
+		Pps.WriteBits(0, 1);							// weighted_pred_flag
+		Pps.WriteBits(0, 2);							// weighted_bipred_idc
+		Pps.WriteSe(0);									// pic_init_qp_minus26
+		Pps.WriteSe(0);									// pic_init_qs_minus26
+		Pps.WriteSe(0);									// chroma_qp_index_offset
+		Pps.WriteBits(1, 1);							// deblocking_filter_control_present_flag
+		Pps.WriteBits(0, 1);							// constrained_intra_pred_flag
+		Pps.WriteBits(0, 1);							// redundant_pic_cnt_present_flag
+		Pps.FinishNal(0x68, Out);
+
+		return Out;
+	}
+
+	// profile_tier_level of HEVC without sub-layers, Main or Main10 at the main tier
+	void WriteProfileTierLevel(FBitWriter& Writer, uint32 ProfileIdc, uint32 Level)
+	{
+		Writer.WriteBits(0, 2);							// general_profile_space
+		Writer.WriteBits(0, 1);							// general_tier_flag, main
+		Writer.WriteBits(ProfileIdc, 5);				// general_profile_idc
+		// general_profile_compatibility_flag[32], a Main stream is decodable by Main10 decoders too
+		Writer.WriteBits(1u << (31 - ProfileIdc) | (ProfileIdc == 1 ? 1u << (31 - 2) : 0), 32);
+		Writer.WriteBits(1, 1);							// general_progressive_source_flag
+		Writer.WriteBits(0, 1);							// general_interlaced_source_flag
+		Writer.WriteBits(0, 1);							// general_non_packed_constraint_flag
+		Writer.WriteBits(1, 1);							// general_frame_only_constraint_flag
+		Writer.WriteBits(0, 32);						// general_reserved_zero_43bits
+		Writer.WriteBits(0, 11);
+		Writer.WriteBits(0, 1);							// general_inbld_flag
+		Writer.WriteBits(Level ? Level : static_cast<uint32>(NV_ENC_LEVEL_HEVC_51), 8);	// general_level_idc
+	}
+
+	// HEVC VPS, SPS and PPS of the encode size, with start codes. Main profile, or Main10 for a bit depth of 10
+	std::vector<uint8> MakeVpsSpsPps(uint32 Width, uint32 Height, uint32 Level, uint32 BitDepthMinus8, bool bLtr)
+	{
+		const uint32 ProfileIdc = BitDepthMinus8 ? 2 : 1;
+		// picture sizes are multiples of the 8x8 minimum coding block, the conformance window crops the rest
+		const uint32 AlignedWidth = (Width + 7) & ~7u;
+		const uint32 AlignedHeight = (Height + 7) & ~7u;
+		std::vector<uint8> Out;
+
+		FBitWriter Vps;
+		Vps.WriteBits(0, 4);							// vps_video_parameter_set_id
+		Vps.WriteBits(1, 1);							// vps_base_layer_internal_flag
+		Vps.WriteBits(1, 1);							// vps_base_layer_available_flag
+		Vps.WriteBits(0, 6);							// vps_max_layers_minus1
+		Vps.WriteBits(0, 3);							// vps_max_sub_layers_minus1
+		Vps.WriteBits(1, 1);							// vps_temporal_id_nesting_flag
+		Vps.WriteBits(0xFFFF, 16);						// vps_reserved_0xffff_16bits
+		WriteProfileTierLevel(Vps, ProfileIdc, Level);
+		Vps.WriteBits(1, 1);							// vps_sub_layer_ordering_info_present_flag
+		Vps.WriteUe(1);									// vps_max_dec_pic_buffering_minus1
+		Vps.WriteUe(0);									// vps_max_num_reorder_pics
+		Vps.WriteUe(0);									// vps_max_latency_increase_plus1
+		Vps.WriteBits(0, 6);							// vps_max_layer_id
+		Vps.WriteUe(0);									// vps_num_layer_sets_minus1
+		Vps.WriteBits(0, 1);							// vps_timing_info_present_flag
+		Vps.WriteBits(0, 1);							// vps_extension_flag
+		Vps.FinishNal(0x40, 0x01, Out);
+
+		FBitWriter Sps;
+		Sps.WriteBits(0, 4);							// sps_video_parameter_set_id
+		Sps.WriteBits(0, 3);							// sps_max_sub_layers_minus1
+		Sps.WriteBits(1, 1);							// sps_temporal_id_nesting_flag
+		WriteProfileTierLevel(Sps, ProfileIdc, Level);
+		Sps.WriteUe(0);									// sps_seq_parameter_set_id
+		Sps.WriteUe(1);									// chroma_format_idc, 4:2:0
+		Sps.WriteUe(AlignedWidth);						// pic_width_in_luma_samples
+		Sps.WriteUe(AlignedHeight);						// pic_height_in_luma_samples
+		const bool bCrop = AlignedWidth != Width || AlignedHeight != Height;
+		Sps.WriteBits(bCrop ? 1 : 0, 1);				// conformance_window_flag
+		if (bCrop)
+		{
+			// 4:2:0 crops in units of 2 pixels
+			Sps.WriteUe(0);
+			Sps.WriteUe((AlignedWidth - Width) / 2);
+			Sps.WriteUe(0);
+			Sps.WriteUe((AlignedHeight - Height) / 2);
+		}
+		Sps.WriteUe(BitDepthMinus8);					// bit_depth_luma_minus8
+		Sps.WriteUe(BitDepthMinus8);					// bit_depth_chroma_minus8
+		Sps.WriteUe(4);									// log2_max_pic_order_cnt_lsb_minus4
+		Sps.WriteBits(1, 1);							// sps_sub_layer_ordering_info_present_flag
+		Sps.WriteUe(1);									// sps_max_dec_pic_buffering_minus1
+		Sps.WriteUe(0);									// sps_max_num_reorder_pics
+		Sps.WriteUe(0);									// sps_max_latency_increase_plus1
+		Sps.WriteUe(0);									// log2_min_luma_coding_block_size_minus3, 8x8
+		Sps.WriteUe(2);									// log2_diff_max_min_luma_coding_block_size, 32x32
+		Sps.WriteUe(0);									// log2_min_luma_transform_block_size_minus2
+		Sps.WriteUe(3);									// log2_diff_max_min_luma_transform_block_size
+		Sps.WriteUe(0);									// max_transform_hierarchy_depth_inter
+		Sps.WriteUe(0);									// max_transform_hierarchy_depth_intra
+		Sps.WriteBits(0, 1);							// scaling_list_enabled_flag
+		Sps.WriteBits(0, 1);							// amp_enabled_flag
+		Sps.WriteBits(0, 1);							// sample_adaptive_offset_enabled_flag
+		Sps.WriteBits(0, 1);							// pcm_enabled_flag
+		Sps.WriteUe(1);									// num_short_term_ref_pic_sets
+		Sps.WriteUe(1);									// num_negative_pics, the previous picture
+		Sps.WriteUe(0);									// num_positive_pics
+		Sps.WriteUe(0);									// delta_poc_s0_minus1
+		Sps.WriteBits(1, 1);							// used_by_curr_pic_s0_flag
+		Sps.WriteBits(bLtr ? 1 : 0, 1);					// long_term_ref_pics_present_flag
+		if (bLtr)
+		{
+			Sps.WriteUe(0);								// num_long_term_ref_pics_sps, signalled in slice headers
+		}
+		Sps.WriteBits(0, 1);							// sps_temporal_mvp_enabled_flag
+		Sps.WriteBits(0, 1);							// strong_intra_smoothing_enabled_flag
+		Sps.WriteBits(0, 1);							// vui_parameters_present_flag
+		Sps.WriteBits(0, 1);							// sps_extension_present_flag
+		Sps.FinishNal(0x42, 0x01, Out);
+
+		FBitWriter Pps;
+		Pps.WriteUe(0);									// pps_pic_parameter_set_id
+		Pps.WriteUe(0);									// pps_seq_parameter_set_id
+		Pps.WriteBits(0, 1);							// dependent_slice_segments_enabled_flag
+		Pps.WriteBits(0, 1);							// output_flag_present_flag
+		Pps.WriteBits(0, 3);							// num_extra_slice_header_bits
+		Pps.WriteBits(0, 1);							// sign_data_hiding_enabled_flag
+		Pps.WriteBits(0, 1);							// cabac_init_present_flag
+		Pps.WriteUe(0);									// num_ref_idx_l0_default_active_minus1
+		Pps.WriteUe(0);									// num_ref_idx_l1_default_active_minus1
+		Pps.WriteSe(0);									// init_qp_minus26
+		Pps.WriteBits(0, 1);							// constrained_intra_pred_flag
+		Pps.WriteBits(0, 1);							// transform_skip_enabled_flag
+		Pps.WriteBits(0, 1);							// cu_qp_delta_enabled_flag
+		Pps.WriteSe(0);									// pps_cb_qp_offset
+		Pps.WriteSe(0);									// pps_cr_qp_offset
+		Pps.WriteBits(0, 1);							// pps_slice_chroma_qp_offsets_present_flag
+		Pps.WriteBits(0, 1);							// weighted_pred_flag
+		Pps.WriteBits(0, 1);							// weighted_bipred_flag
+		Pps.WriteBits(0, 1);							// transquant_bypass_enabled_flag
+		Pps.WriteBits(0, 1);							// tiles_enabled_flag
+		Pps.WriteBits(0, 1);							// entropy_coding_sync_enabled_flag
+		Pps.WriteBits(1, 1);							// pps_loop_filter_across_slices_enabled_flag
+		Pps.WriteBits(0, 1);							// deblocking_filter_control_present_flag
+		Pps.WriteBits(0, 1);							// pps_scaling_list_data_present_flag
+		Pps.WriteBits(0, 1);							// lists_modification_present_flag
+		Pps.WriteUe(0);									// log2_parallel_merge_level_minus2
+		Pps.WriteBits(0, 1);							// slice_segment_header_extension_present_flag
+		Pps.WriteBits(0, 1);							// pps_extension_present_flag
+		Pps.FinishNal(0x44, 0x01, Out);
+
+		return Out;
+	}
+
+	bool IsHevcGuid(const GUID& EncodeGuid)
+	{
+		return std::memcmp(&EncodeGuid, &NV_ENC_CODEC_HEVC_GUID, sizeof(GUID)) == 0;
+	}
+
+	struct FAccessUnit
+	{
+		std::vector<uint8>	Data;
+		bool				bIdr = false;
+	};
+
+	// NVENC_STUB_BITSTREAM split into access units, plus its first SPS and PPS
+	struct FCannedBitstream
+	{
+		std::vector<FAccessUnit>	AccessUnits;
+		std::vector<uint8>			SpsPps;
+
+		FCannedBitstream()
+		{
+			const char* Path = std::getenv("NVENC_STUB_BITSTREAM");
+			if (!Path || !*Path)
+			{
+				return;
+			}
+
+			std::vector<uint8> File;
+			if (FILE* Handle = std::fopen(Path, "rb"))
+			{
+				uint8 Chunk[65536];
+				size_t Read;
+				while ((Read = std::fread(Chunk, 1, sizeof(Chunk), Handle)) > 0)
+				{
+					File.insert(File.end(), Chunk, Chunk + Read);
+				}
+				std::fclose(Handle);
+			}
+			else
+			{
+				std::fprintf(stderr, "NvEncStub: can't open NVENC_STUB_BITSTREAM %s, using synthetic frames\n", Path);
+				return;
+			}
+
+			// NAL units start at 00 00 01, a 4 byte start code's leading zero ends up at the end of the previous one
+			std::vector<size_t> Starts;
+			for (size_t Pos = 0; Pos + 3 <= File.size(); ++Pos)
+			{
+				if (File[Pos] == 0 && File[Pos + 1] == 0 && File[Pos + 2] == 1)
+				{
+					Starts.push_back(Pos);
+					Pos += 2;
+				}
+			}
+
+			bool bPreviousVcl = false;
+			for (size_t Index = 0; Index < Starts.size(); ++Index)
+			{
+				const size_t Begin = Starts[Index];
+				size_t End = Index + 1 < Starts.size() ? Starts[Index + 1] : File.size();
+				while (End > Begin + 3 && File[End - 1] == 0)
+				{
+					End--;
+				}
+				if (End <= Begin + 3)
+				{
+					continue;
+				}
+
+				const uint8 Type = File[Begin + 3] & 0x1F;
+				const bool bVcl = Type == 1 || Type == 5;
+				const bool bFirstSlice = bVcl && End > Begin + 4 && (File[Begin + 4] & 0x80);		// first_mb_in_slice == 0
+				if (AccessUnits.empty() || (bPreviousVcl && (!bVcl || bFirstSlice)))
+				{
+					AccessUnits.emplace_back();
+				}
+				bPreviousVcl = bVcl;
+
+				static const uint8 StartCode[] = { 0, 0, 0, 1 };
+				FAccessUnit& AccessUnit = AccessUnits.back();
+				AccessUnit.Data.insert(AccessUnit.Data.end(), StartCode, StartCode + sizeof(StartCode));
+				AccessUnit.Data.insert(AccessUnit.Data.end(), File.begin() + Begin + 3, File.begin() + End);
+				AccessUnit.bIdr |= Type == 5;
+
+				if ((Type == 7 && SpsPps.empty()) || (Type == 8 && !SpsPps.empty() && SpsPps.size() == SpsSize))
+				{
+					SpsPps.insert(SpsPps.end(), StartCode, StartCode + sizeof(StartCode));
+					SpsPps.insert(SpsPps.end(), File.begin() + Begin + 3, File.begin() + End);
+					SpsSize = Type == 7 ? SpsPps.size() : 0;
+				}
+			}
+
+			if (AccessUnits.empty())
+			{
+				std::fprintf(stderr, "NvEncStub: no NAL units in NVENC_STUB_BITSTREAM %s, using synthetic frames\n", Path);
+			}
+		}
+
+	private:
+		size_t	SpsSize = 0;
+	};
+
+	const FCannedBitstream& GetCannedBitstream()
+	{
+		static FCannedBitstream CannedBitstream;
+		return CannedBitstream;
+	}
+
+	std::atomic<uint32> NumOpenSessions(0);
+
+	struct FResource
+	{
+		uint32					Width = 0;
+		uint32					Height = 0;
+		NV_ENC_BUFFER_FORMAT	BufferFormat = NV_ENC_BUFFER_FORMAT_UNDEFINED;
+		bool					bMapped = false;
+	};
+
+	struct FBitstreamBuffer
+	{
+		std::vector<uint8>	Data;					// sized to the requested capacity
+		uint32				Size = 0;
+		bool				bPending = false;		// submitted, not encoded yet
+		bool				bLocked = false;
+		NV_ENC_PIC_TYPE		PictureType = NV_ENC_PIC_TYPE_P;
+		bool				bLtrFrame = false;			// marked as long-term reference
+		uint32				LtrFrameIdx = 0;
+		uint32				LtrFrameBitmap = 0;			// long-term references the frame was predicted from
+		uint32				FrameIdx = 0;
+		uint64				InputTimeStamp = 0;
+		std::vector<uint32>	SliceEnds;				// end of each slice, the first one includes the parameter sets
+		uint32				WrittenSlices = 0;		// all of them once encoded
+	};
+
+	struct FJob
+	{
+		FBitstreamBuffer*	Buffer;
+		void*				CompletionEvent;
+	};
+
+	struct FEncoder
+	{
+		std::mutex					Mutex;
+		std::condition_variable		Cond;				// jobs queued or completed
+		std::deque<FJob>			Jobs;
+		std::thread					Worker;
+		bool						bExit = false;
+		uint32						LatencyMs = 0;
+
+		bool						bInitialized = false;
+		NV_ENC_INITIALIZE_PARAMS	InitializeParams;
+		NV_ENC_CONFIG				Config;
+		bool						bForceIdr = true;	// the first frame is an IDR frame
+		uint32						FramesSinceIdr = 0;
+		uint32						FrameCount = 0;
+		size_t						NextAccessUnit = 0;
+		bool						bReferenceInvalid = false;	// the previous frame was invalidated, P-frames can't use it
+		uint64						LastTimeStamp = 0;			// inputTimeStamp of the previous frame
+		uint64						LtrTimeStamps[32];
+		uint32						LtrValidMask = 0;			// bit per long-term reference index
+
+		std::set<FResource*>		Resources;
+		std::set<FBitstreamBuffer*>	BitstreamBuffers;
+		std::set<void*>				Events;
+
+		void WorkerLoop()
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			while (true)
+			{
+				Cond.wait(Lock, [this]() { return bExit || !Jobs.empty(); });
+				if (bExit)
+				{
+					return;
+				}
+
+				// sub-frame writes spread the slices over the latency, otherwise they show up together at the end
+				const FJob Job = Jobs.front();
+				const uint32 NumSlices = static_cast<uint32>(Job.Buffer->SliceEnds.size());
+				const uint32 Steps = InitializeParams.enableSubFrameWrite ? std::max<uint32>(NumSlices, 1) : 1;
+				for (uint32 Step = 1; Step <= Steps; ++Step)
+				{
+					if (LatencyMs)
+					{
+						Lock.unlock();
+						std::this_thread::sleep_for(std::chrono::microseconds(LatencyMs * 1000ull * Step / Steps - LatencyMs * 1000ull * (Step - 1) / Steps));
+						Lock.lock();
+					}
+					Job.Buffer->WrittenSlices = Step * NumSlices / Steps;
+					Cond.notify_all();
+				}
+				Jobs.pop_front();
+				Job.Buffer->bPending = false;
+#if defined(_WIN32)
+				if (Job.CompletionEvent)
+				{
+					SetEvent(Job.CompletionEvent);
+				}
+#endif
+				Cond.notify_all();
+			}
+		}
+
+		bool IsHevc() const
+		{
+			return IsHevcGuid(InitializeParams.encodeGUID);
+		}
+
+		uint32 GetIdrPeriod() const
+		{
+			const uint32 IdrPeriod = IsHevc() ? Config.encodeCodecConfig.hevcConfig.idrPeriod : Config.encodeCodecConfig.h264Config.idrPeriod;
+			return IdrPeriod ? IdrPeriod : Config.gopLength;
+		}
+
+		// the SPS and PPS, or the VPS, SPS and PPS, the session's frames refer to
+		std::vector<uint8> MakeParameterSets() const
+		{
+			if (IsHevc())
+			{
+				const NV_ENC_CONFIG_HEVC& HevcConfig = Config.encodeCodecConfig.hevcConfig;
+				return MakeVpsSpsPps(InitializeParams.encodeWidth, InitializeParams.encodeHeight, HevcConfig.level, HevcConfig.pixelBitDepthMinus8, HevcConfig.enableLTR != 0);
+			}
+			return MakeSpsPps(InitializeParams.encodeWidth, InitializeParams.encodeHeight, Config.encodeCodecConfig.h264Config.level);
+		}
+
+		// fills the buffer with the next frame, under Mutex
+		void MakeFrame(FBitstreamBuffer& Buffer, const NV_ENC_PIC_PARAMS& Params)
+		{
+			Buffer.bLtrFrame = false;
+			Buffer.LtrFrameIdx = 0;
+			Buffer.LtrFrameBitmap = 0;
+
+			const FCannedBitstream& Canned = GetCannedBitstream();
+			const bool bHevc = IsHevc();
+			if (!Canned.AccessUnits.empty() && !bHevc)
+			{
+				const FAccessUnit& AccessUnit = Canned.AccessUnits[NextAccessUnit];
+				NextAccessUnit = (NextAccessUnit + 1) % Canned.AccessUnits.size();
+				Buffer.Size = static_cast<uint32>(std::min(AccessUnit.Data.size(), Buffer.Data.size()));
+				std::memcpy(Buffer.Data.data(), AccessUnit.Data.data(), Buffer.Size);
+				Buffer.PictureType = AccessUnit.bIdr ? NV_ENC_PIC_TYPE_IDR : NV_ENC_PIC_TYPE_P;
+				Buffer.SliceEnds.assign(1, Buffer.Size);
+				return;
+			}
+
+			// a frame predicted from long-term references the client asked for, or an IDR frame if the encoder has
+			// nothing valid left to predict from
+			const NV_ENC_PIC_PARAMS_H264& H264Params = Params.codecPicParams.h264PicParams;
+			const NV_ENC_PIC_PARAMS_HEVC& HevcParams = Params.codecPicParams.hevcPicParams;
+			const bool bLtrUse = bHevc ? HevcParams.ltrUseFrames : H264Params.ltrUseFrames;
+			const uint32 LtrUseFrameBitmap = bHevc ? HevcParams.ltrUseFrameBitmap : H264Params.ltrUseFrameBitmap;
+			const bool bLtrMark = bHevc ? HevcParams.ltrMarkFrame : H264Params.ltrMarkFrame;
+			const uint32 LtrMarkFrameIdx = bHevc ? HevcParams.ltrMarkFrameIdx : H264Params.ltrMarkFrameIdx;
+			const bool bLtrEnabled = bHevc ? Config.encodeCodecConfig.hevcConfig.enableLTR : Config.encodeCodecConfig.h264Config.enableLTR;
+			const uint32 LtrUseMask = bLtrUse ? (LtrUseFrameBitmap & LtrValidMask) : 0;
+			const uint32 IdrPeriod = GetIdrPeriod();
+			const bool bIdr = (Params.encodePicFlags & NV_ENC_PIC_FLAG_FORCEIDR) || bForceIdr || (bReferenceInvalid && !LtrUseMask)
+				|| (IdrPeriod != NVENC_INFINITE_GOPLENGTH && IdrPeriod && FramesSinceIdr >= IdrPeriod);
+			bForceIdr = false;
+			bReferenceInvalid = false;
+			FramesSinceIdr = bIdr ? 1 : FramesSinceIdr + 1;
+			LastTimeStamp = Params.inputTimeStamp;
+
+			if (bIdr)
+			{
+				LtrValidMask = 0;
+			}
+			else
+			{
+				Buffer.LtrFrameBitmap = LtrUseMask;
+			}
+			if (bLtrEnabled && bLtrMark && LtrMarkFrameIdx < 32)
+			{
+				LtrTimeStamps[LtrMarkFrameIdx] = Params.inputTimeStamp;
+				LtrValidMask |= 1u << LtrMarkFrameIdx;
+				Buffer.bLtrFrame = true;
+				Buffer.LtrFrameIdx = LtrMarkFrameIdx;
+			}
+
+			std::vector<uint8> Frame;
+			const bool bRepeatParameterSets = bHevc ? Config.encodeCodecConfig.hevcConfig.repeatSPSPPS : Config.encodeCodecConfig.h264Config.repeatSPSPPS;
+			if (bIdr && bRepeatParameterSets)
+			{
+				Frame = MakeParameterSets();
+			}
+
+			static const uint8 StartCode[] = { 0, 0, 0, 1 };
+			const uint8 NumLayers = !bHevc && Config.encodeCodecConfig.h264Config.enableTemporalSVC
+				? static_cast<uint8>(Config.encodeCodecConfig.h264Config.numTemporalLayers) : 1;
+			const uint8 Layer = GetTemporalLayer(FramesSinceIdr - 1, NumLayers);
+			const bool bReference = Layer + 1 < NumLayers || NumLayers == 1;
+
+			// filler slices of the frame's share of the bitrate, or of a size halving every 6 QP steps in constant QP mode.
+			// IDR frames are a few times larger and frames predicted from an old long-term reference a bit larger, unless
+			// the VBV buffer is too small for that
+			const NV_ENC_RC_PARAMS& RcParams = Config.rcParams;
+			const uint32 FrameRate = std::max<uint32>(InitializeParams.frameRateNum / std::max<uint32>(InitializeParams.frameRateDen, 1), 1);
+			uint32 FillerSize = std::max<uint32>(RcParams.averageBitRate / FrameRate / 8, 16);
+			if (RcParams.rateControlMode == NV_ENC_PARAMS_RC_CONSTQP)
+			{
+				const uint32 Pixels = InitializeParams.encodeWidth * InitializeParams.encodeHeight;
+				FillerSize = std::max<uint32>((Pixels / 8) >> std::min<uint32>(RcParams.constQP.qpInterP / 6, 31), 16);
+			}
+			FillerSize = bIdr ? FillerSize * 4 : (Buffer.LtrFrameBitmap ? FillerSize * 3 / 2 : FillerSize);
+			if (RcParams.rateControlMode != NV_ENC_PARAMS_RC_CONSTQP && RcParams.vbvBufferSize)
+			{
+				FillerSize = std::min(FillerSize, std::max<uint32>(RcParams.vbvBufferSize / 8, 16));
+			}
+
+			// byte based slices are at most sliceModeData bytes, their NAL unit header and slice header included
+			const uint32 SliceMode = bHevc ? Config.encodeCodecConfig.hevcConfig.sliceMode : Config.encodeCodecConfig.h264Config.sliceMode;
+			const uint32 SliceModeData = bHevc ? Config.encodeCodecConfig.hevcConfig.sliceModeData : Config.encodeCodecConfig.h264Config.sliceModeData;
+			const uint32 SliceHeaderSize = bHevc ? 3 : 2;
+			const uint32 MaxSlicePayload = SliceMode == 1 && SliceModeData > SliceHeaderSize ? SliceModeData - SliceHeaderSize : FillerSize;
+			Buffer.SliceEnds.clear();
+			for (uint32 Remaining = FillerSize; Remaining; )
+			{
+				const bool bFirstSlice = Buffer.SliceEnds.empty();
+				if (NumLayers > 1)
+				{
+					// prefix NAL unit, nal_unit_header_svc_extension with the dependency and quality ids at 0
+					Frame.insert(Frame.end(), StartCode, StartCode + sizeof(StartCode));
+					Frame.push_back(bReference ? 0x6E : 0x0E);
+					Frame.push_back(bIdr ? 0xC0 : 0x80);	// svc_extension_flag, idr_flag, priority_id 0
+					Frame.push_back(0x80);					// no_inter_layer_pred_flag
+					Frame.push_back(static_cast<uint8>(Layer << 5 | 0x07));	// temporal_id, output_flag, reserved_three_2bits
+				}
+
+				Frame.insert(Frame.end(), StartCode, StartCode + sizeof(StartCode));
+				if (bHevc)
+				{
+					Frame.push_back(bIdr ? 0x26 : 0x02);	// IDR_W_RADL or TRAIL_R
+					Frame.push_back(0x01);					// nuh_layer_id 0, nuh_temporal_id_plus1 1
+					Frame.push_back(bFirstSlice ? 0x80 : 0x00);	// first_slice_segment_in_pic_flag
+				}
+				else
+				{
+					Frame.push_back(bIdr ? 0x65 : (bReference ? 0x41 : 0x01));
+					Frame.push_back(0x88);					// first_mb_in_slice, 0 for every slice of the filler
+				}
+				const uint32 PayloadSize = std::min(Remaining, MaxSlicePayload);
+				Frame.resize(Frame.size() + PayloadSize, 0xAA);
+				Remaining -= PayloadSize;
+				Buffer.SliceEnds.push_back(static_cast<uint32>(std::min(Frame.size(), Buffer.Data.size())));
+			}
+
+			Buffer.Size = static_cast<uint32>(std::min(Frame.size(), Buffer.Data.size()));
+			std::memcpy(Buffer.Data.data(), Frame.data(), Buffer.Size);
+			Buffer.PictureType = bIdr ? NV_ENC_PIC_TYPE_IDR : NV_ENC_PIC_TYPE_P;
+		}
+	};
+
+	FEncoder* ToEncoder(void* Encoder)
+	{
+		return static_cast<FEncoder*>(Encoder);
+	}
+
+	NVENCSTATUS NVENCAPI StubOpenEncodeSessionEx(NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS* Params, void** OutEncoder)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncOpenEncodeSessionEx);
+		if (!Params || !OutEncoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (Params->apiVersion != NVENCAPI_VERSION)
+		{
+			return NV_ENC_ERR_INVALID_VERSION;
+		}
+
+		const uint32 MaxSessions = GetEnvUInt("NVENC_STUB_MAX_SESSIONS", 0);
+		if (MaxSessions && ++NumOpenSessions > MaxSessions)
+		{
+			NumOpenSessions--;
+			return NV_ENC_ERR_OUT_OF_MEMORY;
+		}
+		else if (!MaxSessions)
+		{
+			NumOpenSessions++;
+		}
+
+		FEncoder* Encoder = new FEncoder;
+		Zero(Encoder->InitializeParams);
+		Zero(Encoder->Config);
+		Encoder->LatencyMs = GetEnvUInt("NVENC_STUB_LATENCY_MS", 0);
+		*OutEncoder = Encoder;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubGetEncodeCaps(void* Encoder, GUID, NV_ENC_CAPS_PARAM* CapsParam, int* CapsValue)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncGetEncodeCaps);
+		if (!Encoder || !CapsParam || !CapsValue)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		switch (CapsParam->capsToQuery)
+		{
+		case NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT:
+#if defined(_WIN32)
+			*CapsValue = 1;
+#else
+			*CapsValue = 0;
+#endif
+			break;
+		case NV_ENC_CAPS_WIDTH_MAX:
+		case NV_ENC_CAPS_HEIGHT_MAX:
+			*CapsValue = 4096;
+			break;
+		case NV_ENC_CAPS_NUM_MAX_TEMPORAL_LAYERS:
+			*CapsValue = MaxTemporalLayers;
+			break;
+		case NV_ENC_CAPS_SUPPORTED_RATECONTROL_MODES:
+			*CapsValue = NV_ENC_PARAMS_RC_VBR | NV_ENC_PARAMS_RC_CBR | NV_ENC_PARAMS_RC_VBR_MINQP | NV_ENC_PARAMS_RC_2_PASS_QUALITY
+				| NV_ENC_PARAMS_RC_2_PASS_FRAMESIZE_CAP | NV_ENC_PARAMS_RC_2_PASS_VBR;
+			break;
+		default:
+			*CapsValue = 1;
+			break;
+		}
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubGetEncodePresetConfig(void* Encoder, GUID EncodeGuid, GUID, NV_ENC_PRESET_CONFIG* PresetConfig)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncGetEncodePresetConfig);
+		if (!Encoder || !PresetConfig)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		NV_ENC_CONFIG& Config = PresetConfig->presetCfg;
+		Config.gopLength = 30;
+		Config.frameIntervalP = 1;
+		Config.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
+		Config.rcParams.averageBitRate = 5000000;
+		if (IsHevcGuid(EncodeGuid))
+		{
+			Config.encodeCodecConfig.hevcConfig.idrPeriod = 30;
+			Config.encodeCodecConfig.hevcConfig.level = NV_ENC_LEVEL_AUTOSELECT;
+			Config.encodeCodecConfig.hevcConfig.chromaFormatIDC = 1;
+		}
+		else
+		{
+			Config.encodeCodecConfig.h264Config.idrPeriod = 30;
+			Config.encodeCodecConfig.h264Config.level = NV_ENC_LEVEL_AUTOSELECT;
+		}
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubInitializeEncoder(void* InEncoder, NV_ENC_INITIALIZE_PARAMS* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncInitializeEncoder);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params || !Params->encodeConfig)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (Encoder->bInitialized)
+		{
+			return NV_ENC_ERR_INVALID_CALL;
+		}
+		if (!Params->encodeWidth || !Params->encodeHeight || Params->encodeWidth > 4096 || Params->encodeHeight > 4096)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		const bool bHevc = IsHevcGuid(Params->encodeGUID);
+		if (!bHevc && std::memcmp(&Params->encodeGUID, &NV_ENC_CODEC_H264_GUID, sizeof(GUID)) != 0)
+		{
+			return NV_ENC_ERR_UNSUPPORTED_PARAM;
+		}
+		const NV_ENC_CONFIG_H264& H264Config = Params->encodeConfig->encodeCodecConfig.h264Config;
+		if (!bHevc && H264Config.enableTemporalSVC && (!H264Config.numTemporalLayers || H264Config.numTemporalLayers > MaxTemporalLayers))
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+#if !defined(_WIN32)
+		if (Params->enableEncodeAsync)
+		{
+			return NV_ENC_ERR_UNSUPPORTED_PARAM;
+		}
+#endif
+		if (Params->reportSliceOffsets && Params->enableEncodeAsync)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+
+		Encoder->InitializeParams = *Params;
+		Encoder->Config = *Params->encodeConfig;
+		Encoder->InitializeParams.encodeConfig = &Encoder->Config;
+		Encoder->bInitialized = true;
+		Encoder->Worker = std::thread([Encoder]() { Encoder->WorkerLoop(); });
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubReconfigureEncoder(void* InEncoder, NV_ENC_RECONFIGURE_PARAMS* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncReconfigureEncoder);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (!Encoder->bInitialized)
+		{
+			return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+		}
+
+		const NV_ENC_INITIALIZE_PARAMS& NewParams = Params->reInitEncodeParams;
+		if (NewParams.encodeWidth > Encoder->InitializeParams.maxEncodeWidth || NewParams.encodeHeight > Encoder->InitializeParams.maxEncodeHeight)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		const bool bResolutionChanged = NewParams.encodeWidth != Encoder->InitializeParams.encodeWidth || NewParams.encodeHeight != Encoder->InitializeParams.encodeHeight;
+		if (NewParams.encodeConfig)
+		{
+			Encoder->Config = *NewParams.encodeConfig;
+		}
+		Encoder->InitializeParams = NewParams;
+		Encoder->InitializeParams.encodeConfig = &Encoder->Config;
+		Encoder->bForceIdr |= bResolutionChanged || Params->forceIDR;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubGetSequenceParams(void* InEncoder, NV_ENC_SEQUENCE_PARAM_PAYLOAD* Payload)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncGetSequenceParams);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Payload || !Payload->spsppsBuffer || !Payload->outSPSPPSPayloadSize)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (!Encoder->bInitialized)
+		{
+			return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+		}
+
+		const FCannedBitstream& Canned = GetCannedBitstream();
+		const std::vector<uint8> SpsPps = !Canned.SpsPps.empty() && !Encoder->IsHevc() ? Canned.SpsPps : Encoder->MakeParameterSets();
+		if (SpsPps.size() > Payload->inBufferSize)
+		{
+			return NV_ENC_ERR_NOT_ENOUGH_BUFFER;
+		}
+
+		std::memcpy(Payload->spsppsBuffer, SpsPps.data(), SpsPps.size());
+		*Payload->outSPSPPSPayloadSize = static_cast<uint32>(SpsPps.size());
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubRegisterAsyncEvent(void* InEncoder, NV_ENC_EVENT_PARAMS* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncRegisterAsyncEvent);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params || !Params->completionEvent)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		Encoder->Events.insert(Params->completionEvent);
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubUnregisterAsyncEvent(void* InEncoder, NV_ENC_EVENT_PARAMS* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncUnregisterAsyncEvent);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		return Encoder->Events.erase(Params->completionEvent) ? NV_ENC_SUCCESS : NV_ENC_ERR_INVALID_PARAM;
+	}
+
+	NVENCSTATUS NVENCAPI StubCreateBitstreamBuffer(void* InEncoder, NV_ENC_CREATE_BITSTREAM_BUFFER* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncCreateBitstreamBuffer);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (!Params->size)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+
+		FBitstreamBuffer* Buffer = new FBitstreamBuffer;
+		Buffer->Data.resize(Params->size);
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		Encoder->BitstreamBuffers.insert(Buffer);
+		Params->bitstreamBuffer = Buffer;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubDestroyBitstreamBuffer(void* InEncoder, NV_ENC_OUTPUT_PTR BitstreamBuffer)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncDestroyBitstreamBuffer);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::unique_lock<std::mutex> Lock(Encoder->Mutex);
+		FBitstreamBuffer* Buffer = static_cast<FBitstreamBuffer*>(BitstreamBuffer);
+		if (!Encoder->BitstreamBuffers.count(Buffer))
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		Encoder->Cond.wait(Lock, [Buffer]() { return !Buffer->bPending; });
+		Encoder->BitstreamBuffers.erase(Buffer);
+		delete Buffer;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubRegisterResource(void* InEncoder, NV_ENC_REGISTER_RESOURCE* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncRegisterResource);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params || !Params->resourceToRegister)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (!Params->width || !Params->height || Params->bufferFormat == NV_ENC_BUFFER_FORMAT_UNDEFINED)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+
+		FResource* Resource = new FResource;
+		Resource->Width = Params->width;
+		Resource->Height = Params->height;
+		Resource->BufferFormat = Params->bufferFormat;
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		Encoder->Resources.insert(Resource);
+		Params->registeredResource = Resource;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubUnregisterResource(void* InEncoder, NV_ENC_REGISTERED_PTR RegisteredResource)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncUnregisterResource);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		FResource* Resource = static_cast<FResource*>(RegisteredResource);
+		if (!Encoder->Resources.count(Resource) || Resource->bMapped)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		Encoder->Resources.erase(Resource);
+		delete Resource;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubMapInputResource(void* InEncoder, NV_ENC_MAP_INPUT_RESOURCE* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncMapInputResource);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		FResource* Resource = static_cast<FResource*>(Params->registeredResource);
+		if (!Encoder->Resources.count(Resource))
+		{
+			return NV_ENC_ERR_RESOURCE_NOT_REGISTERED;
+		}
+		if (Resource->bMapped)
+		{
+			return NV_ENC_ERR_INVALID_CALL;
+		}
+		Resource->bMapped = true;
+		Params->mappedResource = Resource;
+		Params->mappedBufferFmt = Resource->BufferFormat;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubUnmapInputResource(void* InEncoder, NV_ENC_INPUT_PTR MappedResource)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncUnmapInputResource);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		FResource* Resource = static_cast<FResource*>(MappedResource);
+		if (!Encoder->Resources.count(Resource) || !Resource->bMapped)
+		{
+			return NV_ENC_ERR_RESOURCE_NOT_MAPPED;
+		}
+		Resource->bMapped = false;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubEncodePicture(void* InEncoder, NV_ENC_PIC_PARAMS* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncEncodePicture);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (!Encoder->bInitialized)
+		{
+			return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		FResource* Resource = static_cast<FResource*>(Params->inputBuffer);
+		FBitstreamBuffer* Buffer = static_cast<FBitstreamBuffer*>(Params->outputBitstream);
+		if (!Encoder->Resources.count(Resource) || !Resource->bMapped)
+		{
+			return NV_ENC_ERR_RESOURCE_NOT_MAPPED;
+		}
+		if (!Encoder->BitstreamBuffers.count(Buffer) || Buffer->bPending || Buffer->bLocked)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		if (Params->inputWidth != Encoder->InitializeParams.encodeWidth || Params->inputHeight != Encoder->InitializeParams.encodeHeight
+			|| Resource->Width != Params->inputWidth || Resource->Height != Params->inputHeight)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		if (Encoder->InitializeParams.enableEncodeAsync && !Encoder->Events.count(Params->completionEvent))
+		{
+			return NV_ENC_ERR_INVALID_EVENT;
+		}
+
+		Encoder->MakeFrame(*Buffer, *Params);
+		Buffer->FrameIdx = Encoder->FrameCount++;
+		Buffer->InputTimeStamp = Params->inputTimeStamp;
+		Buffer->bPending = true;
+		Encoder->Jobs.push_back(FJob{ Buffer, Encoder->InitializeParams.enableEncodeAsync ? Params->completionEvent : nullptr });
+		Encoder->Cond.notify_all();
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubInvalidateRefFrames(void* InEncoder, uint64_t InvalidRefFrameTimeStamp)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncInvalidateRefFrames);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		if (!Encoder->bInitialized)
+		{
+			return NV_ENC_ERR_ENCODER_NOT_INITIALIZED;
+		}
+
+		// frames are only predicted from the previous one or from long-term references
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		if (Encoder->FrameCount && InvalidRefFrameTimeStamp == Encoder->LastTimeStamp)
+		{
+			Encoder->bReferenceInvalid = true;
+		}
+		for (uint32 Index = 0; Index < 32; ++Index)
+		{
+			if ((Encoder->LtrValidMask & (1u << Index)) && Encoder->LtrTimeStamps[Index] == InvalidRefFrameTimeStamp)
+			{
+				Encoder->LtrValidMask &= ~(1u << Index);
+			}
+		}
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubLockBitstream(void* InEncoder, NV_ENC_LOCK_BITSTREAM* Params)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncLockBitstream);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder || !Params)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::unique_lock<std::mutex> Lock(Encoder->Mutex);
+		FBitstreamBuffer* Buffer = static_cast<FBitstreamBuffer*>(Params->outputBitstream);
+		if (!Encoder->BitstreamBuffers.count(Buffer) || Buffer->bLocked)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		const NV_ENC_INITIALIZE_PARAMS& InitializeParams = Encoder->InitializeParams;
+		if (InitializeParams.reportSliceOffsets && !Params->sliceOffsets)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+		const bool bPartial = Buffer->bPending && Params->doNotWait && InitializeParams.enableSubFrameWrite && Buffer->WrittenSlices;
+		if (Buffer->bPending && !bPartial)
+		{
+			if (Params->doNotWait)
+			{
+				return NV_ENC_ERR_ENCODER_BUSY;
+			}
+			Encoder->Cond.wait(Lock, [Buffer]() { return !Buffer->bPending; });
+		}
+
+		// hwEncodeStatus 2 once the frame is done, the slices written so far before that
+		const uint32 NumSlices = bPartial ? Buffer->WrittenSlices : static_cast<uint32>(Buffer->SliceEnds.size());
+		if (InitializeParams.reportSliceOffsets)
+		{
+			for (uint32 Slice = 0; Slice < NumSlices; ++Slice)
+			{
+				Params->sliceOffsets[Slice] = Slice ? Buffer->SliceEnds[Slice - 1] : 0;
+			}
+		}
+		Buffer->bLocked = true;
+		Params->hwEncodeStatus = bPartial ? 1 : 2;
+		Params->bitstreamBufferPtr = Buffer->Data.data();
+		Params->bitstreamSizeInBytes = NumSlices ? Buffer->SliceEnds[NumSlices - 1] : Buffer->Size;
+		Params->pictureType = Buffer->PictureType;
+		Params->pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
+		Params->frameIdx = Buffer->FrameIdx;
+		Params->ltrFrame = Buffer->bLtrFrame ? 1 : 0;
+		Params->ltrFrameIdx = Buffer->LtrFrameIdx;
+		Params->ltrFrameBitmap = Buffer->LtrFrameBitmap;
+		Params->outputTimeStamp = Buffer->InputTimeStamp;
+		Params->numSlices = std::max<uint32>(NumSlices, 1);
+		Params->frameAvgQP = 26;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubUnlockBitstream(void* InEncoder, NV_ENC_OUTPUT_PTR BitstreamBuffer)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncUnlockBitstream);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+		FBitstreamBuffer* Buffer = static_cast<FBitstreamBuffer*>(BitstreamBuffer);
+		if (!Encoder->BitstreamBuffers.count(Buffer) || !Buffer->bLocked)
+		{
+			return NV_ENC_ERR_INVALID_PARAM;
+		}
+		Buffer->bLocked = false;
+		return NV_ENC_SUCCESS;
+	}
+
+	NVENCSTATUS NVENCAPI StubDestroyEncoder(void* InEncoder)
+	{
+		NVENC_STUB_INJECT_ERROR(nvEncDestroyEncoder);
+		FEncoder* Encoder = ToEncoder(InEncoder);
+		if (!Encoder)
+		{
+			return NV_ENC_ERR_INVALID_PTR;
+		}
+
+		{
+			std::lock_guard<std::mutex> Lock(Encoder->Mutex);
+			Encoder->bExit = true;
+			Encoder->Cond.notify_all();
+		}
+		if (Encoder->Worker.joinable())
+		{
+			Encoder->Worker.join();
+		}
+
+		// what the client forgot to release, a real driver would leak it with the session
+		if (!Encoder->Resources.empty() || !Encoder->BitstreamBuffers.empty() || !Encoder->Events.empty())
+		{
+			std::fprintf(stderr, "NvEncStub: session destroyed with %u resources, %u bitstream buffers and %u events still registered\n",
+				static_cast<uint32>(Encoder->Resources.size()), static_cast<uint32>(Encoder->BitstreamBuffers.size()), static_cast<uint32>(Encoder->Events.size()));
+		}
+		for (FResource* Resource : Encoder->Resources)
+		{
+			delete Resource;
+		}
+		for (FBitstreamBuffer* Buffer : Encoder->BitstreamBuffers)
+		{
+			delete Buffer;
+		}
+
+		delete Encoder;
+		NumOpenSessions--;
+		return NV_ENC_SUCCESS;
+	}
+}
+
+extern "C" NVENC_STUB_EXPORT NVENCSTATUS NVENCAPI NvEncodeAPICreateInstance(NV_ENCODE_API_FUNCTION_LIST* FunctionList)
+{
+	NVENC_STUB_INJECT_ERROR(NvEncodeAPICreateInstance);
+	if (!FunctionList)
+	{
+		return NV_ENC_ERR_INVALID_PTR;
+	}
+	if (FunctionList->version != NV_ENCODE_API_FUNCTION_LIST_VER)
+	{
+		return NV_ENC_ERR_INVALID_VERSION;
+	}
+
+	// calls the core doesn't make stay null, like entry points of a newer API on an older driver
+	Zero(*FunctionList);
+	FunctionList->version = NV_ENCODE_API_FUNCTION_LIST_VER;
+	FunctionList->nvEncOpenEncodeSessionEx = StubOpenEncodeSessionEx;
+	FunctionList->nvEncGetEncodeCaps = StubGetEncodeCaps;
+	FunctionList->nvEncGetEncodePresetConfig = StubGetEncodePresetConfig;
+	FunctionList->nvEncInitializeEncoder = StubInitializeEncoder;
+	FunctionList->nvEncReconfigureEncoder = StubReconfigureEncoder;
+	FunctionList->nvEncGetSequenceParams = StubGetSequenceParams;
+	FunctionList->nvEncRegisterAsyncEvent = StubRegisterAsyncEvent;
+	FunctionList->nvEncUnregisterAsyncEvent = StubUnregisterAsyncEvent;
+	FunctionList->nvEncCreateBitstreamBuffer = StubCreateBitstreamBuffer;
+	FunctionList->nvEncDestroyBitstreamBuffer = StubDestroyBitstreamBuffer;
+	FunctionList->nvEncRegisterResource = StubRegisterResource;
+	FunctionList->nvEncUnregisterResource = StubUnregisterResource;
+	FunctionList->nvEncMapInputResource = StubMapInputResource;
+	FunctionList->nvEncUnmapInputResource = StubUnmapInputResource;
+	FunctionList->nvEncEncodePicture = StubEncodePicture;
+	FunctionList->nvEncLockBitstream = StubLockBitstream;
+	FunctionList->nvEncInvalidateRefFrames = StubInvalidateRefFrames;
+	FunctionList->nvEncUnlockBitstream = StubUnlockBitstream;
+	FunctionList->nvEncDestroyEncoder = StubDestroyEncoder;
+	return NV_ENC_SUCCESS;
+}
+
+#endif
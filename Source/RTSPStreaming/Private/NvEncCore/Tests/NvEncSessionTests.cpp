@@ -0,0 +1,596 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// tests of FNvEncSession against the stub driver in NvEncCore/Stub, one case per run as the stub reads its
+// environment once. Exits with the number of failed checks
+// usage: NvEncSessionTests <stub library> <case>, NvEncCore/CMakeLists.txt registers every case with ctest and the
+// NVENC_STUB_* variables it needs
+// - the BlockingLock cases run a completion thread like FNvVideoEncoder's, waiting on the slots in ring order
+// - the function list handed to the session records the picture parameters and reference invalidations before
+//   passing the calls on to the stub, so the cases can check what the session asked the driver for
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "NvEncCore/NvEncSession.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#	include <dlfcn.h>
+#endif
+
+static int32 Failures = 0;
+
+static void Check(bool bCondition, const char* What, int32 Line)
+{
+	if (!bCondition)
+	{
+		printf("FAIL line %d: %s\n", Line, What);
+		Failures++;
+	}
+}
+
+#define CHECK(Condition) Check(Condition, #Condition, __LINE__)
+
+// RTP timestamps of 60 Hz frames, what the plugin passes to BeginFrame()
+static const uint64 FrameDuration = 1500;
+
+// the picture parameters of a call to nvEncEncodePicture that matter to loss recovery
+struct FPicture
+{
+	bool	bForceIdr = false;
+	bool	bLtrMark = false;
+	uint32	LtrMarkIdx = 0;
+	bool	bLtrUse = false;
+	uint32	LtrUseBitmap = 0;
+};
+
+static NV_ENCODE_API_FUNCTION_LIST StubApi;
+static std::vector<FPicture> Pictures;					// every picture submitted so far
+static std::vector<uint64> InvalidatedFrames;			// every frame passed to nvEncInvalidateRefFrames so far
+
+static NVENCSTATUS NVENCAPI RecordEncodePicture(void* Encoder, NV_ENC_PIC_PARAMS* Params)
+{
+	const NV_ENC_PIC_PARAMS_H264& H264Params = Params->codecPicParams.h264PicParams;
+	FPicture Picture;
+	Picture.bForceIdr = (Params->encodePicFlags & NV_ENC_PIC_FLAG_FORCEIDR) != 0;
+	Picture.bLtrMark = H264Params.ltrMarkFrame != 0;
+	Picture.LtrMarkIdx = H264Params.ltrMarkFrameIdx;
+	Picture.bLtrUse = H264Params.ltrUseFrames != 0;
+	Picture.LtrUseBitmap = H264Params.ltrUseFrameBitmap;
+	Pictures.push_back(Picture);
+	return StubApi.nvEncEncodePicture(Encoder, Params);
+}
+
+static NVENCSTATUS NVENCAPI RecordInvalidateRefFrames(void* Encoder, uint64_t FrameIdx)
+{
+	InvalidatedFrames.push_back(FrameIdx);
+	return StubApi.nvEncInvalidateRefFrames(Encoder, FrameIdx);
+}
+
+static bool LoadStub(const char* Path, NV_ENCODE_API_FUNCTION_LIST& OutApi)
+{
+	typedef NVENCSTATUS(NVENCAPI* FCreateInstance)(NV_ENCODE_API_FUNCTION_LIST*);
+#if defined(_WIN32)
+	HMODULE Library = LoadLibraryA(Path);
+	FCreateInstance CreateInstance = Library ? reinterpret_cast<FCreateInstance>(GetProcAddress(Library, "NvEncodeAPICreateInstance")) : nullptr;
+#else
+	void* Library = dlopen(Path, RTLD_NOW);
+	FCreateInstance CreateInstance = Library ? reinterpret_cast<FCreateInstance>(dlsym(Library, "NvEncodeAPICreateInstance")) : nullptr;
+#endif
+	if (!CreateInstance)
+	{
+		printf("can't load the stub driver %s\n", Path);
+		return false;
+	}
+
+	std::memset(&StubApi, 0, sizeof(StubApi));
+	StubApi.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+	if (CreateInstance(&StubApi) != NV_ENC_SUCCESS)
+	{
+		return false;
+	}
+
+	OutApi = StubApi;
+	OutApi.nvEncEncodePicture = RecordEncodePicture;
+	OutApi.nvEncInvalidateRefFrames = RecordInvalidateRefFrames;
+	return true;
+}
+
+static NV_ENCODE_API_FUNCTION_LIST Api;
+
+// stands in for the textures the plugin registers, the stub only cares that each slot has one
+static int32 Inputs[FNvEncSession::MaxSlots];
+
+static FNvEncSettings MakeSettings(uint32 Width, uint32 Height)
+{
+	FNvEncSettings Settings;
+	Settings.Width = Width;
+	Settings.Height = Height;
+	return Settings;
+}
+
+// periodic IDR frames off, so every IDR frame a case sees is one the session asked for
+static NVENCSTATUS OpenSession(FNvEncSession& Session, const FNvEncSettings& Settings, ENvEncCompletionMode Mode)
+{
+	return Session.Open(nullptr, NV_ENC_DEVICE_TYPE_CUDA, Settings, Mode, [](NV_ENC_INITIALIZE_PARAMS&, NV_ENC_CONFIG& Config)
+	{
+		Config.gopLength = NVENC_INFINITE_GOPLENGTH;
+		Config.encodeCodecConfig.h264Config.idrPeriod = NVENC_INFINITE_GOPLENGTH;
+	});
+}
+
+// registers an input of the current size with the slot if it has none and submits it
+static NVENCSTATUS SubmitFrame(FNvEncSession& Session, int32 Slot)
+{
+	if (!Session.HasInput(Slot))
+	{
+		Session.UnregisterInput(Slot);
+		NVENCSTATUS Result = Session.RegisterInput(Slot, &Inputs[Slot], NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, NV_ENC_BUFFER_FORMAT_ABGR10);
+		if (Result != NV_ENC_SUCCESS)
+		{
+			return Result;
+		}
+	}
+	return Session.SubmitFrame(Slot);
+}
+
+static NVENCSTATUS CompleteFrame(FNvEncSession& Session, int32 Slot, FNvEncFrameInfo& OutInfo)
+{
+	return Session.CompleteFrame(Slot, [](const uint8*, uint32) {}, OutInfo);
+}
+
+// begins, submits and completes the frame of Timestamp in Inline mode
+static bool EncodeFrame(FNvEncSession& Session, uint64 Timestamp, FNvEncFrameInfo& OutInfo)
+{
+	const int32 Slot = Session.BeginFrame(Timestamp);
+	if (Slot == INDEX_NONE)
+	{
+		return false;
+	}
+	const NVENCSTATUS SubmitResult = SubmitFrame(Session, Slot);
+	return CompleteFrame(Session, Slot, OutInfo) == NV_ENC_SUCCESS && SubmitResult == NV_ENC_SUCCESS;
+}
+
+// frames are dropped once the pipeline depth is reached, an aborted frame gives its slot and index back
+static void TestDrops()
+{
+	FNvEncSession Session(Api);
+	CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::Inline) == NV_ENC_SUCCESS);
+	Session.SetPipelineDepth(2);
+
+	const int32 First = Session.BeginFrame(0);
+	const int32 Second = Session.BeginFrame(FrameDuration);
+	CHECK(First != INDEX_NONE && Second != INDEX_NONE && First != Second);
+	CHECK(Session.BeginFrame(2 * FrameDuration) == INDEX_NONE);
+	CHECK(Session.GetInFlightFrames() == 2);
+
+	FNvEncFrameInfo Info;
+	CHECK(SubmitFrame(Session, First) == NV_ENC_SUCCESS);
+	CHECK(CompleteFrame(Session, First, Info) == NV_ENC_SUCCESS);
+	CHECK(Info.FrameIdx == 0 && Info.Timestamp == 0);
+
+	// the dropped frame took no index, the aborted one gives its index back to the next
+	const int32 Aborted = Session.BeginFrame(3 * FrameDuration);
+	CHECK(Aborted != INDEX_NONE);
+	Session.AbortFrame(Aborted);
+	CHECK(Session.GetInFlightFrames() == 1);
+	CHECK(!Session.IsEncoding(Aborted));
+	const int32 Third = Session.BeginFrame(4 * FrameDuration);
+	CHECK(Third == Aborted);
+
+	CHECK(SubmitFrame(Session, Second) == NV_ENC_SUCCESS);
+	CHECK(SubmitFrame(Session, Third) == NV_ENC_SUCCESS);
+	CHECK(CompleteFrame(Session, Second, Info) == NV_ENC_SUCCESS);
+	CHECK(Info.FrameIdx == 1 && Info.Timestamp == FrameDuration);
+	CHECK(CompleteFrame(Session, Third, Info) == NV_ENC_SUCCESS);
+	CHECK(Info.FrameIdx == 2 && Info.Timestamp == 4 * FrameDuration);
+	CHECK(Session.GetInFlightFrames() == 0);
+
+	// in adaptive mode a drop deepens the pipeline instead of repeating
+	Session.SetPipelineDepth(1);
+	Session.SetAdaptivePipelineDepth(true);
+	const int32 Fourth = Session.BeginFrame(5 * FrameDuration);
+	CHECK(Session.BeginFrame(6 * FrameDuration) == INDEX_NONE);
+	CHECK(Session.GetPipelineDepth() == 2);
+	const int32 Fifth = Session.BeginFrame(7 * FrameDuration);
+	CHECK(Fifth != INDEX_NONE);
+	for (int32 Slot : { Fourth, Fifth })
+	{
+		CHECK(SubmitFrame(Session, Slot) == NV_ENC_SUCCESS);
+		CHECK(CompleteFrame(Session, Slot, Info) == NV_ENC_SUCCESS);
+	}
+	CHECK(Info.FrameIdx == 4);
+}
+
+// NVENC_STUB_FAIL=nvEncReconfigureEncoder:1, the refused settings leave the session as it was and can be retried
+static void TestReconfigureRollback()
+{
+	FNvEncSession Session(Api);
+	const FNvEncSettings Settings = MakeSettings(1280, 720);
+	CHECK(OpenSession(Session, Settings, ENvEncCompletionMode::Inline) == NV_ENC_SUCCESS);
+	const std::vector<uint8> Header = Session.GetSpsPpsHeader();
+
+	FNvEncFrameInfo Info;
+	CHECK(EncodeFrame(Session, 0, Info));
+	CHECK(Info.bIdrFrame);
+
+	FNvEncSettings NewSettings = MakeSettings(1920, 1080);
+	NewSettings.AverageBitRate = Settings.AverageBitRate / 2;
+	NewSettings.FrameRate = 30;
+	bool bResolutionChanged = true;
+	CHECK(Session.Reconfigure(NewSettings, bResolutionChanged) == NV_ENC_ERR_GENERIC);
+	CHECK(!bResolutionChanged);
+	CHECK(Session.GetInitializeParams().encodeWidth == 1280 && Session.GetInitializeParams().encodeHeight == 720);
+	CHECK(Session.GetInitializeParams().darWidth == 1280 && Session.GetInitializeParams().darHeight == 720);
+	CHECK(Session.GetInitializeParams().frameRateNum == Settings.FrameRate);
+	CHECK(Session.GetConfig().rcParams.averageBitRate == Settings.AverageBitRate);
+	CHECK(Session.GetSpsPpsHeader() == Header);
+
+	// inputs are still registered at the old size and the stream carries on without an IDR frame
+	const int32 Slot = Session.BeginFrame(FrameDuration);
+	CHECK(Slot != INDEX_NONE);
+	CHECK(SubmitFrame(Session, Slot) == NV_ENC_SUCCESS);
+	CHECK(Session.HasInput(Slot));
+	CHECK(CompleteFrame(Session, Slot, Info) == NV_ENC_SUCCESS);
+	CHECK(!Info.bIdrFrame);
+
+	CHECK(Session.Reconfigure(NewSettings, bResolutionChanged) == NV_ENC_SUCCESS);
+	CHECK(bResolutionChanged);
+	CHECK(Session.GetInitializeParams().encodeWidth == 1920 && Session.GetInitializeParams().encodeHeight == 1080);
+	CHECK(Session.GetInitializeParams().frameRateNum == 30);
+	CHECK(Session.GetConfig().rcParams.averageBitRate == NewSettings.AverageBitRate);
+	CHECK(Session.GetSpsPpsHeader() != Header);
+
+	CHECK(EncodeFrame(Session, 2 * FrameDuration, Info));
+	CHECK(Info.bIdrFrame);
+}
+
+// without long-term references a loss is recovered with an IDR frame
+static void TestLossIdr()
+{
+	FNvEncSession Session(Api);
+	CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::Inline) == NV_ENC_SUCCESS);
+
+	FNvEncFrameInfo Info;
+	for (uint64 Frame = 0; Frame < 10; ++Frame)
+	{
+		if (Frame == 6)
+		{
+			Session.ReportLoss(static_cast<uint32>(3 * FrameDuration));
+		}
+		CHECK(EncodeFrame(Session, Frame * FrameDuration, Info));
+		CHECK(Info.bIdrFrame == (Frame == 0 || Frame == 6));
+		CHECK(Pictures.back().bForceIdr == (Frame == 6));
+	}
+	CHECK(InvalidatedFrames.empty());
+}
+
+// with long-term references the frames since the loss are invalidated and the next one is predicted from the newest
+// long-term reference before it. Losses a recovery covers are ignored, unknown frames need an IDR frame
+static void TestLossLtr()
+{
+	FNvEncSession Session(Api);
+	Session.SetLtrInterval(10);
+	CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::Inline) == NV_ENC_SUCCESS);
+	CHECK(Session.GetLtrInterval() == 10);
+
+	FNvEncFrameInfo Info;
+	for (uint64 Frame = 0; Frame < 40; ++Frame)
+	{
+		if (Frame == 30)
+		{
+			Session.ReportLoss(static_cast<uint32>(25 * FrameDuration));
+		}
+		if (Frame == 32)
+		{
+			Session.ReportLoss(static_cast<uint32>(27 * FrameDuration));
+		}
+		if (Frame == 35)
+		{
+			Session.ReportLoss(12345);
+		}
+		CHECK(EncodeFrame(Session, Frame * FrameDuration, Info));
+
+		// long-term references are marked in turn, frames 0, 10 and 20 before the loss
+		const FPicture& Picture = Pictures.back();
+		if (Frame < 30)
+		{
+			CHECK(Picture.bLtrMark == (Frame % 10 == 0));
+			CHECK(!Picture.bLtrMark || Picture.LtrMarkIdx == (Frame / 10) % 2);
+		}
+
+		if (Frame == 30)
+		{
+			// frame 20 is the newest reference before 25, frames 25 to 29 are invalidated newest first
+			CHECK(!Info.bIdrFrame && !Picture.bForceIdr);
+			CHECK(Picture.bLtrUse && Picture.LtrUseBitmap == 1u << 0);
+			CHECK((InvalidatedFrames == std::vector<uint64>{ 29, 28, 27, 26, 25 }));
+		}
+		else if (Frame == 35)
+		{
+			CHECK(Info.bIdrFrame && Picture.bForceIdr && !Picture.bLtrUse);
+			CHECK(Picture.bLtrMark);
+		}
+		else
+		{
+			CHECK(Info.bIdrFrame == (Frame == 0));
+			CHECK(!Picture.bLtrUse);
+		}
+	}
+	CHECK(InvalidatedFrames.size() == 5);
+}
+
+// NVENC_STUB_FAIL=nvEncInvalidateRefFrames, a loss the driver can't invalidate the references of needs an IDR frame
+static void TestLossLtrInvalidateFails()
+{
+	FNvEncSession Session(Api);
+	Session.SetLtrInterval(10);
+	CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::Inline) == NV_ENC_SUCCESS);
+	CHECK(Session.GetLtrInterval() == 10);
+
+	FNvEncFrameInfo Info;
+	for (uint64 Frame = 0; Frame < 20; ++Frame)
+	{
+		if (Frame == 15)
+		{
+			Session.ReportLoss(static_cast<uint32>(13 * FrameDuration));
+		}
+		CHECK(EncodeFrame(Session, Frame * FrameDuration, Info));
+		CHECK(Info.bIdrFrame == (Frame == 0 || Frame == 15));
+		CHECK(!Pictures.back().bLtrUse);
+	}
+	CHECK(!InvalidatedFrames.empty());
+}
+
+// the owner's completion thread, waits on the slots in ring order and queues the finished ones for CompleteFrame()
+class FCompletionThread
+{
+public:
+	explicit FCompletionThread(FNvEncSession& InSession)
+		: Session(InSession)
+		, bStopped(false)
+		, Thread([this]() { Run(); })
+	{}
+
+	~FCompletionThread()
+	{
+		Stop();
+	}
+
+	// wakes the thread and waits for it to leave
+	void Stop()
+	{
+		Session.WakeCompletionWaiter();
+		if (Thread.joinable())
+		{
+			Thread.join();
+		}
+	}
+
+	// the next finished slot, INDEX_NONE if there was none within TimeoutMs
+	int32 PopFinished(uint32 TimeoutMs)
+	{
+		std::unique_lock<std::mutex> Lock(Mutex);
+		Cond.wait_for(Lock, std::chrono::milliseconds(TimeoutMs), [this]() { return !Finished.empty(); });
+		if (Finished.empty())
+		{
+			return INDEX_NONE;
+		}
+		const int32 Slot = Finished.front();
+		Finished.pop_front();
+		return Slot;
+	}
+
+	bool HasStopped()
+	{
+		std::lock_guard<std::mutex> Lock(Mutex);
+		return bStopped;
+	}
+
+private:
+	void Run()
+	{
+		for (int32 Slot = 0; ; Slot = (Slot + 1) % FNvEncSession::MaxSlots)
+		{
+			const bool bFinished = Session.WaitForCompletion(Slot);
+			std::lock_guard<std::mutex> Lock(Mutex);
+			if (!bFinished)
+			{
+				bStopped = true;
+				return;
+			}
+			Finished.push_back(Slot);
+			Cond.notify_all();
+		}
+	}
+
+	FNvEncSession&			Session;
+	std::mutex				Mutex;
+	std::condition_variable	Cond;
+	std::deque<int32>		Finished;
+	bool					bStopped;
+	std::thread				Thread;			// last, it starts running in the constructor
+};
+
+// NVENC_STUB_LATENCY_MS=5, frames complete in submission order while the next ones are submitted, and the ones the
+// pipeline has no room for are dropped without taking a frame index
+static void TestBlockingLockOrder()
+{
+	FNvEncSession Session(Api);
+	CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::BlockingLock) == NV_ENC_SUCCESS);
+	CHECK(Session.GetCompletionMode() == ENvEncCompletionMode::BlockingLock);
+	Session.SetPipelineDepth(3);
+
+	FCompletionThread Completion(Session);
+	std::vector<uint64> Timestamps;					// by frame index
+	uint64 NextFrameIdx = 0;
+	int32 NumDropped = 0;
+	const auto Complete = [&](int32 Slot)
+	{
+		FNvEncFrameInfo Info;
+		CHECK(CompleteFrame(Session, Slot, Info) == NV_ENC_SUCCESS);
+		CHECK(Info.FrameIdx == NextFrameIdx);
+		CHECK(Info.FrameIdx < Timestamps.size() && Info.Timestamp == Timestamps[Info.FrameIdx]);
+		// the lock blocked until the stub had taken its time over the frame
+		CHECK(Info.EncodeEndTimeMs >= Info.EncodeStartTimeMs + 4);
+		NextFrameIdx++;
+	};
+
+	const int32 NumFrames = 40;
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		for (int32 Slot = Completion.PopFinished(0); Slot != INDEX_NONE; Slot = Completion.PopFinished(0))
+		{
+			Complete(Slot);
+		}
+
+		const int32 Slot = Session.BeginFrame(Frame * FrameDuration);
+		if (Slot == INDEX_NONE)
+		{
+			NumDropped++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
+		}
+		Timestamps.push_back(Frame * FrameDuration);
+		CHECK(SubmitFrame(Session, Slot) == NV_ENC_SUCCESS);
+	}
+
+	while (Session.GetInFlightFrames() > 0)
+	{
+		const int32 Slot = Completion.PopFinished(1000);
+		CHECK(Slot != INDEX_NONE);
+		if (Slot == INDEX_NONE)
+		{
+			break;
+		}
+		Complete(Slot);
+	}
+	CHECK(NextFrameIdx == Timestamps.size());
+	CHECK(static_cast<int32>(NextFrameIdx) + NumDropped == NumFrames);
+	CHECK(NumDropped > 0);
+}
+
+// NVENC_STUB_FAIL=nvEncEncodePicture:3, a frame the driver refuses completes right away with its error and the
+// completion thread carries on with the next slot
+static void TestBlockingLockRejected()
+{
+	FNvEncSession Session(Api);
+	CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::BlockingLock) == NV_ENC_SUCCESS);
+	Session.SetPipelineDepth(3);
+
+	FCompletionThread Completion(Session);
+	int32 NumCopied = 0;
+	for (int32 Batch = 0; Batch < 2; ++Batch)
+	{
+		int32 Slots[3];
+		for (int32 Index = 0; Index < 3; ++Index)
+		{
+			const uint64 Frame = Batch * 3 + Index;
+			Slots[Index] = Session.BeginFrame(Frame * FrameDuration);
+			CHECK(Slots[Index] != INDEX_NONE);
+			CHECK(SubmitFrame(Session, Slots[Index]) == (Frame == 2 ? NV_ENC_ERR_GENERIC : NV_ENC_SUCCESS));
+		}
+
+		for (int32 Index = 0; Index < 3; ++Index)
+		{
+			const uint64 Frame = Batch * 3 + Index;
+			const int32 Slot = Completion.PopFinished(1000);
+			CHECK(Slot == Slots[Index]);
+			if (Slot == INDEX_NONE)
+			{
+				return;
+			}
+
+			FNvEncFrameInfo Info;
+			const NVENCSTATUS Result = Session.CompleteFrame(Slot, [&NumCopied](const uint8*, uint32) { NumCopied++; }, Info);
+			CHECK(Result == (Frame == 2 ? NV_ENC_ERR_GENERIC : NV_ENC_SUCCESS));
+			CHECK(Info.FrameIdx == Frame);
+		}
+	}
+	CHECK(NumCopied == 5);
+	CHECK(Session.GetInFlightFrames() == 0);
+}
+
+// NVENC_STUB_LATENCY_MS=50, WakeCompletionWaiter() gets the completion thread out of its wait whether it waits for a
+// submission or for a frame the driver is still encoding, and the frame can be completed after it left
+static void TestBlockingLockShutdown()
+{
+	{
+		FNvEncSession Session(Api);
+		CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::BlockingLock) == NV_ENC_SUCCESS);
+		FCompletionThread Completion(Session);
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		CHECK(!Completion.HasStopped());
+		Completion.Stop();
+		CHECK(Completion.HasStopped());
+
+		// woken stays woken, a late wait doesn't block the shutdown
+		CHECK(!Session.WaitForCompletion(0));
+	}
+
+	{
+		FNvEncSession Session(Api);
+		CHECK(OpenSession(Session, MakeSettings(1280, 720), ENvEncCompletionMode::BlockingLock) == NV_ENC_SUCCESS);
+		FCompletionThread Completion(Session);
+		const int32 Slot = Session.BeginFrame(0);
+		CHECK(Slot != INDEX_NONE);
+		CHECK(SubmitFrame(Session, Slot) == NV_ENC_SUCCESS);
+		Completion.Stop();
+		CHECK(Completion.HasStopped());
+
+		FNvEncFrameInfo Info;
+		CHECK(CompleteFrame(Session, Slot, Info) == NV_ENC_SUCCESS);
+		CHECK(Info.FrameIdx == 0);
+		CHECK(Session.GetInFlightFrames() == 0);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const struct
+	{
+		const char*	Name;
+		void		(*Run)();
+	} Cases[] =
+	{
+		{ "Drops", TestDrops },
+		{ "ReconfigureRollback", TestReconfigureRollback },
+		{ "LossIdr", TestLossIdr },
+		{ "LossLtr", TestLossLtr },
+		{ "LossLtrInvalidateFails", TestLossLtrInvalidateFails },
+		{ "BlockingLockOrder", TestBlockingLockOrder },
+		{ "BlockingLockRejected", TestBlockingLockRejected },
+		{ "BlockingLockShutdown", TestBlockingLockShutdown },
+	};
+
+	if (argc != 3)
+	{
+		printf("usage: NvEncSessionTests <stub library> <case>\n");
+		return 1;
+	}
+	if (!LoadStub(argv[1], Api))
+	{
+		return 1;
+	}
+
+	for (const auto& Case : Cases)
+	{
+		if (std::string(argv[2]) == Case.Name)
+		{
+			Case.Run();
+			return Failures;
+		}
+	}
+	printf("unknown case %s\n", argv[2]);
+	return 1;
+}
+
+#endif
@@ -2,27 +2,25 @@
 
 #include "NvVideoEncoder.h"
 
+#include "BackBufferCopy.h"
 #include "Utils.h"
-#include "ScreenRendering.h"
 #include "RTSPStreamingCommon.h"
-#include "ShaderCore.h"
-#include "RendererInterface.h"
-#include "RHIStaticStates.h"
-#include "PipelineStateCache.h"
+#include "EncodedFramePool.h"
 #include "HAL/Runnable.h"
 #include "HAL/RunnableThread.h"
 #include "HAL/ThreadSafeBool.h"
 #include "HAL/ThreadSafeCounter.h"
+#include "HAL/Event.h"
 #include "Misc/CoreDelegates.h"
 #include "Modules/ModuleManager.h"
-#include "CommonRenderResources.h"
+
+#include "NvEncCore/NvEncSession.h"
 
 #if defined PLATFORM_WINDOWS
 // Disable macro redefinition warning for compatibility with Windows SDK 8+
 #	pragma warning(push)
 #		pragma warning(disable : 4005)	// macro redefinition
 #		include "Windows/AllowWindowsPlatformTypes.h"
-#			include "NvEncoder/nvEncodeAPI.h"
 #			include <d3d11.h>
 #		include "Windows/HideWindowsPlatformTypes.h"
 #		include "D3D11RHIPrivate.h"
@@ -34,281 +32,311 @@ DECLARE_CYCLE_STAT(TEXT("SendBackBufferToEncoder"), STAT_NvEnc_SendBackBufferToE
 DECLARE_CYCLE_STAT(TEXT("WaitForEncodeEvent"), STAT_NvEnc_WaitForEncodeEvent, STATGROUP_NvEnc);
 DECLARE_CYCLE_STAT(TEXT("RetrieveEncodedFrame"), STAT_NvEnc_RetrieveEncodedFrame, STATGROUP_NvEnc);
 DECLARE_CYCLE_STAT(TEXT("StreamEncodedFrame"), STAT_NvEnc_StreamEncodedFrame, STATGROUP_NvEnc);
-DECLARE_DWORD_COUNTER_STAT(TEXT("AsyncMode"), STAT_NvEnc_AsyncMode, STATGROUP_NvEnc);
+DECLARE_DWORD_COUNTER_STAT(TEXT("CompletionMode"), STAT_NvEnc_CompletionMode, STATGROUP_NvEnc);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("DroppedFrames"), STAT_NvEnc_DroppedFrames, STATGROUP_NvEnc);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SlotWaitMs"), STAT_NvEnc_SlotWaitMs, STATGROUP_NvEnc);
+DECLARE_DWORD_COUNTER_STAT(TEXT("InFlightFrames"), STAT_NvEnc_InFlightFrames, STATGROUP_NvEnc);
+DECLARE_DWORD_COUNTER_STAT(TEXT("PipelineDepth"), STAT_NvEnc_PipelineDepth, STATGROUP_NvEnc);
+DECLARE_DWORD_COUNTER_STAT(TEXT("SlicesPerFrame"), STAT_NvEnc_SlicesPerFrame, STATGROUP_NvEnc);
+
+static TAutoConsoleVariable<int32> CVarEncoderPipelineDepth(
+	TEXT("Encoder.PipelineDepth"),
+	3,
+	TEXT("Frames that can be in the encoder at once, captured frames are dropped when all are busy. Starting depth in adaptive mode"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarEncoderAdaptivePipelineDepth(
+	TEXT("Encoder.AdaptivePipelineDepth"),
+	0,
+	TEXT("Grows the pipeline depth when frames are dropped and shrinks it for lower latency while the encoder keeps up"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarEncoderLtrInterval(
+	TEXT("Encoder.LtrInterval"),
+	0,
+	TEXT("Frames between long-term references NvEnc recovers client losses from without an IDR frame, 0 disables. Also stops periodic IDR frames. Read when the encoder starts"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarEncoderTemporalLayers(
+	TEXT("Encoder.TemporalLayers"),
+	1,
+	TEXT("Hierarchical-P temporal layers NvEnc encodes, clients asking for a lower frame rate are only sent the lower layers. Up to 4, 1 disables. Replaces Encoder.LtrInterval. Read when the encoder starts"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarEncoderSliceStreaming(
+	TEXT("Encoder.SliceStreaming"),
+	0,
+	TEXT("NvEnc encodes slices that fit into an RTP packet of Streamer.MaxPayloadSize and each one is sent as soon as it's written rather than the frame once it's encoded. Frames complete in BlockingLock mode then. Read when the encoder starts"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarEncoderCompletionThreadPriority(
+	TEXT("Encoder.CompletionThreadPriority"),
+	TEXT("Normal"),
+	TEXT("Priority of the thread waiting for NvEnc to complete frames: Normal, AboveNormal, BelowNormal, Highest, Lowest, SlightlyBelowNormal or TimeCritical. Read when the encoder starts"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarEncoderCompletionThreadAffinity(
+	TEXT("Encoder.CompletionThreadAffinity"),
+	TEXT(""),
+	TEXT("Hex mask of the cores the NvEnc completion thread may run on, empty for any. Read when the encoder starts"),
+	ECVF_Default);
+
+static NV_ENC_PARAMS_RC_MODE ToNvEncRateControlMode(EVideoRateControl RateControl)
+{
+	switch (RateControl)
+	{
+	case EVideoRateControl::Cbr:
+		return NV_ENC_PARAMS_RC_CBR;
+	case EVideoRateControl::Vbr:
+		return NV_ENC_PARAMS_RC_VBR;
+	case EVideoRateControl::ConstQp:
+		return NV_ENC_PARAMS_RC_CONSTQP;
+	default:
+		// CBR low-delay HQ, named after two-pass quality encoding in SDK 7 and only for the low latency presets
+		return NV_ENC_PARAMS_RC_2_PASS_QUALITY;
+	}
+}
 
-#define BITSTREAM_SIZE 1280 * 720 * 2
-#define NV_RESULT(NvFunction) NvFunction == NV_ENC_SUCCESS
+static const TCHAR* RateControlModeToString(NV_ENC_PARAMS_RC_MODE Mode)
+{
+	switch (Mode)
+	{
+	case NV_ENC_PARAMS_RC_CONSTQP:
+		return TEXT("CQP");
+	case NV_ENC_PARAMS_RC_VBR:
+		return TEXT("VBR");
+	case NV_ENC_PARAMS_RC_CBR:
+		return TEXT("CBR");
+	case NV_ENC_PARAMS_RC_2_PASS_QUALITY:
+		return TEXT("CBR_LD_HQ");
+	default:
+		return TEXT("Other");
+	}
+}
 
-#if defined PLATFORM_WINDOWS
-#define CLOSE_EVENT_HANDLE(EventHandle) CloseHandle(EventHandle);
-#else
-#define CLOSE_EVENT_HANDLE(EventHandle) fclose((FILE*)EventHandle);
-#endif
+static FNvEncSettings ToNvEncSettings(const FVideoEncoderSettings& Settings)
+{
+	FNvEncSettings NvEncSettings;
+	NvEncSettings.Width = Settings.Width;
+	NvEncSettings.Height = Settings.Height;
+	NvEncSettings.FrameRate = Settings.FrameRate;
+	NvEncSettings.AverageBitRate = Settings.AverageBitRate;
+	NvEncSettings.Codec = Settings.Codec;
+	NvEncSettings.RateControlMode = ToNvEncRateControlMode(Settings.RateControl);
+	NvEncSettings.MaxBitRate = Settings.MaxBitRate;
+	NvEncSettings.ConstQp = Settings.ConstQp;
+	NvEncSettings.VbvBufferSize = Settings.VbvBufferSize;
+	return NvEncSettings;
+}
 
+// D3D11 side of the NvEnc encoder, the session, frame ring, reconfiguration and completion are FNvEncSession's
+// - each slot of the session's ring gets a render target the back buffer is scaled into, registered as its input
+// - frames are submitted from the RHI thread and completed on the render thread, unless they complete inline the
+//   completion thread waits for the slots in turn and hands them to the render thread
+// - with slice streaming the completion thread sends the slices of a frame itself while the rest of it is encoded,
+//   the render thread only releases the slot
 class FNvVideoEncoder::FNvVideoEncoderImpl
 {
 private:
-	struct FInputFrame
-	{
-		void*					RegisteredResource;
-		NV_ENC_INPUT_PTR		MappedResource;
-		NV_ENC_BUFFER_FORMAT	BufferFormat;
-	};
-
-	struct FOutputFrame
-	{
-		NV_ENC_OUTPUT_PTR		BitstreamBuffer;
-		HANDLE					EventHandle;
-	};
-
-	struct FFrame
-	{
-		FTexture2DRHIRef		ResolvedBackBuffer;
-		FInputFrame				InputFrame;
-		FOutputFrame			OutputFrame;
-		TArray<uint8>			EncodedFrame;
-		bool					bIdrFrame = false;
-		uint64					FrameIdx = 0;
-
-		// timestamps to measure encoding latency
-		uint64					CaptureTimeStamp = 0;
-		uint64					EncodeStartTimeStamp = 0;
-		uint64					EncodeEndTimeStamp = 0;
-
-		FThreadSafeBool bEncoding = false;
-	};
-
 	struct FRHITransferRenderTargetToNvEnc final : public FRHICommand<FRHITransferRenderTargetToNvEnc>
 	{
 		FNvVideoEncoder::FNvVideoEncoderImpl* Encoder;
-		FFrame* Frame;
+		int32 Slot;
 
-		FORCEINLINE_DEBUGGABLE FRHITransferRenderTargetToNvEnc(FNvVideoEncoder::FNvVideoEncoderImpl* InEncoder, FFrame* InFrame)
-			: Encoder(InEncoder), Frame(InFrame)
+		FORCEINLINE_DEBUGGABLE FRHITransferRenderTargetToNvEnc(FNvVideoEncoder::FNvVideoEncoderImpl* InEncoder, int32 InSlot)
+			: Encoder(InEncoder), Slot(InSlot)
 		{}
 
 		void Execute(FRHICommandListBase& CmdList)
 		{
-			Encoder->TransferRenderTargetToHWEncoder(*Frame);
+			Encoder->TransferRenderTargetToHWEncoder(Slot);
 		}
 	};
 
 public:
-	FNvVideoEncoderImpl(void* DllHandle, const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, bool bEnableAsyncMode, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
+	FNvVideoEncoderImpl(const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
 	~FNvVideoEncoderImpl();
 
-	void UpdateSettings(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer);
-	void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 CaptureMs);
-	void TransferRenderTargetToHWEncoder(FFrame& Frame);
+	bool Open(const NV_ENCODE_API_FUNCTION_LIST& NvEncodeAPI, const FVideoEncoderSettings& Settings, ENvEncCompletionMode CompletionMode);
+	void InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer);
+
+	void UpdateSettings(const FVideoEncoderSettings& Settings);
+	void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp);
+	void TransferRenderTargetToHWEncoder(int32 Slot);
 
-	void PostRenderingThreadCreated()				{ bWaitForRenderThreadToResume = false; }
-	void PreRenderingThreadDestroyed()				{ bWaitForRenderThreadToResume = true; }
+	void PostRenderingThreadCreated();
+	void PreRenderingThreadDestroyed();
 	bool IsSupported() const						{ return bIsSupported; }
-	bool IsAsyncEnabled() const						{ return NvEncInitializeParams.enableEncodeAsync > 0; }
+	bool IsAsyncEnabled() const						{ return Session->IsAsync(); }
+	EVideoCodec GetCodec() const					{ return Session->GetCodec(); }
 	const TArray<uint8>& GetSpsPpsHeader() const	{ return SpsPpsHeader; }
-	void ForceIdrFrame()							{ bForceIdrFrame = true; }
+	void ForceIdrFrame()							{ Session->ForceIdrFrame(); }
+	void ReportLoss(uint32 RtpTimestamp)			{ Session->ReportLoss(RtpTimestamp); }
 
 private:
-	void InitFrameInputBuffer(const FTexture2DRHIRef& BackBuffer, FFrame& Frame);
-	void InitializeResources(const FTexture2DRHIRef& BackBuffer);
-	void ReleaseFrameInputBuffer(FFrame& Frame);
-	void ReleaseResources();
-	void RegisterAsyncEvent(void** OutEvent);
-	void UnregisterAsyncEvent(void* Event);
-	void EncoderCheckLoop();
-	void ProcessFrame(FFrame& Frame);
-	void CopyBackBuffer(const FTexture2DRHIRef& BackBuffer, const FTexture2DRHIRef& ResolvedBackBuffer);
+	bool InitSlotInput(int32 Slot);
+	void ReleaseSlotInput(int32 Slot);
+	void UpdatePipelineDepth();
 	void UpdateSpsPpsHeader();
+	void EncoderCheckLoop();
+	void StreamSlices(const uint8* Slices, uint32 Size, const FNvEncFrameInfo& Frame, bool bFirstSlices, bool bLastSlices);
+	void ProcessFrame(int32 Slot);
 
-	TUniquePtr<NV_ENCODE_API_FUNCTION_LIST> NvEncodeAPI;
-	void*									EncoderInterface;
-	NV_ENC_INITIALIZE_PARAMS				NvEncInitializeParams;
-	NV_ENC_CONFIG							NvEncConfig;
+	TUniquePtr<FNvEncSession>				Session;
+	FTexture2DRHIRef						ResolvedBackBuffers[FNvEncSession::MaxSlots];	// input of each slot of the session
+	FVideoEncoderSettings					RejectedSettings;		// last settings the driver refused, not retried every frame
 	bool									bIsSupported;
 	TArray<uint8>							SpsPpsHeader;
 	FThreadSafeBool							bWaitForRenderThreadToResume;
-	FThreadSafeBool							bForceIdrFrame;
+	FEvent*									RenderThreadResumedEvent;	// manual reset, triggered while the render thread runs
 	// Used to make sure we don't have a race condition trying to access a deleted "this" captured
 	// in the render command lambda sent to the render thread from EncoderCheckLoop
 	static FThreadSafeCounter				ImplCounter;
-	uint64									FrameCount;
-	static const uint32						NumBufferedFrames = 3;
-	FFrame									BufferedFrames[NumBufferedFrames];
 	TUniquePtr<FThread>						EncoderThread;
 	FThreadSafeBool							bExitEncoderThread;
 	FEncodedFrameReadyCallback				EncodedFrameReadyCallback;
+	FEncodedFramePool						EncodedFramePool;		// buffers encoded frames are handed to the server in
 };
 
 FThreadSafeCounter FNvVideoEncoder::FNvVideoEncoderImpl::ImplCounter(0);
 
-/**
-* Implementation class of NvEnc.
-* Note bEnableAsyncMode flag is for debugging purpose, it should be set to true normally unless user wants to test in synchronous mode.
-*/
-FNvVideoEncoder::FNvVideoEncoderImpl::FNvVideoEncoderImpl(void* DllHandle, const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, bool bEnableAsyncMode, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
-	: EncoderInterface(nullptr)
-	, bIsSupported(false)
+FNvVideoEncoder::FNvVideoEncoderImpl::FNvVideoEncoderImpl(const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
+	: bIsSupported(false)
 	, bWaitForRenderThreadToResume(false)
-	, bForceIdrFrame(false)
-	, FrameCount(0)
+	, RenderThreadResumedEvent(FPlatformProcess::GetSynchEventFromPool(true))
 	, bExitEncoderThread(false)
 	, EncodedFrameReadyCallback(InEncodedFrameReadyCallback)
+	, EncodedFramePool(16)
 {
-	// Bind to the delegates that are triggered when render thread is created or destroyed, so the encoder thread can act accordingly.
-	FCoreDelegates::PostRenderingThreadCreated.AddRaw(this, &FNvVideoEncoderImpl::PostRenderingThreadCreated);
-	FCoreDelegates::PreRenderingThreadDestroyed.AddRaw(this, &FNvVideoEncoderImpl::PreRenderingThreadDestroyed);
+	// the render thread is running, the encoder thread only waits on this while it's being recreated
+	RenderThreadResumedEvent->Trigger();
 
-	uint32 Width = Settings.Width;
-	uint32 Height = Settings.Height;
+	// no settings were rejected yet
+	RejectedSettings.Width = 0;
+}
 
+/**
+* Opens and initializes the session, which doesn't need the render thread. Frames can be encoded once InitializeResources() ran.
+* Note CompletionMode is for debugging purpose, it should be Event normally (which falls back to BlockingLock where the driver
+* has no async mode) unless user wants to test Inline completion.
+* Returns false if the session couldn't be opened, e.g. because the GPU is out of NvEnc sessions.
+*/
+bool FNvVideoEncoder::FNvVideoEncoderImpl::Open(const NV_ENCODE_API_FUNCTION_LIST& NvEncodeAPI, const FVideoEncoderSettings& Settings, ENvEncCompletionMode CompletionMode)
+{
 	FString RHIName = GDynamicRHI->GetName();
-	check(RHIName == TEXT("D3D11"));
+	if (RHIName != TEXT("D3D11"))
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("NvEnc needs the D3D11 RHI, not %s"), *RHIName);
+		return false;
+	}
 	ID3D11Device* Device = static_cast<ID3D11Device*>(GDynamicRHI->RHIGetNativeDevice());
-	checkf(Device != nullptr, TEXT("Cannot initialize NvEnc with invalid device"));
-	checkf(Width > 0 && Height > 0, TEXT("Cannot initialize NvEnc with invalid width/height"));
-	_NVENCSTATUS Result;
+	if (Device == nullptr || Settings.Width == 0 || Settings.Height == 0)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Cannot initialize NvEnc with invalid device or %dx%d"), Settings.Width, Settings.Height);
+		return false;
+	}
 	bool bWebSocketStreaming = FParse::Param(FCommandLine::Get(), TEXT("WebSocketStreaming"));
 
-	// Load NvEnc dll and create an NvEncode API instance
-	{		
-		// define a function pointer for creating an instance of nvEncodeAPI
-		typedef NVENCSTATUS(NVENCAPI *NVENCAPIPROC)(NV_ENCODE_API_FUNCTION_LIST*);
-		NVENCAPIPROC NvEncodeAPICreateInstanceFunc;
+	Session = MakeUnique<FNvEncSession>(NvEncodeAPI);
+	Session->SetPipelineDepth(CVarEncoderPipelineDepth.GetValueOnAnyThread());
+	Session->SetLtrInterval(FMath::Max(CVarEncoderLtrInterval.GetValueOnAnyThread(), 0));
+	Session->SetTemporalLayers(FMath::Max(CVarEncoderTemporalLayers.GetValueOnAnyThread(), 1));
+	if (CVarEncoderSliceStreaming.GetValueOnAnyThread())
+	{
+		// a slice is sent as a single NAL unit packet, never fragmented
+		IConsoleVariable* MaxPayloadSize = IConsoleManager::Get().FindConsoleVariable(TEXT("Streamer.MaxPayloadSize"));
+		Session->SetSliceStreaming(static_cast<uint32>(FMath::Max(MaxPayloadSize ? MaxPayloadSize->GetInt() : 1400, 64)));
+	}
 
-#if defined PLATFORM_WINDOWS
-#	pragma warning(push)
-#		pragma warning(disable: 4191) // https://stackoverflow.com/a/4215425/453271
-		NvEncodeAPICreateInstanceFunc = (NVENCAPIPROC)FPlatformProcess::GetDllExport((HMODULE)DllHandle, TEXT("NvEncodeAPICreateInstance"));
-#	pragma warning(pop)
-#else
-		NvEncodeAPICreateInstanceFunc = (NVENCAPIPROC)dlsym(DllHandle, "NvEncodeAPICreateInstance");
-#endif
-		checkf(NvEncodeAPICreateInstanceFunc != nullptr, TEXT("NvEncodeAPICreateInstance failed"));
-		NvEncodeAPI.Reset(new NV_ENCODE_API_FUNCTION_LIST);
-		FMemory::Memzero(NvEncodeAPI.Get(), sizeof(NV_ENCODE_API_FUNCTION_LIST));
-		NvEncodeAPI->version = NV_ENCODE_API_FUNCTION_LIST_VER;
-		Result = NvEncodeAPICreateInstanceFunc(NvEncodeAPI.Get());
-		checkf(NV_RESULT(Result), TEXT("Unable to create NvEnc API function list (status: %d)"), Result);
-	}
-	// Open an encoding session
-	{
-		NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS OpenEncodeSessionExParams;
-		FMemory::Memzero(OpenEncodeSessionExParams);
-		OpenEncodeSessionExParams.version = NV_ENC_OPEN_ENCODE_SESSION_EX_PARAMS_VER;
-		OpenEncodeSessionExParams.device = Device;
-		OpenEncodeSessionExParams.deviceType = NV_ENC_DEVICE_TYPE_DIRECTX;	// Currently only DX11 is supported
-		OpenEncodeSessionExParams.apiVersion = NVENCAPI_VERSION;
-		Result = NvEncodeAPI->nvEncOpenEncodeSessionEx(&OpenEncodeSessionExParams, &EncoderInterface);
-		checkf(NV_RESULT(Result), TEXT("Unable to open NvEnc encoding session (status: %d)"), Result);
-	}	
-	// Set initialization parameters
-	{
-		FMemory::Memzero(NvEncInitializeParams);
-		NvEncInitializeParams.version = NV_ENC_INITIALIZE_PARAMS_VER;
-		NvEncInitializeParams.encodeWidth = Width;
-		NvEncInitializeParams.encodeHeight = Height;
-		NvEncInitializeParams.darWidth = Width;
-		NvEncInitializeParams.darHeight = Height;
-		NvEncInitializeParams.encodeGUID = NV_ENC_CODEC_H264_GUID;
-		NvEncInitializeParams.presetGUID = NV_ENC_PRESET_LOW_LATENCY_HQ_GUID;
-		NvEncInitializeParams.frameRateNum = Settings.FrameRate;
-		FParse::Value(FCommandLine::Get(), TEXT("NvEncFrameRateNum="), NvEncInitializeParams.frameRateNum);
-		UE_LOG(RTSPStreaming, Log, TEXT("NvEnc configured to %d FPS"), NvEncInitializeParams.frameRateNum);
-		NvEncInitializeParams.frameRateDen = 1;
-		NvEncInitializeParams.enablePTD = 1;
-		NvEncInitializeParams.reportSliceOffsets = 0;
-		NvEncInitializeParams.enableSubFrameWrite = 0;
-		NvEncInitializeParams.encodeConfig = &NvEncConfig;
-		NvEncInitializeParams.maxEncodeWidth = 3840;
-		NvEncInitializeParams.maxEncodeHeight = 2160;
-		FParse::Value(FCommandLine::Get(), TEXT("NvEncMaxEncodeWidth="), NvEncInitializeParams.maxEncodeWidth);
-		FParse::Value(FCommandLine::Get(), TEXT("NvEncMaxEncodeHeight="), NvEncInitializeParams.maxEncodeHeight);
-	}
-	// Get preset config and tweak it accordingly
-	{
-		NV_ENC_PRESET_CONFIG PresetConfig;
-		FMemory::Memzero(PresetConfig);
-		PresetConfig.version = NV_ENC_PRESET_CONFIG_VER;
-		PresetConfig.presetCfg.version = NV_ENC_CONFIG_VER;
-		Result = NvEncodeAPI->nvEncGetEncodePresetConfig(EncoderInterface, NvEncInitializeParams.encodeGUID, NvEncInitializeParams.presetGUID, &PresetConfig);
-		checkf(NV_RESULT(Result), TEXT("Failed to select NVEncoder preset config (status: %d)"), Result);
-		FMemory::Memcpy(&NvEncConfig, &PresetConfig.presetCfg, sizeof(NV_ENC_CONFIG));
-		
-		NvEncConfig.profileGUID = NV_ENC_H264_PROFILE_BASELINE_GUID;
-		//NvEncConfig.profileGUID = NV_ENC_H264_PROFILE_HIGH_GUID;
-		//NvEncConfig.gopLength = NVENC_INFINITE_GOPLENGTH;
-		NvEncConfig.gopLength = 3; // once a sec
-		//NvEncConfig.frameIntervalP = 1;
-		//NvEncConfig.frameFieldMode = NV_ENC_PARAMS_FRAME_FIELD_MODE_FRAME;
-		//NvEncConfig.mvPrecision = NV_ENC_MV_PRECISION_QUARTER_PEL;
-		//NvEncConfig.rcParams.rateControlMode = NV_ENC_PARAMS_RC_CBR;
-		//FString RateControlMode;
-		//FParse::Value(FCommandLine::Get(), TEXT("NvEncRateControlMode="), RateControlMode);
-		//if (RateControlMode == TEXT("NV_ENC_PARAMS_RC_VBR_HQ"))
-		//{
-		//	NvEncConfig.rcParams.rateControlMode = NV_ENC_PARAMS_RC_VBR_HQ;
-		//}
-		NvEncConfig.rcParams.averageBitRate = Settings.AverageBitRate;
-		FParse::Value(FCommandLine::Get(), TEXT("NvEncAverageBitRate="), NvEncConfig.rcParams.averageBitRate);
-		//NvEncConfig.encodeCodecConfig.h264Config.chromaFormatIDC = 1;
-		NvEncConfig.encodeCodecConfig.h264Config.idrPeriod = NvEncConfig.gopLength;
+	// command line overrides of the session's defaults
+	const bool bHevc = IsH265(Settings.Codec);
+	auto Configure = [bWebSocketStreaming, bHevc](NV_ENC_INITIALIZE_PARAMS& InitializeParams, NV_ENC_CONFIG& Config)
+	{
+		FParse::Value(FCommandLine::Get(), TEXT("NvEncFrameRateNum="), InitializeParams.frameRateNum);
+		FParse::Value(FCommandLine::Get(), TEXT("NvEncMaxEncodeWidth="), InitializeParams.maxEncodeWidth);
+		FParse::Value(FCommandLine::Get(), TEXT("NvEncMaxEncodeHeight="), InitializeParams.maxEncodeHeight);
+		FParse::Value(FCommandLine::Get(), TEXT("NvEncAverageBitRate="), Config.rcParams.averageBitRate);
 
 		if (bWebSocketStreaming)
 		{
-			NvEncConfig.encodeCodecConfig.h264Config.sliceMode = 0;
-			NvEncConfig.encodeCodecConfig.h264Config.sliceModeData = 0;
-		}
-		else
-		{
-			// configure "entire frame as a single slice"
-			// seems WebRTC implementation doesn't work well with slicing, default mode 
-			// (Mode=3/ModeData=4 - 4 slices per frame) produces (rarely) grey full screen or just top half of it. 
-			// it also can be related with our handling of slices in proxy's FakeVideoEncoder
-			NvEncConfig.encodeCodecConfig.h264Config.sliceMode = 0;
-			NvEncConfig.encodeCodecConfig.h264Config.sliceModeData = 0;
-
-			// let encoder slice encoded frame so they can fit into RTP packets
-			// commented out because at some point it started to produce immediately visible visual artefacts
-			// on clients
-			//NvEncConfig.encodeCodecConfig.h264Config.sliceMode = 1;
-			//NvEncConfig.encodeCodecConfig.h264Config.sliceModeData = 1100; // max bytes per slice
-
-			// repeat SPS/PPS with each key-frame for a case when the first frame (with mandatory SPS/PPS) 
-			// was dropped by WebRTC
-			NvEncConfig.encodeCodecConfig.h264Config.repeatSPSPPS = 1;
+			// only RTSP clients need SPS/PPS repeated with each key-frame
+			if (bHevc)
+			{
+				Config.encodeCodecConfig.hevcConfig.repeatSPSPPS = 0;
+			}
+			else
+			{
+				Config.encodeCodecConfig.h264Config.repeatSPSPPS = 0;
+			}
 		}
 
-		// maybe doesn't have an effect, high level is chosen because we aim at high bitrate
-		NvEncConfig.encodeCodecConfig.h264Config.level = NV_ENC_LEVEL_H264_51;			
 		FString NvEncH264ConfigLevel;
 		FParse::Value(FCommandLine::Get(), TEXT("NvEncH264ConfigLevel="), NvEncH264ConfigLevel);
-		if (NvEncH264ConfigLevel == TEXT("NV_ENC_LEVEL_H264_52"))
+		if (NvEncH264ConfigLevel == TEXT("NV_ENC_LEVEL_H264_52") && !bHevc)
 		{
-			NvEncConfig.encodeCodecConfig.h264Config.level = NV_ENC_LEVEL_H264_52;
+			Config.encodeCodecConfig.h264Config.level = NV_ENC_LEVEL_H264_52;
 		}
-	}		
-	// Get encoder capability
-	{
-		NV_ENC_CAPS_PARAM CapsParam;
-		FMemory::Memzero(CapsParam);
-		CapsParam.version = NV_ENC_CAPS_PARAM_VER;
-		CapsParam.capsToQuery = NV_ENC_CAPS_ASYNC_ENCODE_SUPPORT;
-		int32 AsyncMode = 0;
-		Result = NvEncodeAPI->nvEncGetEncodeCaps(EncoderInterface, NvEncInitializeParams.encodeGUID, &CapsParam, &AsyncMode);
-		checkf(NV_RESULT(Result), TEXT("Failed to get NVEncoder capability params (status: %d)"), Result);
-		NvEncInitializeParams.enableEncodeAsync = bEnableAsyncMode ? AsyncMode : 0;
+	};
+
+	NVENCSTATUS Result = Session->Open(Device, NV_ENC_DEVICE_TYPE_DIRECTX, ToNvEncSettings(Settings), CompletionMode, Configure);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Unable to open NvEnc encoding session (status: %d)"), Result);
+		Session.Reset();
+		return false;
+	}
+	UE_LOG(RTSPStreaming, Log, TEXT("NvEnc configured to %s %d FPS, %s rate control with a %d bit VBV buffer, %s completion"), ANSI_TO_TCHAR(VideoCodecToString(Session->GetCodec())),
+		Session->GetInitializeParams().frameRateNum, RateControlModeToString(Session->GetConfig().rcParams.rateControlMode), Session->GetConfig().rcParams.vbvBufferSize,
+		ANSI_TO_TCHAR(CompletionModeToString(Session->GetCompletionMode())));
+	if (Session->GetCodec() != Settings.Codec)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("NvEnc can't encode %s on this GPU, encoding %s, which is announced to clients instead"), ANSI_TO_TCHAR(VideoCodecToString(Settings.Codec)), ANSI_TO_TCHAR(VideoCodecToString(Session->GetCodec())));
+	}
+
+	const int32 TemporalLayers = CVarEncoderTemporalLayers.GetValueOnAnyThread();
+	if (TemporalLayers > 1 && static_cast<int32>(Session->GetTemporalLayers()) < TemporalLayers)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("NvEnc encodes %d of %d temporal layers"), Session->GetTemporalLayers(), TemporalLayers);
+	}
+	if (CVarEncoderLtrInterval.GetValueOnAnyThread() > 0 && !Session->GetLtrInterval())
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("NvEnc can't invalidate reference frames%s, client losses are recovered with IDR frames"),
+			Session->GetTemporalLayers() > 1 ? TEXT(" with temporal layers") : TEXT(""));
+	}
+	if (Session->IsSliceStreaming())
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("NvEnc streams slices of up to %u bytes as they are encoded"), Session->GetMaxSliceSize());
+	}
+	else if (CVarEncoderSliceStreaming.GetValueOnAnyThread())
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("NvEnc can't read back slices while a frame is encoded%s, frames are sent once encoded"),
+			Session->GetCompletionMode() == ENvEncCompletionMode::Inline ? TEXT(" with inline completion") : TEXT(""));
 	}
-	
-	Result = NvEncodeAPI->nvEncInitializeEncoder(EncoderInterface, &NvEncInitializeParams);
-	checkf(NV_RESULT(Result), TEXT("Failed to initialize NVEncoder (status: %d)"), Result);
 
 	UpdateSpsPpsHeader();
+	return true;
+}
 
-	InitializeResources(BackBuffer);
+void FNvVideoEncoder::FNvVideoEncoderImpl::InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer)
+{
+	check(IsInRenderingThread());
+
+	// Bind to the delegates that are triggered when render thread is created or destroyed, so the encoder thread can act accordingly.
+	FCoreDelegates::PostRenderingThreadCreated.AddRaw(this, &FNvVideoEncoderImpl::PostRenderingThreadCreated);
+	FCoreDelegates::PreRenderingThreadDestroyed.AddRaw(this, &FNvVideoEncoderImpl::PreRenderingThreadDestroyed);
+
+	// the back buffer could have been resized while the session was being opened
+	UpdateSettings(Settings);
+
+	// slots beyond the starting depth get their inputs once the pipeline grows into them
+	for (int32 Slot = 0; Slot < Session->GetPipelineDepth(); ++Slot)
+	{
+		InitSlotInput(Slot);
+	}
 
-	if (NvEncInitializeParams.enableEncodeAsync)
+	if (Session->IsAsync())
 	{
-		EncoderThread.Reset(new FThread(TEXT("RTSPStreaming Video Send"), [this]() { EncoderCheckLoop(); }));
+		EncoderThread.Reset(new FThread(TEXT("RTSPStreaming Video Send"), [this]() { EncoderCheckLoop(); }, FThreadSettings::FromConsoleVariables(TEXT("Encoder.CompletionThread"))));
 	}
 
 	bIsSupported = true;
@@ -323,14 +351,10 @@ FNvVideoEncoder::FNvVideoEncoderImpl::~FNvVideoEncoderImpl()
 	{
 		// Reset bWaitForRenderThreadToResume so encoder thread can quit
 		bWaitForRenderThreadToResume = false;
+		RenderThreadResumedEvent->Trigger();
 
 		bExitEncoderThread = true;
-		// Trigger all frame events to release encoder thread waiting on them
-		// (we don't know here which frame it's waiting for)
-		for (FFrame& Frame : BufferedFrames)
-		{
-			SetEvent(Frame.OutputFrame.EventHandle);
-		}
+		Session->WakeCompletionWaiter();
 		// Exit encoder runnable thread before shutting down NvEnc interface
 		EncoderThread->Join();
 		// Increment the counter, so that if any pending render commands sent from EncoderCheckLoop 
@@ -338,213 +362,170 @@ FNvVideoEncoder::FNvVideoEncoderImpl::~FNvVideoEncoderImpl()
 		ImplCounter.Increment();
 	}
 
-	ReleaseResources();
-
-	if (EncoderInterface)
+	// unregisters the inputs before their textures are released
+	Session.Reset();
+	for (FTexture2DRHIRef& ResolvedBackBuffer : ResolvedBackBuffers)
 	{
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncDestroyEncoder(EncoderInterface);
-		checkf(NV_RESULT(Result), TEXT("Failed to destroy NvEnc interface (status: %d)"), Result);
-		EncoderInterface = nullptr;
+		ResolvedBackBuffer.SafeRelease();
 	}
 
+	FPlatformProcess::ReturnSynchEventToPool(RenderThreadResumedEvent);
 	bIsSupported = false;
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::UpdateSpsPpsHeader()
+void FNvVideoEncoder::FNvVideoEncoderImpl::PostRenderingThreadCreated()
 {
-	uint8 SpsPpsBuffer[NV_MAX_SEQ_HDR_LEN];
-	uint32 PayloadSize = 0;
-
-	NV_ENC_SEQUENCE_PARAM_PAYLOAD SequenceParamPayload;
-	FMemory::Memzero(SequenceParamPayload);
-	SequenceParamPayload.version = NV_ENC_SEQUENCE_PARAM_PAYLOAD_VER;
-	SequenceParamPayload.inBufferSize = NV_MAX_SEQ_HDR_LEN;
-	SequenceParamPayload.spsppsBuffer = &SpsPpsBuffer;
-	SequenceParamPayload.outSPSPPSPayloadSize = &PayloadSize;
+	bWaitForRenderThreadToResume = false;
+	RenderThreadResumedEvent->Trigger();
+}
 
-	_NVENCSTATUS Result = NvEncodeAPI->nvEncGetSequenceParams(EncoderInterface, &SequenceParamPayload);
-	checkf(NV_RESULT(Result), TEXT("Unable to get NvEnc sequence params (status: %d)"), Result);
+void FNvVideoEncoder::FNvVideoEncoderImpl::PreRenderingThreadDestroyed()
+{
+	RenderThreadResumedEvent->Reset();
+	bWaitForRenderThreadToResume = true;
+}
 
-	SpsPpsHeader.SetNum(PayloadSize);
-	FMemory::Memcpy(SpsPpsHeader.GetData(), SpsPpsBuffer, PayloadSize);
+void FNvVideoEncoder::FNvVideoEncoderImpl::UpdateSpsPpsHeader()
+{
+	const std::vector<uint8>& Header = Session->GetSpsPpsHeader();
+	SpsPpsHeader.SetNum(static_cast<int32>(Header.size()));
+	FMemory::Memcpy(SpsPpsHeader.GetData(), Header.data(), Header.size());
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::UpdateSettings(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer)
+void FNvVideoEncoder::FNvVideoEncoderImpl::UpdateSettings(const FVideoEncoderSettings& Settings)
 {
-	bool bSettingsChanged = false;
-	bool bResolutionChanged = false;
-	if (NvEncConfig.rcParams.averageBitRate != Settings.AverageBitRate)
+	if (Settings == RejectedSettings)
 	{
-		NvEncConfig.rcParams.averageBitRate = Settings.AverageBitRate;
-		bSettingsChanged = true;
-	}
-	if (NvEncInitializeParams.frameRateNum != Settings.FrameRate)
-	{
-		NvEncInitializeParams.frameRateNum = Settings.FrameRate;
-		bSettingsChanged = true;
-		UE_LOG(RTSPStreaming, Log, TEXT("NvEnc reconfigured to %d FPS"), NvEncInitializeParams.frameRateNum);
-	}
-	if (NvEncInitializeParams.encodeWidth != Settings.Width)
-	{
-		NvEncInitializeParams.encodeWidth = Settings.Width;
-		NvEncInitializeParams.darWidth = Settings.Width;
-		bResolutionChanged = true;
-		bSettingsChanged = true;
-	}
-	if (NvEncInitializeParams.encodeHeight != Settings.Height)
-	{
-		NvEncInitializeParams.encodeHeight = Settings.Height;
-		NvEncInitializeParams.darHeight = Settings.Height;
-		bResolutionChanged = true;
-		bSettingsChanged = true;
+		return;
 	}
 
-	if (bSettingsChanged)
+	const uint32 PreviousFrameRate = Session->GetInitializeParams().frameRateNum;
+	const NV_ENC_PARAMS_RC_MODE PreviousRateControlMode = Session->GetConfig().rcParams.rateControlMode;
+	bool bResolutionChanged = false;
+	NVENCSTATUS Result = Session->Reconfigure(ToNvEncSettings(Settings), bResolutionChanged);
+	if (Result != NV_ENC_SUCCESS)
 	{
-		NV_ENC_RECONFIGURE_PARAMS NvEncReconfigureParams;
-		FMemory::Memzero(NvEncReconfigureParams);
-		FMemory::Memcpy(&NvEncReconfigureParams.reInitEncodeParams, &NvEncInitializeParams, sizeof(NvEncInitializeParams));
-		NvEncReconfigureParams.version = NV_ENC_RECONFIGURE_PARAMS_VER;
-		NvEncReconfigureParams.forceIDR = bResolutionChanged;
-
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncReconfigureEncoder(EncoderInterface, &NvEncReconfigureParams);
-		checkf(NV_RESULT(Result), TEXT("Failed to reconfigure encoder (status: %d)"), Result);
+		// keeps encoding with the previous settings
+		UE_LOG(RTSPStreaming, Error, TEXT("Failed to reconfigure NvEnc to %dx%d %d FPS %d bps %s (status: %d)"), Settings.Width, Settings.Height, Settings.FrameRate, Settings.AverageBitRate,
+			RateControlModeToString(ToNvEncRateControlMode(Settings.RateControl)), Result);
+		RejectedSettings = Settings;
+		return;
 	}
+	RejectedSettings.Width = 0;
 
-	if (bResolutionChanged)
+	if (Session->GetInitializeParams().frameRateNum != PreviousFrameRate)
 	{
-		UpdateSpsPpsHeader();
+		UE_LOG(RTSPStreaming, Log, TEXT("NvEnc reconfigured to %d FPS"), Session->GetInitializeParams().frameRateNum);
 	}
-}
-
-void FNvVideoEncoder::FNvVideoEncoderImpl::CopyBackBuffer(const FTexture2DRHIRef& BackBuffer, const FTexture2DRHIRef& ResolvedBackBuffer)
-{
-	IRendererModule* RendererModule = &FModuleManager::GetModuleChecked<IRendererModule>("Renderer");
-	FRHICommandListImmediate& RHICmdList = FRHICommandListExecutor::GetImmediateCommandList();
-
-	if (BackBuffer->GetFormat() == ResolvedBackBuffer->GetFormat() &&
-		BackBuffer->GetSizeXY() == ResolvedBackBuffer->GetSizeXY())
+	if (Session->GetConfig().rcParams.rateControlMode != PreviousRateControlMode)
 	{
-		RHICmdList.CopyToResolveTarget(BackBuffer, ResolvedBackBuffer, FResolveParams());
+		UE_LOG(RTSPStreaming, Log, TEXT("NvEnc reconfigured to %s rate control"), RateControlModeToString(Session->GetConfig().rcParams.rateControlMode));
 	}
-	else // Texture format mismatch, use a shader to do the copy.
+	if (bResolutionChanged)
 	{
-		// #todo-renderpasses there's no explicit resolve here? Do we need one?
-		FRHIRenderPassInfo RPInfo(ResolvedBackBuffer, ERenderTargetActions::Load_Store);
-		RHICmdList.BeginRenderPass(RPInfo, TEXT("CopyBackbuffer"));
-		{
-			RHICmdList.SetViewport(0, 0, 0.0f, ResolvedBackBuffer->GetSizeX(), ResolvedBackBuffer->GetSizeY(), 1.0f);
-
-			FGraphicsPipelineStateInitializer GraphicsPSOInit;
-			RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
-			GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
-			GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
-			GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
-
-			TShaderMap<FGlobalShaderType>* ShaderMap = GetGlobalShaderMap(GMaxRHIFeatureLevel);
-			TShaderMapRef<FScreenVS> VertexShader(ShaderMap);
-			TShaderMapRef<FScreenPS> PixelShader(ShaderMap);
-
-			GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GFilterVertexDeclaration.VertexDeclarationRHI;
-			GraphicsPSOInit.BoundShaderState.VertexShaderRHI = GETSAFERHISHADER_VERTEX(*VertexShader);
-			GraphicsPSOInit.BoundShaderState.PixelShaderRHI = GETSAFERHISHADER_PIXEL(*PixelShader);
-			GraphicsPSOInit.PrimitiveType = PT_TriangleList;
-
-			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit);
-
-			if (ResolvedBackBuffer->GetSizeX() != BackBuffer->GetSizeX() || ResolvedBackBuffer->GetSizeY() != BackBuffer->GetSizeY())
-				PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Bilinear>::GetRHI(), BackBuffer);
-			else
-				PixelShader->SetParameters(RHICmdList, TStaticSamplerState<SF_Point>::GetRHI(), BackBuffer);
-
-			RendererModule->DrawRectangle(
-				RHICmdList,
-				0, 0,									// Dest X, Y
-				ResolvedBackBuffer->GetSizeX(),			// Dest Width
-				ResolvedBackBuffer->GetSizeY(),			// Dest Height
-				0, 0,									// Source U, V
-				1, 1,									// Source USize, VSize
-				ResolvedBackBuffer->GetSizeXY(),		// Target buffer size
-				FIntPoint(1, 1),						// Source texture size
-				*VertexShader,
-				EDRF_Default);
-		}
-		RHICmdList.EndRenderPass();
+		UpdateSpsPpsHeader();
 	}
 }
 
 void FNvVideoEncoder::FNvVideoEncoderImpl::EncoderCheckLoop()
 {
-	int CurrentIndex = 0;
+	int32 Slot = 0;
 	while (!bExitEncoderThread)
 	{
-		FFrame& Frame = BufferedFrames[CurrentIndex];
-
 		{
 			SCOPE_CYCLE_COUNTER(STAT_NvEnc_WaitForEncodeEvent);
-			DWORD Result = WaitForSingleObject(Frame.OutputFrame.EventHandle, INFINITE);
-			checkf(Result == WAIT_OBJECT_0, TEXT("Error waiting for frame event: %d"), Result);
-			if (bExitEncoderThread)
+			// with slice streaming the frame's slices are sent from here as they are encoded, in order with those of
+			// the frames before and after it
+			bool bFirstSlices = true;
+			auto OnSlices = [this, &bFirstSlices](const uint8* Slices, uint32 Size, const FNvEncFrameInfo& Frame, bool bLastSlices)
+			{
+				StreamSlices(Slices, Size, Frame, bFirstSlices, bLastSlices);
+				bFirstSlices = false;
+			};
+			if (!Session->WaitForCompletion(Slot, OnSlices) || bExitEncoderThread)
 			{
 				return;
 			}
 		}
 
-		Frame.EncodeEndTimeStamp = NowMs();
-
-		ResetEvent(Frame.OutputFrame.EventHandle);
 		int32 CurrImplCounter = ImplCounter.GetValue();
 		// When resolution changes, render thread is stopped and later restarted from game thread.
 		// We can't enqueue render commands when render thread is stopped, so pause until render thread is restarted.
-		while (bWaitForRenderThreadToResume) {}
+		if (bWaitForRenderThreadToResume)
+		{
+			RenderThreadResumedEvent->Wait();
+		}
 		FNvVideoEncoderImpl* This = this;
-		FFrame* InFrame = &Frame;
 		ENQUEUE_RENDER_COMMAND(NvEncProcessFrame)(
-			[This, InFrame, CurrImplCounter](FRHICommandListImmediate& RHICmdList)
+			[This, Slot, CurrImplCounter](FRHICommandListImmediate& RHICmdList)
 			{
 				if (CurrImplCounter != ImplCounter.GetValue()) // Check if the "this" we captured is still valid
 				{
 					return;
 				}
 	
-				This->ProcessFrame(*InFrame);
+				This->ProcessFrame(Slot);
 			}
 		);
 
-		CurrentIndex = (CurrentIndex + 1) % NumBufferedFrames;
+		Slot = (Slot + 1) % FNvEncSession::MaxSlots;
 	}
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 CaptureMs)
+void FNvVideoEncoder::FNvVideoEncoderImpl::StreamSlices(const uint8* Slices, uint32 Size, const FNvEncFrameInfo& Frame, bool bFirstSlices, bool bLastSlices)
 {
-	SET_DWORD_STAT(STAT_NvEnc_AsyncMode, NvEncInitializeParams.enableEncodeAsync ? 1 : 0);
+	SCOPE_CYCLE_COUNTER(STAT_NvEnc_StreamEncodedFrame);
+
+	// the only copy of the slices, shared by every client they are sent to
+	FEncodedFramePool::FBufferRef EncodedSlices = EncodedFramePool.Acquire();
+	EncodedSlices->SetNumUninitialized(Size, false);
+	FMemory::Memcpy(EncodedSlices->GetData(), Slices, Size);
+
+	FEncodedFrameInfo FrameInfo;
+	FrameInfo.Timestamp = Frame.Timestamp;
+	FrameInfo.bKeyframe = Frame.bIdrFrame;
+	FrameInfo.TemporalLayer = Frame.TemporalLayer;
+	FrameInfo.NumTemporalLayers = static_cast<uint8>(Session->GetTemporalLayers());
+	FrameInfo.bFirstPart = bFirstSlices;
+	FrameInfo.bLastPart = bLastSlices;
+	EncodedFrameReadyCallback(FrameInfo, EncodedSlices);
+}
 
-	UpdateSettings(Settings, BackBuffer);
+void FNvVideoEncoder::FNvVideoEncoderImpl::EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp)
+{
+	SET_DWORD_STAT(STAT_NvEnc_CompletionMode, static_cast<uint32>(Session->GetCompletionMode()));
 
-	uint32 BufferIndexToWrite = FrameCount % NumBufferedFrames;
-	FFrame& Frame = BufferedFrames[BufferIndexToWrite];
+	UpdateSettings(Settings);
+	UpdatePipelineDepth();
 
 	// If we don't have any free buffers, then we skip this rendered frame
-	if (Frame.bEncoding)
+	const int32 PipelineDepth = Session->GetPipelineDepth();
+	const int32 Slot = Session->BeginFrame(Timestamp);
+	if (Session->GetPipelineDepth() != PipelineDepth)
 	{
+		UE_LOG(RTSPStreaming, Log, TEXT("NvEnc pipeline depth %s to %d"), Session->GetPipelineDepth() > PipelineDepth ? TEXT("grown") : TEXT("shrunk"), Session->GetPipelineDepth());
+	}
+	SET_DWORD_STAT(STAT_NvEnc_PipelineDepth, Session->GetPipelineDepth());
+	if (Slot == INDEX_NONE)
+	{
+		INC_DWORD_STAT(STAT_NvEnc_DroppedFrames);
+		UE_LOG(RTSPStreaming, Verbose, TEXT("Dropped captured frame, %d frames in flight"), Session->GetInFlightFrames());
 		return;
 	}
 
-	// When resolution changes, buffers need to be recreated
-	if (Frame.ResolvedBackBuffer->GetSizeX() != Settings.Width || Frame.ResolvedBackBuffer->GetSizeY() != Settings.Height)
+	// inputs are created the first time a slot is used and recreated when the resolution changes
+	if (!Session->HasInput(Slot) && !InitSlotInput(Slot))
 	{
-		ReleaseFrameInputBuffer(Frame);
-		InitFrameInputBuffer(BackBuffer, Frame);
+		Session->AbortFrame(Slot);
+		INC_DWORD_STAT(STAT_NvEnc_DroppedFrames);
+		return;
 	}
-
-	Frame.bEncoding = true;
-	Frame.FrameIdx = FrameCount;
-	Frame.CaptureTimeStamp = CaptureMs;
+	SET_DWORD_STAT(STAT_NvEnc_InFlightFrames, Session->GetInFlightFrames());
 
 	// Copy BackBuffer to ResolvedBackBuffer
 	{
 		SCOPE_CYCLE_COUNTER(STAT_NvEnc_CopyBackBuffer);
-		CopyBackBuffer(BackBuffer, Frame.ResolvedBackBuffer);
+		CopyBackBuffer(BackBuffer, ResolvedBackBuffers[Slot]);
 	}
 
 	// Encode frame
@@ -552,265 +533,220 @@ void FNvVideoEncoder::FNvVideoEncoderImpl::EncodeFrame(const FVideoEncoderSettin
 		FRHICommandList& RHICmdList = FRHICommandListExecutor::GetImmediateCommandList();
 		if (RHICmdList.Bypass())
 		{
-			FRHITransferRenderTargetToNvEnc Command(this, &Frame);
+			FRHITransferRenderTargetToNvEnc Command(this, Slot);
 			Command.Execute(RHICmdList);
 		}
 		else
 		{
-			ALLOC_COMMAND_CL(RHICmdList, FRHITransferRenderTargetToNvEnc)(this, &Frame);
+			ALLOC_COMMAND_CL(RHICmdList, FRHITransferRenderTargetToNvEnc)(this, Slot);
 		}
 	}
-
-	FrameCount++;
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::TransferRenderTargetToHWEncoder(FFrame& Frame)
+void FNvVideoEncoder::FNvVideoEncoderImpl::UpdatePipelineDepth()
 {
-	SCOPE_CYCLE_COUNTER(STAT_NvEnc_SendBackBufferToEncoder);
-
-	NV_ENC_PIC_PARAMS PicParams;
-	FMemory::Memzero(PicParams);
-	PicParams.version = NV_ENC_PIC_PARAMS_VER;
-	PicParams.inputBuffer = Frame.InputFrame.MappedResource;
-	PicParams.bufferFmt = Frame.InputFrame.BufferFormat;
-	PicParams.inputWidth = NvEncInitializeParams.encodeWidth;
-	PicParams.inputHeight = NvEncInitializeParams.encodeHeight;
-	PicParams.outputBitstream = Frame.OutputFrame.BitstreamBuffer;
-	PicParams.completionEvent = Frame.OutputFrame.EventHandle;
-	PicParams.inputTimeStamp = Frame.FrameIdx;
-	PicParams.pictureStruct = NV_ENC_PIC_STRUCT_FRAME;
-
-	if (bForceIdrFrame)
+	const bool bAdaptive = CVarEncoderAdaptivePipelineDepth.GetValueOnAnyThread() != 0;
+	Session->SetAdaptivePipelineDepth(bAdaptive);
+	if (!bAdaptive)
 	{
-		PicParams.encodePicFlags |= NV_ENC_PIC_FLAG_FORCEIDR;
+		Session->SetPipelineDepth(CVarEncoderPipelineDepth.GetValueOnAnyThread());
 	}
-	bForceIdrFrame = false;
+}
+
+void FNvVideoEncoder::FNvVideoEncoderImpl::TransferRenderTargetToHWEncoder(int32 Slot)
+{
+	SCOPE_CYCLE_COUNTER(STAT_NvEnc_SendBackBufferToEncoder);
 
-	Frame.EncodeStartTimeStamp = NowMs();
-	_NVENCSTATUS Result = NvEncodeAPI->nvEncEncodePicture(EncoderInterface, &PicParams);
-	checkf(NV_RESULT(Result), TEXT("Failed to encode frame (status: %d)"), Result);
+	// a failed frame still completes, ProcessFrame() reports it
+	Session->SubmitFrame(Slot);
 
-	if (!NvEncInitializeParams.enableEncodeAsync)
+	if (!Session->IsAsync())
 	{
 		// In synchronous mode, simply process the frame immediately.
-		ProcessFrame(Frame);
+		ProcessFrame(Slot);
 	}
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::ProcessFrame(FFrame& Frame)
+void FNvVideoEncoder::FNvVideoEncoderImpl::ProcessFrame(int32 Slot)
 {
 	// If the expected frame hasn't been doing encoding, then nothing to do
-	checkf(Frame.bEncoding, TEXT("This should not happen"));
-	if (!Frame.bEncoding)
+	checkf(Session->IsEncoding(Slot), TEXT("This should not happen"));
+	if (!Session->IsEncoding(Slot))
 	{
 		return;
 	}
 
-	// log encoding latency for every 1000th frame
-	if (Frame.FrameIdx % 1000 == 0)
+	// Retrieve encoded frame from output buffer, this is the only copy of the bitstream. Streamed slices were copied
+	// and sent by the completion thread already
+	const bool bSliceStreaming = Session->IsSliceStreaming();
+	TSharedPtr<TArray<uint8>, ESPMode::ThreadSafe> EncodedFrame;
+	FNvEncFrameInfo Frame;
+	NVENCSTATUS Result;
 	{
-		uint64 ms = NowMs();
-		UE_LOG(RTSPStreaming, Log, TEXT("#%d %d %d %d"), Frame.FrameIdx, Frame.EncodeStartTimeStamp - Frame.CaptureTimeStamp, Frame.EncodeEndTimeStamp - Frame.EncodeStartTimeStamp, ms - Frame.EncodeEndTimeStamp);
+		SCOPE_CYCLE_COUNTER(STAT_NvEnc_RetrieveEncodedFrame);
+		Result = Session->CompleteFrame(Slot, [this, bSliceStreaming, &EncodedFrame](const uint8* Bitstream, uint32 Size)
+		{
+			if (!bSliceStreaming)
+			{
+				FEncodedFramePool::FBufferRef Buffer = EncodedFramePool.Acquire();
+				Buffer->SetNumUninitialized(Size, false);
+				FMemory::Memcpy(Buffer->GetData(), Bitstream, Size);
+				EncodedFrame = Buffer;
+			}
+		}, Frame);
 	}
 
-	Frame.bEncoding = false;
+	uint64 ms = FNvEncSession::GetTimeMs();
+	SET_DWORD_STAT(STAT_NvEnc_SlotWaitMs, ms - Frame.EncodeStartTimeMs);
 
-	// Retrieve encoded frame from output buffer
+	if (Result != NV_ENC_SUCCESS)
 	{
-		SCOPE_CYCLE_COUNTER(STAT_NvEnc_RetrieveEncodedFrame);
-
-		NV_ENC_LOCK_BITSTREAM LockBitstream;
-		FMemory::Memzero(LockBitstream);
-		LockBitstream.version = NV_ENC_LOCK_BITSTREAM_VER;
-		LockBitstream.outputBitstream = Frame.OutputFrame.BitstreamBuffer;
-		LockBitstream.doNotWait = NvEncInitializeParams.enableEncodeAsync;
-
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncLockBitstream(EncoderInterface, &LockBitstream);
-		checkf(NV_RESULT(Result), TEXT("Failed to lock bitstream (status: %d)"), Result);
-
-		Frame.EncodedFrame.SetNum(LockBitstream.bitstreamSizeInBytes);
-		FMemory::Memcpy(Frame.EncodedFrame.GetData(), LockBitstream.bitstreamBufferPtr, LockBitstream.bitstreamSizeInBytes);
+		INC_DWORD_STAT(STAT_NvEnc_DroppedFrames);
+		UE_LOG(RTSPStreaming, Warning, TEXT("NvEnc failed to encode frame %llu (status: %d)"), Frame.FrameIdx, Result);
+		return;
+	}
 
-		Result = NvEncodeAPI->nvEncUnlockBitstream(EncoderInterface, Frame.OutputFrame.BitstreamBuffer);
-		checkf(NV_RESULT(Result), TEXT("Failed to unlock bitstream (status: %d)"), Result);
-		Frame.bIdrFrame = LockBitstream.pictureType == NV_ENC_PIC_TYPE_IDR;
+	// log encoding latency for every 1000th frame
+	if (Frame.FrameIdx % 1000 == 0)
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("#%d %d %d %d"), Frame.FrameIdx, Frame.EncodeStartTimeMs - Frame.CaptureTimeMs, Frame.EncodeEndTimeMs - Frame.EncodeStartTimeMs, ms - Frame.EncodeEndTimeMs);
 	}
+	SET_DWORD_STAT(STAT_NvEnc_SlicesPerFrame, Frame.NumSlices);
 
 	// Stream the encoded frame
+	if (EncodedFrame.IsValid())
 	{
 		SCOPE_CYCLE_COUNTER(STAT_NvEnc_StreamEncodedFrame);
-		EncodedFrameReadyCallback(Frame.CaptureTimeStamp, Frame.bIdrFrame, Frame.EncodedFrame.GetData(), Frame.EncodedFrame.Num());
+		FEncodedFrameInfo FrameInfo;
+		FrameInfo.Timestamp = Frame.Timestamp;
+		FrameInfo.bKeyframe = Frame.bIdrFrame;
+		FrameInfo.TemporalLayer = Frame.TemporalLayer;
+		FrameInfo.NumTemporalLayers = static_cast<uint8>(Session->GetTemporalLayers());
+		EncodedFrameReadyCallback(FrameInfo, EncodedFrame.ToSharedRef());
 	}
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::InitFrameInputBuffer(const FTexture2DRHIRef& BackBuffer, FFrame& Frame)
+bool FNvVideoEncoder::FNvVideoEncoderImpl::InitSlotInput(int32 Slot)
 {
-	// Create resolved back buffer texture
-	{
-		// Make sure format used here is compatible with NV_ENC_BUFFER_FORMAT specified later in NV_ENC_REGISTER_RESOURCE bufferFormat
-		FRHIResourceCreateInfo CreateInfo;
-		Frame.ResolvedBackBuffer = RHICreateTexture2D(NvEncInitializeParams.encodeWidth, NvEncInitializeParams.encodeHeight, EPixelFormat::PF_A2B10G10R10, 1, 1, TexCreate_RenderTargetable, CreateInfo);
-	}
+	ReleaseSlotInput(Slot);
 
-	FMemory::Memzero(Frame.InputFrame);
-	// Register input back buffer
-	{
-		ID3D11Texture2D* ResolvedBackBufferDX11 = (ID3D11Texture2D*)(GetD3D11TextureFromRHITexture(Frame.ResolvedBackBuffer)->GetResource());
-		EPixelFormat PixelFormat = Frame.ResolvedBackBuffer->GetFormat();
+	const NV_ENC_INITIALIZE_PARAMS& InitializeParams = Session->GetInitializeParams();
 
-		NV_ENC_REGISTER_RESOURCE RegisterResource;
-		FMemory::Memzero(RegisterResource);
-		RegisterResource.version = NV_ENC_REGISTER_RESOURCE_VER;
-		RegisterResource.resourceType = NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX;
-		RegisterResource.resourceToRegister = (void*)ResolvedBackBufferDX11;
-		RegisterResource.width = NvEncInitializeParams.encodeWidth;
-		RegisterResource.height = NvEncInitializeParams.encodeHeight;
-		RegisterResource.bufferFormat = NV_ENC_BUFFER_FORMAT_ABGR10;	// Make sure ResolvedBackBuffer is created with a compatible format
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncRegisterResource(EncoderInterface, &RegisterResource);
-		checkf(NV_RESULT(Result), TEXT("Failed to register input back buffer (status: %d)"), Result);
+	// Make sure format used here is compatible with NV_ENC_BUFFER_FORMAT specified in RegisterInput. HEVC Main10 encodes
+	// its 10 bits, the 8 bit profiles have the driver convert it
+	FRHIResourceCreateInfo CreateInfo;
+	ResolvedBackBuffers[Slot] = RHICreateTexture2D(InitializeParams.encodeWidth, InitializeParams.encodeHeight, EPixelFormat::PF_A2B10G10R10, 1, 1, TexCreate_RenderTargetable, CreateInfo);
 
-		Frame.InputFrame.RegisteredResource = RegisterResource.registeredResource;
-		Frame.InputFrame.BufferFormat = RegisterResource.bufferFormat;
-	}
-	// Map input buffer resource
+	ID3D11Texture2D* ResolvedBackBufferDX11 = (ID3D11Texture2D*)(GetD3D11TextureFromRHITexture(ResolvedBackBuffers[Slot])->GetResource());
+	NVENCSTATUS Result = Session->RegisterInput(Slot, ResolvedBackBufferDX11, NV_ENC_INPUT_RESOURCE_TYPE_DIRECTX, NV_ENC_BUFFER_FORMAT_ABGR10);
+	if (Result != NV_ENC_SUCCESS)
 	{
-		NV_ENC_MAP_INPUT_RESOURCE MapInputResource;
-		FMemory::Memzero(MapInputResource);
-		MapInputResource.version = NV_ENC_MAP_INPUT_RESOURCE_VER;
-		MapInputResource.registeredResource = Frame.InputFrame.RegisteredResource;
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncMapInputResource(EncoderInterface, &MapInputResource);
-		checkf(NV_RESULT(Result), TEXT("Failed to map NvEnc input resource (status: %d)"), Result);
-		Frame.InputFrame.MappedResource = MapInputResource.mappedResource;
+		UE_LOG(RTSPStreaming, Warning, TEXT("Failed to register NvEnc input %d (status: %d)"), Slot, Result);
+		ResolvedBackBuffers[Slot].SafeRelease();
+		return false;
 	}
+	return true;
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::InitializeResources(const FTexture2DRHIRef& BackBuffer)
+void FNvVideoEncoder::FNvVideoEncoderImpl::ReleaseSlotInput(int32 Slot)
 {
-	for (uint32 i = 0; i < NumBufferedFrames; ++i)
-	{
-		FFrame& Frame = BufferedFrames[i];
-		
-		InitFrameInputBuffer(BackBuffer, Frame);
-
-		FMemory::Memzero(Frame.OutputFrame);
-		// Create output bitstream buffer
-		{
-			NV_ENC_CREATE_BITSTREAM_BUFFER CreateBitstreamBuffer;
-			FMemory::Memzero(CreateBitstreamBuffer);
-			CreateBitstreamBuffer.version = NV_ENC_CREATE_BITSTREAM_BUFFER_VER;
-			CreateBitstreamBuffer.size = BITSTREAM_SIZE;
-			CreateBitstreamBuffer.memoryHeap = NV_ENC_MEMORY_HEAP_SYSMEM_CACHED;
-			_NVENCSTATUS Result = NvEncodeAPI->nvEncCreateBitstreamBuffer(EncoderInterface, &CreateBitstreamBuffer);
-			checkf(NV_RESULT(Result), TEXT("Failed to create NvEnc bitstream buffer (status: %d)"), Result);
-			Frame.OutputFrame.BitstreamBuffer = CreateBitstreamBuffer.bitstreamBuffer;
-		}
-		// Register event handles
-		if (NvEncInitializeParams.enableEncodeAsync)
-		{
-			RegisterAsyncEvent(&Frame.OutputFrame.EventHandle);
-		}
-	}
+	Session->UnregisterInput(Slot);
+	ResolvedBackBuffers[Slot].SafeRelease();
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::ReleaseFrameInputBuffer(FFrame& Frame)
-{
-	_NVENCSTATUS Result = NvEncodeAPI->nvEncUnmapInputResource(EncoderInterface, Frame.InputFrame.MappedResource);
-	checkf(NV_RESULT(Result), TEXT("Failed to unmap input resource (status: %d)"), Result);
-	Frame.InputFrame.MappedResource = nullptr;
 
-	Result = NvEncodeAPI->nvEncUnregisterResource(EncoderInterface, Frame.InputFrame.RegisteredResource);
-	checkf(NV_RESULT(Result), TEXT("Failed to unregister input buffer resource (status: %d)"), Result);
-	Frame.InputFrame.RegisteredResource = nullptr;
+FNvVideoEncoder::FNvVideoEncoder(const FVideoEncoderSettings& Settings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
+	: NvVideoEncoderImpl(nullptr), DllHandle(nullptr), InitialSettings(Settings), EncodedFrameReadyCallback(InEncodedFrameReadyCallback)
+{}
 
-	Frame.ResolvedBackBuffer.SafeRelease();
+TUniquePtr<IVideoEncoder> FNvVideoEncoder::Create(const FVideoEncoderSettings& Settings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
+{
+	return MakeUnique<FNvVideoEncoder>(Settings, InEncodedFrameReadyCallback);
 }
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::ReleaseResources()
+FNvVideoEncoder::~FNvVideoEncoder()
 {
-	for (uint32 i = 0; i < NumBufferedFrames; ++i)
+	if (DllHandle)
 	{
-		FFrame& Frame = BufferedFrames[i];
-
-		ReleaseFrameInputBuffer(Frame);
-
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncDestroyBitstreamBuffer(EncoderInterface, Frame.OutputFrame.BitstreamBuffer);
-		checkf(NV_RESULT(Result), TEXT("Failed to destroy output buffer bitstream (status: %d)"), Result);
-		Frame.OutputFrame.BitstreamBuffer = nullptr;
-
-		if (Frame.OutputFrame.EventHandle)
-		{
-			UnregisterAsyncEvent(Frame.OutputFrame.EventHandle);
-			CLOSE_EVENT_HANDLE(Frame.OutputFrame.EventHandle);
-			Frame.OutputFrame.EventHandle = nullptr;
-		}
-	}
-}
+		delete NvVideoEncoderImpl;
 
-void FNvVideoEncoder::FNvVideoEncoderImpl::RegisterAsyncEvent(void** OutEvent)
-{
-	NV_ENC_EVENT_PARAMS EventParams;
-	FMemory::Memzero(EventParams);
-	EventParams.version = NV_ENC_EVENT_PARAMS_VER;
 #if defined PLATFORM_WINDOWS
-	EventParams.completionEvent = CreateEvent(nullptr, false, false, nullptr);
+		FPlatformProcess::FreeDllHandle(DllHandle);
+#else
+		dlclose(DllHandle);
 #endif
-	_NVENCSTATUS Result = NvEncodeAPI->nvEncRegisterAsyncEvent(EncoderInterface, &EventParams);
-	checkf(NV_RESULT(Result), TEXT("Failed to register async event (status: %d)"), Result);
-	*OutEvent = EventParams.completionEvent;
-}
-
-void FNvVideoEncoder::FNvVideoEncoderImpl::UnregisterAsyncEvent(void* Event)
-{
-	if (Event)
-	{
-		NV_ENC_EVENT_PARAMS EventParams;
-		FMemory::Memzero(EventParams);
-		EventParams.version = NV_ENC_EVENT_PARAMS_VER;
-		EventParams.completionEvent = Event;
-		_NVENCSTATUS Result = NvEncodeAPI->nvEncUnregisterAsyncEvent(EncoderInterface, &EventParams);
-		checkf(NV_RESULT(Result), TEXT("Failed to unregister async event (status: %d)"), Result);
+		DllHandle = nullptr;
 	}
 }
 
-
-FNvVideoEncoder::FNvVideoEncoder(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
-	: NvVideoEncoderImpl(nullptr), DllHandle(nullptr)
+bool FNvVideoEncoder::Initialize()
 {
+	// -NvEncLibrary=<path> loads another build of the driver library, e.g. the stub in NvEncCore/Stub
+	FString LibraryName;
 #if defined PLATFORM_WINDOWS
 #if defined _WIN64
-	DllHandle = FPlatformProcess::GetDllHandle(TEXT("nvEncodeAPI64.dll"));
+	LibraryName = TEXT("nvEncodeAPI64.dll");
 #else
-	DllHandle = FPlatformProcess::GetDllHandle(TEXT("nvEncodeAPI.dll"));
+	LibraryName = TEXT("nvEncodeAPI.dll");
 #endif
 #else
-	DllHandle = FPlatformProcess::GetDllHandle(TEXT("libnvidia-encode.so.1"));
+	LibraryName = TEXT("libnvidia-encode.so.1");
 #endif
-	checkf(DllHandle != nullptr, TEXT("Failed to load NvEncode dll"));
+	FParse::Value(FCommandLine::Get(), TEXT("NvEncLibrary="), LibraryName);
 
-	if (DllHandle)
+	DllHandle = FPlatformProcess::GetDllHandle(*LibraryName);
+	if (!DllHandle)
 	{
-		NvVideoEncoderImpl = new FNvVideoEncoderImpl(DllHandle, Settings, BackBuffer, true, InEncodedFrameReadyCallback);
+		UE_LOG(RTSPStreaming, Error, TEXT("Failed to load NvEncode dll %s"), *LibraryName);
+		return false;
 	}
-}
 
-FNvVideoEncoder::~FNvVideoEncoder()
-{
-	if (DllHandle)
-	{
-		delete NvVideoEncoderImpl;
+	// define a function pointer for creating an instance of nvEncodeAPI
+	typedef NVENCSTATUS(NVENCAPI *NVENCAPIPROC)(NV_ENCODE_API_FUNCTION_LIST*);
+	NVENCAPIPROC NvEncodeAPICreateInstanceFunc;
 
 #if defined PLATFORM_WINDOWS
-		FPlatformProcess::FreeDllHandle(DllHandle);
+#	pragma warning(push)
+#		pragma warning(disable: 4191) // https://stackoverflow.com/a/4215425/453271
+	NvEncodeAPICreateInstanceFunc = (NVENCAPIPROC)FPlatformProcess::GetDllExport((HMODULE)DllHandle, TEXT("NvEncodeAPICreateInstance"));
+#	pragma warning(pop)
 #else
-		dlclose(DllHandle);
+	NvEncodeAPICreateInstanceFunc = (NVENCAPIPROC)dlsym(DllHandle, "NvEncodeAPICreateInstance");
 #endif
-		DllHandle = nullptr;
+	if (NvEncodeAPICreateInstanceFunc == nullptr)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("NvEncodeAPICreateInstance not found in %s"), *LibraryName);
+		return false;
+	}
+
+	NV_ENCODE_API_FUNCTION_LIST NvEncodeAPI;
+	FMemory::Memzero(NvEncodeAPI);
+	NvEncodeAPI.version = NV_ENCODE_API_FUNCTION_LIST_VER;
+	NVENCSTATUS Result = NvEncodeAPICreateInstanceFunc(&NvEncodeAPI);
+	if (Result != NV_ENC_SUCCESS)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Unable to create NvEnc API function list (status: %d)"), Result);
+		return false;
 	}
+
+	NvVideoEncoderImpl = new FNvVideoEncoderImpl(EncodedFrameReadyCallback);
+	if (!NvVideoEncoderImpl->Open(NvEncodeAPI, InitialSettings, ENvEncCompletionMode::Event))
+	{
+		delete NvVideoEncoderImpl;
+		NvVideoEncoderImpl = nullptr;
+		return false;
+	}
+	return true;
+}
+
+void FNvVideoEncoder::InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer)
+{
+	NvVideoEncoderImpl->InitializeResources(Settings, BackBuffer);
 }
 
 bool FNvVideoEncoder::IsSupported() const
 {
-	return DllHandle && NvVideoEncoderImpl->IsSupported();
+	return NvVideoEncoderImpl && NvVideoEncoderImpl->IsSupported();
 }
 
 bool FNvVideoEncoder::IsAsyncEnabled() const
@@ -818,9 +754,14 @@ bool FNvVideoEncoder::IsAsyncEnabled() const
 	return NvVideoEncoderImpl->IsAsyncEnabled();
 }
 
-void FNvVideoEncoder::EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 CaptureMs)
+void FNvVideoEncoder::EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp)
 {
-	NvVideoEncoderImpl->EncodeFrame(Settings, BackBuffer, CaptureMs);
+	NvVideoEncoderImpl->EncodeFrame(Settings, BackBuffer, Timestamp);
+}
+
+EVideoCodec FNvVideoEncoder::GetCodec(EVideoCodec Requested) const
+{
+	return NvVideoEncoderImpl ? NvVideoEncoderImpl->GetCodec() : Requested;
 }
 
 const TArray<uint8>& FNvVideoEncoder::GetSpsPpsHeader() const
@@ -832,3 +773,8 @@ void FNvVideoEncoder::ForceIdrFrame()
 {
 	NvVideoEncoderImpl->ForceIdrFrame();
 }
+
+void FNvVideoEncoder::ReportLoss(uint32 RtpTimestamp)
+{
+	NvVideoEncoderImpl->ReportLoss(RtpTimestamp);
+}
@@ -10,9 +10,14 @@ DECLARE_STATS_GROUP(TEXT("NvEnc"), STATGROUP_NvEnc, STATCAT_Advanced);
 class FNvVideoEncoder : public IVideoEncoder
 {
 public:
-	FNvVideoEncoder(const FVideoEncoderSettings& InSettings, const FTexture2DRHIRef& BackBuffer, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
+	FNvVideoEncoder(const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
 	~FNvVideoEncoder();
 
+	/**
+	* Encoder factory for the controller.
+	*/
+	static TUniquePtr<IVideoEncoder> Create(const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
+
 	/**
 	* Return name of the encoder.
 	*/
@@ -24,6 +29,21 @@ public:
 	*/
 	virtual bool IsSupported() const override;
 
+	/**
+	* Loads the NvEnc dll, opens and initializes an encoding session.
+	*/
+	virtual bool Initialize() override;
+
+	/**
+	* Registers input and output buffers and starts the encoder thread.
+	*/
+	virtual void InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer) override;
+
+	/**
+	* HEVC Main if Main10 was asked for and the GPU can't encode 10 bit.
+	*/
+	virtual EVideoCodec GetCodec(EVideoCodec Requested) const override;
+
 	/**
 	* Get Sps/Pps header data.
 	*/
@@ -32,13 +52,18 @@ public:
 	/**
 	* Encode an input back buffer.
 	*/
-	virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 CaptureMs) override;
+	virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp) override;
 
 	/**
 	* Force the next frame to be an IDR frame.
 	*/
 	virtual void ForceIdrFrame() override;
 
+	/**
+	* Predict the next frame from a long-term reference the client still has, if enabled.
+	*/
+	virtual void ReportLoss(uint32 RtpTimestamp) override;
+
 	/**
 	* If encoder is running in async/sync mode.
 	*/
@@ -48,4 +73,6 @@ private:
 	class FNvVideoEncoderImpl;
 	FNvVideoEncoderImpl* NvVideoEncoderImpl;
 	void* DllHandle;
+	FVideoEncoderSettings InitialSettings;
+	FEncodedFrameReadyCallback EncodedFrameReadyCallback;
 };
\ No newline at end of file
@@ -0,0 +1,54 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeLock.h"
+
+// fixed size packet buffers carved out of one contiguous allocation
+// the single allocation can be registered with the kernel once (io_uring fixed buffers) and every packet is
+// then addressed by its index
+class FPacketPool final
+{
+public:
+	FPacketPool(uint32 InPacketSize, uint32 InNumPackets)
+		: PacketSize(InPacketSize)
+		, NumPackets(InNumPackets)
+	{
+		Memory.SetNumUninitialized(PacketSize * NumPackets);
+		FreeList.Reserve(NumPackets);
+		for (uint32 Index = NumPackets; Index > 0; --Index)
+		{
+			FreeList.Add(Index - 1);
+		}
+	}
+
+	int32 Alloc()											// index of a free packet, INDEX_NONE if the pool is exhausted
+	{
+		FScopeLock Lock(&FreeListMt);
+		return FreeList.Num() ? FreeList.Pop(false) : INDEX_NONE;
+	}
+
+	void Free(int32 Index)
+	{
+		FScopeLock Lock(&FreeListMt);
+		FreeList.Add(Index);
+	}
+
+	uint8* GetPacket(int32 Index)
+	{
+		return Memory.GetData() + static_cast<SIZE_T>(Index) * PacketSize;
+	}
+
+	uint8* GetMemory()					{ return Memory.GetData(); }
+	SIZE_T GetMemorySize() const		{ return Memory.Num(); }
+	uint32 GetPacketSize() const		{ return PacketSize; }
+	uint32 GetNumPackets() const		{ return NumPackets; }
+
+private:
+	const uint32		PacketSize;
+	const uint32		NumPackets;
+	TArray<uint8>		Memory;				// NumPackets * PacketSize bytes, never reallocated
+	FCriticalSection	FreeListMt;			// thread lock for FreeList
+	TArray<int32>		FreeList;			// indices of free packets
+};
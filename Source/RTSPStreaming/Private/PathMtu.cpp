@@ -0,0 +1,234 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "PathMtu.h"
+#include "NativeSocket.h"
+#include "RTSPStreamingCommon.h"
+
+#if PLATFORM_LINUX
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#endif
+
+static TAutoConsoleVariable<int32> CVarStreamerPathMtuDiscovery(
+	TEXT("Streamer.PathMtuDiscovery"),
+	1,
+	TEXT("Probes the path MTU of every UDP client and sizes its RTP packets to it, 0 uses Streamer.MaxPayloadSize for everyone"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarStreamerPathMtuMax(
+	TEXT("Streamer.PathMtuMax"),
+	9000,
+	TEXT("Largest datagram path MTU discovery probes for, bytes"),
+	ECVF_Default);
+
+static const uint32 MinMtu = 576;					// IPv4 minimum reassembly size, reported MTUs below are ignored
+static const uint32 SearchGranularity = 32;			// search stops when the ceiling is this close, bytes
+static const uint32 MaxProbeAttempts = 3;			// lost probes before a size counts as too large
+static const double ProbeTimeout = 10.0;			// receiver reports usually come every 5 seconds
+static const double ProbeRetryInterval = 1.0;
+static const double RaiseInterval = 600.0;			// paths change, search upward again after 10 minutes (RFC 1191)
+
+FPathMtu::FPathMtu()
+	: State(EState::Disabled)
+	, Mtu(0)
+	, MaxMtu(0)
+	, Ceiling(0)
+	, bCeilingReported(false)
+	, ProbeSize(0)
+	, ProbeSequenceNumber(0)
+	, ProbeAttempts(0)
+	, ProbeSentTime(0.0)
+	, NextProbeTime(0.0)
+	, LastCumulativeLost(INDEX_NONE)
+{}
+
+void FPathMtu::Start(FSocket* Socket, uint32 InitialMtu, uint32 MaxSupportedMtu)
+{
+	if (!CVarStreamerPathMtuDiscovery.GetValueOnAnyThread())
+	{
+		return;
+	}
+
+	//sets DF on every datagram and stops the kernel from fragmenting or clamping to its cached PMTU
+	const SOCKET NativeSocket = GetNativeSocket(Socket);
+#if PLATFORM_LINUX
+	int32 Discover = IP_PMTUDISC_PROBE;
+	int32 Enable = 1;
+	if (setsockopt(NativeSocket, IPPROTO_IP, IP_MTU_DISCOVER, &Discover, sizeof(Discover)) != 0 ||
+		setsockopt(NativeSocket, IPPROTO_IP, IP_RECVERR, &Enable, sizeof(Enable)) != 0)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("Failed to enable path MTU discovery (errno: %d)"), errno);
+		return;
+	}
+#elif PLATFORM_WINDOWS
+	DWORD Enable = 1;
+	if (setsockopt(NativeSocket, IPPROTO_IP, IP_DONTFRAGMENT, reinterpret_cast<const char*>(&Enable), sizeof(Enable)) != 0)
+	{
+		UE_LOG(RTSPStreaming, Warning, TEXT("Failed to set IP_DONTFRAGMENT (error: %d)"), WSAGetLastError());
+		return;
+	}
+#else
+	return;
+#endif
+
+	Mtu = FMath::Min(InitialMtu, MaxSupportedMtu);
+	MaxMtu = FMath::Max(FMath::Min(static_cast<uint32>(FMath::Max(CVarStreamerPathMtuMax.GetValueOnAnyThread(), 0)), MaxSupportedMtu), Mtu);
+	Ceiling = MaxMtu + 1;
+	bCeilingReported = false;
+	ProbeAttempts = 0;
+	NextProbeTime = 0.0;
+	LastCumulativeLost = INDEX_NONE;
+	State = EState::Search;
+}
+
+uint32 FPathMtu::GetProbeSize(double Now)
+{
+	if (State == EState::Probing && Now - ProbeSentTime > ProbeTimeout)
+	{
+		//the client doesn't send receiver reports or the probe got lost
+		ProbeFailed(Now);
+	}
+
+	if (State == EState::Done && Now >= NextProbeTime)
+	{
+		Ceiling = MaxMtu + 1;
+		bCeilingReported = false;
+		State = EState::Search;
+	}
+
+	if (State != EState::Search || Now < NextProbeTime)
+	{
+		return 0;
+	}
+
+	if (Ceiling - Mtu <= SearchGranularity && !bCeilingReported)
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("Path MTU discovery settled at %d bytes"), Mtu);
+		State = EState::Done;
+		NextProbeTime = Now + RaiseInterval;
+		return 0;
+	}
+
+	ProbeSize = bCeilingReported ? Ceiling - 1 : (Mtu + Ceiling) / 2;
+	return ProbeSize;
+}
+
+void FPathMtu::OnProbeSent(uint16 SequenceNumber, double Now)
+{
+	ProbeSequenceNumber = SequenceNumber;
+	ProbeSentTime = Now;
+	State = EState::Probing;
+}
+
+void FPathMtu::OnReceiverReport(const FRTCPReportBlock& Block, double Now)
+{
+	const bool bNewLosses = LastCumulativeLost != INDEX_NONE && Block.CumulativeLost > LastCumulativeLost;
+	LastCumulativeLost = Block.CumulativeLost;
+
+	//waits for the first report that covers the probe
+	if (State != EState::Probing || static_cast<int16>(static_cast<uint16>(Block.ExtendedHighestSequence) - ProbeSequenceNumber) < 0)
+	{
+		return;
+	}
+
+	if (bNewLosses)
+	{
+		ProbeFailed(Now);
+		return;
+	}
+
+	Mtu = ProbeSize;
+	bCeilingReported = false;
+	ProbeAttempts = 0;
+	NextProbeTime = Now;
+	State = EState::Search;
+	UE_LOG(RTSPStreaming, Verbose, TEXT("Path MTU probe of %d bytes confirmed"), ProbeSize);
+}
+
+void FPathMtu::OnMtuExceeded(uint32 ReportedMtu, double Now)
+{
+	if (State == EState::Disabled)
+	{
+		return;
+	}
+
+	if (ReportedMtu >= MinMtu)
+	{
+		if (ReportedMtu < Mtu)
+		{
+			UE_LOG(RTSPStreaming, Log, TEXT("Path MTU dropped from %d to %d bytes"), Mtu, ReportedMtu);
+			Mtu = ReportedMtu;
+		}
+		if (ReportedMtu < Ceiling)
+		{
+			Ceiling = ReportedMtu + 1;
+			bCeilingReported = ReportedMtu > Mtu;
+		}
+	}
+	else if (State == EState::Probing)
+	{
+		//the probe itself was refused without a usable MTU
+		Ceiling = ProbeSize;
+		bCeilingReported = false;
+	}
+
+	if (State == EState::Probing || State == EState::Done)
+	{
+		ProbeAttempts = 0;
+		NextProbeTime = Now;
+		State = EState::Search;
+	}
+}
+
+void FPathMtu::ReceiveErrors(FSocket* Socket, double Now)
+{
+#if PLATFORM_LINUX
+	if (State == EState::Disabled)
+	{
+		return;
+	}
+
+	const SOCKET NativeSocket = GetNativeSocket(Socket);
+	for (;;)
+	{
+		uint8 Control[256];
+		msghdr Message;
+		FMemory::Memzero(Message);
+		Message.msg_control = Control;
+		Message.msg_controllen = sizeof(Control);
+		if (recvmsg(NativeSocket, &Message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+		{
+			return;
+		}
+
+		for (cmsghdr* ControlMessage = CMSG_FIRSTHDR(&Message); ControlMessage; ControlMessage = CMSG_NXTHDR(&Message, ControlMessage))
+		{
+			if (ControlMessage->cmsg_level != SOL_IP || ControlMessage->cmsg_type != IP_RECVERR)
+			{
+				continue;
+			}
+
+			//ICMP fragmentation needed carries the next hop MTU, local EMSGSIZE the interface MTU
+			const sock_extended_err* Error = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(ControlMessage));
+			if (Error->ee_errno == EMSGSIZE)
+			{
+				OnMtuExceeded(Error->ee_info, Now);
+			}
+		}
+	}
+#endif
+}
+
+void FPathMtu::ProbeFailed(double Now)
+{
+	if (++ProbeAttempts >= MaxProbeAttempts)
+	{
+		Ceiling = ProbeSize;
+		bCeilingReported = false;
+		ProbeAttempts = 0;
+	}
+	NextProbeTime = Now + ProbeRetryInterval;
+	State = EState::Search;
+}
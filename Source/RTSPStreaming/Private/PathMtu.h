@@ -0,0 +1,67 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RTSPCore/RTCP.h"
+#include "RTSPCore/RTPPacketizer.h"
+
+class FSocket;
+
+#define IPV4_UDP_HEADER_SIZE	28		// IPv4 header without options plus UDP header
+
+// path MTU discovery for the RTP socket of one UDP client (packetization layer PMTUD, RFC 4821)
+// RTP is sent with DF set and the kernel PMTU cache bypassed (IP_PMTUDISC_PROBE), the MTU starts at the size
+// Streamer.MaxPayloadSize implies and is raised by binary search: a probe is one RTP packet padded to the probed
+// datagram size that goes out with a frame, it is confirmed once an RTCP receiver report covers its sequence
+// number without new losses. Lost probes, EMSGSIZE and ICMP fragmentation needed lower the ceiling, an MTU
+// reported below the current one lowers it right away.
+class FPathMtu final
+{
+public:
+	FPathMtu();
+
+	void Start(FSocket* Socket, uint32 InitialMtu, uint32 MaxSupportedMtu);	// configures the socket and starts probing, unless disabled
+	bool IsEnabled() const
+	{
+		return State != EState::Disabled;
+	}
+
+	uint32 GetMtu() const											// largest datagram known to get through
+	{
+		return Mtu;
+	}
+	uint32 GetMaxPayloadSize() const								// RTP payload that fits into the MTU
+	{
+		return Mtu - IPV4_UDP_HEADER_SIZE - RTP_HEADER_SIZE;
+	}
+
+	uint32 GetProbeSize(double Now);								// datagram size to probe with the next frame, 0 if not probing now
+	void OnProbeSent(uint16 SequenceNumber, double Now);			// the probe went out as RTP packet SequenceNumber
+	void OnReceiverReport(const FRTCPReportBlock& Block, double Now);
+	void OnMtuExceeded(uint32 ReportedMtu, double Now);			// EMSGSIZE or ICMP fragmentation needed, ReportedMtu 0 if unknown
+	void ReceiveErrors(FSocket* Socket, double Now);				// drains ICMP and local MTU errors of the socket
+
+private:
+	enum class EState : uint8
+	{
+		Disabled,
+		Search,			// waiting to send the next probe
+		Probing,		// probe in flight, waiting for a receiver report
+		Done			// search converged, raised again after a while
+	};
+
+	void ProbeFailed(double Now);
+
+	EState		State;
+	uint32		Mtu;					// confirmed datagram size
+	uint32		MaxMtu;					// probes never go above this
+	uint32		Ceiling;				// smallest datagram size known or assumed not to get through
+	bool		bCeilingReported;		// Ceiling - 1 was reported by ICMP or the kernel, probe it directly
+	uint32		ProbeSize;				// datagram size of the probe in flight
+	uint16		ProbeSequenceNumber;	// RTP sequence number of the probe in flight
+	uint32		ProbeAttempts;			// lost probes of the current size
+	double		ProbeSentTime;
+	double		NextProbeTime;
+	int32		LastCumulativeLost;		// from the previous receiver report, INDEX_NONE before the first one
+};
@@ -0,0 +1,832 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// RTSP load generator for comparing the server's network backends, e.g. blocking sockets against io_uring, Linux only
+// - opens <clients> sessions to one URL over UDP, each with its own RTSP connection and RTP/RTCP socket pair, and plays them
+// - one epoll thread receives with recvmmsg and counts packets, losses from sequence gaps, frames by the marker bit,
+//   the RFC 3550 interarrival jitter and the longest gap between two frames of a session
+// - sends every session a receiver report each RTCP interval, which also keeps the sessions alive
+// - with -pid samples the CPU time of the server process from /proc, in total and per thread name
+// prints a line per second and a summary of the time after the warm-up, -csv also writes the lines to a file
+// usage: RTSPLoadGenerator rtsp://<host>:<port>/<path> [-clients 100] [-seconds 60] [-warmup 10] [-ramp 20]
+//        [-port 40000] [-rtcp 1000] [-pid <server pid>] [-csv <file>]
+
+// UBT compiles every source of the module, the load generator is only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE) && defined(__linux__)
+
+#include "RTSPCoreTypes.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+	struct FOptions
+	{
+		std::string	Url;
+		std::string	Host;
+		std::string	Port = "554";
+		int32		NumClients = 100;
+		int32		Seconds = 60;
+		int32		WarmupSeconds = 10;
+		int32		RampMs = 20;				// between two sessions starting
+		int32		BasePort = 40000;			// first local RTP port, RTCP is the one above
+		int32		RtcpIntervalMs = 1000;
+		int32		ServerPid = 0;
+		std::string	CsvPath;
+	};
+
+	uint64 GetTimeNs()
+	{
+		return static_cast<uint64>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	// reception statistics of one session, RFC 3550 A.1 and A.8, receive thread only
+	struct FReceptionStats
+	{
+		bool	bStarted = false;
+		uint32	SSRC = 0;
+		uint16	BaseSequence = 0;
+		uint16	MaxSequence = 0;
+		uint32	Cycles = 0;
+		uint64	Received = 0;
+		uint64	Bytes = 0;
+		uint64	Frames = 0;
+		double	Jitter = 0;					// RTP timestamp units
+		int64	LastTransit = 0;
+		uint64	LastFrameNs = 0;
+		uint64	MaxFrameGapNs = 0;			// since the last report line
+		uint64	ExpectedPrior = 0;			// for the fraction lost of receiver reports
+		uint64	ReceivedPrior = 0;
+
+		uint64 GetExpected() const
+		{
+			return bStarted ? Cycles + MaxSequence - BaseSequence + 1ull : 0;
+		}
+
+		int64 GetLost() const
+		{
+			return static_cast<int64>(GetExpected()) - static_cast<int64>(Received);
+		}
+
+		void OnPacket(const uint8* Data, int32 Size, uint64 ArrivalNs)
+		{
+			if (Size < 12 || (Data[0] >> 6) != 2)
+			{
+				return;
+			}
+			const bool bMarker = (Data[1] & 0x80) != 0;
+			const uint16 Sequence = static_cast<uint16>(Data[2] << 8 | Data[3]);
+			const uint32 Timestamp = static_cast<uint32>(Data[4]) << 24 | Data[5] << 16 | Data[6] << 8 | Data[7];
+
+			if (!bStarted)
+			{
+				bStarted = true;
+				SSRC = static_cast<uint32>(Data[8]) << 24 | Data[9] << 16 | Data[10] << 8 | Data[11];
+				BaseSequence = Sequence;
+				MaxSequence = Sequence;
+			}
+			else if (static_cast<uint16>(Sequence - MaxSequence) < 0x8000)
+			{
+				if (Sequence < MaxSequence)
+				{
+					Cycles += 0x10000;
+				}
+				MaxSequence = Sequence;
+			}
+			Received++;
+			Bytes += Size;
+
+			// arrival on the 90 kHz clock of H.264 and H.265
+			const int64 Transit = static_cast<int64>(ArrivalNs / 1000 * 9 / 100) - static_cast<int64>(Timestamp);
+			if (Received > 1)
+			{
+				Jitter += (std::abs(static_cast<double>(Transit - LastTransit)) - Jitter) / 16;
+			}
+			LastTransit = Transit;
+
+			if (bMarker)
+			{
+				if (LastFrameNs)
+				{
+					MaxFrameGapNs = std::max(MaxFrameGapNs, ArrivalNs - LastFrameNs);
+				}
+				LastFrameNs = ArrivalNs;
+				Frames++;
+			}
+		}
+	};
+
+	struct FClient
+	{
+		int32			Index = 0;
+		int				RtspSocket = -1;
+		int				RtpSocket = -1;
+		int				RtcpSocket = -1;
+		sockaddr_in		ServerRtcpAddress;
+		std::string		SessionId;
+		bool			bClosed = false;		// the server closed the RTSP connection
+		FReceptionStats	Stats;
+		FReceptionStats	StatsAtLastLine;
+
+		~FClient()
+		{
+			for (int Socket : { RtspSocket, RtpSocket, RtcpSocket })
+			{
+				if (Socket >= 0)
+				{
+					close(Socket);
+				}
+			}
+		}
+	};
+
+	// what a report line is computed from, totals since the start
+	struct FTotals
+	{
+		uint64	Received = 0;
+		uint64	Bytes = 0;
+		uint64	Frames = 0;
+		int64	Lost = 0;
+		uint64	Expected = 0;
+	};
+
+	// CPU time of the server process in seconds, in total and per thread name
+	struct FCpuSample
+	{
+		double							Total = 0;
+		std::map<std::string, double>	PerThreadName;
+	};
+
+	bool ParseUrl(FOptions& Options)
+	{
+		const std::string Prefix = "rtsp://";
+		if (Options.Url.compare(0, Prefix.size(), Prefix) != 0)
+		{
+			return false;
+		}
+		const size_t HostStart = Prefix.size();
+		const size_t PathStart = Options.Url.find('/', HostStart);
+		const std::string HostPort = Options.Url.substr(HostStart, PathStart == std::string::npos ? std::string::npos : PathStart - HostStart);
+		const size_t Colon = HostPort.find(':');
+		Options.Host = HostPort.substr(0, Colon);
+		if (Colon != std::string::npos)
+		{
+			Options.Port = HostPort.substr(Colon + 1);
+		}
+		return !Options.Host.empty();
+	}
+
+	// utime and stime of a /proc/<pid>/stat or /proc/<pid>/task/<tid>/stat file, and the thread name in it
+	bool ReadCpuSeconds(const std::string& Path, double& OutSeconds, std::string& OutName)
+	{
+		FILE* File = fopen(Path.c_str(), "r");
+		if (!File)
+		{
+			return false;
+		}
+		char Line[1024];
+		const bool bRead = fgets(Line, sizeof(Line), File) != nullptr;
+		fclose(File);
+
+		// the name is in parentheses and may contain spaces, the fields after it are fixed
+		const char* NameStart = bRead ? strchr(Line, '(') : nullptr;
+		const char* NameEnd = bRead ? strrchr(Line, ')') : nullptr;
+		unsigned long long UserTicks = 0, SystemTicks = 0;
+		if (!NameStart || !NameEnd || sscanf(NameEnd + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &UserTicks, &SystemTicks) != 2)
+		{
+			return false;
+		}
+		OutName.assign(NameStart + 1, NameEnd);
+		OutSeconds = static_cast<double>(UserTicks + SystemTicks) / sysconf(_SC_CLK_TCK);
+		return true;
+	}
+
+	FCpuSample SampleCpu(int32 Pid)
+	{
+		FCpuSample Sample;
+		std::string Name;
+		ReadCpuSeconds("/proc/" + std::to_string(Pid) + "/stat", Sample.Total, Name);
+
+		const std::string TaskDir = "/proc/" + std::to_string(Pid) + "/task";
+		if (DIR* Dir = opendir(TaskDir.c_str()))
+		{
+			while (dirent* Entry = readdir(Dir))
+			{
+				double Seconds = 0;
+				if (Entry->d_name[0] != '.' && ReadCpuSeconds(TaskDir + "/" + Entry->d_name + "/stat", Seconds, Name))
+				{
+					Sample.PerThreadName[Name] += Seconds;
+				}
+			}
+			closedir(Dir);
+		}
+		return Sample;
+	}
+
+	// sends an RTSP request and reads the response, false unless it's a 200
+	bool Request(FClient& Client, int32& CSeq, const char* Method, const std::string& Url, const std::string& Headers, std::string& OutResponse)
+	{
+		const std::string Text = std::string(Method) + " " + Url + " RTSP/1.0\r\nCSeq: " + std::to_string(++CSeq) + "\r\nUser-Agent: RTSPLoadGenerator\r\n" + Headers + "\r\n";
+		if (send(Client.RtspSocket, Text.data(), Text.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(Text.size()))
+		{
+			return false;
+		}
+
+		OutResponse.clear();
+		size_t HeaderEnd = std::string::npos;
+		size_t ContentLength = 0;
+		char Buffer[4096];
+		while (HeaderEnd == std::string::npos || OutResponse.size() < HeaderEnd + 4 + ContentLength)
+		{
+			const ssize_t Size = recv(Client.RtspSocket, Buffer, sizeof(Buffer), 0);
+			if (Size <= 0)
+			{
+				fprintf(stderr, "client %d: no response to %s\n", Client.Index, Method);
+				return false;
+			}
+			OutResponse.append(Buffer, Size);
+			if (HeaderEnd == std::string::npos && (HeaderEnd = OutResponse.find("\r\n\r\n")) != std::string::npos)
+			{
+				const size_t Length = OutResponse.find("Content-Length:");
+				if (Length != std::string::npos && Length < HeaderEnd)
+				{
+					ContentLength = strtoul(OutResponse.c_str() + Length + 15, nullptr, 10);
+				}
+			}
+		}
+
+		if (OutResponse.compare(0, 12, "RTSP/1.0 200") != 0)
+		{
+			fprintf(stderr, "client %d: %s answered with %s\n", Client.Index, Method, OutResponse.substr(0, OutResponse.find('\r')).c_str());
+			return false;
+		}
+		return true;
+	}
+
+	// binds the RTP socket to an even port and the RTCP socket to the one above, from BasePort on
+	bool BindPortPair(FClient& Client, int32& InOutPort)
+	{
+		Client.RtpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		Client.RtcpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+		if (Client.RtpSocket < 0 || Client.RtcpSocket < 0)
+		{
+			return false;
+		}
+		const int ReceiveBufferSize = 4 << 20;
+		setsockopt(Client.RtpSocket, SOL_SOCKET, SO_RCVBUF, &ReceiveBufferSize, sizeof(ReceiveBufferSize));
+
+		for (; InOutPort < 65534; InOutPort += 2)
+		{
+			sockaddr_in Address;
+			memset(&Address, 0, sizeof(Address));
+			Address.sin_family = AF_INET;
+			Address.sin_addr.s_addr = htonl(INADDR_ANY);
+			Address.sin_port = htons(static_cast<uint16>(InOutPort));
+			if (bind(Client.RtpSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0)
+			{
+				continue;
+			}
+			Address.sin_port = htons(static_cast<uint16>(InOutPort + 1));
+			if (bind(Client.RtcpSocket, reinterpret_cast<sockaddr*>(&Address), sizeof(Address)) != 0)
+			{
+				// a bound socket can't be rebound, start the pair over
+				close(Client.RtpSocket);
+				Client.RtpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+				setsockopt(Client.RtpSocket, SOL_SOCKET, SO_RCVBUF, &ReceiveBufferSize, sizeof(ReceiveBufferSize));
+				continue;
+			}
+			InOutPort += 2;
+			return true;
+		}
+		return false;
+	}
+
+	// OPTIONS, DESCRIBE, SETUP and PLAY of one session
+	bool StartSession(FClient& Client, const FOptions& Options, const addrinfo& ServerAddress, int32& InOutPort)
+	{
+		Client.RtspSocket = socket(ServerAddress.ai_family, SOCK_STREAM, 0);
+		if (Client.RtspSocket < 0)
+		{
+			fprintf(stderr, "client %d: can't create a socket, %s\n", Client.Index, strerror(errno));
+			return false;
+		}
+		timeval Timeout = { 5, 0 };
+		setsockopt(Client.RtspSocket, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+		if (connect(Client.RtspSocket, ServerAddress.ai_addr, ServerAddress.ai_addrlen) != 0)
+		{
+			fprintf(stderr, "client %d: can't connect, %s\n", Client.Index, strerror(errno));
+			return false;
+		}
+		if (!BindPortPair(Client, InOutPort))
+		{
+			fprintf(stderr, "client %d: no free UDP port pair\n", Client.Index);
+			return false;
+		}
+		const int32 RtpPort = InOutPort - 2;
+
+		int32 CSeq = 0;
+		std::string Response;
+		if (!Request(Client, CSeq, "OPTIONS", Options.Url, "", Response)
+			|| !Request(Client, CSeq, "DESCRIBE", Options.Url, "Accept: application/sdp\r\n", Response))
+		{
+			return false;
+		}
+
+		const std::string Transport = "Transport: RTP/AVP;unicast;client_port=" + std::to_string(RtpPort) + "-" + std::to_string(RtpPort + 1) + "\r\n";
+		// the SDP has no control attribute, the stream is set up on the URL itself
+		if (!Request(Client, CSeq, "SETUP", Options.Url, Transport, Response))
+		{
+			return false;
+		}
+		const size_t Session = Response.find("Session: ");
+		const size_t ServerPort = Response.find("server_port=");
+		if (Session == std::string::npos || ServerPort == std::string::npos)
+		{
+			fprintf(stderr, "client %d: SETUP response without a session or server port\n", Client.Index);
+			return false;
+		}
+		Client.SessionId = Response.substr(Session + 9, Response.find_first_of(";\r", Session) - Session - 9);
+
+		// RTCP goes to the server's second port, on the address the RTSP connection went to
+		memset(&Client.ServerRtcpAddress, 0, sizeof(Client.ServerRtcpAddress));
+		memcpy(&Client.ServerRtcpAddress, ServerAddress.ai_addr, std::min<size_t>(ServerAddress.ai_addrlen, sizeof(Client.ServerRtcpAddress)));
+		unsigned ServerRtpPort = 0, ServerRtcpPort = 0;
+		sscanf(Response.c_str() + ServerPort, "server_port=%u-%u", &ServerRtpPort, &ServerRtcpPort);
+		Client.ServerRtcpAddress.sin_port = htons(static_cast<uint16>(ServerRtcpPort));
+
+		return Request(Client, CSeq, "PLAY", Options.Url, "Session: " + Client.SessionId + "\r\nRange: npt=0.000-\r\n", Response);
+	}
+
+	// receiver report with one report block about the session's stream, RFC 3550 6.4.2
+	void SendReceiverReport(FClient& Client)
+	{
+		FReceptionStats& Stats = Client.Stats;
+		if (!Stats.bStarted)
+		{
+			return;
+		}
+
+		const uint64 Expected = Stats.GetExpected();
+		const int64 ExpectedInterval = static_cast<int64>(Expected - Stats.ExpectedPrior);
+		const int64 LostInterval = ExpectedInterval - static_cast<int64>(Stats.Received - Stats.ReceivedPrior);
+		Stats.ExpectedPrior = Expected;
+		Stats.ReceivedPrior = Stats.Received;
+		const uint8 FractionLost = ExpectedInterval > 0 && LostInterval > 0 ? static_cast<uint8>((LostInterval << 8) / ExpectedInterval) : 0;
+		const int32 CumulativeLost = static_cast<int32>(std::min<int64>(std::max<int64>(Stats.GetLost(), -0x800000), 0x7FFFFF));
+		const uint32 ExtendedHighest = Stats.Cycles + Stats.MaxSequence;
+		const uint32 Jitter = static_cast<uint32>(Stats.Jitter);
+		const uint32 ReceiverSSRC = 0x4C470000u + static_cast<uint32>(Client.Index);
+
+		uint8 Packet[32];
+		const auto Write32 = [&Packet](int32 Offset, uint32 Value)
+		{
+			Packet[Offset] = static_cast<uint8>(Value >> 24);
+			Packet[Offset + 1] = static_cast<uint8>(Value >> 16);
+			Packet[Offset + 2] = static_cast<uint8>(Value >> 8);
+			Packet[Offset + 3] = static_cast<uint8>(Value);
+		};
+		Write32(0, 0x81C90007);									// V=2, RC=1, RR, 7 words after the first
+		Write32(4, ReceiverSSRC);
+		Write32(8, Stats.SSRC);
+		Write32(12, static_cast<uint32>(FractionLost) << 24 | (static_cast<uint32>(CumulativeLost) & 0xFFFFFF));
+		Write32(16, ExtendedHighest);
+		Write32(20, Jitter);
+		Write32(24, 0);											// no sender report received, LSR
+		Write32(28, 0);											// and DLSR are 0
+		sendto(Client.RtcpSocket, Packet, sizeof(Packet), 0, reinterpret_cast<sockaddr*>(&Client.ServerRtcpAddress), sizeof(Client.ServerRtcpAddress));
+	}
+
+	class FLoadGenerator
+	{
+	public:
+		explicit FLoadGenerator(const FOptions& InOptions)
+			: Options(InOptions)
+			, Epoll(epoll_create1(0))
+			, bStopping(false)
+			, bRampedUp(false)
+			, Csv(nullptr)
+			, bMeasuring(false)
+			, MeasureStartTimeNs(0)
+			, MeasureEndTimeNs(0)
+		{}
+
+		~FLoadGenerator()
+		{
+			close(Epoll);
+			if (Csv)
+			{
+				fclose(Csv);
+			}
+		}
+
+		int Run()
+		{
+			addrinfo Hints;
+			memset(&Hints, 0, sizeof(Hints));
+			Hints.ai_family = AF_INET;
+			Hints.ai_socktype = SOCK_STREAM;
+			addrinfo* ServerAddress = nullptr;
+			if (getaddrinfo(Options.Host.c_str(), Options.Port.c_str(), &Hints, &ServerAddress) != 0 || !ServerAddress)
+			{
+				fprintf(stderr, "can't resolve %s\n", Options.Host.c_str());
+				return 1;
+			}
+			if (!Options.CsvPath.empty() && !(Csv = fopen(Options.CsvPath.c_str(), "w")))
+			{
+				fprintf(stderr, "can't write %s\n", Options.CsvPath.c_str());
+				freeaddrinfo(ServerAddress);
+				return 1;
+			}
+
+			printf("%d clients of %s, %d s after a %d s warm-up\n", Options.NumClients, Options.Url.c_str(), Options.Seconds, Options.WarmupSeconds);
+			PrintHeader();
+
+			// the receive thread measures while the sessions start, the warm-up begins once they all did
+			std::thread ReceiveThread([this]() { Receive(); });
+			int32 Port = Options.BasePort;
+			int32 NumFailed = 0;
+			for (int32 Index = 0; Index < Options.NumClients; ++Index)
+			{
+				std::unique_ptr<FClient> Client(new FClient);
+				Client->Index = Index;
+				if (!StartSession(*Client, Options, *ServerAddress, Port))
+				{
+					NumFailed++;
+					continue;
+				}
+				{
+					std::lock_guard<std::mutex> Lock(ClientsMutex);
+					NewClients.push_back(std::move(Client));
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(Options.RampMs));
+			}
+			freeaddrinfo(ServerAddress);
+			if (NumFailed)
+			{
+				fprintf(stderr, "%d of %d sessions failed to start\n", NumFailed, Options.NumClients);
+			}
+
+			// nothing to measure without a session
+			bStopping = NumFailed == Options.NumClients;
+			bRampedUp = true;
+			ReceiveThread.join();
+			PrintSummary();
+			return NumFailed == Options.NumClients ? 1 : 0;
+		}
+
+	private:
+		void PrintHeader()
+		{
+			const char* Columns = "time_s,clients,mbit_s,kpkt_s,fps_mean,fps_min,loss_pct,jitter_ms,max_frame_gap_ms,server_cpu_pct,server_cpu_ms_per_stream_s";
+			printf("%6s %7s %8s %7s %8s %7s %8s %9s %9s %8s %10s\n", "time", "clients", "Mbit/s", "kpkt/s", "fps", "fps min", "loss %", "jitter ms", "gap ms", "cpu %", "ms/stream");
+			if (Csv)
+			{
+				fprintf(Csv, "%s\n", Columns);
+			}
+		}
+
+		void Receive()
+		{
+			const int32 BatchSize = 64;
+			const int32 MaxDatagramSize = 9216;
+			std::vector<uint8> Buffers(static_cast<size_t>(BatchSize) * MaxDatagramSize);
+			mmsghdr Messages[BatchSize];
+			iovec Vectors[BatchSize];
+			for (int32 Index = 0; Index < BatchSize; ++Index)
+			{
+				Vectors[Index].iov_base = &Buffers[static_cast<size_t>(Index) * MaxDatagramSize];
+				Vectors[Index].iov_len = MaxDatagramSize;
+				memset(&Messages[Index], 0, sizeof(Messages[Index]));
+				Messages[Index].msg_hdr.msg_iov = &Vectors[Index];
+				Messages[Index].msg_hdr.msg_iovlen = 1;
+			}
+
+			const uint64 StartNs = GetTimeNs();
+			uint64 NextLineNs = StartNs + 1000000000ull;
+			uint64 NextRtcpNs = StartNs + Options.RtcpIntervalMs * 1000000ull;
+			uint64 MeasureStartNs = 0;
+			uint64 EndNs = 0;
+			FTotals LastTotals;
+			FCpuSample LastCpu = Options.ServerPid ? SampleCpu(Options.ServerPid) : FCpuSample();
+
+			epoll_event Events[256];
+			while (!bStopping)
+			{
+				AddNewClients();
+
+				const uint64 NowNs = GetTimeNs();
+				// sessions are picked up between waits, often while they start
+				const uint64 NextTimerNs = std::min(std::min(NextLineNs, NextRtcpNs), bRampedUp ? UINT64_MAX : NowNs + 10000000ull);
+				const int TimeoutMs = NextTimerNs > NowNs ? static_cast<int>((NextTimerNs - NowNs) / 1000000 + 1) : 0;
+				const int NumEvents = epoll_wait(Epoll, Events, 256, TimeoutMs);
+				for (int Event = 0; Event < NumEvents; ++Event)
+				{
+					FClient& Client = *Clients[Events[Event].data.u32 >> 1];
+					if (Events[Event].data.u32 & 1)
+					{
+						// the server has nothing more to say after PLAY, a readable connection is a closed one
+						char Discard[4096];
+						if (recv(Client.RtspSocket, Discard, sizeof(Discard), MSG_DONTWAIT) <= 0)
+						{
+							Client.bClosed = true;
+							epoll_ctl(Epoll, EPOLL_CTL_DEL, Client.RtspSocket, nullptr);
+						}
+						continue;
+					}
+
+					int NumMessages;
+					while ((NumMessages = recvmmsg(Client.RtpSocket, Messages, BatchSize, MSG_DONTWAIT, nullptr)) > 0)
+					{
+						const uint64 ArrivalNs = GetTimeNs();
+						for (int Message = 0; Message < NumMessages; ++Message)
+						{
+							Client.Stats.OnPacket(static_cast<const uint8*>(Vectors[Message].iov_base), static_cast<int32>(Messages[Message].msg_len), ArrivalNs);
+						}
+					}
+				}
+
+				const uint64 AfterNs = GetTimeNs();
+				if (AfterNs >= NextRtcpNs)
+				{
+					for (const std::unique_ptr<FClient>& Client : Clients)
+					{
+						SendReceiverReport(*Client);
+					}
+					NextRtcpNs += Options.RtcpIntervalMs * 1000000ull;
+				}
+
+				if (AfterNs >= NextLineNs)
+				{
+					const double Seconds = (AfterNs - (NextLineNs - 1000000000ull)) / 1e9;
+					FCpuSample Cpu = Options.ServerPid ? SampleCpu(Options.ServerPid) : FCpuSample();
+					const FTotals Totals = PrintLine((AfterNs - StartNs) / 1e9, Seconds, LastTotals, Cpu.Total - LastCpu.Total);
+					LastTotals = Totals;
+					NextLineNs += 1000000000ull;
+
+					if (!MeasureStartNs && bRampedUp)
+					{
+						MeasureStartNs = AfterNs + Options.WarmupSeconds * 1000000000ull;
+						EndNs = MeasureStartNs + Options.Seconds * 1000000000ull;
+					}
+					if (MeasureStartNs && AfterNs >= MeasureStartNs && !bMeasuring)
+					{
+						bMeasuring = true;
+						MeasureStart = Totals;
+						MeasureStartCpu = Cpu;
+						MeasureStartTimeNs = AfterNs;
+						printf("-- measuring\n");
+					}
+					if (bMeasuring)
+					{
+						Measured.push_back(LastLine);
+					}
+					if (EndNs && AfterNs >= EndNs)
+					{
+						MeasureEnd = Totals;
+						MeasureEndCpu = Cpu;
+						MeasureEndTimeNs = AfterNs;
+						return;
+					}
+					LastCpu = std::move(Cpu);
+				}
+			}
+		}
+
+		void AddNewClients()
+		{
+			std::vector<std::unique_ptr<FClient>> Added;
+			{
+				std::lock_guard<std::mutex> Lock(ClientsMutex);
+				Added.swap(NewClients);
+			}
+			for (std::unique_ptr<FClient>& Client : Added)
+			{
+				// the index in Clients and whether it's the RTSP connection
+				const uint32 Index = static_cast<uint32>(Clients.size());
+				epoll_event Event;
+				memset(&Event, 0, sizeof(Event));
+				Event.events = EPOLLIN;
+				Event.data.u32 = Index << 1;
+				epoll_ctl(Epoll, EPOLL_CTL_ADD, Client->RtpSocket, &Event);
+				Event.data.u32 = Index << 1 | 1;
+				epoll_ctl(Epoll, EPOLL_CTL_ADD, Client->RtspSocket, &Event);
+				Clients.push_back(std::move(Client));
+			}
+		}
+
+		struct FLine
+		{
+			double	Mbps = 0;
+			double	FpsMean = 0;
+			double	FpsMin = 0;
+			double	LossPercent = 0;
+			double	JitterMs = 0;
+			double	MaxFrameGapMs = 0;
+			double	CpuPercent = 0;
+		};
+
+		FTotals PrintLine(double Time, double Seconds, const FTotals& Last, double CpuSeconds)
+		{
+			FTotals Totals;
+			FLine Line;
+			int32 NumPlaying = 0;
+			double JitterSum = 0;
+			Line.FpsMin = 1e9;
+			for (const std::unique_ptr<FClient>& Client : Clients)
+			{
+				FReceptionStats& Stats = Client->Stats;
+				Totals.Received += Stats.Received;
+				Totals.Bytes += Stats.Bytes;
+				Totals.Frames += Stats.Frames;
+				Totals.Lost += Stats.GetLost();
+				Totals.Expected += Stats.GetExpected();
+				if (Client->bClosed || !Stats.bStarted)
+				{
+					continue;
+				}
+
+				NumPlaying++;
+				const double Fps = (Stats.Frames - Client->StatsAtLastLine.Frames) / Seconds;
+				Line.FpsMin = std::min(Line.FpsMin, Fps);
+				JitterSum += Stats.Jitter / 90.0;
+				Line.MaxFrameGapMs = std::max(Line.MaxFrameGapMs, Stats.MaxFrameGapNs / 1e6);
+				Stats.MaxFrameGapNs = 0;
+				Client->StatsAtLastLine = Stats;
+			}
+
+			const double Packets = static_cast<double>(Totals.Received - Last.Received);
+			const double Expected = static_cast<double>(Totals.Expected - Last.Expected);
+			Line.Mbps = (Totals.Bytes - Last.Bytes) * 8 / Seconds / 1e6;
+			Line.FpsMean = NumPlaying ? (Totals.Frames - Last.Frames) / Seconds / NumPlaying : 0;
+			Line.FpsMin = NumPlaying ? Line.FpsMin : 0;
+			Line.LossPercent = Expected > 0 ? std::max(0.0, (Expected - Packets) * 100 / Expected) : 0;
+			Line.JitterMs = NumPlaying ? JitterSum / NumPlaying : 0;
+			Line.CpuPercent = CpuSeconds * 100 / Seconds;
+			const double CpuMsPerStream = NumPlaying ? Line.CpuPercent * 10 / NumPlaying : 0;
+			LastLine = Line;
+
+			printf("%6.0f %7d %8.1f %7.1f %8.1f %7.1f %8.3f %9.2f %9.1f %8.1f %10.3f\n", Time, NumPlaying, Line.Mbps, Packets / Seconds / 1000,
+				Line.FpsMean, Line.FpsMin, Line.LossPercent, Line.JitterMs, Line.MaxFrameGapMs, Line.CpuPercent, CpuMsPerStream);
+			if (Csv)
+			{
+				fprintf(Csv, "%.0f,%d,%.3f,%.3f,%.2f,%.2f,%.4f,%.3f,%.2f,%.2f,%.4f\n", Time, NumPlaying, Line.Mbps, Packets / Seconds / 1000,
+					Line.FpsMean, Line.FpsMin, Line.LossPercent, Line.JitterMs, Line.MaxFrameGapMs, Line.CpuPercent, CpuMsPerStream);
+				fflush(Csv);
+			}
+			fflush(stdout);
+			return Totals;
+		}
+
+		// averages of the measured lines and the server's CPU time over them, per thread name
+		void PrintSummary()
+		{
+			if (Measured.empty())
+			{
+				printf("nothing measured\n");
+				return;
+			}
+
+			FLine Mean;
+			double WorstGapMs = 0, WorstFpsMin = 1e9;
+			for (const FLine& Line : Measured)
+			{
+				Mean.Mbps += Line.Mbps / Measured.size();
+				Mean.FpsMean += Line.FpsMean / Measured.size();
+				Mean.JitterMs += Line.JitterMs / Measured.size();
+				WorstGapMs = std::max(WorstGapMs, Line.MaxFrameGapMs);
+				WorstFpsMin = std::min(WorstFpsMin, Line.FpsMin);
+			}
+			const double Seconds = (MeasureEndTimeNs - MeasureStartTimeNs) / 1e9;
+			const double Expected = static_cast<double>(MeasureEnd.Expected - MeasureStart.Expected);
+			const double Lost = static_cast<double>(MeasureEnd.Lost - MeasureStart.Lost);
+			int32 NumPlaying = 0;
+			for (const std::unique_ptr<FClient>& Client : Clients)
+			{
+				NumPlaying += !Client->bClosed && Client->Stats.bStarted;
+			}
+
+			printf("\nsummary of %.0f s with %d of %d sessions playing\n", Seconds, NumPlaying, Options.NumClients);
+			printf("  %.1f Mbit/s, %.2f fps per session, lowest %.2f, %.4f %% lost\n", Mean.Mbps, Mean.FpsMean, WorstFpsMin, Expected > 0 ? std::max(0.0, Lost * 100 / Expected) : 0.0);
+			printf("  jitter %.2f ms on average, longest gap between two frames of a session %.1f ms\n", Mean.JitterMs, WorstGapMs);
+			if (!Options.ServerPid)
+			{
+				return;
+			}
+
+			const double CpuSeconds = MeasureEndCpu.Total - MeasureStartCpu.Total;
+			printf("  server CPU %.1f %%, %.3f ms per stream and second\n", CpuSeconds * 100 / Seconds, NumPlaying ? CpuSeconds * 1000 / Seconds / NumPlaying : 0.0);
+
+			std::vector<std::pair<double, std::string>> Threads;
+			for (const auto& Entry : MeasureEndCpu.PerThreadName)
+			{
+				const auto Start = MeasureStartCpu.PerThreadName.find(Entry.first);
+				Threads.emplace_back(Entry.second - (Start != MeasureStartCpu.PerThreadName.end() ? Start->second : 0), Entry.first);
+			}
+			std::sort(Threads.rbegin(), Threads.rend());
+			for (size_t Index = 0; Index < Threads.size() && Index < 10 && Threads[Index].first > 0; ++Index)
+			{
+				printf("  %6.1f %%  %s\n", Threads[Index].first * 100 / Seconds, Threads[Index].second.c_str());
+			}
+		}
+
+		const FOptions&							Options;
+		int										Epoll;
+		std::atomic<bool>						bStopping;
+		std::atomic<bool>						bRampedUp;
+		std::mutex								ClientsMutex;
+		std::vector<std::unique_ptr<FClient>>	NewClients;			// started, not yet picked up by the receive thread
+		std::vector<std::unique_ptr<FClient>>	Clients;			// receive thread only
+		FILE*									Csv;
+
+		// receive thread only, then the summary
+		FLine				LastLine;
+		std::vector<FLine>	Measured;
+		bool				bMeasuring;
+		FTotals				MeasureStart;
+		FTotals				MeasureEnd;
+		FCpuSample			MeasureStartCpu;
+		FCpuSample			MeasureEndCpu;
+		uint64				MeasureStartTimeNs;
+		uint64				MeasureEndTimeNs;
+	};
+}
+
+int main(int argc, char** argv)
+{
+	FOptions Options;
+	const struct
+	{
+		const char*	Name;
+		int32*		Value;
+	} IntOptions[] =
+	{
+		{ "-clients", &Options.NumClients },
+		{ "-seconds", &Options.Seconds },
+		{ "-warmup", &Options.WarmupSeconds },
+		{ "-ramp", &Options.RampMs },
+		{ "-port", &Options.BasePort },
+		{ "-rtcp", &Options.RtcpIntervalMs },
+		{ "-pid", &Options.ServerPid },
+	};
+
+	for (int Arg = 1; Arg < argc; ++Arg)
+	{
+		bool bParsed = false;
+		for (const auto& IntOption : IntOptions)
+		{
+			if (strcmp(argv[Arg], IntOption.Name) == 0 && Arg + 1 < argc)
+			{
+				*IntOption.Value = atoi(argv[++Arg]);
+				bParsed = true;
+			}
+		}
+		if (!bParsed && strcmp(argv[Arg], "-csv") == 0 && Arg + 1 < argc)
+		{
+			Options.CsvPath = argv[++Arg];
+		}
+		else if (!bParsed)
+		{
+			Options.Url = argv[Arg];
+		}
+	}
+	Options.BasePort &= ~1;
+
+	if (!ParseUrl(Options) || Options.NumClients <= 0 || Options.Seconds <= 0 || Options.RtcpIntervalMs <= 0)
+	{
+		printf("usage: RTSPLoadGenerator rtsp://<host>:<port>/<path> [-clients 100] [-seconds 60] [-warmup 10] [-ramp 20]\n"
+			"       [-port 40000] [-rtcp 1000] [-pid <server pid>] [-csv <file>]\n");
+		return 1;
+	}
+
+	// three sockets a session, more than the default soft limit of 1024 from about 340 sessions on
+	rlimit Limit;
+	if (getrlimit(RLIMIT_NOFILE, &Limit) == 0 && Limit.rlim_cur < Limit.rlim_max)
+	{
+		Limit.rlim_cur = Limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &Limit);
+	}
+
+	FLoadGenerator Generator(Options);
+	return Generator.Run();
+}
+
+#endif
@@ -0,0 +1,136 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// cost of FTimerWheel operations with a large number of active timers, next to a std::multimap keyed on the deadline
+// - Add: fills the timer set, deadlines spread evenly over the period
+// - Rearm: cancels a random active timer and adds it again, like a keepalive pushed back by every client request
+// - Advance: steps the clock 1 ms at a time through the period, every fired timer is added again one period later
+// usage: TimerWheelBench [<active timers> [<period in ms>]], 100000 timers over 5000 ms by default
+
+// UBT compiles every source of the module, the benchmark is only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "TimerWheel.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <vector>
+
+using FClock = std::chrono::steady_clock;
+
+static double GetNanoseconds(FClock::time_point Start, int64 Operations)
+{
+	return std::chrono::duration<double, std::nano>(FClock::now() - Start).count() / Operations;
+}
+
+// the same operations on a balanced tree, what the wheel is meant to beat
+class FMultimapTimers
+{
+public:
+	using FMap = std::multimap<uint64, FTimerWheel::FCallback>;
+
+	FMap::iterator Add(uint64 DeadlineMs, FTimerWheel::FCallback&& Callback)
+	{
+		return Timers.emplace(DeadlineMs, std::move(Callback));
+	}
+
+	void Cancel(FMap::iterator It)
+	{
+		Timers.erase(It);
+	}
+
+	void Advance(uint64 NowMs, std::vector<FTimerWheel::FCallback>& OutExpired)
+	{
+		FMap::iterator It = Timers.begin();
+		for (; It != Timers.end() && It->first <= NowMs; ++It)
+		{
+			OutExpired.push_back(std::move(It->second));
+		}
+		Timers.erase(Timers.begin(), It);
+	}
+
+private:
+	FMap Timers;
+};
+
+// Handles[Timer] is the id of the active timer, callbacks carry their index so fired timers can be added again
+template<typename TTimers, typename THandle>
+static void Bench(const char* Name, TTimers& Timers, int32 NumTimers, uint32 PeriodMs)
+{
+	std::mt19937 Random(1);
+	std::vector<THandle> Handles(NumTimers);
+	std::vector<uint64> Deadlines(NumTimers);
+	std::vector<FTimerWheel::FCallback> Expired;
+	int32 Fired = INDEX_NONE;
+	uint64 NowMs = 0;
+
+	const FClock::time_point AddStart = FClock::now();
+	for (int32 Timer = 0; Timer < NumTimers; Timer++)
+	{
+		Deadlines[Timer] = 1 + static_cast<uint64>(Timer) * PeriodMs / NumTimers;
+		Handles[Timer] = Timers.Add(Deadlines[Timer], [&Fired, Timer]() { Fired = Timer; });
+	}
+	const double AddNs = GetNanoseconds(AddStart, NumTimers);
+
+	const int32 NumRearms = NumTimers * 10;
+	std::uniform_int_distribution<int32> PickTimer(0, NumTimers - 1);
+	std::vector<int32> Picks(NumRearms);
+	for (int32& Pick : Picks)
+	{
+		Pick = PickTimer(Random);
+	}
+	const FClock::time_point RearmStart = FClock::now();
+	for (int32 Timer : Picks)
+	{
+		Timers.Cancel(Handles[Timer]);
+		Handles[Timer] = Timers.Add(Deadlines[Timer], [&Fired, Timer]() { Fired = Timer; });
+	}
+	const double RearmNs = GetNanoseconds(RearmStart, NumRearms);
+
+	int64 NumFired = 0;
+	const FClock::time_point AdvanceStart = FClock::now();
+	while (NowMs < PeriodMs)
+	{
+		NowMs++;
+		Expired.clear();
+		Timers.Advance(NowMs, Expired);
+		for (FTimerWheel::FCallback& Callback : Expired)
+		{
+			Callback();
+			Deadlines[Fired] += PeriodMs;
+			Handles[Fired] = Timers.Add(Deadlines[Fired], [&Fired, Timer = Fired]() { Fired = Timer; });
+		}
+		NumFired += Expired.size();
+	}
+	const double AdvanceNs = GetNanoseconds(AdvanceStart, PeriodMs);
+
+	if (NumFired != NumTimers)
+	{
+		printf("%s fired %lld of %d timers\n", Name, static_cast<long long>(NumFired), NumTimers);
+	}
+	printf("%-10s %12.1f %12.1f %14.0f %14.1f\n", Name, AddNs, RearmNs, AdvanceNs, AdvanceNs * PeriodMs / NumFired);
+}
+
+int main(int argc, char** argv)
+{
+	const int32 NumTimers = argc > 1 ? atoi(argv[1]) : 100000;
+	const uint32 PeriodMs = argc > 2 ? static_cast<uint32>(atoi(argv[2])) : 5000;
+	if (NumTimers <= 0 || PeriodMs == 0)
+	{
+		printf("usage: TimerWheelBench [<active timers> [<period in ms>]]\n");
+		return 1;
+	}
+
+	printf("%d active timers over %u ms, ns per operation\n", NumTimers, PeriodMs);
+	printf("%-10s %12s %12s %14s %14s\n", "", "Add", "Rearm", "Advance 1 ms", "per fired");
+
+	FTimerWheel Wheel(0);
+	Bench<FTimerWheel, FTimerWheel::FTimerId>("wheel", Wheel, NumTimers, PeriodMs);
+
+	FMultimapTimers Multimap;
+	Bench<FMultimapTimers, FMultimapTimers::FMap::iterator>("multimap", Multimap, NumTimers, PeriodMs);
+	return 0;
+}
+
+#endif
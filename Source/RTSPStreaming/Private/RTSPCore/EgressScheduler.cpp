@@ -0,0 +1,202 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "EgressScheduler.h"
+#include "RTSPStringUtils.h"
+#include <algorithm>
+#include <cstring>
+
+// relative share of the link each class gets when the link is congested
+static const uint32 ClassWeights[(uint8)EClientPriority::Num] = { 8, 4, 1 };
+
+static const char* const ClassNames[(uint8)EClientPriority::Num] = { "operator", "recorder", "viewer" };
+
+bool ParseClientPriority(const char* Name, EClientPriority& OutPriority)
+{
+	for (uint8 Class = 0; Class < (uint8)EClientPriority::Num; ++Class)
+	{
+		if (EqualsIgnoreCase(Name, ClassNames[Class]))
+		{
+			OutPriority = (EClientPriority)Class;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* ClientPriorityToString(EClientPriority Priority)
+{
+	return Priority < EClientPriority::Num ? ClassNames[(uint8)Priority] : ClassNames[(uint8)EClientPriority::Viewer];
+}
+
+FEgressScheduler::FEgressScheduler()
+	: LastScheduleTime(0)
+	, Tokens(0)
+	, LargestKeyframe(0)
+{
+	memset(RoundRobinOffset, 0, sizeof(RoundRobinOffset));
+}
+
+// false if the client skips the frame, because it's waiting for a keyframe or the frame is above the layers it gets
+static bool WantsFrame(const FEgressRequest& Request, uint8 TemporalLayer)
+{
+	return !Request.State->bWaitForKeyframe && TemporalLayer <= Request.MaxTemporalLayer && TemporalLayer < Request.State->BrokenLayer;
+}
+
+uint32 FEgressScheduler::Schedule(FEgressRequest* Requests, uint32 NumRequests, bool bKeyframe, uint8 TemporalLayer, uint8 NumTemporalLayers,
+	double NowSeconds, int32 CapacityKbps, int32 BurstMs)
+{
+	//the first call starts with a full bucket
+	const double Elapsed = std::min(std::max(NowSeconds - LastScheduleTime, 0.0), 1.0);
+	LastScheduleTime = NowSeconds;
+
+	FEgressRequest* const RequestsEnd = Requests + NumRequests;
+	if (CapacityKbps <= 0)
+	{
+		//scheduling disabled, everybody gets every frame of the layers they asked for. A client still waits for a
+		//keyframe it needs, e.g. after switching renditions
+		for (FEgressRequest* Request = Requests; Request != RequestsEnd; ++Request)
+		{
+			if (bKeyframe)
+			{
+				Request->State->bWaitForKeyframe = false;
+				Request->State->BrokenLayer = TemporalLayerNone;
+			}
+			Request->bSend = WantsFrame(*Request, TemporalLayer);
+			if (Request->bSend)
+			{
+				Request->State->BrokenLayer = TemporalLayerNone;
+			}
+		}
+		return 0;
+	}
+
+	//refills token bucket, which holds at least the largest keyframe so a keyframe larger than the burst fits too
+	if (bKeyframe)
+	{
+		for (FEgressRequest* Request = Requests; Request != RequestsEnd; ++Request)
+		{
+			LargestKeyframe = std::max(LargestKeyframe, static_cast<double>(Request->Size));
+		}
+	}
+	const double BytesPerSecond = CapacityKbps * 1000.0 / 8.0;
+	const double MaxTokens = std::max(BytesPerSecond * std::max(BurstMs, 1) / 1000.0, LargestKeyframe);
+	Tokens = std::min(Tokens + BytesPerSecond * Elapsed, MaxTokens);
+
+	//a keyframe the class allocations can't fit still goes through once the bucket is full, so clients waiting for it
+	//always get one. The bucket goes into debt then and is paid back before anything else is sent
+	const bool bKeyframeDebt = bKeyframe && Tokens >= MaxTokens;
+
+	//sums up demand of each class, clients waiting for a keyframe or skipping the layer don't want this frame
+	double Demand[(uint8)EClientPriority::Num] = {};
+	for (FEgressRequest* Request = Requests; Request != RequestsEnd; ++Request)
+	{
+		if (bKeyframe)
+		{
+			Request->State->bWaitForKeyframe = false;
+			Request->State->BrokenLayer = TemporalLayerNone;
+		}
+		Request->bSend = false;
+		if (WantsFrame(*Request, TemporalLayer))
+		{
+			Demand[(uint8)Request->Priority] += Request->Size;
+		}
+	}
+
+	//max-min weighted water filling of available tokens between classes
+	double Allocation[(uint8)EClientPriority::Num] = {};
+	bool bActive[(uint8)EClientPriority::Num];
+	double Remaining = Tokens;
+	for (uint8 Class = 0; Class < (uint8)EClientPriority::Num; ++Class)
+	{
+		bActive[Class] = Demand[Class] > 0;
+	}
+	while (Remaining > 0)
+	{
+		uint32 ActiveWeight = 0;
+		for (uint8 Class = 0; Class < (uint8)EClientPriority::Num; ++Class)
+		{
+			ActiveWeight += bActive[Class] ? ClassWeights[Class] : 0;
+		}
+		if (!ActiveWeight)
+		{
+			break;
+		}
+
+		//classes which need less than their fair share are satisfied and leave the rest to others
+		bool bSatisfiedAny = false;
+		const double RemainingBefore = Remaining;
+		for (uint8 Class = 0; Class < (uint8)EClientPriority::Num; ++Class)
+		{
+			const double Share = RemainingBefore * ClassWeights[Class] / ActiveWeight;
+			if (bActive[Class] && Demand[Class] - Allocation[Class] <= Share)
+			{
+				Remaining -= Demand[Class] - Allocation[Class];
+				Allocation[Class] = Demand[Class];
+				bActive[Class] = false;
+				bSatisfiedAny = true;
+			}
+		}
+
+		//every class wants more than its share, split what is left by weight
+		if (!bSatisfiedAny)
+		{
+			for (uint8 Class = 0; Class < (uint8)EClientPriority::Num; ++Class)
+			{
+				if (bActive[Class])
+				{
+					Allocation[Class] += Remaining * ClassWeights[Class] / ActiveWeight;
+				}
+			}
+			Remaining = 0;
+		}
+	}
+
+	//serves clients of each class round-robin within the class allocation
+	uint32 Dropped = 0;
+	for (uint8 Class = 0; Class < (uint8)EClientPriority::Num; ++Class)
+	{
+		ClassRequests.clear();
+		for (FEgressRequest* Request = Requests; Request != RequestsEnd; ++Request)
+		{
+			if ((uint8)Request->Priority == Class && WantsFrame(*Request, TemporalLayer))
+			{
+				ClassRequests.push_back(Request);
+			}
+		}
+		if (ClassRequests.empty())
+		{
+			continue;
+		}
+
+		const uint32 NumClassRequests = static_cast<uint32>(ClassRequests.size());
+		const uint32 Start = RoundRobinOffset[Class] % NumClassRequests;
+		for (uint32 Index = 0; Index < NumClassRequests; ++Index)
+		{
+			FEgressRequest& Request = *ClassRequests[(Start + Index) % NumClassRequests];
+			if (Request.Size <= Allocation[Class] || bKeyframeDebt)
+			{
+				Allocation[Class] = std::max(Allocation[Class] - Request.Size, 0.0);
+				Tokens -= Request.Size;
+				Request.bSend = true;
+				Request.State->BrokenLayer = TemporalLayerNone;
+			}
+			else
+			{
+				//following P-frames reference this one, so the client is skipped until the next keyframe. Frames of
+				//higher layers only until the next frame of a lower layer, and nothing references the top layer
+				if (TemporalLayer == 0)
+				{
+					Request.State->bWaitForKeyframe = true;
+				}
+				else if (TemporalLayer + 1 < NumTemporalLayers)
+				{
+					Request.State->BrokenLayer = TemporalLayer;
+				}
+				Request.State->DroppedFrames++;
+				Dropped++;
+			}
+		}
+		RoundRobinOffset[Class] = Start + 1;
+	}
+	return Dropped;
+}
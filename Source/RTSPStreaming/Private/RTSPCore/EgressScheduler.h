@@ -0,0 +1,84 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+#include "TemporalLayers.h"
+#include <vector>
+
+// client priority classes used by the egress scheduler, highest priority first
+enum class EClientPriority : uint8
+{
+	Operator,
+	Recorder,
+	Viewer,
+	Num
+};
+
+// parses "operator", "recorder" or "viewer" (case insensitive), returns false if the name is unknown
+bool ParseClientPriority(const char* Name, EClientPriority& OutPriority);
+const char* ClientPriorityToString(EClientPriority Priority);
+
+// per client bookkeeping kept by each streamer on behalf of the scheduler
+struct FEgressClientState
+{
+	bool	bWaitForKeyframe = false;			// true after a dropped base layer frame or a rendition switch, P-frames are useless to the decoder until the next IDR
+	uint8	BrokenLayer = TemporalLayerNone;	// temporal layer of a dropped frame, frames of it and up are skipped until one of a lower layer is sent
+	uint32	DroppedFrames = 0;					// frames dropped for this client by the scheduler
+	bool	bFrameInProgress = false;			// was sent the first part of a frame sent in parts, the other parts follow it
+};
+
+// one client's share of the frame that is about to be fanned out
+struct FEgressRequest
+{
+	EClientPriority			Priority;
+	FEgressClientState*		State;
+	uint32					Size;
+	uint8					MaxTemporalLayer;	// frames of higher temporal layers are skipped, see GetMaxTemporalLayer()
+	bool					bSend;				// output: true if the frame should be sent to this client
+};
+
+// weighted fair egress scheduler
+// the link is modelled as a token bucket refilled at the egress capacity. Every frame the available tokens
+// are split between the priority classes by class weight using max-min water filling, so a class that needs less
+// than its share hands the rest to the others. Weights are per class rather than per client, which means a crowd
+// of low priority viewers can not dilute the share of an operator. Inside a class the clients are served
+// round-robin and clients that do not fit are dropped until the next keyframe. The bucket grows to hold the largest
+// keyframe seen, and a keyframe that doesn't fit is let through once the bucket is full, putting it into debt.
+// With temporal layers a client that does not fit a frame above the base layer only skips the frames predicted
+// from it, which costs it frame rate rather than everything up to the next keyframe.
+class FEgressScheduler final
+{
+public:
+	FEgressScheduler();
+
+	// fills bSend of every request and returns the number of clients dropped, a capacity of 0 disables scheduling.
+	// TemporalLayer is the frame's layer out of NumTemporalLayers, 0 of 1 without layers. BurstMs is how much
+	// capacity can be saved up for keyframes
+	uint32 Schedule(FEgressRequest* Requests, uint32 NumRequests, bool bKeyframe, uint8 TemporalLayer, uint8 NumTemporalLayers,
+		double NowSeconds, int32 CapacityKbps, int32 BurstMs);
+
+	// charges the link for the parts of a frame after the first, sent to the clients Schedule() picked for the first
+	void Consume(uint32 Size)
+	{
+		Tokens -= Size;
+	}
+
+	double GetTokens() const
+	{
+		return Tokens;
+	}
+
+	// true if there are tokens for a keyframe as large as the largest one seen, when one forced now is likely sent
+	bool HasTokensForKeyframe() const
+	{
+		return Tokens >= LargestKeyframe;
+	}
+
+private:
+	double		LastScheduleTime;									// time of the previous Schedule call, seconds
+	double		Tokens;												// bytes the link can absorb right now, negative while in debt for a keyframe
+	double		LargestKeyframe;									// bytes of the largest keyframe of a single client, the least the bucket holds
+	uint32		RoundRobinOffset[(uint8)EClientPriority::Num];		// first client served in each class next frame
+	std::vector<FEgressRequest*> ClassRequests;						// requests of the class being served, kept to reuse its memory
+};
@@ -0,0 +1,109 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RTCP.h"
+
+#define RTCP_HEADER_SIZE		8		// common header and sender SSRC
+#define RTCP_SENDER_INFO_SIZE	20		// NTP and RTP timestamps, packet and octet counts of a sender report
+#define RTCP_REPORT_BLOCK_SIZE	24
+#define RTCP_FEEDBACK_SIZE		12		// common header, sender and media source SSRCs
+#define RTCP_NACK_SIZE			4		// packet ID and bitmask of following lost packets
+#define RTCP_FMT_NACK			1
+#define RTCP_FMT_PLI			1
+
+static uint32 ReadUint32(const uint8* Data)
+{
+	return (Data[0] << 24) | (Data[1] << 16) | (Data[2] << 8) | Data[3];
+}
+
+bool ParseRTCPReportBlock(const uint8* Data, int32 Size, uint32 SSRC, FRTCPReportBlock& OutBlock)
+{
+	// walk the packets of the compound packet, each one carries its length in 32 bit words minus one
+	while (Size >= RTCP_HEADER_SIZE)
+	{
+		const uint8 Version = Data[0] >> 6;
+		const uint8 ReportCount = Data[0] & 0x1F;
+		const uint8 PacketType = Data[1];
+		const int32 PacketSize = (((Data[2] << 8) | Data[3]) + 1) * 4;
+		if (Version != 2 || PacketSize > Size)
+		{
+			return false;
+		}
+
+		if (PacketType == RTCP_SR || PacketType == RTCP_RR)
+		{
+			const uint8* Block = Data + RTCP_HEADER_SIZE + (PacketType == RTCP_SR ? RTCP_SENDER_INFO_SIZE : 0);
+			for (uint8 Index = 0; Index < ReportCount && Block + RTCP_REPORT_BLOCK_SIZE <= Data + PacketSize; ++Index, Block += RTCP_REPORT_BLOCK_SIZE)
+			{
+				if (ReadUint32(Block) != SSRC)
+				{
+					continue;
+				}
+
+				OutBlock.SSRC = SSRC;
+				OutBlock.FractionLost = Block[4];
+				OutBlock.CumulativeLost = (Block[5] << 16) | (Block[6] << 8) | Block[7];
+				if (OutBlock.CumulativeLost & 0x800000)
+				{
+					OutBlock.CumulativeLost -= 0x1000000;	// 24 bit signed, duplicates can make it negative
+				}
+				OutBlock.ExtendedHighestSequence = ReadUint32(Block + 8);
+				OutBlock.Jitter = ReadUint32(Block + 12);
+				return true;
+			}
+		}
+
+		Data += PacketSize;
+		Size -= PacketSize;
+	}
+	return false;
+}
+
+bool ParseRTCPFeedback(const uint8* Data, int32 Size, uint32 SSRC, FRTCPFeedback& OutFeedback)
+{
+	OutFeedback.bPictureLoss = false;
+	OutFeedback.LostSequences.clear();
+
+	bool bFound = false;
+	while (Size >= RTCP_HEADER_SIZE)
+	{
+		const uint8 Version = Data[0] >> 6;
+		const uint8 Format = Data[0] & 0x1F;
+		const uint8 PacketType = Data[1];
+		const int32 PacketSize = (((Data[2] << 8) | Data[3]) + 1) * 4;
+		if (Version != 2 || PacketSize > Size)
+		{
+			return bFound;
+		}
+
+		if ((PacketType == RTCP_RTPFB || PacketType == RTCP_PSFB) && PacketSize >= RTCP_FEEDBACK_SIZE && ReadUint32(Data + 8) == SSRC)
+		{
+			if (PacketType == RTCP_PSFB && Format == RTCP_FMT_PLI)
+			{
+				OutFeedback.bPictureLoss = true;
+				bFound = true;
+			}
+			else if (PacketType == RTCP_RTPFB && Format == RTCP_FMT_NACK)
+			{
+				// each NACK names a lost packet and, in its bitmask, which of the 16 following ones were lost too
+				for (const uint8* Nack = Data + RTCP_FEEDBACK_SIZE; Nack + RTCP_NACK_SIZE <= Data + PacketSize; Nack += RTCP_NACK_SIZE)
+				{
+					const uint16 PacketId = static_cast<uint16>((Nack[0] << 8) | Nack[1]);
+					const uint16 Bitmask = static_cast<uint16>((Nack[2] << 8) | Nack[3]);
+					OutFeedback.LostSequences.push_back(PacketId);
+					for (uint16 Bit = 0; Bit < 16; ++Bit)
+					{
+						if (Bitmask & (1 << Bit))
+						{
+							OutFeedback.LostSequences.push_back(static_cast<uint16>(PacketId + Bit + 1));
+						}
+					}
+					bFound = true;
+				}
+			}
+		}
+
+		Data += PacketSize;
+		Size -= PacketSize;
+	}
+	return bFound;
+}
@@ -0,0 +1,34 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+#include <vector>
+
+#define RTCP_SR		200		// sender report
+#define RTCP_RR		201		// receiver report
+#define RTCP_RTPFB	205		// transport layer feedback, generic NACK (RFC 4585 6.2.1)
+#define RTCP_PSFB	206		// payload specific feedback, picture loss indication (RFC 4585 6.3.1)
+
+// reception statistics a receiver reports about one of our RTP streams (RFC 3550 6.4.1)
+struct FRTCPReportBlock
+{
+	uint32	SSRC;						// source the block is about
+	uint8	FractionLost;				// fraction of packets lost since the previous report, 1/256 units
+	int32	CumulativeLost;				// packets lost since the start of reception
+	uint32	ExtendedHighestSequence;	// highest sequence number received, upper 16 bits count wrap-arounds
+	uint32	Jitter;						// interarrival jitter, RTP timestamp units
+};
+
+// finds the report block about SSRC in a compound RTCP packet from the client, false if it has none
+bool ParseRTCPReportBlock(const uint8* Data, int32 Size, uint32 SSRC, FRTCPReportBlock& OutBlock);
+
+// loss feedback a receiver sent about one of our RTP streams (RFC 4585)
+struct FRTCPFeedback
+{
+	bool				bPictureLoss = false;		// PLI, the decoder needs a frame it can start from
+	std::vector<uint16>	LostSequences;				// generic NACKs, in the order the client sent them
+};
+
+// collects the feedback about SSRC from a compound RTCP packet, false if it has none
+bool ParseRTCPFeedback(const uint8* Data, int32 Size, uint32 SSRC, FRTCPFeedback& OutFeedback);
@@ -0,0 +1,127 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RTPLossTracker.h"
+
+// RFC 1982 serial number arithmetic, sequence numbers wrap every 65536 packets
+static bool IsNewer(uint16 A, uint16 B)
+{
+	return static_cast<int16>(A - B) > 0;
+}
+
+FRTPLossTracker::FRTPLossTracker()
+	: Frames(HistoryFrames)
+	, NextFrame(0)
+	, NumFrames(0)
+	, bHaveReport(false)
+	, LastCumulativeLost(0)
+	, LastHighestSequence(0)
+	, bReported(false)
+	, LastReportedTimestamp(0)
+	, CoveredTimestamp(0)
+{
+}
+
+void FRTPLossTracker::OnFrameSent(uint32 Timestamp, uint16 FirstSequence, uint16 NumPackets, uint16 NumExpendable)
+{
+	check(NumExpendable <= NumPackets);
+	if (!NumPackets)
+	{
+		return;
+	}
+
+	FFrame& Frame = Frames[NextFrame];
+	Frame.Timestamp = Timestamp;
+	Frame.FirstSequence = FirstSequence;
+	Frame.NumPackets = NumPackets;
+	Frame.NumExpendable = NumExpendable;
+	NextFrame = (NextFrame + 1) % HistoryFrames;
+	if (NumFrames < HistoryFrames)
+	{
+		NumFrames++;
+	}
+}
+
+const FRTPLossTracker::FFrame& FRTPLossTracker::GetFrame(uint32 Age) const
+{
+	return Frames[(NextFrame + HistoryFrames - NumFrames + Age) % HistoryFrames];
+}
+
+bool FRTPLossTracker::OnReceiverReport(const FRTCPReportBlock& Block, uint32& OutLostTimestamp)
+{
+	const uint16 HighestSequence = static_cast<uint16>(Block.ExtendedHighestSequence);
+	const int32 NewlyLost = Block.CumulativeLost - LastCumulativeLost;
+	const uint16 PreviousHighestSequence = LastHighestSequence;
+	const bool bHadReport = bHaveReport;
+
+	bHaveReport = true;
+	LastCumulativeLost = Block.CumulativeLost;
+	LastHighestSequence = HighestSequence;
+
+	// the first report is the baseline, losses before it can't be placed
+	if (!bHadReport || NewlyLost <= 0)
+	{
+		return false;
+	}
+
+	// the frames the report covers that the previous one didn't, oldest first
+	const FFrame* Oldest = nullptr;
+	int32 Expendable = 0;
+	for (uint32 Age = 0; Age < NumFrames; ++Age)
+	{
+		const FFrame& Frame = GetFrame(Age);
+		const uint16 LastSequence = static_cast<uint16>(Frame.FirstSequence + Frame.NumPackets - 1);
+		if (!IsNewer(LastSequence, PreviousHighestSequence))
+		{
+			continue;
+		}
+		if (IsNewer(Frame.FirstSequence, HighestSequence))
+		{
+			break;
+		}
+		if (!Oldest)
+		{
+			Oldest = &Frame;
+		}
+		Expendable += Frame.NumExpendable;
+	}
+
+	// lost probes are what path MTU discovery expects, they cost no picture
+	if (!Oldest || NewlyLost <= Expendable)
+	{
+		return false;
+	}
+	return Report(*Oldest, OutLostTimestamp);
+}
+
+bool FRTPLossTracker::OnNack(const std::vector<uint16>& LostSequences, uint32& OutLostTimestamp)
+{
+	for (uint32 Age = 0; Age < NumFrames; ++Age)
+	{
+		const FFrame& Frame = GetFrame(Age);
+		const uint16 MediaPackets = Frame.NumPackets - Frame.NumExpendable;
+		for (uint16 Sequence : LostSequences)
+		{
+			if (static_cast<uint16>(Sequence - Frame.FirstSequence) < MediaPackets)
+			{
+				return Report(Frame, OutLostTimestamp);
+			}
+		}
+	}
+	return false;
+}
+
+bool FRTPLossTracker::Report(const FFrame& Frame, uint32& OutLostTimestamp)
+{
+	//the frame lies between the one last reported and the newest one sent then, the recovery requested covers it. RTP
+	//timestamps wrap
+	if (bReported && static_cast<int32>(Frame.Timestamp - LastReportedTimestamp) >= 0 && static_cast<int32>(CoveredTimestamp - Frame.Timestamp) >= 0)
+	{
+		return false;
+	}
+
+	bReported = true;
+	LastReportedTimestamp = Frame.Timestamp;
+	CoveredTimestamp = GetFrame(NumFrames - 1).Timestamp;
+	OutLostTimestamp = Frame.Timestamp;
+	return true;
+}
@@ -0,0 +1,51 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTCP.h"
+#include <vector>
+
+// maps the losses a client reports back to the frames they hit, so the encoder can recover from the oldest one
+// - remembers the RTP sequence numbers of the last HistoryFrames frames sent over UDP
+// - receiver reports only count losses, a rise of the cumulative count is put on the oldest frame sent after the
+//   highest sequence number of the previous report. Generic NACKs name the lost packets
+// - packets without media, path MTU probes, are expendable: losses they can account for report nothing
+// - the recovery of a reported frame also covers the frames sent after it until then, so later, duplicate or
+//   reordered reports of losses in them report nothing. A loss in an older frame is still reported
+// not thread safe, the owner serialises access
+class FRTPLossTracker final
+{
+public:
+	static const uint32 HistoryFrames = 128;
+
+	FRTPLossTracker();
+
+	// the last NumExpendable of the frame's NumPackets packets carry no media
+	void OnFrameSent(uint32 Timestamp, uint16 FirstSequence, uint16 NumPackets, uint16 NumExpendable);
+
+	// true with the RTP timestamp of the oldest frame the reported loss hit
+	bool OnReceiverReport(const FRTCPReportBlock& Block, uint32& OutLostTimestamp);
+	bool OnNack(const std::vector<uint16>& LostSequences, uint32& OutLostTimestamp);
+
+private:
+	struct FFrame
+	{
+		uint32	Timestamp;
+		uint16	FirstSequence;
+		uint16	NumPackets;
+		uint16	NumExpendable;
+	};
+
+	const FFrame& GetFrame(uint32 Age) const;		// 0 is the oldest frame remembered
+	bool Report(const FFrame& Frame, uint32& OutLostTimestamp);
+
+	std::vector<FFrame>	Frames;					// ring of the frames sent
+	uint32				NextFrame;				// ring index the next frame goes to
+	uint32				NumFrames;
+	bool				bHaveReport;			// a receiver report set the fields below
+	int32				LastCumulativeLost;
+	uint16				LastHighestSequence;
+	bool				bReported;				// the two timestamps below are set
+	uint32				LastReportedTimestamp;
+	uint32				CoveredTimestamp;		// newest frame sent when the last loss was reported, recovered with it
+};
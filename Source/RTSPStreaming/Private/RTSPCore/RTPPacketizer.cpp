@@ -0,0 +1,256 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RTPPacketizer.h"
+#include <algorithm>
+#include <cstring>
+
+#define H264_NAL_FU_A		28		// fragmentation unit type A
+#define H264_NAL_FILLER		12		// filler data
+#define FU_A_HEADER_SIZE	2		// FU indicator + FU header
+#define H265_NAL_AP			48		// aggregation packet
+#define H265_NAL_FU			49		// fragmentation unit
+#define H265_NAL_FILLER		38		// filler data
+#define H265_NAL_HEADER_SIZE	2
+#define H265_FU_HEADER_SIZE	3		// payload header + FU header
+#define H265_AP_SIZE_FIELD	2		// NAL unit size in front of each aggregated NAL unit
+
+// filler data RBSP, 0xFF bytes closed by the RBSP trailing bits. Fillers of any size point into its tail
+static struct FFillerPayload
+{
+	uint8 Data[RTP_MAX_FILLER_SIZE];
+
+	FFillerPayload()
+	{
+		memset(Data, 0xFF, sizeof(Data));
+		Data[RTP_MAX_FILLER_SIZE - 1] = 0x80;
+	}
+} FillerPayload;
+
+FRTPPacketizer::FRTPPacketizer()
+	: Codec(EVideoCodec::H264)
+	, SequenceNumber(0)
+	, SSRC(0x13f97e67)	// we just an arbitrary number here to keep it simple
+	, PendingSize(0)
+{}
+
+FRTPPacket& FRTPPacketizer::AddPacket(FRTPPacketArray& OutPackets, uint32 Timestamp, const uint8* Payload, uint32 PayloadSize)
+{
+	OutPackets.emplace_back();
+	FRTPPacket& Packet = OutPackets.back();
+	Packet.HeaderSize = RTP_HEADER_SIZE;
+	Packet.Payload = Payload;
+	Packet.PayloadSize = PayloadSize;
+
+	// Prepare the 12 byte RTP header
+	uint8* RTPBuf = Packet.GetRTPHeader();
+	RTPBuf[0] = 0x80;									// RTP Version - 0b10, 0b0 - Padding, 0b0 - Extension, 0b0000 - CSRC count
+	RTPBuf[1] = 0x60;									// Marker - 0b0, payload type - 96 (dynamic)
+	RTPBuf[2] = SequenceNumber >> 8;					// sequence counter
+	RTPBuf[3] = SequenceNumber & 0x0FF;					// sequence counter
+	RTPBuf[4] = (Timestamp & 0xFF000000) >> 24;			// timestamp
+	RTPBuf[5] = (Timestamp & 0x00FF0000) >> 16;			// timestamp
+	RTPBuf[6] = (Timestamp & 0x0000FF00) >> 8;			// timestamp
+	RTPBuf[7] = (Timestamp & 0x000000FF);				// timestamp
+	RTPBuf[8] = (SSRC & 0xFF000000) >> 24;				// 4 byte SSRC (sychronization source identifier)
+	RTPBuf[9] = (SSRC & 0x00FF0000) >> 16;
+	RTPBuf[10] = (SSRC & 0x0000FF00) >> 8;
+	RTPBuf[11] = (SSRC & 0x000000FF);
+
+	//prepare the packet counter for the next packet
+	SequenceNumber++;
+	return Packet;
+}
+
+void FRTPPacketizer::Packetize(uint32 Timestamp, const uint8* Data, uint32 Size, uint32 MaxPayloadSize, FRTPPacketArray& OutPackets, bool bEndOfAccessUnit)
+{
+	check(MaxPayloadSize > H265_FU_HEADER_SIZE);
+	OutPackets.clear();
+
+	ForEachAnnexBNal(Data, Size, [this, Timestamp, MaxPayloadSize, &OutPackets](const uint8* Nal, uint32 NalSize)
+	{
+		if (IsH265(Codec))
+		{
+			// a NAL unit shorter than its header can't be sent on its own
+			if (NalSize >= H265_NAL_HEADER_SIZE)
+			{
+				PacketizeH265Nal(Timestamp, Nal, NalSize, MaxPayloadSize, OutPackets);
+			}
+		}
+		else if (NalSize)
+		{
+			PacketizeH264Nal(Timestamp, Nal, NalSize, MaxPayloadSize, OutPackets);
+		}
+	});
+	FlushAggregation(Timestamp, OutPackets);
+
+	// marker bit on the last packet of the access unit
+	if (bEndOfAccessUnit && !OutPackets.empty())
+	{
+		OutPackets.back().GetRTPHeader()[1] |= 0x80;
+	}
+}
+
+void FRTPPacketizer::PacketizeH264Nal(uint32 Timestamp, const uint8* Nal, uint32 NalSize, uint32 MaxPayloadSize, FRTPPacketArray& OutPackets)
+{
+	// single NAL unit packet
+	if (NalSize <= MaxPayloadSize)
+	{
+		AddPacket(OutPackets, Timestamp, Nal, NalSize);
+		return;
+	}
+
+	// FU-A fragments, the NAL header is replaced by FU indicator and FU header
+	const uint8 NalHeader = Nal[0];
+	const uint32 FragmentSize = MaxPayloadSize - FU_A_HEADER_SIZE;
+	const uint8* Fragment = Nal + 1;
+	uint32 Remaining = NalSize - 1;
+	bool bFirst = true;
+	while (Remaining)
+	{
+		const uint32 PayloadSize = std::min(Remaining, FragmentSize);
+		FRTPPacket& Packet = AddPacket(OutPackets, Timestamp, Fragment, PayloadSize);
+		Fragment += PayloadSize;
+		Remaining -= PayloadSize;
+
+		uint8* FUHeader = Packet.GetRTPHeader() + RTP_HEADER_SIZE;
+		FUHeader[0] = (NalHeader & 0xE0) | H264_NAL_FU_A;								// F, NRI and FU-A type
+		FUHeader[1] = (bFirst ? 0x80 : 0x00) | (!Remaining ? 0x40 : 0x00) | (NalHeader & 0x1F);	// start, end and NAL type
+		Packet.HeaderSize += FU_A_HEADER_SIZE;
+		bFirst = false;
+	}
+}
+
+void FRTPPacketizer::PacketizeH265Nal(uint32 Timestamp, const uint8* Nal, uint32 NalSize, uint32 MaxPayloadSize, FRTPPacketArray& OutPackets)
+{
+	// NAL units are aggregated while the aggregation packet fits, its payload header is counted with the first one
+	const uint32 AggregatedSize = H265_AP_SIZE_FIELD + NalSize + (PendingNals.empty() ? H265_NAL_HEADER_SIZE : 0);
+	if (NalSize <= 0xFFFF && PendingSize + AggregatedSize <= MaxPayloadSize)
+	{
+		PendingNals.emplace_back(Nal, NalSize);
+		PendingSize += AggregatedSize;
+		return;
+	}
+	FlushAggregation(Timestamp, OutPackets);
+
+	// starts the next aggregation, unless it doesn't fit with a size field
+	if (H265_NAL_HEADER_SIZE + H265_AP_SIZE_FIELD + NalSize <= MaxPayloadSize)
+	{
+		PendingNals.emplace_back(Nal, NalSize);
+		PendingSize = H265_NAL_HEADER_SIZE + H265_AP_SIZE_FIELD + NalSize;
+		return;
+	}
+
+	// single NAL unit packet
+	if (NalSize <= MaxPayloadSize)
+	{
+		AddPacket(OutPackets, Timestamp, Nal, NalSize);
+		return;
+	}
+
+	// fragmentation units, the NAL header becomes the payload header with the FU type, the NAL type moves to the FU header
+	const uint8 NalType = (Nal[0] >> 1) & 0x3F;
+	const uint32 FragmentSize = MaxPayloadSize - H265_FU_HEADER_SIZE;
+	const uint8* Fragment = Nal + H265_NAL_HEADER_SIZE;
+	uint32 Remaining = NalSize - H265_NAL_HEADER_SIZE;
+	bool bFirst = true;
+	while (Remaining)
+	{
+		const uint32 PayloadSize = std::min(Remaining, FragmentSize);
+		FRTPPacket& Packet = AddPacket(OutPackets, Timestamp, Fragment, PayloadSize);
+		Fragment += PayloadSize;
+		Remaining -= PayloadSize;
+
+		uint8* FUHeader = Packet.GetRTPHeader() + RTP_HEADER_SIZE;
+		FUHeader[0] = (Nal[0] & 0x81) | (H265_NAL_FU << 1);							// F, FU type and the high bit of the layer id
+		FUHeader[1] = Nal[1];														// layer id and temporal id
+		FUHeader[2] = (bFirst ? 0x80 : 0x00) | (!Remaining ? 0x40 : 0x00) | NalType;	// start, end and NAL type
+		Packet.HeaderSize += H265_FU_HEADER_SIZE;
+		bFirst = false;
+	}
+}
+
+void FRTPPacketizer::FlushAggregation(uint32 Timestamp, FRTPPacketArray& OutPackets)
+{
+	if (PendingNals.size() == 1)
+	{
+		// nothing to aggregate with
+		AddPacket(OutPackets, Timestamp, PendingNals[0].first, PendingNals[0].second);
+	}
+	else if (PendingNals.size() > 1)
+	{
+		// the payload header has the F bit of any NAL unit and the lowest layer and temporal ids
+		uint8 F = 0;
+		uint8 LayerId = 0x3F;
+		uint8 TemporalId = 0x07;
+		FRTPPacket& Packet = AddPacket(OutPackets, Timestamp, nullptr, 0);
+		Packet.Aggregate.reserve(PendingSize - H265_NAL_HEADER_SIZE);
+		for (const std::pair<const uint8*, uint32>& Nal : PendingNals)
+		{
+			F |= Nal.first[0] & 0x80;
+			LayerId = std::min<uint8>(LayerId, ((Nal.first[0] & 0x01) << 5) | (Nal.first[1] >> 3));
+			TemporalId = std::min<uint8>(TemporalId, Nal.first[1] & 0x07);
+			Packet.Aggregate.push_back(static_cast<uint8>(Nal.second >> 8));
+			Packet.Aggregate.push_back(static_cast<uint8>(Nal.second & 0xFF));
+			Packet.Aggregate.insert(Packet.Aggregate.end(), Nal.first, Nal.first + Nal.second);
+		}
+		Packet.Payload = Packet.Aggregate.data();
+		Packet.PayloadSize = static_cast<uint32>(Packet.Aggregate.size());
+
+		uint8* PayloadHeader = Packet.GetRTPHeader() + RTP_HEADER_SIZE;
+		PayloadHeader[0] = F | (H265_NAL_AP << 1) | (LayerId >> 5);
+		PayloadHeader[1] = static_cast<uint8>((LayerId << 3) | TemporalId);
+		Packet.HeaderSize += H265_NAL_HEADER_SIZE;
+	}
+	PendingNals.clear();
+	PendingSize = 0;
+}
+
+void FRTPPacketizer::AppendFiller(uint32 Timestamp, uint32 PayloadSize, FRTPPacketArray& OutPackets)
+{
+	const uint32 NalHeaderSize = IsH265(Codec) ? H265_NAL_HEADER_SIZE : 1;
+	check(PayloadSize > NalHeaderSize && PayloadSize <= RTP_MAX_FILLER_SIZE);
+
+	// filler data may only follow the VCL NAL units, so it becomes the last packet of the access unit
+	if (!OutPackets.empty())
+	{
+		OutPackets.back().GetRTPHeader()[1] &= ~0x80;
+	}
+
+	// the NAL header lives in the packet header like the FU bytes, the RBSP comes from the shared filler payload
+	FRTPPacket& Packet = AddPacket(OutPackets, Timestamp, FillerPayload.Data + RTP_MAX_FILLER_SIZE - (PayloadSize - NalHeaderSize), PayloadSize - NalHeaderSize);
+	uint8* NalHeader = Packet.GetRTPHeader() + RTP_HEADER_SIZE;
+	if (IsH265(Codec))
+	{
+		NalHeader[0] = H265_NAL_FILLER << 1;
+		NalHeader[1] = 0x01;							// layer 0, temporal id plus 1
+	}
+	else
+	{
+		NalHeader[0] = H264_NAL_FILLER;
+	}
+	Packet.HeaderSize += NalHeaderSize;
+	Packet.GetRTPHeader()[1] |= 0x80;
+}
+
+bool ExtractParameterSets(EVideoCodec Codec, const uint8* Data, uint32 Size, std::vector<uint8>& OutParameterSets)
+{
+	OutParameterSets.clear();
+	ForEachAnnexBNal(Data, Size, [Codec, &OutParameterSets](const uint8* Nal, uint32 NalSize)
+	{
+		if (!NalSize)
+		{
+			return;
+		}
+		const uint8 Type = GetNalType(Codec, Nal);
+		const bool bParameterSet = IsH265(Codec)
+			? (Type == H265_NAL_VPS || Type == H265_NAL_SPS || Type == H265_NAL_PPS)
+			: (Type == H264_NAL_SPS || Type == H264_NAL_PPS);
+		if (bParameterSet)
+		{
+			static const uint8 StartCode[] = { 0, 0, 0, 1 };
+			OutParameterSets.insert(OutParameterSets.end(), StartCode, StartCode + sizeof(StartCode));
+			OutParameterSets.insert(OutParameterSets.end(), Nal, Nal + NalSize);
+		}
+	});
+	return !OutParameterSets.empty();
+}
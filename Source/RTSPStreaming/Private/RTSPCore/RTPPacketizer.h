@@ -0,0 +1,135 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+#include "VideoCodec.h"
+#include <utility>
+#include <vector>
+
+#define RTP_HEADER_SIZE				12		// fixed RTP header, no CSRCs or extensions
+#define RTP_INTERLEAVED_HEADER_SIZE	4		// '$', channel and 16 bit length in front of each RTP packet on the RTSP connection
+#define RTP_MAX_FILLER_SIZE			9216	// largest filler payload AppendFiller() can produce
+
+// one RTP packet that references its payload inside the encoded frame instead of owning a copy, only H.265 aggregation
+// packets build theirs
+struct FRTPPacket
+{
+	static const uint32 MaxHeaderSize = RTP_INTERLEAVED_HEADER_SIZE + RTP_HEADER_SIZE + 3;
+
+	uint8			Header[MaxHeaderSize];	// interleave header, RTP header and FU-A indicator/header or H.265 payload/FU header
+	uint32			HeaderSize;				// RTP header plus FU bytes, the interleave header is not counted
+	const uint8*	Payload;				// points into the encoded frame, or into Aggregate
+	uint32			PayloadSize;
+	std::vector<uint8>	Aggregate;		// payload of an H.265 aggregation packet, the NAL units with their sizes interleaved
+
+	uint8* GetRTPHeader()					// start of the RTP packet, UDP sends from here
+	{
+		return Header + RTP_INTERLEAVED_HEADER_SIZE;
+	}
+	uint32 GetRTPSize() const				// size of the RTP packet without the interleave header
+	{
+		return HeaderSize + PayloadSize;
+	}
+	void SetInterleavedHeader(uint8 Channel)
+	{
+		const uint32 Size = GetRTPSize();
+		Header[0] = '$';
+		Header[1] = Channel;
+		Header[2] = (Size & 0x0000FF00) >> 8;
+		Header[3] = (Size & 0x000000FF);
+	}
+};
+
+// packets of one access unit, reused from frame to frame. Moving the array keeps aggregation payloads in place, copying it doesn't
+using FRTPPacketArray = std::vector<FRTPPacket>;
+
+// splits an Annex-B access unit into RTP packets
+// - H.264 (RFC 6184): NAL units that fit into MaxPayloadSize are sent as single NAL unit packets, larger ones are split
+//   into FU-A fragments
+// - H.265 (RFC 7798): small NAL units in a row, like the VPS, SPS and PPS of an IDR frame, share an aggregation packet,
+//   the others are sent as single NAL unit packets or split into fragmentation units
+// Start codes are stripped and the marker bit is set on the last packet of the access unit. An access unit can be
+// packetized in parts of whole NAL units, e.g. slices sent as soon as they are encoded, only its last part is marked.
+class FRTPPacketizer final
+{
+public:
+	FRTPPacketizer();
+
+	void SetCodec(EVideoCodec InCodec)		// codec of the frames passed to Packetize(), set before the first one
+	{
+		Codec = InCodec;
+	}
+	EVideoCodec GetCodec() const
+	{
+		return Codec;
+	}
+
+	void Packetize(uint32 Timestamp, const uint8* Data, uint32 Size, uint32 MaxPayloadSize, FRTPPacketArray& OutPackets, bool bEndOfAccessUnit = true);
+
+	// appends a filler data NAL unit of PayloadSize bytes to the access unit in OutPackets and moves the marker bit to
+	// it, decoders discard it so it can pad a path MTU probe to any size
+	void AppendFiller(uint32 Timestamp, uint32 PayloadSize, FRTPPacketArray& OutPackets);
+
+	uint16 GetSequenceNumber() const		// sequence number of the next packet
+	{
+		return SequenceNumber;
+	}
+	uint32 GetSSRC() const
+	{
+		return SSRC;
+	}
+
+private:
+	FRTPPacket& AddPacket(FRTPPacketArray& OutPackets, uint32 Timestamp, const uint8* Payload, uint32 PayloadSize);
+	void PacketizeH264Nal(uint32 Timestamp, const uint8* Nal, uint32 NalSize, uint32 MaxPayloadSize, FRTPPacketArray& OutPackets);
+	void PacketizeH265Nal(uint32 Timestamp, const uint8* Nal, uint32 NalSize, uint32 MaxPayloadSize, FRTPPacketArray& OutPackets);
+	void FlushAggregation(uint32 Timestamp, FRTPPacketArray& OutPackets);	// sends the NAL units waiting for an aggregation packet
+
+	EVideoCodec		Codec;
+	uint16			SequenceNumber;		// RTP packet number
+	uint32			SSRC;				// sychronization source identifier
+	std::vector<std::pair<const uint8*, uint32>> PendingNals;	// small H.265 NAL units waiting to be aggregated
+	uint32			PendingSize;		// aggregation packet payload the pending NAL units make up
+};
+
+// calls Visitor(const uint8* Nal, uint32 NalSize) for every NAL unit of an Annex-B byte stream
+template<typename FVisitor>
+void ForEachAnnexBNal(const uint8* Data, uint32 Size, FVisitor&& Visitor)
+{
+	const uint8* End = Data + Size;
+	const uint8* NalStart = nullptr;
+	const uint8* Ptr = Data;
+	while (Ptr + 3 <= End)
+	{
+		if (Ptr[0] == 0 && Ptr[1] == 0 && Ptr[2] == 1)
+		{
+			if (NalStart)
+			{
+				// a 4 byte start code leaves a trailing zero on the previous NAL
+				const uint8* NalEnd = (Ptr > NalStart && Ptr[-1] == 0) ? Ptr - 1 : Ptr;
+				Visitor(NalStart, static_cast<uint32>(NalEnd - NalStart));
+			}
+			Ptr += 3;
+			NalStart = Ptr;
+		}
+		else
+		{
+			++Ptr;
+		}
+	}
+
+	if (NalStart && NalStart < End)
+	{
+		Visitor(NalStart, static_cast<uint32>(End - NalStart));
+	}
+	else if (!NalStart && Size)
+	{
+		// not Annex-B, treat the whole buffer as one NAL
+		Visitor(Data, Size);
+	}
+}
+
+// replaces OutParameterSets with the parameter set NAL units of an access unit, the VPS, SPS and PPS with H.265, each
+// with a start code. Returns false if it has none
+bool ExtractParameterSets(EVideoCodec Codec, const uint8* Data, uint32 Size, std::vector<uint8>& OutParameterSets);
@@ -0,0 +1,31 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+// the RTSP/RTP core is engine independent, it's compiled into the plugin module and standalone by RTSPCore/CMakeLists.txt
+// - inside the engine it uses the engine's integer types and check()
+// - standalone it defines the same names on top of the standard library, RTSP_CORE_STANDALONE is set by CMake
+// everything else in the core sticks to the standard library, containers are std::vector and callbacks std::function
+#if defined(RTSP_CORE_STANDALONE)
+
+#include <cassert>
+#include <cstdint>
+
+typedef std::uint8_t		uint8;
+typedef std::uint16_t		uint16;
+typedef std::uint32_t		uint32;
+typedef unsigned long long	uint64;
+typedef std::int8_t			int8;
+typedef std::int16_t		int16;
+typedef std::int32_t		int32;
+typedef long long			int64;
+
+#define INDEX_NONE	-1
+#define check(expr)	assert(expr)
+
+#else
+
+#include "CoreTypes.h"
+#include "Misc/AssertionMacros.h"
+
+#endif
@@ -0,0 +1,205 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RTSPRequest.h"
+#include <cstdio>
+#include <cstdlib>
+
+static const struct
+{
+	const char*	Name;
+	ERTSPMethod	Method;
+} Methods[] =
+{
+	{ "OPTIONS",		ERTSPMethod::Options },
+	{ "DESCRIBE",		ERTSPMethod::Describe },
+	{ "SETUP",			ERTSPMethod::Setup },
+	{ "PLAY",			ERTSPMethod::Play },
+	{ "TEARDOWN",		ERTSPMethod::Teardown },
+	{ "PAUSE",			ERTSPMethod::Pause },
+	{ "GET_PARAMETER",	ERTSPMethod::GetParameter },
+	{ "SET_PARAMETER",	ERTSPMethod::SetParameter },
+};
+
+bool ParseRTSPRequest(const char* Request, uint32 Size, FRTSPRequest& OutRequest)
+{
+	char     CmdName[RTSP_PARAM_STRING_MAX];
+	char     CurRequest[RTSP_BUFFER_SIZE];
+	unsigned CurRequestSize;
+
+	memset(&OutRequest, 0x00, sizeof(OutRequest));
+	OutRequest.Method = ERTSPMethod::Unknown;
+	CurRequestSize = Size < RTSP_BUFFER_SIZE - 1 ? Size : RTSP_BUFFER_SIZE - 1;
+	memcpy(CurRequest, Request, CurRequestSize);
+	CurRequest[CurRequestSize] = 0;		// received data isn't terminated, the parsing below relies on strstr
+
+	// the body follows the empty line, it's parsed by the handler of the method
+	const char* HeaderEnd = strstr(CurRequest, "\r\n\r\n");
+	if (HeaderEnd != nullptr && HeaderEnd + 4 < CurRequest + CurRequestSize)
+	{
+		OutRequest.Body = Request + (HeaderEnd + 4 - CurRequest);
+		OutRequest.BodySize = static_cast<uint32>(CurRequest + CurRequestSize - (HeaderEnd + 4));
+	}
+
+	// check whether the request contains information about the RTP/RTCP UDP client ports (SETUP command)
+	const char* ClientPortPtr = strstr(CurRequest, "client_port");
+	if (ClientPortPtr != nullptr)
+	{
+		unsigned RTPPort;
+		if (sscanf(ClientPortPtr, "client_port=%u-", &RTPPort) == 1 && RTPPort > 0 && RTPPort < 0xFFFF)
+		{
+			OutRequest.ClientRTPPort = static_cast<uint16>(RTPPort);
+			OutRequest.ClientRTCPPort = static_cast<uint16>(RTPPort + 1);
+		}
+	}
+
+	// Read everything up to the first space as the command name
+	bool parseSucceeded = false;
+	unsigned i;
+	for (i = 0; i < sizeof(CmdName) - 1 && i < CurRequestSize; ++i)
+	{
+		char c = CurRequest[i];
+		if (c == ' ' || c == '\t')
+		{
+			parseSucceeded = true;
+			break;
+		}
+		CmdName[i] = c;
+	}
+	CmdName[i] = '\0';
+	if (!parseSucceeded) return false;
+
+	// find out the command type
+	for (const auto& Method : Methods)
+	{
+		if (strcmp(CmdName, Method.Name) == 0)
+		{
+			OutRequest.Method = Method.Method;
+			break;
+		}
+	}
+
+	// check whether the request contains transport information (UDP or TCP)
+	if (OutRequest.Method == ERTSPMethod::Setup)
+	{
+		OutRequest.bTCPTransport = strstr(CurRequest, "RTP/AVP/TCP") != nullptr;
+	}
+
+	// Skip over the prefix of any "RTSP://" or "RTSP:/" URL that follows:
+	unsigned j = i + 1;
+	while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j; // skip over any additional white space
+	for (; (int)j < (int)(CurRequestSize - 8); ++j)
+	{
+		if ((CurRequest[j] == 'r' || CurRequest[j] == 'R') &&
+			(CurRequest[j + 1] == 't' || CurRequest[j + 1] == 'T') &&
+			(CurRequest[j + 2] == 's' || CurRequest[j + 2] == 'S') &&
+			(CurRequest[j + 3] == 'p' || CurRequest[j + 3] == 'P') &&
+			CurRequest[j + 4] == ':' && CurRequest[j + 5] == '/')
+		{
+			j += 6;
+			if (CurRequest[j] == '/')
+			{   // This is a "RTSP://" URL; skip over the host:port part that follows:
+				++j;
+				unsigned uidx = 0;
+				while (j < CurRequestSize && CurRequest[j] != '/' && CurRequest[j] != ' ')
+				{   // extract the host:port part of the URL here
+					if (uidx < sizeof(OutRequest.URLHostPort) - 1)
+					{
+						OutRequest.URLHostPort[uidx++] = CurRequest[j];
+					}
+					++j;
+				}
+			}
+			else --j;
+			i = j;
+			break;
+		}
+	}
+
+	// Look for the URL suffix (before the following "RTSP/"):
+	parseSucceeded = false;
+	for (unsigned k = i + 1; (int)k < (int)(CurRequestSize - 5); ++k)
+	{
+		if (CurRequest[k] == 'R' && CurRequest[k + 1] == 'T' &&
+			CurRequest[k + 2] == 'S' && CurRequest[k + 3] == 'P' &&
+			CurRequest[k + 4] == '/')
+		{
+			while (--k >= i && CurRequest[k] == ' ') {}
+			unsigned k1 = k;
+			while (k1 > i && CurRequest[k1] != '/') --k1;
+			if (k - k1 + 1 > sizeof(OutRequest.URLSuffix)) return false;
+			unsigned n = 0, k2 = k1 + 1;
+
+			while (k2 <= k) OutRequest.URLSuffix[n++] = CurRequest[k2++];
+			OutRequest.URLSuffix[n] = '\0';
+
+			// split off the query string, e.g. "1?priority=operator"
+			char* QueryPtr = strchr(OutRequest.URLSuffix, '?');
+			if (QueryPtr != nullptr)
+			{
+				QueryPtr[0] = 0x00;
+				snprintf(OutRequest.URLQuery, sizeof(OutRequest.URLQuery), "%s", QueryPtr + 1);
+			}
+
+			if (k1 - i > sizeof(OutRequest.URLPreSuffix)) return false;
+			n = 0; k2 = i + 1;
+			while (k2 <= k1 - 1) OutRequest.URLPreSuffix[n++] = CurRequest[k2++];
+			OutRequest.URLPreSuffix[n] = '\0';
+			i = k + 7;
+			parseSucceeded = true;
+			break;
+		}
+	}
+	if (!parseSucceeded) return false;
+
+	// Look for "CSeq:", skip whitespace, then read everything up to the next \r or \n as 'CSeq':
+	parseSucceeded = false;
+	for (j = i; (int)j < (int)(CurRequestSize - 5); ++j)
+	{
+		if (CurRequest[j] == 'C' && CurRequest[j + 1] == 'S' &&
+			CurRequest[j + 2] == 'e' && CurRequest[j + 3] == 'q' &&
+			CurRequest[j + 4] == ':')
+		{
+			j += 5;
+			while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j;
+			unsigned n;
+			for (n = 0; n < sizeof(OutRequest.CSeq) - 1 && j < CurRequestSize; ++n, ++j)
+			{
+				char c = CurRequest[j];
+				if (c == '\r' || c == '\n')
+				{
+					parseSucceeded = true;
+					break;
+				}
+				OutRequest.CSeq[n] = c;
+			}
+			OutRequest.CSeq[n] = '\0';
+			break;
+		}
+	}
+	if (!parseSucceeded) return false;
+
+	// Also: Look for "Content-Length:" (optional)
+	for (j = i; (int)j < (int)(CurRequestSize - 15); ++j)
+	{
+		if (CurRequest[j] == 'C' && CurRequest[j + 1] == 'o' &&
+			CurRequest[j + 2] == 'n' && CurRequest[j + 3] == 't' &&
+			CurRequest[j + 4] == 'e' && CurRequest[j + 5] == 'n' &&
+			CurRequest[j + 6] == 't' && CurRequest[j + 7] == '-' &&
+			(CurRequest[j + 8] == 'L' || CurRequest[j + 8] == 'l') &&
+			CurRequest[j + 9] == 'e' && CurRequest[j + 10] == 'n' &&
+			CurRequest[j + 11] == 'g' && CurRequest[j + 12] == 't' &&
+			CurRequest[j + 13] == 'h' && CurRequest[j + 14] == ':')
+		{
+			j += 15;
+			while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j;
+			OutRequest.ContentLength = static_cast<uint32>(strtoul(&CurRequest[j], nullptr, 10));
+		}
+	}
+
+	// the body ends where Content-Length says, the rest of the data would be the next request
+	if (OutRequest.Body && OutRequest.ContentLength && OutRequest.ContentLength < OutRequest.BodySize)
+	{
+		OutRequest.BodySize = OutRequest.ContentLength;
+	}
+	return true;
+}
@@ -0,0 +1,96 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+#include <cstring>
+
+#define RTSP_BUFFER_SIZE       10000    // for incoming requests, and outgoing responses
+#define RTSP_PARAM_STRING_MAX  200		// for RTSP commands (OPTIONS, DESCRIBE, etc.)
+
+// supported RTSP methods
+enum class ERTSPMethod : uint8
+{
+	Options,
+	Describe,
+	Setup,
+	Play,
+	Teardown,
+	Pause,
+	GetParameter,
+	SetParameter,
+	Unknown
+};
+
+// fields of a received RTSP request the server acts on
+struct FRTSPRequest
+{
+	ERTSPMethod	Method;
+	char		URLPreSuffix[RTSP_PARAM_STRING_MAX];	// stream name pre suffix
+	char		URLSuffix[RTSP_PARAM_STRING_MAX];		// stream name suffix
+	char		URLQuery[RTSP_PARAM_STRING_MAX];		// query string of the URL, without '?'
+	char		URLHostPort[RTSP_PARAM_STRING_MAX];		// host:port part of the URL
+	char		CSeq[RTSP_PARAM_STRING_MAX];			// RTSP command sequence number
+	uint32		ContentLength;							// size of the body, 0 if there is none
+	uint16		ClientRTPPort;							// client_port of the Transport header, 0 if there is none
+	uint16		ClientRTCPPort;
+	bool		bTCPTransport;							// SETUP asked for RTP/AVP/TCP
+	const char*	Body;									// message body, points into the parsed request, null if there is none
+	uint32		BodySize;
+};
+
+// parses an RTSP request, received data doesn't need to be null terminated. False if it isn't a request
+bool ParseRTSPRequest(const char* Request, uint32 Size, FRTSPRequest& OutRequest);
+
+// calls Visitor(const char* Name, const char* Value) for every "name=value" pair of a URL query string
+template<typename FVisitor>
+void ForEachURLQueryParameter(const char* URLQuery, FVisitor&& Visitor)
+{
+	char Query[RTSP_PARAM_STRING_MAX];
+	strncpy(Query, URLQuery, sizeof(Query) - 1);
+	Query[sizeof(Query) - 1] = 0x00;
+
+	char* Param = Query;
+	while (Param && *Param)
+	{
+		char* Next = strchr(Param, '&');
+		if (Next != nullptr) *Next++ = 0x00;
+
+		char* Equals = strchr(Param, '=');
+		if (Equals != nullptr)
+		{
+			Equals[0] = 0x00;
+			Visitor(static_cast<const char*>(Param), static_cast<const char*>(Equals + 1));
+		}
+		Param = Next;
+	}
+}
+
+// calls Visitor(const char* Name, const char* Value) for every "name: value" line of a text/parameters body
+template<typename FVisitor>
+void ForEachBodyParameter(const char* Body, uint32 BodySize, FVisitor&& Visitor)
+{
+	char Lines[RTSP_BUFFER_SIZE];
+	const uint32 Size = BodySize < sizeof(Lines) - 1 ? BodySize : sizeof(Lines) - 1;
+	memcpy(Lines, Body, Size);
+	Lines[Size] = 0x00;
+
+	char* Line = Lines;
+	while (*Line)
+	{
+		char* LineEnd = strstr(Line, "\r\n");
+		if (LineEnd != nullptr) LineEnd[0] = 0x00;
+
+		char* Colon = strchr(Line, ':');
+		if (Colon != nullptr)
+		{
+			Colon[0] = 0x00;
+			char* Value = Colon + 1;
+			while (*Value == ' ' || *Value == '\t') ++Value;
+			Visitor(static_cast<const char*>(Line), static_cast<const char*>(Value));
+		}
+
+		if (LineEnd == nullptr) break;
+		Line = LineEnd + 2;
+	}
+}
@@ -0,0 +1,387 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RTSPSession.h"
+#include "RTPPacketizer.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+FRTSPSession::FRTSPSession(IRTSPSessionHost& Host, uint32 SessionId)
+	: Host(Host)
+	, SessionId(SessionId)
+	, State(EState::Init)
+{
+	memset(&Request, 0x00, sizeof(Request));
+	Date[0] = 0x00;
+}
+
+ERTSPMethod FRTSPSession::HandleMessage(const char* Message, uint32 Size)
+{
+	//filter away everything which seems not to be an RTSP command: O-ption, D-escribe, S-etup, P-lay/P-ause, T-eardown, G-et/S-et_parameter
+	if (!Size || State == EState::Closed ||
+		!((Message[0] == 'O') || (Message[0] == 'D') || (Message[0] == 'S') || (Message[0] == 'P') || (Message[0] == 'T') || (Message[0] == 'G')))
+	{
+		return ERTSPMethod::Unknown;
+	}
+
+	if (!ParseRTSPRequest(Message, Size, Request))
+	{
+		return ERTSPMethod::Unknown;
+	}
+
+	//URL parameters apply to whatever request carries them, unknown ones are ignored
+	ForEachURLQueryParameter(Request.URLQuery, [this](const char* Name, const char* Value) { Host.ApplyParameter(Name, Value); });
+
+	FormatDateHeader(Date, sizeof(Date));
+	switch (Request.Method)
+	{
+	case ERTSPMethod::Options:		{  HandleOptions();			break;	}
+	case ERTSPMethod::Describe:		{  HandleDescribe();		break;	}
+	case ERTSPMethod::Setup:		{  HandleSetup();			break;	}
+	case ERTSPMethod::Play:			{  HandlePlay();			break;	}
+	case ERTSPMethod::Pause:		{  HandlePause();			break;	}
+	case ERTSPMethod::GetParameter:	{  HandleGetParameter();	break;	}
+	case ERTSPMethod::SetParameter:	{  HandleSetParameter();	break;	}
+	case ERTSPMethod::Teardown:
+	{
+		if (State == EState::Playing)
+		{
+			Host.SetPlaying(false);
+		}
+		State = EState::Closed;
+		break;
+	}
+	default:						{								}
+	}
+	return Request.Method;
+}
+
+void FRTSPSession::HandleOptions()
+{
+	Send(
+		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
+		"Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER, SET_PARAMETER\r\n"
+		"%s\r\n\r\n",
+		Request.CSeq,
+		Date);
+}
+
+void FRTSPSession::HandleDescribe()
+{
+	// check whether a stream is mounted at the requested URL
+	char Path[RTSP_PARAM_STRING_MAX * 2];
+	snprintf(Path, sizeof(Path), "%s%s%s", Request.URLPreSuffix, Request.URLPreSuffix[0] ? "/" : "", Request.URLSuffix);
+	FRTSPStreamDescription Stream;
+	if (!Host.DescribeStream(Path, Stream))
+	{   // Stream not available
+		Send(
+			"RTSP/1.0 404 Stream Not Found\r\nCSeq: %s\r\n%s\r\n",
+			Request.CSeq,
+			Date);
+		return;
+	}
+
+	// the origin line carries the host part of the URL
+	char HostAddress[RTSP_PARAM_STRING_MAX];
+	snprintf(HostAddress, sizeof(HostAddress), "%s", Request.URLHostPort);
+	char* ColonPtr = strchr(HostAddress, ':');
+	if (ColonPtr != nullptr) ColonPtr[0] = 0x00;
+
+	char SDPBuf[2048];
+	const int32 SDPSize = BuildSDP(SDPBuf, sizeof(SDPBuf), HostAddress, Stream);
+	Send(
+		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
+		"Content-Type: application/sdp\r\n"
+		"Content-Base: RTSP://%s/%s/\r\n"
+		"Server: RTSPStreaming RTSP Server\r\n"
+		"%s\r\n"
+		"Content-Length: %d\r\n\r\n"
+		"%s",
+		Request.CSeq,
+		Request.URLHostPort,
+		Path,
+		Date,
+		SDPSize,
+		SDPBuf);
+}
+
+void FRTSPSession::HandleSetup()
+{
+	// reserve egress budget before binding any sockets
+	if (!Host.Admit())
+	{
+		HandleNotEnoughBandwidth();
+		return;
+	}
+
+	// client ports are only sent with SETUP, a repeated SETUP without them keeps the previous ones
+	Transport.bTCP = Request.bTCPTransport;
+	if (Request.ClientRTPPort)
+	{
+		Transport.ClientRTPPort = Request.ClientRTPPort;
+		Transport.ClientRTCPPort = Request.ClientRTCPPort;
+	}
+	if (Host.SetupTransport(Transport) && State == EState::Init)
+	{
+		State = EState::Ready;
+	}
+
+	char TransportBuf[255];
+	if (Transport.bTCP)
+	{
+		snprintf(TransportBuf, sizeof(TransportBuf), "RTP/AVP/TCP;unicast;interleaved=0-1");
+	}
+	else
+	{
+		snprintf(TransportBuf, sizeof(TransportBuf),
+			"RTP/AVP;unicast;destination=%s;source=%s;client_port=%u-%u;server_port=%u-%u",
+			Transport.ClientIP.c_str(),
+			Transport.ServerIP.c_str(),
+			Transport.ClientRTPPort,
+			Transport.ClientRTCPPort,
+			Transport.ServerRTPPort,
+			Transport.ServerRTCPPort);
+	}
+
+	Send(
+		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
+		"%s\r\n"
+		"Transport: %s\r\n"
+		"Session: %u;timeout=%d\r\n\r\n",
+		Request.CSeq,
+		Date,
+		TransportBuf,
+		SessionId,
+		Host.GetSessionTimeout());
+}
+
+void FRTSPSession::HandlePlay()
+{
+	// bitrate may have changed since SETUP, check budget again if the client has no reservation yet
+	if (!Host.Admit())
+	{
+		HandleNotEnoughBandwidth();
+		return;
+	}
+
+	Send(
+		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
+		"%s\r\n"
+		"Range: npt=0.000-\r\n"
+		"Session: %u\r\n"
+		"RTP-Info: url=RTSP://127.0.0.1:8554/mjpeg/1/track1\r\n\r\n",
+		Request.CSeq,
+		Date,
+		SessionId);
+
+	// starts passing frames once the transport is set up
+	if (State == EState::Ready)
+	{
+		State = EState::Playing;
+		Host.SetPlaying(true);
+	}
+}
+
+void FRTSPSession::HandlePause()
+{
+	Send(
+		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
+		"%s\r\n",
+		Request.CSeq,
+		Date);
+
+	// the encoder stops once no client is playing
+	if (State == EState::Playing)
+	{
+		State = EState::Ready;
+		Host.SetPlaying(false);
+	}
+}
+
+void FRTSPSession::HandleGetParameter()
+{
+	// no parameters are reported, clients send an empty GET_PARAMETER as keepalive
+	Send(
+		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
+		"%s\r\n"
+		"Session: %u;timeout=%d\r\n\r\n",
+		Request.CSeq,
+		Date,
+		SessionId,
+		Host.GetSessionTimeout());
+}
+
+void FRTSPSession::HandleSetParameter()
+{
+	// parameters are sent as "name: value" lines in the message body
+	bool bUnderstood = true;
+	if (Request.Body)
+	{
+		ForEachBodyParameter(Request.Body, Request.BodySize, [this, &bUnderstood](const char* Name, const char* Value)
+		{
+			bUnderstood &= Host.ApplyParameter(Name, Value);
+		});
+	}
+
+	Send(
+		"RTSP/1.0 %s\r\nCSeq: %s\r\n"
+		"%s\r\n"
+		"Session: %u\r\n\r\n",
+		bUnderstood ? "200 OK" : "451 Parameter Not Understood",
+		Request.CSeq,
+		Date,
+		SessionId);
+}
+
+void FRTSPSession::HandleNotEnoughBandwidth()
+{
+	const std::string Redirect = Host.GetAdmissionRedirect();
+	if (Redirect.empty())
+	{
+		Send(
+			"RTSP/1.0 453 Not Enough Bandwidth\r\nCSeq: %s\r\n"
+			"%s\r\n\r\n",
+			Request.CSeq,
+			Date);
+	}
+	else
+	{
+		// point the client at the same stream on another instance
+		Send(
+			"RTSP/1.0 302 Moved Temporarily\r\nCSeq: %s\r\n"
+			"%s\r\n"
+			"Location: %s/%s/%s\r\n\r\n",
+			Request.CSeq,
+			Date,
+			Redirect.c_str(),
+			Request.URLPreSuffix,
+			Request.URLSuffix);
+	}
+}
+
+void FRTSPSession::Send(const char* Format, ...)
+{
+	char Response[RTSP_BUFFER_SIZE];
+	va_list Args;
+	va_start(Args, Format);
+	const int Size = vsnprintf(Response, sizeof(Response), Format, Args);
+	va_end(Args);
+
+	if (Size > 0)
+	{
+		Host.SendResponse(Response, static_cast<uint32>(Size < static_cast<int>(sizeof(Response)) ? Size : sizeof(Response) - 1));
+	}
+}
+
+void FRTSPSession::FormatDateHeader(char* OutDate, uint32 Size)
+{
+	time_t tt = time(NULL);
+	tm ts;
+#if defined(_WIN32)
+	gmtime_s(&ts, &tt);
+#else
+	gmtime_r(&tt, &ts);
+#endif
+	strftime(OutDate, Size, "Date: %a, %b %d %Y %H:%M:%S GMT", &ts);
+}
+
+// appends the base64 of Size bytes to Out, as the sprop-* parameters carry parameter sets
+static void AppendBase64(const uint8* Data, uint32 Size, std::string& Out)
+{
+	static const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	for (uint32 Index = 0; Index < Size; Index += 3)
+	{
+		const uint32 Remaining = Size - Index;
+		const uint32 Bits = (Data[Index] << 16) | (Remaining > 1 ? Data[Index + 1] << 8 : 0) | (Remaining > 2 ? Data[Index + 2] : 0);
+		Out += Alphabet[(Bits >> 18) & 0x3F];
+		Out += Alphabet[(Bits >> 12) & 0x3F];
+		Out += Remaining > 1 ? Alphabet[(Bits >> 6) & 0x3F] : '=';
+		Out += Remaining > 2 ? Alphabet[Bits & 0x3F] : '=';
+	}
+}
+
+// base64 of the stream's parameter sets of a type, comma separated
+static std::string GetParameterSetsBase64(const FRTSPStreamDescription& Stream, uint8 Type)
+{
+	std::string Value;
+	ForEachAnnexBNal(Stream.ParameterSets.data(), static_cast<uint32>(Stream.ParameterSets.size()), [&Value, &Stream, Type](const uint8* Nal, uint32 NalSize)
+	{
+		if (NalSize >= 2 && GetNalType(Stream.Codec, Nal) == Type)
+		{
+			Value += Value.empty() ? "" : ",";
+			AppendBase64(Nal, NalSize, Value);
+		}
+	});
+	return Value;
+}
+
+// rtpmap and fmtp lines of the stream's codec. Parameter sets are repeated with every IDR frame, announcing them lets
+// clients set up their decoder sooner
+static std::string BuildMediaFormat(const FRTSPStreamDescription& Stream)
+{
+	if (!IsH265(Stream.Codec))
+	{
+		// the profile and level of the SPS, constrained baseline 5.1 before the first IDR frame
+		char ProfileLevelId[7] = "42e033";
+		ForEachAnnexBNal(Stream.ParameterSets.data(), static_cast<uint32>(Stream.ParameterSets.size()), [&ProfileLevelId](const uint8* Nal, uint32 NalSize)
+		{
+			if (NalSize >= 4 && GetNalType(EVideoCodec::H264, Nal) == H264_NAL_SPS)
+			{
+				snprintf(ProfileLevelId, sizeof(ProfileLevelId), "%02x%02x%02x", Nal[1], Nal[2], Nal[3]);
+			}
+		});
+
+		std::string Format = "a=rtpmap:96 H264/90000\r\na=fmtp:96 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=";
+		Format += ProfileLevelId;
+		const std::string Sps = GetParameterSetsBase64(Stream, H264_NAL_SPS);
+		const std::string Pps = GetParameterSetsBase64(Stream, H264_NAL_PPS);
+		if (!Sps.empty() && !Pps.empty())
+		{
+			Format += ";sprop-parameter-sets=";
+			Format += Sps;
+			Format += ",";
+			Format += Pps;
+		}
+		Format += "\r\n";
+		return Format;
+	}
+
+	std::string Format = "a=rtpmap:96 H265/90000\r\na=fmtp:96 profile-id=";
+	Format += Stream.Codec == EVideoCodec::H265Main10 ? "2" : "1";
+	static const uint8 Types[] = { H265_NAL_VPS, H265_NAL_SPS, H265_NAL_PPS };
+	static const char* const Names[] = { "sprop-vps", "sprop-sps", "sprop-pps" };
+	for (uint32 Index = 0; Index < sizeof(Types); ++Index)
+	{
+		const std::string Value = GetParameterSetsBase64(Stream, Types[Index]);
+		if (!Value.empty())
+		{
+			Format += ";";
+			Format += Names[Index];
+			Format += "=";
+			Format += Value;
+		}
+	}
+	Format += "\r\n";
+	return Format;
+}
+
+int32 FRTSPSession::BuildSDP(char* OutSDP, uint32 Size, const char* HostAddress, const FRTSPStreamDescription& Stream)
+{
+	const int Length = snprintf(OutSDP, Size,
+		"v=0\r\n"
+		"o=- %d 1 IN IP4 %s\r\n"
+		"s=Session streamed with RTSPStreaming\r\n"
+		"i=RTSP-server\r\n"
+		"t=0 0\r\n"
+		"a=type:broadcast\r\n"
+		"a=range:npt=now-\r\n"
+		"m=video 0 RTP/AVP 96\r\n"
+		"c=IN IP4 0.0.0.0\r\n"
+		"%s"
+		"a=framerate:60.000000\r\n",
+		rand(),
+		HostAddress,
+		BuildMediaFormat(Stream).c_str());
+	return Length < static_cast<int>(Size) ? Length : static_cast<int32>(Size) - 1;
+}
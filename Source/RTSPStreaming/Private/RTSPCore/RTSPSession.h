@@ -0,0 +1,100 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+#include "RTSPRequest.h"
+#include "VideoCodec.h"
+#include <string>
+#include <vector>
+
+// RTP transport of a session, negotiated at SETUP
+struct FRTSPTransport
+{
+	bool		bTCP = false;			// RTP/AVP/TCP, RTP is interleaved on the RTSP connection
+	uint16		ClientRTPPort = 0;
+	uint16		ClientRTCPPort = 0;
+	uint16		ServerRTPPort = 0;		// filled in by the host for UDP transport
+	uint16		ServerRTCPPort = 0;
+	std::string	ClientIP;				// filled in by the host, announced in the Transport header
+	std::string	ServerIP;
+};
+
+// stream a DESCRIBE asked for, filled in by the host
+struct FRTSPStreamDescription
+{
+	EVideoCodec			Codec = EVideoCodec::H264;
+	std::vector<uint8>	ParameterSets;		// Annex-B parameter sets announced as sprop-*, empty if the stream hasn't any yet
+};
+
+// what a session needs from the connection it runs on, the engine adapter implements it on top of its sockets
+// all calls are made from within FRTSPSession::HandleMessage()
+class IRTSPSessionHost
+{
+public:
+	virtual ~IRTSPSessionHost() {}
+
+	virtual void SendResponse(const char* Response, uint32 Size) = 0;		// sends on the RTSP connection
+	virtual bool DescribeStream(const char* Path, FRTSPStreamDescription& OutStream) = 0;	// stream mounted at Path, e.g. "stream/1", false if none is
+	virtual bool Admit() = 0;												// reserves egress budget for the client, false rejects it
+	virtual std::string GetAdmissionRedirect() = 0;							// URL rejected clients are redirected to, empty to reply 453
+	virtual bool SetupTransport(FRTSPTransport& Transport) = 0;				// binds RTP/RTCP, false if it couldn't
+	virtual void SetPlaying(bool bPlaying) = 0;								// starts or stops passing frames to the client
+	virtual bool ApplyParameter(const char* Name, const char* Value) = 0;	// URL query or SET_PARAMETER, false if unknown
+	virtual int32 GetSessionTimeout() = 0;									// announced in the Session header, seconds
+};
+
+// RTSP session state machine of one client connection
+// parses requests, answers them and drives the host through Init -> Ready (SETUP) -> Playing (PLAY) -> Ready (PAUSE).
+// Owns no sockets or threads, the host serialises calls and reports TEARDOWN or disconnects by destroying it
+class FRTSPSession final
+{
+public:
+	enum class EState : uint8
+	{
+		Init,				// no transport yet
+		Ready,				// transport set up, not playing
+		Playing,
+		Closed				// TEARDOWN received
+	};
+
+	FRTSPSession(IRTSPSessionHost& Host, uint32 SessionId);
+
+	// handles one received RTSP message, returns the method or Unknown if it was ignored
+	ERTSPMethod HandleMessage(const char* Message, uint32 Size);
+
+	EState GetState() const
+	{
+		return State;
+	}
+	uint32 GetSessionId() const
+	{
+		return SessionId;
+	}
+	const FRTSPTransport& GetTransport() const
+	{
+		return Transport;
+	}
+
+	static void FormatDateHeader(char* OutDate, uint32 Size);				// "Date: ..." line for the current time
+	static int32 BuildSDP(char* OutSDP, uint32 Size, const char* HostAddress, const FRTSPStreamDescription& Stream);	// session description of the stream, returns its length
+
+private:
+	void HandleOptions();
+	void HandleDescribe();
+	void HandleSetup();
+	void HandlePlay();
+	void HandlePause();
+	void HandleGetParameter();
+	void HandleSetParameter();
+	void HandleNotEnoughBandwidth();										// rejects or redirects a client the host couldn't admit
+
+	void Send(const char* Format, ...);									// formats a response and sends it
+
+	IRTSPSessionHost&	Host;
+	const uint32		SessionId;
+	EState				State;
+	FRTSPTransport		Transport;
+	FRTSPRequest		Request;			// request being handled
+	char				Date[200];			// Date line of the response being built
+};
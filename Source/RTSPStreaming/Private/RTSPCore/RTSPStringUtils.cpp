@@ -0,0 +1,16 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RTSPStringUtils.h"
+#include <cctype>
+
+bool EqualsIgnoreCase(const char* A, const char* B)
+{
+	for (; *A && *B; ++A, ++B)
+	{
+		if (tolower(static_cast<unsigned char>(*A)) != tolower(static_cast<unsigned char>(*B)))
+		{
+			return false;
+		}
+	}
+	return *A == *B;
+}
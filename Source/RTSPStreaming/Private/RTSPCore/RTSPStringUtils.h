@@ -0,0 +1,8 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+
+// ASCII case insensitive comparison, strcasecmp and _stricmp aren't portable
+bool EqualsIgnoreCase(const char* A, const char* B);
@@ -0,0 +1,65 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "RenditionSelector.h"
+
+FRenditionSelector::FRenditionSelector()
+	: NumRenditions(1)
+	, Rendition(0)
+	, bCongested(false)
+	, LastDownMs(0)
+	, QuietSinceMs(0)
+{
+}
+
+void FRenditionSelector::Reset(int32 InNumRenditions, int32 InRendition, uint64 NowMs)
+{
+	check(InNumRenditions > 0 && InRendition >= 0 && InRendition < InNumRenditions);
+	NumRenditions = InNumRenditions;
+	Rendition = InRendition;
+	bCongested = false;
+	QuietSinceMs = NowMs;
+}
+
+bool FRenditionSelector::OnReceiverReport(uint8 FractionLost, uint64 NowMs)
+{
+	return FractionLost > DownLossFraction && StepDown(NowMs);
+}
+
+bool FRenditionSelector::OnEgressDrop(uint64 NowMs)
+{
+	return StepDown(NowMs);
+}
+
+bool FRenditionSelector::StepDown(uint64 NowMs)
+{
+	//any congestion holds off stepping up again
+	QuietSinceMs = NowMs;
+
+	//a report and the drops of one congestion episode arrive within a short time of each other, they step down once
+	if (bCongested && NowMs - LastDownMs < DownHoldMs)
+	{
+		return false;
+	}
+	bCongested = true;
+	LastDownMs = NowMs;
+
+	if (Rendition + 1 >= NumRenditions)
+	{
+		return false;
+	}
+	Rendition++;
+	return true;
+}
+
+bool FRenditionSelector::Update(uint64 NowMs)
+{
+	if (Rendition == 0 || NowMs - QuietSinceMs < UpHoldMs)
+	{
+		return false;
+	}
+
+	//each step up has to stay quiet for another UpHoldMs before the next one
+	QuietSinceMs = NowMs;
+	Rendition--;
+	return true;
+}
@@ -0,0 +1,46 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+
+// picks the rendition of the simulcast ladder a client is sent when it leaves the choice to the server
+// - renditions are indexed from the largest, index 0, down to the smallest
+// - a receiver report with more than DownLossFraction of the packets lost, or a frame the egress scheduler dropped
+//   for the client, steps it down one rendition. Further congestion within DownHoldMs counts as the same episode
+// - after UpHoldMs without congestion it steps up one rendition, and again after another UpHoldMs. Congestion right
+//   after a step up steps it down again
+// not thread safe, the owner serialises access
+class FRenditionSelector final
+{
+public:
+	static const uint8 DownLossFraction = 13;		// 1/256 units, about 5%
+	static const uint64 DownHoldMs = 1000;
+	static const uint64 UpHoldMs = 10000;
+
+	FRenditionSelector();
+
+	// starts over at InRendition of NumRenditions renditions
+	void Reset(int32 InNumRenditions, int32 InRendition, uint64 NowMs);
+
+	// congestion feedback, true if the client was stepped down
+	bool OnReceiverReport(uint8 FractionLost, uint64 NowMs);
+	bool OnEgressDrop(uint64 NowMs);
+
+	// steps up after a quiet period, true if the rendition changed
+	bool Update(uint64 NowMs);
+
+	int32 GetRendition() const
+	{
+		return Rendition;
+	}
+
+private:
+	bool StepDown(uint64 NowMs);
+
+	int32	NumRenditions;
+	int32	Rendition;
+	bool	bCongested;				// LastDownMs is set
+	uint64	LastDownMs;				// start of the last congestion episode
+	uint64	QuietSinceMs;			// last congestion or step up
+};
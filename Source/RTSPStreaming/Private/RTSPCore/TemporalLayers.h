@@ -0,0 +1,55 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+
+// hierarchical-P temporal layers, the dyadic pattern NVENC's temporal SVC encodes
+// - a stream of N layers repeats every 2^(N-1) frames counted from an IDR frame. The first frame of a period is in
+//   layer 0, the base layer, the others in layer N-1 minus the number of trailing zero bits of their position
+// - a frame only references the newest frame of a lower layer, frames of the top layer aren't referenced at all
+// - the layers up to L run at 1/2^(N-1-L) of the full frame rate, so a client can be sent a lower frame rate by
+//   skipping the layers above L, and a frame of layer L can be dropped if the following frames of layer L and up
+//   are dropped with it until the next frame of a lower layer
+static const uint8 MaxTemporalLayers = 4;
+static const uint8 TemporalLayerNone = 0xFF;
+
+// layer of the frame at Position since the last IDR frame
+inline uint8 GetTemporalLayer(uint64 Position, uint8 NumLayers)
+{
+	if (NumLayers <= 1)
+	{
+		return 0;
+	}
+
+	const uint64 Period = 1ull << (NumLayers - 1);
+	uint64 Phase = Position % Period;
+	if (!Phase)
+	{
+		return 0;
+	}
+
+	uint8 Layer = NumLayers - 1;
+	for (; !(Phase & 1); Phase >>= 1)
+	{
+		--Layer;
+	}
+	return Layer;
+}
+
+// highest layer sent to a client that wants at most MaxFrameRate of the stream's FrameRate, 0 for all of it.
+// The base layer even if that's more than MaxFrameRate
+inline uint8 GetMaxTemporalLayer(uint32 FrameRate, uint32 MaxFrameRate, uint8 NumLayers)
+{
+	if (NumLayers <= 1)
+	{
+		return 0;
+	}
+
+	uint8 Layer = NumLayers - 1;
+	while (MaxFrameRate && Layer > 0 && (FrameRate >> (NumLayers - 1 - Layer)) > MaxFrameRate)
+	{
+		--Layer;
+	}
+	return Layer;
+}
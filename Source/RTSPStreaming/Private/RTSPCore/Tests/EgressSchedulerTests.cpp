@@ -0,0 +1,261 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// FEgressScheduler on congested links, keyframes larger than the burst, temporal layers and with scheduling disabled
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include "EgressScheduler.h"
+#include <vector>
+
+namespace
+{
+	const double FrameTime = 1.0 / 30.0;
+	const double StartTime = 100.0;				// the first Schedule() call then starts with a full bucket
+
+	// the clients of a stream with their scheduler state, kept apart from the requests the state is pointed to by
+	struct FTestClients
+	{
+		std::vector<FEgressClientState>	States;
+		std::vector<FEgressRequest>		Requests;
+
+		FTestClients(uint32 NumOperators, uint32 NumRecorders, uint32 NumViewers)
+			: States(NumOperators + NumRecorders + NumViewers)
+			, Requests(States.size())
+		{
+			for (uint32 Index = 0; Index < Requests.size(); ++Index)
+			{
+				Requests[Index].Priority = Index < NumOperators ? EClientPriority::Operator
+					: Index < NumOperators + NumRecorders ? EClientPriority::Recorder : EClientPriority::Viewer;
+				Requests[Index].State = &States[Index];
+				Requests[Index].MaxTemporalLayer = MaxTemporalLayers;
+			}
+		}
+
+		// schedules a frame of the same size for every client
+		uint32 Schedule(FEgressScheduler& Scheduler, uint32 Size, bool bKeyframe, uint8 TemporalLayer, uint8 NumTemporalLayers,
+			double Now, int32 CapacityKbps, int32 BurstMs)
+		{
+			for (FEgressRequest& Request : Requests)
+			{
+				Request.Size = Size;
+			}
+			return Scheduler.Schedule(Requests.data(), static_cast<uint32>(Requests.size()), bKeyframe, TemporalLayer, NumTemporalLayers,
+				Now, CapacityKbps, BurstMs);
+		}
+	};
+}
+
+void TestSchedulerOperatorUnderFlood()
+{
+	// 12000 bytes a frame at 30 fps. Class weights keep 8/9 of it for the operator however many viewers there are,
+	// with per client weights the operator would get 8/1008 of it
+	const int32 CapacityKbps = 2880;
+	const int32 BurstMs = 40;
+	const uint32 NumViewers = 1000;
+	const int32 NumFrames = 300;
+
+	// the viewers keep asking, as if each of them had just been sent a keyframe
+	auto Flood = [](FTestClients& Clients)
+	{
+		for (FEgressClientState& State : Clients.States)
+		{
+			State.bWaitForKeyframe = false;
+		}
+	};
+
+	// the operator is sent every frame, the viewers share what it leaves
+	const uint32 FrameSize = 5000;
+	FEgressScheduler Scheduler;
+	FTestClients Clients(1, 0, NumViewers);
+	uint32 ViewerFramesSent = 0;
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		Flood(Clients);
+		const uint32 Dropped = Clients.Schedule(Scheduler, FrameSize, false, 0, 1, StartTime + Frame * FrameTime, CapacityKbps, BurstMs);
+		CHECK(Clients.Requests[0].bSend);
+		uint32 Sent = 0;
+		for (const FEgressRequest& Request : Clients.Requests)
+		{
+			Sent += Request.bSend ? 1 : 0;
+		}
+		CHECK(Sent + Dropped == NumViewers + 1);
+		ViewerFramesSent += Sent - 1;
+	}
+	CHECK(Clients.States[0].DroppedFrames == 0);
+	CHECK(ViewerFramesSent > 0);
+	CHECK((ViewerFramesSent + NumFrames) * FrameSize <= CapacityKbps * 1000.0 / 8.0 * (NumFrames * FrameTime + BurstMs / 1000.0));
+	CHECK(Scheduler.GetTokens() >= 0);
+
+	// operators that want more than their share still get it, taking turns
+	const uint32 OperatorFrameSize = 10000;
+	FEgressScheduler Congested;
+	FTestClients Operators(2, 0, NumViewers);
+	uint32 OperatorFramesSent[2] = {};
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		Flood(Operators);
+		Operators.Schedule(Congested, OperatorFrameSize, false, 0, 1, StartTime + Frame * FrameTime, CapacityKbps, BurstMs);
+		CHECK(Operators.Requests[0].bSend != Operators.Requests[1].bSend);
+		OperatorFramesSent[0] += Operators.Requests[0].bSend ? 1 : 0;
+		OperatorFramesSent[1] += Operators.Requests[1].bSend ? 1 : 0;
+	}
+	CHECK(OperatorFramesSent[0] == NumFrames / 2 && OperatorFramesSent[1] == NumFrames / 2);
+}
+
+void TestSchedulerKeyframeOverBurst()
+{
+	// 4167 bytes a frame and a 12500 byte burst, the keyframes are four times that
+	const int32 CapacityKbps = 1000;
+	const int32 BurstMs = 100;
+	const uint32 KeyframeSize = 50000;
+
+	// the bucket grows to hold the keyframe, it was capped at the burst and the keyframe never fit
+	FEgressScheduler Scheduler;
+	FTestClients Client(0, 0, 1);
+	CHECK(Client.Schedule(Scheduler, KeyframeSize, true, 0, 1, StartTime, CapacityKbps, BurstMs) == 0);
+	CHECK(Client.Requests[0].bSend);
+
+	// the next one waits until the bucket has refilled
+	int32 Frame = 1;
+	for (; Frame < 30; ++Frame)
+	{
+		const bool bHadTokens = Scheduler.HasTokensForKeyframe();
+		Client.Schedule(Scheduler, KeyframeSize, true, 0, 1, StartTime + Frame * FrameTime, CapacityKbps, BurstMs);
+		if (Client.Requests[0].bSend)
+		{
+			break;
+		}
+		CHECK(!bHadTokens);
+		CHECK(Client.States[0].bWaitForKeyframe);
+	}
+	CHECK(Client.Requests[0].bSend);
+	CHECK(Frame >= 12 && Frame <= 13);
+	CHECK(!Client.States[0].bWaitForKeyframe);
+
+	// a keyframe more than the full bucket holds goes through to every client waiting for it, into debt
+	FEgressScheduler Shared;
+	FTestClients Clients(0, 0, 3);
+	Clients.Schedule(Shared, KeyframeSize, true, 0, 1, StartTime, CapacityKbps, BurstMs);
+	for (const FEgressRequest& Request : Clients.Requests)
+	{
+		CHECK(Request.bSend);
+	}
+	CHECK(Shared.GetTokens() < 0);
+	CHECK(!Shared.HasTokensForKeyframe());
+
+	// the debt is paid back before anything else is sent
+	for (Frame = 1; Shared.GetTokens() + CapacityKbps * 1000.0 / 8.0 * FrameTime < 0; ++Frame)
+	{
+		for (FEgressClientState& State : Clients.States)
+		{
+			State.bWaitForKeyframe = false;
+		}
+		CHECK(Clients.Schedule(Shared, 100, false, 0, 1, StartTime + Frame * FrameTime, CapacityKbps, BurstMs) == Clients.Requests.size());
+	}
+	CHECK(Frame >= 23 && Frame <= 25);
+}
+
+void TestSchedulerLayerSkipping()
+{
+	// 3 layers, the frames of layer 1 are referenced by layer 2, the frames of layer 2 by nothing. The large frames
+	// don't fit the link, the small ones do
+	const int32 CapacityKbps = 1000;
+	const int32 BurstMs = 100;
+	const uint8 NumLayers = 3;
+	const uint32 Small = 100;
+	const uint32 Large = 100000;
+
+	FEgressScheduler Scheduler;
+	FTestClients Client(0, 0, 1);
+	FEgressClientState& State = Client.States[0];
+	const FEgressRequest& Request = Client.Requests[0];
+	double Now = StartTime;
+	auto Schedule = [&](uint32 Size, uint8 Layer)
+	{
+		const uint32 Dropped = Client.Schedule(Scheduler, Size, false, Layer, NumLayers, Now, CapacityKbps, BurstMs);
+		Now += FrameTime;
+		return Dropped;
+	};
+
+	CHECK(Schedule(Small, 0) == 0 && Request.bSend);
+
+	// a dropped frame of a middle layer skips it and the layers above until the next frame of a lower layer
+	CHECK(Schedule(Large, 1) == 1 && !Request.bSend);
+	CHECK(State.BrokenLayer == 1 && !State.bWaitForKeyframe && State.DroppedFrames == 1);
+	CHECK(Schedule(Small, 2) == 0 && !Request.bSend);
+	CHECK(Schedule(Small, 1) == 0 && !Request.bSend);
+	CHECK(Schedule(Small, 2) == 0 && !Request.bSend);
+	CHECK(State.DroppedFrames == 1);
+	CHECK(Schedule(Small, 0) == 0 && Request.bSend);
+	CHECK(State.BrokenLayer == TemporalLayerNone);
+	CHECK(Schedule(Small, 2) == 0 && Request.bSend);
+
+	// nothing references the top layer, losing one of its frames costs nothing else
+	CHECK(Schedule(Large, 2) == 1 && !Request.bSend);
+	CHECK(State.BrokenLayer == TemporalLayerNone && !State.bWaitForKeyframe);
+	CHECK(Schedule(Small, 1) == 0 && Request.bSend);
+	CHECK(Schedule(Small, 2) == 0 && Request.bSend);
+
+	// a dropped base layer frame waits for the next keyframe
+	CHECK(Schedule(Large, 0) == 1 && !Request.bSend);
+	CHECK(State.bWaitForKeyframe);
+	CHECK(Schedule(Small, 2) == 0 && !Request.bSend);
+	CHECK(Schedule(Small, 1) == 0 && !Request.bSend);
+	CHECK(Schedule(Small, 0) == 0 && !Request.bSend);
+	CHECK(Client.Schedule(Scheduler, Small, true, 0, NumLayers, Now, CapacityKbps, BurstMs) == 0 && Request.bSend);
+	CHECK(!State.bWaitForKeyframe);
+	Now += FrameTime;
+
+	// layers above the client's frame rate are skipped without counting as dropped
+	Client.Requests[0].MaxTemporalLayer = 1;
+	CHECK(Schedule(Small, 2) == 0 && !Request.bSend);
+	CHECK(Schedule(Small, 1) == 0 && Request.bSend);
+	CHECK(State.DroppedFrames == 3);
+}
+
+void TestSchedulerDisabled()
+{
+	// a capacity of 0 sends every frame however large
+	FEgressScheduler Scheduler;
+	FTestClients Clients(0, 0, 2);
+	FEgressClientState& Switching = Clients.States[1];
+	double Now = StartTime;
+	CHECK(Clients.Schedule(Scheduler, 10000000, false, 0, 1, Now, 0, 100) == 0);
+	CHECK(Clients.Requests[0].bSend && Clients.Requests[1].bSend);
+
+	// a client switching renditions waits for the keyframe of the new one
+	Switching.bWaitForKeyframe = true;
+	for (int32 Frame = 0; Frame < 5; ++Frame)
+	{
+		Now += FrameTime;
+		CHECK(Clients.Schedule(Scheduler, 1000, false, 0, 1, Now, 0, 100) == 0);
+		CHECK(Clients.Requests[0].bSend && !Clients.Requests[1].bSend);
+		CHECK(Switching.bWaitForKeyframe);
+	}
+	Now += FrameTime;
+	CHECK(Clients.Schedule(Scheduler, 1000, true, 0, 1, Now, 0, 100) == 0);
+	CHECK(Clients.Requests[0].bSend && Clients.Requests[1].bSend);
+	CHECK(!Switching.bWaitForKeyframe);
+	Now += FrameTime;
+	CHECK(Clients.Schedule(Scheduler, 1000, false, 0, 1, Now, 0, 100) == 0);
+	CHECK(Clients.Requests[1].bSend);
+
+	// the client's frame rate still holds, and a layer broken while scheduling was on heals at a lower layer
+	Clients.Requests[0].MaxTemporalLayer = 0;
+	Switching.BrokenLayer = 1;
+	Now += FrameTime;
+	Clients.Schedule(Scheduler, 1000, false, 1, 2, Now, 0, 100);
+	CHECK(!Clients.Requests[0].bSend && !Clients.Requests[1].bSend);
+	Now += FrameTime;
+	Clients.Schedule(Scheduler, 1000, false, 0, 2, Now, 0, 100);
+	CHECK(Clients.Requests[0].bSend && Clients.Requests[1].bSend);
+	CHECK(Switching.BrokenLayer == TemporalLayerNone);
+	Now += FrameTime;
+	Clients.Schedule(Scheduler, 1000, false, 1, 2, Now, 0, 100);
+	CHECK(!Clients.Requests[0].bSend && Clients.Requests[1].bSend);
+	CHECK(Clients.States[0].DroppedFrames == 0 && Switching.DroppedFrames == 0);
+}
+
+#endif
@@ -0,0 +1,335 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// RTCP report and feedback parsing, malformed packets among them, and FRTPLossTracker mapping losses to frames
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include "RTCP.h"
+#include "RTPLossTracker.h"
+#include <vector>
+
+namespace
+{
+	const uint32 MediaSSRC = 0x11223344;			// our stream
+	const uint32 OtherSSRC = 0x55667788;			// another stream the receiver reports on
+	const uint32 ReceiverSSRC = 0x0A0B0C0D;
+	const uint8 FormatNack = 1;					// of transport layer feedback
+	const uint8 FormatPictureLoss = 1;			// of payload specific feedback
+
+	struct FTestReportBlock
+	{
+		uint32	SSRC;
+		uint8	FractionLost;
+		int32	CumulativeLost;
+		uint32	ExtendedHighestSequence;
+	};
+
+	struct FTestNack
+	{
+		uint16	PacketId;
+		uint16	Bitmask;
+	};
+
+	void AppendUint16(std::vector<uint8>& Out, uint16 Value)
+	{
+		Out.push_back(static_cast<uint8>(Value >> 8));
+		Out.push_back(static_cast<uint8>(Value));
+	}
+
+	void AppendUint32(std::vector<uint8>& Out, uint32 Value)
+	{
+		AppendUint16(Out, static_cast<uint16>(Value >> 16));
+		AppendUint16(Out, static_cast<uint16>(Value));
+	}
+
+	// common header of a packet of Size bytes and the sender SSRC
+	void AppendHeader(std::vector<uint8>& Out, uint8 CountOrFormat, uint8 PacketType, uint32 Size)
+	{
+		Out.push_back(static_cast<uint8>(0x80 | CountOrFormat));
+		Out.push_back(PacketType);
+		AppendUint16(Out, static_cast<uint16>(Size / 4 - 1));
+		AppendUint32(Out, ReceiverSSRC);
+	}
+
+	void AppendReport(std::vector<uint8>& Out, uint8 PacketType, const std::vector<FTestReportBlock>& Blocks)
+	{
+		const uint32 SenderInfoSize = PacketType == RTCP_SR ? 20 : 0;
+		AppendHeader(Out, static_cast<uint8>(Blocks.size()), PacketType, 8 + SenderInfoSize + 24 * static_cast<uint32>(Blocks.size()));
+		Out.insert(Out.end(), SenderInfoSize, 0xEE);
+		for (const FTestReportBlock& Block : Blocks)
+		{
+			AppendUint32(Out, Block.SSRC);
+			AppendUint32(Out, (static_cast<uint32>(Block.FractionLost) << 24) | (static_cast<uint32>(Block.CumulativeLost) & 0xFFFFFF));
+			AppendUint32(Out, Block.ExtendedHighestSequence);
+			AppendUint32(Out, 17);					// jitter
+			AppendUint32(Out, 0);					// last SR
+			AppendUint32(Out, 0);					// delay since last SR
+		}
+	}
+
+	void AppendNacks(std::vector<uint8>& Out, uint32 SSRC, const std::vector<FTestNack>& Nacks)
+	{
+		AppendHeader(Out, FormatNack, RTCP_RTPFB, 12 + 4 * static_cast<uint32>(Nacks.size()));
+		AppendUint32(Out, SSRC);
+		for (const FTestNack& Nack : Nacks)
+		{
+			AppendUint16(Out, Nack.PacketId);
+			AppendUint16(Out, Nack.Bitmask);
+		}
+	}
+
+	void AppendPictureLoss(std::vector<uint8>& Out, uint32 SSRC, uint8 Format = FormatPictureLoss)
+	{
+		AppendHeader(Out, Format, RTCP_PSFB, 12);
+		AppendUint32(Out, SSRC);
+	}
+
+	// a copy exactly as large as the packet, so reading past it is caught by the address sanitizer
+	bool ParseReport(const std::vector<uint8>& Packet, uint32 Size, FRTCPReportBlock& OutBlock)
+	{
+		const std::vector<uint8> Exact(Packet.begin(), Packet.begin() + Size);
+		return ParseRTCPReportBlock(Exact.data(), static_cast<int32>(Size), MediaSSRC, OutBlock);
+	}
+
+	bool ParseFeedback(const std::vector<uint8>& Packet, uint32 Size, FRTCPFeedback& OutFeedback)
+	{
+		const std::vector<uint8> Exact(Packet.begin(), Packet.begin() + Size);
+		return ParseRTCPFeedback(Exact.data(), static_cast<int32>(Size), MediaSSRC, OutFeedback);
+	}
+
+	// a report as the loss tracker sees it, the fraction lost and jitter are the rendition selector's business
+	FRTCPReportBlock MakeReportBlock(int32 CumulativeLost, uint32 ExtendedHighestSequence)
+	{
+		FRTCPReportBlock Block;
+		Block.SSRC = MediaSSRC;
+		Block.FractionLost = 0;
+		Block.CumulativeLost = CumulativeLost;
+		Block.ExtendedHighestSequence = ExtendedHighestSequence;
+		Block.Jitter = 0;
+		return Block;
+	}
+}
+
+void TestRTCPReportBlock()
+{
+	FRTCPReportBlock Block;
+
+	// the block about our stream, wherever it is in the report
+	std::vector<uint8> Packet;
+	AppendReport(Packet, RTCP_RR, { { OtherSSRC, 1, 2, 3 }, { MediaSSRC, 64, 1000, 0x0001FFF0 } });
+	CHECK(ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+	CHECK(Block.SSRC == MediaSSRC && Block.FractionLost == 64 && Block.CumulativeLost == 1000);
+	CHECK(Block.ExtendedHighestSequence == 0x0001FFF0 && Block.Jitter == 17);
+
+	// a sender report has its sender info before the blocks, and the cumulative count is signed
+	Packet.clear();
+	AppendReport(Packet, RTCP_SR, { { MediaSSRC, 0, -3, 70000 } });
+	CHECK(ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+	CHECK(Block.CumulativeLost == -3 && Block.ExtendedHighestSequence == 70000);
+
+	// the report follows feedback in a compound packet
+	Packet.clear();
+	AppendPictureLoss(Packet, MediaSSRC);
+	AppendReport(Packet, RTCP_RR, { { MediaSSRC, 0, 0x7FFFFF, 5 } });
+	CHECK(ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+	CHECK(Block.CumulativeLost == 0x7FFFFF);
+
+	// reports about other streams only
+	Packet.clear();
+	AppendReport(Packet, RTCP_RR, { { OtherSSRC, 0, 0, 5 } });
+	AppendReport(Packet, RTCP_RR, {});
+	CHECK(!ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+}
+
+void TestRTCPFeedback()
+{
+	FRTCPFeedback Feedback;
+
+	// each bit of a NACK's bitmask names one of the 16 packets after its packet ID, sequence numbers wrap
+	std::vector<uint8> Packet;
+	AppendNacks(Packet, MediaSSRC, { { 65534, 0x8005 } });
+	CHECK(ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+	CHECK(!Feedback.bPictureLoss);
+	CHECK((Feedback.LostSequences == std::vector<uint16>{ 65534, 65535, 1, 14 }));
+
+	// several NACKs and packets, duplicates kept in the order the client sent them
+	Packet.clear();
+	AppendNacks(Packet, MediaSSRC, { { 300, 0 }, { 100, 1 } });
+	AppendReport(Packet, RTCP_RR, { { MediaSSRC, 0, 0, 5 } });
+	AppendNacks(Packet, MediaSSRC, { { 100, 0 } });
+	CHECK(ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+	CHECK((Feedback.LostSequences == std::vector<uint16>{ 300, 100, 101, 100 }));
+
+	// a picture loss indication, other payload specific feedback such as FIR (format 4) isn't one
+	Packet.clear();
+	AppendPictureLoss(Packet, MediaSSRC, 4);
+	CHECK(!ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+	AppendPictureLoss(Packet, MediaSSRC);
+	CHECK(ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+	CHECK(Feedback.bPictureLoss && Feedback.LostSequences.empty());
+
+	// feedback about another stream
+	Packet.clear();
+	AppendNacks(Packet, OtherSSRC, { { 7, 0 } });
+	AppendPictureLoss(Packet, OtherSSRC);
+	CHECK(!ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+	CHECK(!Feedback.bPictureLoss && Feedback.LostSequences.empty());
+}
+
+void TestRTCPMalformed()
+{
+	FRTCPReportBlock Block;
+	FRTCPFeedback Feedback;
+
+	// a compound packet cut anywhere, the parsers find what is complete and don't read past the end
+	std::vector<uint8> Packet;
+	AppendReport(Packet, RTCP_RR, { { MediaSSRC, 0, 4, 5 } });
+	const uint32 ReportSize = static_cast<uint32>(Packet.size());
+	AppendNacks(Packet, MediaSSRC, { { 9, 0 }, { 40, 0 } });
+	for (uint32 Size = 0; Size <= Packet.size(); ++Size)
+	{
+		CHECK(ParseReport(Packet, Size, Block) == (Size >= ReportSize));
+		CHECK(ParseFeedback(Packet, Size, Feedback) == (Size == Packet.size()));
+	}
+
+	// a length beyond the data
+	Packet.clear();
+	AppendReport(Packet, RTCP_RR, { { MediaSSRC, 0, 4, 5 } });
+	Packet[3] += 1;
+	Packet.insert(Packet.end(), 2, 0);
+	CHECK(!ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+
+	Packet.clear();
+	AppendNacks(Packet, MediaSSRC, { { 9, 0 } });
+	Packet[2] = 0xFF;
+	CHECK(!ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+
+	// more report blocks counted than the length holds, the one about our stream is in the next packet's bytes
+	Packet.clear();
+	AppendReport(Packet, RTCP_RR, { { OtherSSRC, 0, 4, 5 }, { MediaSSRC, 0, 4, 5 } });
+	Packet[3] -= 6;
+	CHECK(!ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+
+	// lengths too short for the packet type
+	Packet.clear();
+	AppendReport(Packet, RTCP_SR, { { MediaSSRC, 0, 4, 5 } });
+	Packet[3] = 1;
+	CHECK(!ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+
+	Packet.clear();
+	AppendNacks(Packet, MediaSSRC, { { 9, 0 } });
+	Packet[3] = 1;
+	CHECK(!ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+
+	Packet.clear();
+	AppendPictureLoss(Packet, MediaSSRC);
+	Packet[3] = 0;
+	CHECK(!ParseFeedback(Packet, static_cast<uint32>(Packet.size()), Feedback));
+
+	// not RTCP version 2, nothing at all
+	Packet.clear();
+	AppendReport(Packet, RTCP_RR, { { MediaSSRC, 0, 4, 5 } });
+	Packet[0] = (Packet[0] & 0x3F) | 0x40;
+	CHECK(!ParseReport(Packet, static_cast<uint32>(Packet.size()), Block));
+	CHECK(!ParseRTCPReportBlock(nullptr, 0, MediaSSRC, Block));
+	CHECK(!ParseRTCPFeedback(nullptr, -1, MediaSSRC, Feedback));
+}
+
+void TestLossTrackerWraparound()
+{
+	// frames of 10 packets numbered across the wrap of the sequence numbers, frame N starts at 65500 + 10 * N
+	FRTPLossTracker Tracker;
+	const uint16 FirstSequence = 65500;
+	auto Timestamp = [](uint32 Frame) { return 3000 * Frame; };
+	auto Sequence = [FirstSequence](uint32 Frame, uint32 Packet) { return static_cast<uint16>(FirstSequence + 10 * Frame + Packet); };
+	for (uint32 Frame = 0; Frame < 8; ++Frame)
+	{
+		Tracker.OnFrameSent(Timestamp(Frame), Sequence(Frame, 0), 10, 0);
+	}
+
+	// the first receiver report is the baseline
+	uint32 Lost = 0;
+	CHECK(!Tracker.OnReceiverReport(MakeReportBlock(0, Sequence(0, 5)), Lost));
+
+	// a loss after the previous report's highest sequence is put on the oldest frame the report covers
+	CHECK(Tracker.OnReceiverReport(MakeReportBlock(2, 0x10000 | Sequence(5, 2)), Lost));
+	CHECK(Lost == Timestamp(0));
+
+	// the recovery of frame 0 covers the frames sent until then, a loss in one sent later is reported
+	CHECK(!Tracker.OnReceiverReport(MakeReportBlock(3, 0x10000 | Sequence(6, 0)), Lost));
+	CHECK(!Tracker.OnReceiverReport(MakeReportBlock(3, 0x10000 | Sequence(7, 9)), Lost));
+	for (uint32 Frame = 8; Frame < 12; ++Frame)
+	{
+		Tracker.OnFrameSent(Timestamp(Frame), Sequence(Frame, 0), 10, 0);
+	}
+	CHECK(Tracker.OnReceiverReport(MakeReportBlock(5, 0x10000 | Sequence(10, 3)), Lost));
+	CHECK(Lost == Timestamp(8));
+
+	// a NACK just after the wrap is in frame 3
+	FRTPLossTracker Nacked;
+	for (uint32 Frame = 0; Frame < 8; ++Frame)
+	{
+		Nacked.OnFrameSent(Timestamp(Frame), Sequence(Frame, 0), 10, 0);
+	}
+	CHECK(Sequence(3, 0) == 65530 && Sequence(3, 9) == 3);
+	CHECK(Nacked.OnNack({ 2 }, Lost));
+	CHECK(Lost == Timestamp(3));
+
+	// losses of path MTU probes, the expendable last packets of a frame, report nothing
+	FRTPLossTracker Probed;
+	Probed.OnFrameSent(Timestamp(0), 65530, 4, 0);
+	Probed.OnFrameSent(Timestamp(1), 65534, 4, 2);
+	CHECK(!Probed.OnReceiverReport(MakeReportBlock(0, 65533), Lost));
+	CHECK(!Probed.OnNack({ 0, 1 }, Lost));
+	CHECK(!Probed.OnReceiverReport(MakeReportBlock(2, 0x10000 | 1), Lost));
+	CHECK(Probed.OnNack({ 1, 65535 }, Lost));
+	CHECK(Lost == Timestamp(1));
+}
+
+void TestLossTrackerNacks()
+{
+	FRTPLossTracker Tracker;
+	auto Timestamp = [](uint32 Frame) { return 0xFFFF0000u + 3000 * Frame; };		// RTP timestamps wrap at frame 22
+	for (uint32 Frame = 0; Frame < 30; ++Frame)
+	{
+		Tracker.OnFrameSent(Timestamp(Frame), static_cast<uint16>(100 * Frame), 100, 0);
+	}
+
+	// a loss is reported once, however often it is NACKed
+	uint32 Lost = 0;
+	CHECK(Tracker.OnNack({ 2050, 2050 }, Lost));
+	CHECK(Lost == Timestamp(20));
+	CHECK(!Tracker.OnNack({ 2050 }, Lost));
+	CHECK(!Tracker.OnNack({ 2099, 2010 }, Lost));
+
+	// the recovery also covers the frames sent until the report, beyond the wrap of the timestamps
+	CHECK(!Tracker.OnNack({ 2500 }, Lost));
+	CHECK(!Tracker.OnNack({ 2999 }, Lost));
+
+	// a reordered NACK of an older frame still needs recovering, and a late one of the newer frame is covered by it
+	CHECK(Tracker.OnNack({ 1500 }, Lost));
+	CHECK(Lost == Timestamp(15));
+	CHECK(!Tracker.OnNack({ 2050 }, Lost));
+	CHECK(!Tracker.OnNack({ 1600 }, Lost));
+
+	// the oldest frame a NACK names is reported
+	CHECK(Tracker.OnNack({ 1450, 1200, 1300 }, Lost));
+	CHECK(Lost == Timestamp(12));
+
+	// frames sent after the report need a recovery of their own
+	for (uint32 Frame = 30; Frame < 35; ++Frame)
+	{
+		Tracker.OnFrameSent(Timestamp(Frame), static_cast<uint16>(100 * Frame), 100, 0);
+	}
+	CHECK(!Tracker.OnNack({ 2950 }, Lost));
+	CHECK(Tracker.OnNack({ 3150 }, Lost));
+	CHECK(Lost == Timestamp(31));
+
+	// packets older than the history or never sent
+	CHECK(!Tracker.OnNack({ 50000 }, Lost));
+	CHECK(!Tracker.OnNack({}, Lost));
+}
+
+#endif
@@ -0,0 +1,291 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// FRTPPacketizer's H.265 packets (RFC 7798) taken apart again the way a receiver does
+// - aggregation packets of the small NAL units in a row, their payload header and when they're flushed
+// - fragmentation units of the NAL units that don't fit, their S/E bits and NAL type
+// - the marker bit on the last packet of the access unit only, also when it's packetized in parts
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include "RTPPacketizer.h"
+#include <vector>
+
+static const uint32 MaxPayloadSize = 1200;
+
+// H.265 NAL unit of Size bytes. The payload has no zero bytes, so no start code can show up in it
+static std::vector<uint8> MakeHevcNal(uint8 Type, uint32 Size, uint8 TemporalId = 0)
+{
+	std::vector<uint8> Nal(Size);
+	Nal[0] = static_cast<uint8>(Type << 1);
+	Nal[1] = static_cast<uint8>(TemporalId + 1);
+	for (uint32 Index = 2; Index < Size; ++Index)
+	{
+		Nal[Index] = static_cast<uint8>(Index * 7 % 255 + 1);
+	}
+	return Nal;
+}
+
+// Annex-B access unit of the NAL units, each after a 4 byte start code
+static std::vector<uint8> MakeAccessUnit(const std::vector<std::vector<uint8>>& Nals)
+{
+	std::vector<uint8> AccessUnit;
+	for (const std::vector<uint8>& Nal : Nals)
+	{
+		static const uint8 StartCode[] = { 0, 0, 0, 1 };
+		AccessUnit.insert(AccessUnit.end(), StartCode, StartCode + sizeof(StartCode));
+		AccessUnit.insert(AccessUnit.end(), Nal.begin(), Nal.end());
+	}
+	return AccessUnit;
+}
+
+// the RTP packet as it's sent, header and payload
+static std::vector<uint8> GetRTPPacket(FRTPPacket& Packet)
+{
+	std::vector<uint8> Bytes(Packet.GetRTPHeader(), Packet.GetRTPHeader() + Packet.HeaderSize);
+	Bytes.insert(Bytes.end(), Packet.Payload, Packet.Payload + Packet.PayloadSize);
+	return Bytes;
+}
+
+static uint8 GetPayloadType(const std::vector<uint8>& Packet)
+{
+	return (Packet[RTP_HEADER_SIZE] >> 1) & 0x3F;
+}
+
+static bool HasMarker(const std::vector<uint8>& Packet)
+{
+	return (Packet[1] & 0x80) != 0;
+}
+
+// the NAL units of the packets as a receiver reassembles them, checking the framing of each packet on the way
+static std::vector<std::vector<uint8>> Depacketize(FRTPPacketArray& Packets, uint32 Timestamp)
+{
+	std::vector<std::vector<uint8>> Nals;
+	bool bInFragment = false;
+	for (FRTPPacket& Each : Packets)
+	{
+		const std::vector<uint8> Packet = GetRTPPacket(Each);
+		CHECK(Packet.size() > RTP_HEADER_SIZE + 2);
+		CHECK(Packet.size() - RTP_HEADER_SIZE <= MaxPayloadSize);
+		CHECK(Packet[0] == 0x80 && (Packet[1] & 0x7F) == 96);
+		CHECK((static_cast<uint32>(Packet[4]) << 24 | Packet[5] << 16 | Packet[6] << 8 | Packet[7]) == Timestamp);
+
+		const uint8* Payload = Packet.data() + RTP_HEADER_SIZE;
+		const uint32 PayloadSize = static_cast<uint32>(Packet.size()) - RTP_HEADER_SIZE;
+		const uint8 Type = GetPayloadType(Packet);
+		if (Type == 48)
+		{
+			// aggregation packet, each NAL unit after its 16 bit size
+			CHECK(!bInFragment);
+			uint32 Offset = 2;
+			while (Offset + 2 <= PayloadSize)
+			{
+				const uint32 NalSize = Payload[Offset] << 8 | Payload[Offset + 1];
+				Offset += 2;
+				CHECK(NalSize >= 2 && Offset + NalSize <= PayloadSize);
+				if (Offset + NalSize > PayloadSize)
+				{
+					break;
+				}
+				Nals.emplace_back(Payload + Offset, Payload + Offset + NalSize);
+				Offset += NalSize;
+			}
+			CHECK(Offset == PayloadSize);
+		}
+		else if (Type == 49)
+		{
+			// fragmentation unit, the NAL header is the payload header with the type of the FU header
+			const bool bStart = (Payload[2] & 0x80) != 0;
+			const bool bEnd = (Payload[2] & 0x40) != 0;
+			CHECK(bStart != bInFragment);
+			CHECK(!(bStart && bEnd));
+			if (bStart)
+			{
+				Nals.push_back({ static_cast<uint8>((Payload[0] & 0x81) | (Payload[2] & 0x3F) << 1), Payload[1] });
+			}
+			Nals.back().insert(Nals.back().end(), Payload + 3, Payload + PayloadSize);
+			bInFragment = !bEnd;
+		}
+		else
+		{
+			CHECK(!bInFragment);
+			Nals.emplace_back(Payload, Payload + PayloadSize);
+		}
+	}
+	CHECK(!bInFragment);
+	return Nals;
+}
+
+// sequence numbers follow on from First, and only the last packet is marked if bMarked
+static void CheckSequence(FRTPPacketArray& Packets, uint16 First, bool bMarked)
+{
+	for (uint32 Index = 0; Index < Packets.size(); ++Index)
+	{
+		const std::vector<uint8> Packet = GetRTPPacket(Packets[Index]);
+		CHECK((Packet[2] << 8 | Packet[3]) == static_cast<uint16>(First + Index));
+		CHECK(HasMarker(Packet) == (bMarked && Index == Packets.size() - 1));
+	}
+}
+
+void TestPacketizeH265Aggregation()
+{
+	FRTPPacketizer Packetizer;
+	Packetizer.SetCodec(EVideoCodec::H265);
+
+	// the VPS, SPS and PPS of an IDR frame share an aggregation packet, the slice after them is sent on its own
+	const std::vector<std::vector<uint8>> Nals = { MakeHevcNal(32, 24), MakeHevcNal(33, 60), MakeHevcNal(34, 8), MakeHevcNal(19, 1150) };
+	const std::vector<uint8> AccessUnit = MakeAccessUnit(Nals);
+	FRTPPacketArray Packets;
+	Packetizer.Packetize(1000, AccessUnit.data(), static_cast<uint32>(AccessUnit.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() == 2);
+	if (Packets.size() == 2)
+	{
+		const std::vector<uint8> Aggregate = GetRTPPacket(Packets[0]);
+		CHECK(GetPayloadType(Aggregate) == 48);
+		CHECK(Aggregate.size() == RTP_HEADER_SIZE + 2 + 3 * 2 + 24 + 60 + 8);
+		CHECK(GetPayloadType(GetRTPPacket(Packets[1])) == 19);
+	}
+	CheckSequence(Packets, 0, true);
+	CHECK(Depacketize(Packets, 1000) == Nals);
+
+	// the payload header has the F bit of any of the NAL units and the lowest temporal id
+	std::vector<std::vector<uint8>> Layered = { MakeHevcNal(1, 30, 2), MakeHevcNal(1, 30, 1), MakeHevcNal(1, 30, 3) };
+	Layered[1][0] |= 0x80;
+	std::vector<uint8> LayeredUnit = MakeAccessUnit(Layered);
+	Packetizer.Packetize(2000, LayeredUnit.data(), static_cast<uint32>(LayeredUnit.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() == 1);
+	const std::vector<uint8> LayeredPacket = GetRTPPacket(Packets[0]);
+	CHECK(LayeredPacket[RTP_HEADER_SIZE] == (0x80 | 48 << 1));
+	CHECK(LayeredPacket[RTP_HEADER_SIZE + 1] == 2);
+	CheckSequence(Packets, 2, true);
+	CHECK(Depacketize(Packets, 2000) == Layered);
+
+	// a NAL unit with nothing to aggregate with is a single NAL unit packet, not an aggregation packet of one
+	const std::vector<std::vector<uint8>> Single = { MakeHevcNal(1, 100) };
+	const std::vector<uint8> SingleUnit = MakeAccessUnit(Single);
+	Packetizer.Packetize(3000, SingleUnit.data(), static_cast<uint32>(SingleUnit.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() == 1 && GetPayloadType(GetRTPPacket(Packets[0])) == 1);
+	CHECK(Depacketize(Packets, 3000) == Single);
+
+	// NAL units that fill more than one aggregation packet start the next one, none goes over MaxPayloadSize
+	std::vector<std::vector<uint8>> Many;
+	for (uint32 Index = 0; Index < 40; ++Index)
+	{
+		Many.push_back(MakeHevcNal(1, 50 + Index * 3));
+	}
+	const std::vector<uint8> ManyUnit = MakeAccessUnit(Many);
+	Packetizer.Packetize(4000, ManyUnit.data(), static_cast<uint32>(ManyUnit.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() > 1);
+	for (FRTPPacket& Packet : Packets)
+	{
+		CHECK(GetPayloadType(GetRTPPacket(Packet)) == 48);
+	}
+	CheckSequence(Packets, 4, true);
+	CHECK(Depacketize(Packets, 4000) == Many);
+}
+
+void TestPacketizeH265Fragmentation()
+{
+	FRTPPacketizer Packetizer;
+	Packetizer.SetCodec(EVideoCodec::H265Main10);
+
+	// the parameter sets are flushed before the IDR slice, which is split into fragmentation units
+	const uint32 SliceSize = 5000;
+	const std::vector<std::vector<uint8>> Nals = { MakeHevcNal(32, 24), MakeHevcNal(33, 60), MakeHevcNal(34, 8), MakeHevcNal(20, SliceSize) };
+	const std::vector<uint8> AccessUnit = MakeAccessUnit(Nals);
+	FRTPPacketArray Packets;
+	Packetizer.Packetize(0xFFFFFF00, AccessUnit.data(), static_cast<uint32>(AccessUnit.size()), MaxPayloadSize, Packets);
+
+	const uint32 NumFragments = (SliceSize - 2 + MaxPayloadSize - 3 - 1) / (MaxPayloadSize - 3);
+	CHECK(Packets.size() == 1 + NumFragments);
+	CHECK(!Packets.empty() && GetPayloadType(GetRTPPacket(Packets[0])) == 48);
+	for (uint32 Index = 1; Index < Packets.size(); ++Index)
+	{
+		const std::vector<uint8> Fragment = GetRTPPacket(Packets[Index]);
+		CHECK(GetPayloadType(Fragment) == 49);
+		CHECK(Fragment[RTP_HEADER_SIZE + 1] == 1);
+		const uint8 FUHeader = Fragment[RTP_HEADER_SIZE + 2];
+		CHECK((FUHeader & 0x3F) == 20);
+		CHECK(((FUHeader & 0x80) != 0) == (Index == 1));
+		CHECK(((FUHeader & 0x40) != 0) == (Index == Packets.size() - 1));
+		CHECK(Index == Packets.size() - 1 || Fragment.size() == RTP_HEADER_SIZE + MaxPayloadSize);
+	}
+	CheckSequence(Packets, 0, true);
+	CHECK(Depacketize(Packets, 0xFFFFFF00) == Nals);
+
+	// a NAL unit too large to aggregate that still fits is a single NAL unit packet, one byte more is fragmented
+	const std::vector<std::vector<uint8>> Fits = { MakeHevcNal(1, MaxPayloadSize) };
+	const std::vector<uint8> FitsUnit = MakeAccessUnit(Fits);
+	Packetizer.Packetize(1, FitsUnit.data(), static_cast<uint32>(FitsUnit.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() == 1 && GetPayloadType(GetRTPPacket(Packets[0])) == 1);
+	CHECK(Depacketize(Packets, 1) == Fits);
+
+	const std::vector<std::vector<uint8>> Over = { MakeHevcNal(1, MaxPayloadSize + 1) };
+	const std::vector<uint8> OverUnit = MakeAccessUnit(Over);
+	Packetizer.Packetize(2, OverUnit.data(), static_cast<uint32>(OverUnit.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() == 2);
+	CheckSequence(Packets, static_cast<uint16>(1 + NumFragments + 1), true);
+	CHECK(Depacketize(Packets, 2) == Over);
+}
+
+void TestPacketizeH265Parts()
+{
+	FRTPPacketizer Packetizer;
+	Packetizer.SetCodec(EVideoCodec::H265);
+
+	// slices streamed as they are encoded, the pending aggregation is flushed with each part and only the last part
+	// is marked
+	const std::vector<std::vector<uint8>> First = { MakeHevcNal(32, 24), MakeHevcNal(33, 60), MakeHevcNal(34, 8), MakeHevcNal(19, 300) };
+	const std::vector<std::vector<uint8>> Middle = { MakeHevcNal(19, 2500) };
+	const std::vector<std::vector<uint8>> Last = { MakeHevcNal(19, 200), MakeHevcNal(19, 150) };
+	FRTPPacketArray Packets;
+	uint16 SequenceNumber = Packetizer.GetSequenceNumber();
+
+	std::vector<uint8> Part = MakeAccessUnit(First);
+	Packetizer.Packetize(500, Part.data(), static_cast<uint32>(Part.size()), MaxPayloadSize, Packets, false);
+	CHECK(Packets.size() == 1 && GetPayloadType(GetRTPPacket(Packets[0])) == 48);
+	CheckSequence(Packets, SequenceNumber, false);
+	CHECK(Depacketize(Packets, 500) == First);
+	SequenceNumber = static_cast<uint16>(SequenceNumber + Packets.size());
+
+	Part = MakeAccessUnit(Middle);
+	Packetizer.Packetize(500, Part.data(), static_cast<uint32>(Part.size()), MaxPayloadSize, Packets, false);
+	CHECK(Packets.size() == 3);
+	CheckSequence(Packets, SequenceNumber, false);
+	CHECK(Depacketize(Packets, 500) == Middle);
+	SequenceNumber = static_cast<uint16>(SequenceNumber + Packets.size());
+
+	Part = MakeAccessUnit(Last);
+	Packetizer.Packetize(500, Part.data(), static_cast<uint32>(Part.size()), MaxPayloadSize, Packets, true);
+	CHECK(Packets.size() == 1 && GetPayloadType(GetRTPPacket(Packets[0])) == 48);
+	CheckSequence(Packets, SequenceNumber, true);
+	CHECK(Depacketize(Packets, 500) == Last);
+	SequenceNumber = static_cast<uint16>(SequenceNumber + Packets.size());
+
+	// a filler padding the access unit takes the marker bit over
+	Packetizer.AppendFiller(500, 100, Packets);
+	CHECK(Packets.size() == 2);
+	CheckSequence(Packets, static_cast<uint16>(SequenceNumber - 1), true);
+	if (Packets.size() == 2)
+	{
+		const std::vector<uint8> Filler = GetRTPPacket(Packets[1]);
+		CHECK(GetPayloadType(Filler) == 38 && Filler.size() == RTP_HEADER_SIZE + 100);
+	}
+
+	// sequence numbers wrap
+	FRTPPacketizer Wrapping;
+	Wrapping.SetCodec(EVideoCodec::H265);
+	const std::vector<uint8> Small = MakeAccessUnit({ MakeHevcNal(1, 10) });
+	for (uint32 Index = 0; Index < 65535; ++Index)
+	{
+		Wrapping.Packetize(Index, Small.data(), static_cast<uint32>(Small.size()), MaxPayloadSize, Packets);
+	}
+	const std::vector<uint8> Large = MakeAccessUnit({ MakeHevcNal(1, 3000) });
+	Wrapping.Packetize(70000, Large.data(), static_cast<uint32>(Large.size()), MaxPayloadSize, Packets);
+	CHECK(Packets.size() == 3);
+	CheckSequence(Packets, 65535, true);
+	CHECK(Wrapping.GetSequenceNumber() == 2);
+}
+
+#endif
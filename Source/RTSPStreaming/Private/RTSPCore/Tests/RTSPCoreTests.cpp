@@ -0,0 +1,82 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// unit tests of the engine independent RTSP/RTP core. Exits with the number of failed checks
+// usage: RTSPCoreTests [<case>], every case without one. RTSPCore/CMakeLists.txt registers each case with ctest
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include <cstdio>
+#include <cstring>
+
+static int32 Failures = 0;
+
+void Check(bool bCondition, const char* What, const char* File, int32 Line)
+{
+	if (!bCondition)
+	{
+		const char* Slash = strrchr(File, '/');
+		printf("FAIL %s:%d: %s\n", Slash ? Slash + 1 : File, Line, What);
+		Failures++;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const struct
+	{
+		const char*	Name;
+		void		(*Run)();
+	} Cases[] =
+	{
+		{ "ParseRequest", TestParseRequest },
+		{ "ParseTruncatedRequest", TestParseTruncatedRequest },
+		{ "ParseOversizedRequest", TestParseOversizedRequest },
+		{ "ParseTransport", TestParseTransport },
+		{ "SessionStates", TestSessionStates },
+		{ "SessionAdmission", TestSessionAdmission },
+		{ "SessionSetup", TestSessionSetup },
+		{ "SessionParameters", TestSessionParameters },
+		{ "SessionDescribe", TestSessionDescribe },
+		{ "SchedulerOperatorUnderFlood", TestSchedulerOperatorUnderFlood },
+		{ "SchedulerKeyframeOverBurst", TestSchedulerKeyframeOverBurst },
+		{ "SchedulerLayerSkipping", TestSchedulerLayerSkipping },
+		{ "SchedulerDisabled", TestSchedulerDisabled },
+		{ "TimerWheelLevels", TestTimerWheelLevels },
+		{ "TimerWheelStaleCancel", TestTimerWheelStaleCancel },
+		{ "TimerWheelOrder", TestTimerWheelOrder },
+		{ "RTCPReportBlock", TestRTCPReportBlock },
+		{ "RTCPFeedback", TestRTCPFeedback },
+		{ "RTCPMalformed", TestRTCPMalformed },
+		{ "LossTrackerWraparound", TestLossTrackerWraparound },
+		{ "LossTrackerNacks", TestLossTrackerNacks },
+		{ "PacketizeH265Aggregation", TestPacketizeH265Aggregation },
+		{ "PacketizeH265Fragmentation", TestPacketizeH265Fragmentation },
+		{ "PacketizeH265Parts", TestPacketizeH265Parts },
+	};
+
+	if (argc > 2)
+	{
+		printf("usage: RTSPCoreTests [<case>]\n");
+		return 1;
+	}
+
+	bool bFound = false;
+	for (const auto& Case : Cases)
+	{
+		if (argc == 1 || strcmp(argv[1], Case.Name) == 0)
+		{
+			Case.Run();
+			bFound = true;
+		}
+	}
+	if (!bFound)
+	{
+		printf("unknown case %s\n", argv[1]);
+		return 1;
+	}
+	return Failures;
+}
+
+#endif
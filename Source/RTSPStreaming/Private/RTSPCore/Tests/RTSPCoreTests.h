@@ -0,0 +1,46 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+// checks and cases of RTSPCoreTests, see RTSPCoreTests.cpp
+#include "RTSPCoreTypes.h"
+
+void Check(bool bCondition, const char* What, const char* File, int32 Line);
+
+#define CHECK(Condition) Check(Condition, #Condition, __FILE__, __LINE__)
+
+// RTSPRequestTests.cpp
+void TestParseRequest();
+void TestParseTruncatedRequest();
+void TestParseOversizedRequest();
+void TestParseTransport();
+
+// RTSPSessionTests.cpp
+void TestSessionStates();
+void TestSessionAdmission();
+void TestSessionSetup();
+void TestSessionParameters();
+void TestSessionDescribe();
+
+// EgressSchedulerTests.cpp
+void TestSchedulerOperatorUnderFlood();
+void TestSchedulerKeyframeOverBurst();
+void TestSchedulerLayerSkipping();
+void TestSchedulerDisabled();
+
+// TimerWheelTests.cpp
+void TestTimerWheelLevels();
+void TestTimerWheelStaleCancel();
+void TestTimerWheelOrder();
+
+// RTCPTests.cpp
+void TestRTCPReportBlock();
+void TestRTCPFeedback();
+void TestRTCPMalformed();
+void TestLossTrackerWraparound();
+void TestLossTrackerNacks();
+
+// RTPPacketizerTests.cpp
+void TestPacketizeH265Aggregation();
+void TestPacketizeH265Fragmentation();
+void TestPacketizeH265Parts();
@@ -0,0 +1,197 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// ParseRTSPRequest() on requests as clients send them, cut short and larger than the receive buffer
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include "RTSPRequest.h"
+#include <string>
+#include <vector>
+
+static bool Parse(const std::string& Request, FRTSPRequest& OutRequest)
+{
+	return ParseRTSPRequest(Request.data(), static_cast<uint32>(Request.size()), OutRequest);
+}
+
+void TestParseRequest()
+{
+	FRTSPRequest Request;
+
+	CHECK(Parse("OPTIONS rtsp://10.0.0.1:8554/stream/1 RTSP/1.0\r\nCSeq: 2\r\nUser-Agent: test\r\n\r\n", Request));
+	CHECK(Request.Method == ERTSPMethod::Options);
+	CHECK(strcmp(Request.URLHostPort, "10.0.0.1:8554") == 0);
+	CHECK(strcmp(Request.URLPreSuffix, "stream") == 0);
+	CHECK(strcmp(Request.URLSuffix, "1") == 0);
+	CHECK(strcmp(Request.CSeq, "2") == 0);
+	CHECK(Request.Body == nullptr && Request.BodySize == 0);
+
+	// the query is split off the suffix, the scheme is case insensitive
+	CHECK(Parse("DESCRIBE RTSP://host/stream/hevc?rendition=720p&priority=operator RTSP/1.0\r\nCSeq:\t17\r\nAccept: application/sdp\r\n\r\n", Request));
+	CHECK(Request.Method == ERTSPMethod::Describe);
+	CHECK(strcmp(Request.URLHostPort, "host") == 0);
+	CHECK(strcmp(Request.URLPreSuffix, "stream") == 0);
+	CHECK(strcmp(Request.URLSuffix, "hevc") == 0);
+	CHECK(strcmp(Request.URLQuery, "rendition=720p&priority=operator") == 0);
+	CHECK(strcmp(Request.CSeq, "17") == 0);
+
+	std::vector<std::string> Names, Values;
+	ForEachURLQueryParameter(Request.URLQuery, [&Names, &Values](const char* Name, const char* Value)
+	{
+		Names.push_back(Name);
+		Values.push_back(Value);
+	});
+	CHECK(Names.size() == 2 && Names[0] == "rendition" && Values[0] == "720p" && Names[1] == "priority" && Values[1] == "operator");
+
+	// a single path segment has no pre suffix
+	CHECK(Parse("PLAY rtsp://host:8554/live RTSP/1.0\r\nCSeq: 5\r\nSession: 12345\r\n\r\n", Request));
+	CHECK(Request.Method == ERTSPMethod::Play);
+	CHECK(Request.URLPreSuffix[0] == 0);
+	CHECK(strcmp(Request.URLSuffix, "live") == 0);
+
+	// every method the session handles
+	const struct
+	{
+		const char*	Name;
+		ERTSPMethod	Method;
+	} Methods[] =
+	{
+		{ "SETUP", ERTSPMethod::Setup },
+		{ "TEARDOWN", ERTSPMethod::Teardown },
+		{ "PAUSE", ERTSPMethod::Pause },
+		{ "GET_PARAMETER", ERTSPMethod::GetParameter },
+		{ "SET_PARAMETER", ERTSPMethod::SetParameter },
+		{ "RECORD", ERTSPMethod::Unknown },
+	};
+	for (const auto& Method : Methods)
+	{
+		CHECK(Parse(std::string(Method.Name) + " rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 3\r\n\r\n", Request));
+		CHECK(Request.Method == Method.Method);
+	}
+
+	// the body ends at Content-Length, anything after it is the next request. Body points into the parsed data
+	const std::string Body = "bitrate: 4000\r\n";
+	const std::string WithBody = "SET_PARAMETER rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 9\r\nContent-Length: 15\r\n\r\n" + Body + "OPTIONS";
+	CHECK(Parse(WithBody, Request));
+	CHECK(Request.Method == ERTSPMethod::SetParameter);
+	CHECK(Request.ContentLength == 15);
+	CHECK(Request.Body != nullptr && std::string(Request.Body, Request.BodySize) == Body);
+
+	std::string Name, Value;
+	ForEachBodyParameter(Request.Body, Request.BodySize, [&Name, &Value](const char* InName, const char* InValue)
+	{
+		Name = InName;
+		Value = InValue;
+	});
+	CHECK(Name == "bitrate" && Value == "4000");
+
+	// not a request
+	CHECK(!Parse("RTSP/1.0 200 OK\r\nCSeq: 2\r\n\r\n", Request));
+	CHECK(!Parse("GARBAGE", Request));
+	CHECK(!Parse("", Request));
+}
+
+void TestParseTruncatedRequest()
+{
+	// a request cut anywhere before the end of its CSeq line is rejected rather than read past its end
+	const std::string Full = "SETUP rtsp://host:8554/stream/1 RTSP/1.0\r\nCSeq: 4\r\nTransport: RTP/AVP;unicast;client_port=5000-5001\r\n\r\n";
+	const size_t CSeqEnd = Full.find("\r\n", Full.find("CSeq:"));
+	for (size_t Size = 0; Size <= Full.size(); ++Size)
+	{
+		// copied so anything read beyond Size is outside the allocation
+		std::vector<char> Data(Full.begin(), Full.begin() + Size);
+		FRTSPRequest Request;
+		const bool bParsed = ParseRTSPRequest(Data.data(), static_cast<uint32>(Size), Request);
+		if (Size <= CSeqEnd)
+		{
+			CHECK(!bParsed);
+		}
+		else
+		{
+			CHECK(bParsed);
+			CHECK(Request.Method == ERTSPMethod::Setup);
+			CHECK(strcmp(Request.CSeq, "4") == 0);
+		}
+	}
+}
+
+void TestParseOversizedRequest()
+{
+	FRTSPRequest Request;
+
+	// more than the receive buffer, the headers are parsed and the rest is cut off
+	std::string Large = "SET_PARAMETER rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 6\r\nContent-Length: 20000\r\n\r\n";
+	Large.append(20000, 'x');
+	CHECK(Parse(Large, Request));
+	CHECK(Request.Method == ERTSPMethod::SetParameter);
+	CHECK(Request.ContentLength == 20000);
+	CHECK(Request.Body != nullptr && Request.Body + Request.BodySize <= Large.data() + RTSP_BUFFER_SIZE);
+
+	// a request line longer than the buffer has no RTSP version within it
+	std::string LongLine = "DESCRIBE rtsp://host/";
+	LongLine.append(RTSP_BUFFER_SIZE, 'a');
+	LongLine += " RTSP/1.0\r\nCSeq: 7\r\n\r\n";
+	CHECK(!Parse(LongLine, Request));
+
+	// path parts longer than the URL fields
+	std::string LongSuffix = "DESCRIBE rtsp://host/stream/";
+	LongSuffix.append(RTSP_PARAM_STRING_MAX, 's');
+	LongSuffix += " RTSP/1.0\r\nCSeq: 8\r\n\r\n";
+	CHECK(!Parse(LongSuffix, Request));
+
+	std::string LongPreSuffix = "DESCRIBE rtsp://host/";
+	LongPreSuffix.append(RTSP_PARAM_STRING_MAX, 'p');
+	LongPreSuffix += "/1 RTSP/1.0\r\nCSeq: 8\r\n\r\n";
+	CHECK(!Parse(LongPreSuffix, Request));
+
+	// the longest suffix that fits
+	std::string MaxSuffix = "DESCRIBE rtsp://host/stream/";
+	MaxSuffix.append(RTSP_PARAM_STRING_MAX - 1, 's');
+	MaxSuffix += " RTSP/1.0\r\nCSeq: 8\r\n\r\n";
+	CHECK(Parse(MaxSuffix, Request));
+	CHECK(strlen(Request.URLSuffix) == RTSP_PARAM_STRING_MAX - 1);
+
+	// CSeq and host are cut to their fields
+	std::string LongCSeq = "OPTIONS rtsp://host/stream/1 RTSP/1.0\r\nCSeq: ";
+	LongCSeq.append(RTSP_PARAM_STRING_MAX * 2, '9');
+	LongCSeq += "\r\n\r\n";
+	Parse(LongCSeq, Request);
+	CHECK(strlen(Request.CSeq) < RTSP_PARAM_STRING_MAX);
+
+	std::string LongHost = "OPTIONS rtsp://";
+	LongHost.append(RTSP_PARAM_STRING_MAX * 2, 'h');
+	LongHost += "/stream/1 RTSP/1.0\r\nCSeq: 1\r\n\r\n";
+	CHECK(Parse(LongHost, Request));
+	CHECK(strlen(Request.URLHostPort) == RTSP_PARAM_STRING_MAX - 1);
+	CHECK(strcmp(Request.URLSuffix, "1") == 0);
+}
+
+void TestParseTransport()
+{
+	FRTSPRequest Request;
+
+	// the RTCP port is taken as the one above the RTP port
+	CHECK(Parse("SETUP rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 3\r\nTransport: RTP/AVP;unicast;client_port=5000-5001\r\n\r\n", Request));
+	CHECK(Request.Method == ERTSPMethod::Setup);
+	CHECK(!Request.bTCPTransport);
+	CHECK(Request.ClientRTPPort == 5000 && Request.ClientRTCPPort == 5001);
+
+	CHECK(Parse("SETUP rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 3\r\nTransport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n\r\n", Request));
+	CHECK(Request.bTCPTransport);
+	CHECK(Request.ClientRTPPort == 0 && Request.ClientRTCPPort == 0);
+
+	// ports that leave no room for RTCP or aren't numbers are ignored
+	const char* const BadPorts[] = { "client_port=0-1", "client_port=65535-65536", "client_port=99999-100000", "client_port=abc", "client_port" };
+	for (const char* Ports : BadPorts)
+	{
+		CHECK(Parse(std::string("SETUP rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 3\r\nTransport: RTP/AVP;unicast;") + Ports + "\r\n\r\n", Request));
+		CHECK(Request.ClientRTPPort == 0 && Request.ClientRTCPPort == 0);
+	}
+
+	// a transport only counts for SETUP
+	CHECK(Parse("PLAY rtsp://host/stream/1 RTSP/1.0\r\nCSeq: 4\r\nTransport: RTP/AVP/TCP\r\n\r\n", Request));
+	CHECK(!Request.bTCPTransport);
+}
+
+#endif
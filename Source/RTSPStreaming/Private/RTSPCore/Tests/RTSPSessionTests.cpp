@@ -0,0 +1,394 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// FRTSPSession driven through a host that records what the session asked of it
+// - the Init -> Ready -> Playing -> Ready -> Closed transitions and the requests that mustn't cause one
+// - admission rejected with 453 or a redirect, SETUP responses for UDP and TCP, parameters of URLs and SET_PARAMETER
+// - the DESCRIBE response and its SDP for each codec
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include "RTSPSession.h"
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+class FTestSessionHost : public IRTSPSessionHost
+{
+public:
+	virtual void SendResponse(const char* Response, uint32 Size) override
+	{
+		Responses.emplace_back(Response, Size);
+	}
+
+	virtual bool DescribeStream(const char* Path, FRTSPStreamDescription& OutStream) override
+	{
+		DescribedPaths.push_back(Path);
+		auto Stream = Streams.find(Path);
+		if (Stream == Streams.end())
+		{
+			return false;
+		}
+		OutStream = Stream->second;
+		return true;
+	}
+
+	virtual bool Admit() override
+	{
+		return bAdmit;
+	}
+
+	virtual std::string GetAdmissionRedirect() override
+	{
+		return AdmissionRedirect;
+	}
+
+	virtual bool SetupTransport(FRTSPTransport& Transport) override
+	{
+		SetupTransports.push_back(Transport);
+		Transport.ClientIP = "10.0.0.2";
+		Transport.ServerIP = "10.0.0.1";
+		Transport.ServerRTPPort = 6970;
+		Transport.ServerRTCPPort = 6971;
+		return bSetupSucceeds;
+	}
+
+	virtual void SetPlaying(bool bPlaying) override
+	{
+		PlayingCalls.push_back(bPlaying);
+	}
+
+	virtual bool ApplyParameter(const char* Name, const char* Value) override
+	{
+		Parameters[Name] = Value;
+		return strcmp(Name, "bitrate") == 0 || strcmp(Name, "rendition") == 0;
+	}
+
+	virtual int32 GetSessionTimeout() override
+	{
+		return 60;
+	}
+
+	const std::string& LastResponse() const
+	{
+		static const std::string None;
+		return Responses.empty() ? None : Responses.back();
+	}
+
+	bool								bAdmit = true;
+	bool								bSetupSucceeds = true;
+	std::string							AdmissionRedirect;
+	std::map<std::string, FRTSPStreamDescription>	Streams;
+	std::vector<std::string>			Responses;
+	std::vector<std::string>			DescribedPaths;
+	std::vector<FRTSPTransport>			SetupTransports;
+	std::vector<bool>					PlayingCalls;
+	std::map<std::string, std::string>	Parameters;
+};
+
+static ERTSPMethod Handle(FRTSPSession& Session, const std::string& Message)
+{
+	return Session.HandleMessage(Message.data(), static_cast<uint32>(Message.size()));
+}
+
+static std::string Request(const char* Method, int32 CSeq, const char* Headers = "", const char* Path = "stream/1")
+{
+	return std::string(Method) + " rtsp://10.0.0.1:8554/" + Path + " RTSP/1.0\r\nCSeq: " + std::to_string(CSeq) + "\r\n" + Headers + "\r\n";
+}
+
+static bool StartsWith(const std::string& Text, const char* Prefix)
+{
+	return Text.compare(0, strlen(Prefix), Prefix) == 0;
+}
+
+static bool Contains(const std::string& Text, const char* Part)
+{
+	return Text.find(Part) != std::string::npos;
+}
+
+static const char* const UdpTransport = "Transport: RTP/AVP;unicast;client_port=5000-5001\r\n";
+
+void TestSessionStates()
+{
+	FTestSessionHost Host;
+	FRTSPSession Session(Host, 1234);
+	CHECK(Session.GetState() == FRTSPSession::EState::Init);
+	CHECK(Session.GetSessionId() == 1234);
+
+	CHECK(Handle(Session, Request("OPTIONS", 1)) == ERTSPMethod::Options);
+	CHECK(Session.GetState() == FRTSPSession::EState::Init);
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 200 OK\r\nCSeq: 1\r\n"));
+	CHECK(Contains(Host.LastResponse(), "Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER, SET_PARAMETER"));
+
+	// PLAY without a transport is answered but doesn't start anything
+	CHECK(Handle(Session, Request("PLAY", 2)) == ERTSPMethod::Play);
+	CHECK(Session.GetState() == FRTSPSession::EState::Init);
+	CHECK(Host.PlayingCalls.empty());
+
+	CHECK(Handle(Session, Request("SETUP", 3, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(Session.GetState() == FRTSPSession::EState::Ready);
+	CHECK(Host.PlayingCalls.empty());
+
+	CHECK(Handle(Session, Request("PLAY", 4, "Session: 1234\r\n")) == ERTSPMethod::Play);
+	CHECK(Session.GetState() == FRTSPSession::EState::Playing);
+	CHECK(Host.PlayingCalls.size() == 1 && Host.PlayingCalls.back());
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 200 OK\r\nCSeq: 4\r\n"));
+	CHECK(Contains(Host.LastResponse(), "Session: 1234\r\n"));
+
+	// a repeated PLAY doesn't start the client twice
+	CHECK(Handle(Session, Request("PLAY", 5)) == ERTSPMethod::Play);
+	CHECK(Host.PlayingCalls.size() == 1);
+
+	CHECK(Handle(Session, Request("PAUSE", 6)) == ERTSPMethod::Pause);
+	CHECK(Session.GetState() == FRTSPSession::EState::Ready);
+	CHECK(Host.PlayingCalls.size() == 2 && !Host.PlayingCalls.back());
+
+	CHECK(Handle(Session, Request("PAUSE", 7)) == ERTSPMethod::Pause);
+	CHECK(Host.PlayingCalls.size() == 2);
+
+	CHECK(Handle(Session, Request("PLAY", 8)) == ERTSPMethod::Play);
+	CHECK(Session.GetState() == FRTSPSession::EState::Playing);
+	CHECK(Host.PlayingCalls.size() == 3 && Host.PlayingCalls.back());
+
+	// a repeated SETUP keeps the session playing
+	CHECK(Handle(Session, Request("SETUP", 9, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(Session.GetState() == FRTSPSession::EState::Playing);
+
+	CHECK(Handle(Session, Request("TEARDOWN", 10)) == ERTSPMethod::Teardown);
+	CHECK(Session.GetState() == FRTSPSession::EState::Closed);
+	CHECK(Host.PlayingCalls.size() == 4 && !Host.PlayingCalls.back());
+
+	// nothing is handled once closed
+	const size_t NumResponses = Host.Responses.size();
+	CHECK(Handle(Session, Request("PLAY", 11)) == ERTSPMethod::Unknown);
+	CHECK(Session.GetState() == FRTSPSession::EState::Closed);
+	CHECK(Host.Responses.size() == NumResponses);
+
+	// TEARDOWN of a session that never played doesn't stop anything
+	FTestSessionHost IdleHost;
+	FRTSPSession IdleSession(IdleHost, 1);
+	CHECK(Handle(IdleSession, Request("SETUP", 1, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(Handle(IdleSession, Request("TEARDOWN", 2)) == ERTSPMethod::Teardown);
+	CHECK(IdleSession.GetState() == FRTSPSession::EState::Closed);
+	CHECK(IdleHost.PlayingCalls.empty());
+
+	// what isn't an RTSP request is ignored without a response
+	FTestSessionHost NoiseHost;
+	FRTSPSession NoiseSession(NoiseHost, 1);
+	CHECK(Handle(NoiseSession, "$\x00\x00\x10") == ERTSPMethod::Unknown);
+	CHECK(Handle(NoiseSession, "hello") == ERTSPMethod::Unknown);
+	CHECK(Handle(NoiseSession, "SETUP") == ERTSPMethod::Unknown);
+	CHECK(NoiseSession.HandleMessage("", 0) == ERTSPMethod::Unknown);
+	CHECK(NoiseHost.Responses.empty());
+	CHECK(NoiseSession.GetState() == FRTSPSession::EState::Init);
+}
+
+void TestSessionAdmission()
+{
+	// rejected with 453 when there is no redirect
+	FTestSessionHost Host;
+	Host.bAdmit = false;
+	FRTSPSession Session(Host, 1);
+	CHECK(Handle(Session, Request("SETUP", 3, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(Session.GetState() == FRTSPSession::EState::Init);
+	CHECK(Host.SetupTransports.empty());
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 453 Not Enough Bandwidth\r\nCSeq: 3\r\n"));
+
+	// sent to the same stream on another instance
+	Host.AdmissionRedirect = "rtsp://10.0.0.9:8554";
+	CHECK(Handle(Session, Request("SETUP", 4, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 302 Moved Temporarily\r\nCSeq: 4\r\n"));
+	CHECK(Contains(Host.LastResponse(), "Location: rtsp://10.0.0.9:8554/stream/1\r\n"));
+
+	// PLAY checks again, a client admitted at SETUP may not be any more
+	FTestSessionHost PlayHost;
+	FRTSPSession PlaySession(PlayHost, 1);
+	CHECK(Handle(PlaySession, Request("SETUP", 1, UdpTransport)) == ERTSPMethod::Setup);
+	PlayHost.bAdmit = false;
+	CHECK(Handle(PlaySession, Request("PLAY", 2)) == ERTSPMethod::Play);
+	CHECK(StartsWith(PlayHost.LastResponse(), "RTSP/1.0 453 Not Enough Bandwidth\r\n"));
+	CHECK(PlaySession.GetState() == FRTSPSession::EState::Ready);
+	CHECK(PlayHost.PlayingCalls.empty());
+}
+
+void TestSessionSetup()
+{
+	// UDP, the host fills in the addresses and server ports
+	FTestSessionHost Host;
+	FRTSPSession Session(Host, 42);
+	CHECK(Handle(Session, Request("SETUP", 3, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(Host.SetupTransports.size() == 1);
+	CHECK(!Host.SetupTransports[0].bTCP);
+	CHECK(Host.SetupTransports[0].ClientRTPPort == 5000 && Host.SetupTransports[0].ClientRTCPPort == 5001);
+	CHECK(Session.GetTransport().ServerRTPPort == 6970);
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 200 OK\r\nCSeq: 3\r\n"));
+	CHECK(Contains(Host.LastResponse(), "Transport: RTP/AVP;unicast;destination=10.0.0.2;source=10.0.0.1;client_port=5000-5001;server_port=6970-6971\r\n"));
+	CHECK(Contains(Host.LastResponse(), "Session: 42;timeout=60\r\n"));
+
+	// a repeated SETUP without client ports keeps the previous ones
+	CHECK(Handle(Session, Request("SETUP", 4, "Transport: RTP/AVP;unicast\r\n")) == ERTSPMethod::Setup);
+	CHECK(Host.SetupTransports.size() == 2);
+	CHECK(Host.SetupTransports[1].ClientRTPPort == 5000 && Host.SetupTransports[1].ClientRTCPPort == 5001);
+
+	// interleaved on the RTSP connection
+	FTestSessionHost TcpHost;
+	FRTSPSession TcpSession(TcpHost, 43);
+	CHECK(Handle(TcpSession, Request("SETUP", 3, "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n")) == ERTSPMethod::Setup);
+	CHECK(TcpHost.SetupTransports.size() == 1 && TcpHost.SetupTransports[0].bTCP);
+	CHECK(TcpSession.GetState() == FRTSPSession::EState::Ready);
+	CHECK(Contains(TcpHost.LastResponse(), "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n"));
+
+	// a transport the host couldn't bind leaves the session without one
+	FTestSessionHost FailingHost;
+	FailingHost.bSetupSucceeds = false;
+	FRTSPSession FailingSession(FailingHost, 44);
+	CHECK(Handle(FailingSession, Request("SETUP", 3, UdpTransport)) == ERTSPMethod::Setup);
+	CHECK(FailingSession.GetState() == FRTSPSession::EState::Init);
+	CHECK(Handle(FailingSession, Request("PLAY", 4)) == ERTSPMethod::Play);
+	CHECK(FailingHost.PlayingCalls.empty());
+}
+
+void TestSessionParameters()
+{
+	FTestSessionHost Host;
+	FRTSPSession Session(Host, 7);
+
+	// URL parameters apply to any request carrying them
+	CHECK(Handle(Session, Request("DESCRIBE", 2, "", "stream/1?rendition=720p&priority=operator")) == ERTSPMethod::Describe);
+	CHECK(Host.Parameters["rendition"] == "720p");
+	CHECK(Host.Parameters["priority"] == "operator");
+	CHECK(Host.DescribedPaths.size() == 1 && Host.DescribedPaths[0] == "stream/1");
+
+	// GET_PARAMETER is a keepalive
+	CHECK(Handle(Session, Request("GET_PARAMETER", 3)) == ERTSPMethod::GetParameter);
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 200 OK\r\nCSeq: 3\r\n"));
+	CHECK(Contains(Host.LastResponse(), "Session: 7;timeout=60\r\n"));
+
+	const std::string Body = "bitrate: 4000\r\nrendition: 360p\r\n";
+	CHECK(Handle(Session, Request("SET_PARAMETER", 4, "Content-Type: text/parameters\r\nContent-Length: 32\r\n") + Body) == ERTSPMethod::SetParameter);
+	CHECK(Host.Parameters["bitrate"] == "4000");
+	CHECK(Host.Parameters["rendition"] == "360p");
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 200 OK\r\nCSeq: 4\r\n"));
+
+	// one unknown parameter fails the request, the others still apply
+	const std::string UnknownBody = "bitrate: 2000\r\ncolor: blue\r\n";
+	CHECK(Handle(Session, Request("SET_PARAMETER", 5, "Content-Length: 28\r\n") + UnknownBody) == ERTSPMethod::SetParameter);
+	CHECK(Host.Parameters["bitrate"] == "2000");
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 451 Parameter Not Understood\r\nCSeq: 5\r\n"));
+}
+
+// value of an SDP attribute parameter, e.g. "sprop-vps" of the fmtp line, empty if there is none
+static std::string GetFmtpParameter(const std::string& SDP, const char* Name)
+{
+	const size_t Fmtp = SDP.find("a=fmtp:96 ");
+	if (Fmtp == std::string::npos)
+	{
+		return std::string();
+	}
+	const std::string Line = SDP.substr(Fmtp, SDP.find("\r\n", Fmtp) - Fmtp);
+	const std::string Key = std::string(Name) + "=";
+	size_t Start = Line.find(Key);
+	while (Start != std::string::npos && Line[Start - 1] != ';' && Line[Start - 1] != ' ')
+	{
+		Start = Line.find(Key, Start + 1);
+	}
+	if (Start == std::string::npos)
+	{
+		return std::string();
+	}
+	Start += Key.size();
+	return Line.substr(Start, Line.find(';', Start) - Start);
+}
+
+static std::vector<uint8> MakeNal(std::initializer_list<uint8> Bytes)
+{
+	std::vector<uint8> Nal(4 + Bytes.size());
+	Nal[3] = 1;
+	std::copy(Bytes.begin(), Bytes.end(), Nal.begin() + 4);
+	return Nal;
+}
+
+void TestSessionDescribe()
+{
+	FTestSessionHost Host;
+	FRTSPStreamDescription H264;
+	H264.Codec = EVideoCodec::H264;
+	Host.Streams["stream/1"] = H264;
+
+	// a High profile level 4.0 SPS and a PPS, after an access unit delimiter
+	for (const std::vector<uint8>& Nal : { MakeNal({ 0x09, 0xF0 }), MakeNal({ 0x67, 0x64, 0x00, 0x28, 0xAC }), MakeNal({ 0x68, 0xEE, 0x3C, 0x80 }) })
+	{
+		H264.ParameterSets.insert(H264.ParameterSets.end(), Nal.begin(), Nal.end());
+	}
+	Host.Streams["stream/avc"] = H264;
+
+	// the H.265 parameter sets, 2 byte NAL headers of types 32, 33 and 34
+	FRTSPStreamDescription Hevc;
+	Hevc.Codec = EVideoCodec::H265;
+	for (const std::vector<uint8>& Nal : { MakeNal({ 0x40, 0x01, 0x0C }), MakeNal({ 0x42, 0x01, 0x01, 0x60 }), MakeNal({ 0x44, 0x01, 0xC1 }) })
+	{
+		Hevc.ParameterSets.insert(Hevc.ParameterSets.end(), Nal.begin(), Nal.end());
+	}
+	Host.Streams["stream/hevc"] = Hevc;
+
+	FRTSPStreamDescription Main10 = Hevc;
+	Main10.Codec = EVideoCodec::H265Main10;
+	Host.Streams["stream/hevc10"] = Main10;
+
+	FRTSPSession Session(Host, 1);
+	CHECK(Handle(Session, Request("DESCRIBE", 2, "Accept: application/sdp\r\n")) == ERTSPMethod::Describe);
+	const std::string Response = Host.LastResponse();
+	CHECK(StartsWith(Response, "RTSP/1.0 200 OK\r\nCSeq: 2\r\n"));
+	CHECK(Contains(Response, "Content-Type: application/sdp\r\n"));
+	CHECK(Contains(Response, "Content-Base: RTSP://10.0.0.1:8554/stream/1/\r\n"));
+
+	// Content-Length is the size of the SDP after the headers
+	const size_t HeaderEnd = Response.find("\r\n\r\n");
+	CHECK(HeaderEnd != std::string::npos);
+	const std::string SDP = Response.substr(HeaderEnd + 4);
+	const size_t LengthStart = Response.find("Content-Length: ");
+	CHECK(LengthStart != std::string::npos && std::stoul(Response.substr(LengthStart + 16)) == SDP.size());
+
+	CHECK(StartsWith(SDP, "v=0\r\n"));
+	CHECK(Contains(SDP, " IN IP4 10.0.0.1\r\n"));
+	CHECK(Contains(SDP, "m=video 0 RTP/AVP 96\r\n"));
+	CHECK(Contains(SDP, "a=rtpmap:96 H264/90000\r\n"));
+	CHECK(GetFmtpParameter(SDP, "packetization-mode") == "1");
+	CHECK(GetFmtpParameter(SDP, "profile-level-id") == "42e033");
+	CHECK(GetFmtpParameter(SDP, "sprop-parameter-sets").empty());
+	CHECK(SDP.size() >= 2 && SDP.compare(SDP.size() - 2, 2, "\r\n") == 0);
+	CHECK(Session.GetState() == FRTSPSession::EState::Init);
+
+	// the parameter sets of the last IDR frame, SPS first, and the profile and level of the SPS
+	CHECK(Handle(Session, Request("DESCRIBE", 3, "", "stream/avc")) == ERTSPMethod::Describe);
+	const std::string AvcSDP = Host.LastResponse();
+	CHECK(Contains(AvcSDP, "a=rtpmap:96 H264/90000\r\n"));
+	CHECK(GetFmtpParameter(AvcSDP, "packetization-mode") == "1");
+	CHECK(GetFmtpParameter(AvcSDP, "profile-level-id") == "640028");
+	CHECK(GetFmtpParameter(AvcSDP, "sprop-parameter-sets") == "Z2QAKKw=,aO48gA==");
+
+	CHECK(Handle(Session, Request("DESCRIBE", 3, "", "stream/hevc")) == ERTSPMethod::Describe);
+	const std::string HevcSDP = Host.LastResponse();
+	CHECK(Contains(HevcSDP, "a=rtpmap:96 H265/90000\r\n"));
+	CHECK(GetFmtpParameter(HevcSDP, "profile-id") == "1");
+	CHECK(GetFmtpParameter(HevcSDP, "sprop-vps") == "QAEM");
+	CHECK(GetFmtpParameter(HevcSDP, "sprop-sps") == "QgEBYA==");
+	CHECK(GetFmtpParameter(HevcSDP, "sprop-pps") == "RAHB");
+
+	CHECK(Handle(Session, Request("DESCRIBE", 4, "", "stream/hevc10")) == ERTSPMethod::Describe);
+	CHECK(GetFmtpParameter(Host.LastResponse(), "profile-id") == "2");
+
+	// an H.265 stream without parameter sets yet
+	Hevc.ParameterSets.clear();
+	Host.Streams["stream/hevc"] = Hevc;
+	CHECK(Handle(Session, Request("DESCRIBE", 5, "", "stream/hevc")) == ERTSPMethod::Describe);
+	CHECK(GetFmtpParameter(Host.LastResponse(), "sprop-vps").empty());
+	CHECK(GetFmtpParameter(Host.LastResponse(), "profile-id") == "1");
+
+	CHECK(Handle(Session, Request("DESCRIBE", 6, "", "stream/none")) == ERTSPMethod::Describe);
+	CHECK(StartsWith(Host.LastResponse(), "RTSP/1.0 404 Stream Not Found\r\nCSeq: 6\r\n"));
+}
+
+#endif
@@ -0,0 +1,156 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+// FTimerWheel deadlines across its level boundaries, cancelling with stale ids and the order timers fire in
+
+// UBT compiles every source of the module, the tests are only meant for the CMake build
+#if defined(RTSP_CORE_STANDALONE)
+
+#include "RTSPCoreTests.h"
+#include "TimerWheel.h"
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+// runs the callbacks Advance() moved out, in the order it moved them
+static void AdvanceAndFire(FTimerWheel& Wheel, uint64 NowMs)
+{
+	std::vector<FTimerWheel::FCallback> Expired;
+	Wheel.Advance(NowMs, Expired);
+	for (FTimerWheel::FCallback& Callback : Expired)
+	{
+		Callback();
+	}
+}
+
+void TestTimerWheelLevels()
+{
+	// each level holds 256 times the ticks of the one below, a deadline just past a level's reach goes to the next one
+	// and comes down again as the wheel turns. The start ticks put the current tick at and around slot boundaries
+	const uint64 Deltas[] = { 1, 2, 255, 256, 257, 511, 512, 65535, 65536, 65537, 65791, 16777215, 16777216, 16777217 };
+	const uint64 Starts[] = { 0, 10, 255, 256, 300, 65535, 65536, 65800, 16777000, (1ull << 40) + 123 };
+	for (const uint64 Start : Starts)
+	{
+		FTimerWheel Wheel(Start);
+		std::vector<uint64> Deadlines;
+		std::vector<uint64> Fired;
+		for (const uint64 Delta : Deltas)
+		{
+			const uint64 Deadline = Start + Delta;
+			Deadlines.push_back(Deadline);
+			Wheel.Add(Deadline, [&Fired, Deadline]() { Fired.push_back(Deadline); });
+		}
+		CHECK(Wheel.Num() == static_cast<int32>(Deadlines.size()));
+
+		// nothing fires a tick early, everything fires at its tick, and the owner is never told to sleep past it
+		uint64 Now = Start;
+		for (uint32 Index = 0; Index < Deadlines.size(); ++Index)
+		{
+			const uint64 Deadline = Deadlines[Index];
+			CHECK(static_cast<uint64>(Wheel.GetTimeoutMs(Now, INT_MAX)) <= Deadline - Now);
+			AdvanceAndFire(Wheel, Deadline - 1);
+			CHECK(Fired.size() == Index);
+			AdvanceAndFire(Wheel, Deadline);
+			CHECK(Fired.size() == Index + 1 && Fired.back() == Deadline);
+			Now = Deadline;
+		}
+		CHECK(Wheel.Num() == 0);
+	}
+
+	// past deadlines fire on the next tick
+	FTimerWheel Wheel(1000);
+	int32 Fired = 0;
+	Wheel.Add(10, [&Fired]() { Fired++; });
+	Wheel.Add(1000, [&Fired]() { Fired++; });
+	AdvanceAndFire(Wheel, 1000);
+	CHECK(Fired == 0);
+	AdvanceAndFire(Wheel, 1001);
+	CHECK(Fired == 2);
+
+	// a deadline beyond the 2^32 ticks of the wheel is kept in the top level, the owner still wakes up when level 0
+	// wraps to move timers down
+	const FTimerWheel::FTimerId Far = Wheel.Add(1001 + (1ull << 40), [&Fired]() { Fired++; });
+	CHECK(Wheel.GetTimeoutMs(1001, 5000) == 1024 - 1001);
+	AdvanceAndFire(Wheel, 1001 + 70000);
+	CHECK(Fired == 2 && Wheel.Num() == 1);
+	CHECK(Wheel.Cancel(Far));
+}
+
+void TestTimerWheelStaleCancel()
+{
+	FTimerWheel Wheel(0);
+	int32 FiredFirst = 0;
+	int32 FiredSecond = 0;
+
+	CHECK(!Wheel.Cancel(0));
+	CHECK(!Wheel.Cancel(12345));
+
+	// a cancelled timer's node is reused by the next one, its id must not cancel the new timer
+	const FTimerWheel::FTimerId Cancelled = Wheel.Add(100, [&FiredFirst]() { FiredFirst++; });
+	CHECK(Cancelled != 0);
+	CHECK(Wheel.Cancel(Cancelled));
+	CHECK(!Wheel.Cancel(Cancelled));
+	const FTimerWheel::FTimerId Reused = Wheel.Add(100, [&FiredSecond]() { FiredSecond++; });
+	CHECK(Reused != Cancelled && (Reused & UINT32_MAX) == (Cancelled & UINT32_MAX));
+	CHECK(!Wheel.Cancel(Cancelled));
+	CHECK(Wheel.Num() == 1);
+	AdvanceAndFire(Wheel, 100);
+	CHECK(FiredFirst == 0 && FiredSecond == 1);
+
+	// the same for a node freed by firing, on a timer in a higher level
+	const FTimerWheel::FTimerId AfterFiring = Wheel.Add(70000, [&FiredFirst]() { FiredFirst++; });
+	CHECK((AfterFiring & UINT32_MAX) == (Reused & UINT32_MAX));
+	CHECK(!Wheel.Cancel(Reused));
+	CHECK(Wheel.Num() == 1);
+	CHECK(Wheel.Cancel(AfterFiring));
+	CHECK(Wheel.Num() == 0);
+	AdvanceAndFire(Wheel, 80000);
+	CHECK(FiredFirst == 0);
+
+	// cancelling one timer of a slot leaves the others linked
+	int32 Fired[3] = {};
+	FTimerWheel::FTimerId Ids[3];
+	for (int32 Index = 0; Index < 3; ++Index)
+	{
+		Ids[Index] = Wheel.Add(80500, [&Fired, Index]() { Fired[Index]++; });
+	}
+	CHECK(Wheel.Cancel(Ids[1]));
+	AdvanceAndFire(Wheel, 80500);
+	CHECK(Fired[0] == 1 && Fired[1] == 0 && Fired[2] == 1);
+	for (const FTimerWheel::FTimerId Id : Ids)
+	{
+		CHECK(!Wheel.Cancel(Id));
+	}
+}
+
+void TestTimerWheelOrder()
+{
+	// deadlines spread over the first three levels, some of them cancelled, then one long Advance()
+	const uint64 Start = 5000;
+	const int32 NumTimers = 5000;
+	FTimerWheel Wheel(Start);
+	std::vector<uint64> Fired;
+	std::vector<uint64> Expected;
+	uint32 Random = 12345;
+	for (int32 Index = 0; Index < NumTimers; ++Index)
+	{
+		Random = Random * 1664525 + 1013904223;
+		const uint64 Deadline = Start + 1 + (Random >> 8) % (Index % 2 ? 70000 : 20000000);
+		const FTimerWheel::FTimerId Id = Wheel.Add(Deadline, [&Fired, Deadline]() { Fired.push_back(Deadline); });
+		if (Index % 7 == 0)
+		{
+			CHECK(Wheel.Cancel(Id));
+		}
+		else
+		{
+			Expected.push_back(Deadline);
+		}
+	}
+	CHECK(Wheel.Num() == static_cast<int32>(Expected.size()));
+
+	std::sort(Expected.begin(), Expected.end());
+	AdvanceAndFire(Wheel, Expected.back());
+	CHECK(Fired == Expected);
+	CHECK(Wheel.Num() == 0);
+}
+
+#endif
@@ -0,0 +1,196 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "TimerWheel.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+FTimerWheel::FTimerWheel(uint64 NowMs)
+	: FreeList(INDEX_NONE)
+	, CurrentTick(NowMs)
+	, NumTimers(0)
+{
+	for (int32& Head : SlotHeads)
+	{
+		Head = INDEX_NONE;
+	}
+}
+
+uint64 FTimerWheel::GetTimeMs()
+{
+	return static_cast<uint64>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+FTimerWheel::FTimerId FTimerWheel::Add(uint64 DeadlineMs, FCallback&& Callback)
+{
+	int32 Index = FreeList;
+	if (Index != INDEX_NONE)
+	{
+		FreeList = Nodes[Index].Next;
+	}
+	else
+	{
+		Index = static_cast<int32>(Nodes.size());
+		Nodes.emplace_back();
+	}
+
+	//the top level reaches 2^32 ticks ahead, later deadlines fire at its end
+	FNode& Node = Nodes[Index];
+	Node.Callback = std::move(Callback);
+	Node.Deadline = std::min(std::max(DeadlineMs, CurrentTick + 1), CurrentTick + UINT32_MAX);
+	Link(Index);
+	NumTimers++;
+
+	return (static_cast<uint64>(Node.Generation) << 32) | static_cast<uint32>(Index + 1);
+}
+
+bool FTimerWheel::Cancel(FTimerId Id)
+{
+	const int32 Index = static_cast<int32>(Id & UINT32_MAX) - 1;
+	if (Index < 0 || Index >= static_cast<int32>(Nodes.size()))
+	{
+		return false;
+	}
+
+	FNode& Node = Nodes[Index];
+	if (Node.Slot == INDEX_NONE || Node.Generation != static_cast<uint32>(Id >> 32))
+	{
+		return false;
+	}
+
+	Unlink(Index);
+	Node.Callback = nullptr;
+	Release(Index);
+	NumTimers--;
+	return true;
+}
+
+void FTimerWheel::Advance(uint64 NowMs, std::vector<FCallback>& OutExpired)
+{
+	//nothing to walk, idle wheels catch up in one step
+	if (NumTimers == 0)
+	{
+		CurrentTick = std::max(CurrentTick, NowMs);
+		return;
+	}
+
+	while (CurrentTick < NowMs)
+	{
+		CurrentTick++;
+		const int32 Slot = CurrentTick & SlotMask;
+		if (Slot == 0)
+		{
+			Cascade(1);
+		}
+
+		//every node left in a level 0 slot is due at this tick
+		for (int32 Index = SlotHeads[Slot]; Index != INDEX_NONE; )
+		{
+			FNode& Node = Nodes[Index];
+			const int32 Next = Node.Next;
+			OutExpired.push_back(std::move(Node.Callback));
+			Node.Callback = nullptr;
+			Release(Index);
+			NumTimers--;
+			Index = Next;
+		}
+		SlotHeads[Slot] = INDEX_NONE;
+
+		if (NumTimers == 0)
+		{
+			CurrentTick = NowMs;
+		}
+	}
+}
+
+int32 FTimerWheel::GetTimeoutMs(uint64 NowMs, int32 MaxTimeoutMs) const
+{
+	if (NumTimers == 0)
+	{
+		return MaxTimeoutMs;
+	}
+
+	//level 0 holds everything due within the next 256 ticks, higher levels only move down when it wraps
+	uint64 NextTick = (CurrentTick | SlotMask) + 1;
+	for (uint64 Tick = CurrentTick + 1; Tick <= CurrentTick + NumSlots; ++Tick)
+	{
+		if (SlotHeads[Tick & SlotMask] != INDEX_NONE)
+		{
+			NextTick = Tick;
+			break;
+		}
+	}
+
+	return NextTick <= NowMs ? 0 : static_cast<int32>(std::min<uint64>(NextTick - NowMs, MaxTimeoutMs));
+}
+
+void FTimerWheel::Link(int32 Index)
+{
+	FNode& Node = Nodes[Index];
+
+	//the lowest level whose range covers the deadline, nodes due this tick go to the level 0 slot about to expire
+	const uint64 Delta = Node.Deadline - CurrentTick;
+	int32 Level = 0;
+	while (Level < NumLevels - 1 && Delta >= (1ull << (SlotBits * (Level + 1))))
+	{
+		Level++;
+	}
+
+	const int32 Slot = Level * NumSlots + static_cast<int32>((Node.Deadline >> (SlotBits * Level)) & SlotMask);
+	Node.Slot = Slot;
+	Node.Prev = INDEX_NONE;
+	Node.Next = SlotHeads[Slot];
+	if (Node.Next != INDEX_NONE)
+	{
+		Nodes[Node.Next].Prev = Index;
+	}
+	SlotHeads[Slot] = Index;
+}
+
+void FTimerWheel::Unlink(int32 Index)
+{
+	FNode& Node = Nodes[Index];
+	if (Node.Prev != INDEX_NONE)
+	{
+		Nodes[Node.Prev].Next = Node.Next;
+	}
+	else
+	{
+		SlotHeads[Node.Slot] = Node.Next;
+	}
+	if (Node.Next != INDEX_NONE)
+	{
+		Nodes[Node.Next].Prev = Node.Prev;
+	}
+}
+
+void FTimerWheel::Release(int32 Index)
+{
+	FNode& Node = Nodes[Index];
+	Node.Slot = INDEX_NONE;
+	Node.Prev = INDEX_NONE;
+	Node.Generation++;
+	Node.Next = FreeList;
+	FreeList = Index;
+}
+
+void FTimerWheel::Cascade(int32 Level)
+{
+	const int32 Slot = static_cast<int32>((CurrentTick >> (SlotBits * Level)) & SlotMask);
+
+	//the level above wrapped as well, its timers may belong in the slot redistributed here
+	if (Slot == 0 && Level + 1 < NumLevels)
+	{
+		Cascade(Level + 1);
+	}
+
+	const int32 Head = Level * NumSlots + Slot;
+	int32 Index = SlotHeads[Head];
+	SlotHeads[Head] = INDEX_NONE;
+	while (Index != INDEX_NONE)
+	{
+		const int32 Next = Nodes[Index].Next;
+		Link(Index);
+		Index = Next;
+	}
+}
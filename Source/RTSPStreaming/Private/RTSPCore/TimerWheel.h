@@ -0,0 +1,61 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+#include <functional>
+#include <vector>
+
+// hashed hierarchical timing wheel with 1 ms ticks, for keepalives, RTCP intervals, pacing deadlines and the like
+// - 4 levels of 256 slots cover 2^32 ms, level N holds timers due within 256^(N+1) ticks of the current tick
+// - a slot is an intrusive doubly linked list of nodes in one array, so Add() and Cancel() are O(1) and
+//   don't allocate once the node array has grown to the peak number of timers
+// - Advance() walks the elapsed ticks, timers of a higher level are redistributed when the level below wraps
+// not thread safe, the owner serialises access and drives Advance() from its network thread's poll timeout
+class FTimerWheel final
+{
+public:
+	using FTimerId = uint64;						// 0 is never a valid timer
+	using FCallback = std::function<void()>;
+
+	explicit FTimerWheel(uint64 NowMs);
+
+	static uint64 GetTimeMs();						// monotonic clock timers are scheduled on
+
+	FTimerId Add(uint64 DeadlineMs, FCallback&& Callback);		// deadlines in the past fire on the next tick
+	bool Cancel(FTimerId Id);									// false if the timer fired or was cancelled already
+	void Advance(uint64 NowMs, std::vector<FCallback>& OutExpired);	// moves callbacks of the timers due by NowMs out, in deadline order
+	int32 GetTimeoutMs(uint64 NowMs, int32 MaxTimeoutMs) const;	// how long the owner can wait before calling Advance() again
+
+	int32 Num() const
+	{
+		return NumTimers;
+	}
+
+private:
+	static const int32 NumLevels = 4;
+	static const int32 SlotBits = 8;
+	static const int32 NumSlots = 1 << SlotBits;
+	static const uint32 SlotMask = NumSlots - 1;
+
+	struct FNode
+	{
+		FCallback	Callback;
+		uint64		Deadline = 0;
+		int32		Prev = INDEX_NONE;
+		int32		Next = INDEX_NONE;
+		int32		Slot = INDEX_NONE;		// index into SlotHeads, INDEX_NONE while on the free list
+		uint32		Generation = 0;			// bumped on every reuse so stale ids don't cancel a new timer
+	};
+
+	void Link(int32 Index);					// puts a node into the slot of its deadline
+	void Unlink(int32 Index);
+	void Release(int32 Index);				// returns a node to the free list
+	void Cascade(int32 Level);				// redistributes the slot of Level the current tick has reached
+
+	std::vector<FNode>	Nodes;
+	int32			SlotHeads[NumLevels * NumSlots];
+	int32			FreeList;				// first free node, linked through Next
+	uint64			CurrentTick;			// all timers due at or before this tick have fired
+	int32			NumTimers;
+};
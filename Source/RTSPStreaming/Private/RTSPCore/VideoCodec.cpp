@@ -0,0 +1,25 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "VideoCodec.h"
+#include "RTSPStringUtils.h"
+
+static const char* const CodecNames[(uint8)EVideoCodec::Num] = { "h264", "hevc", "hevc10" };
+static const char* const CodecAliases[(uint8)EVideoCodec::Num] = { "avc", "h265", "h265main10" };
+
+bool ParseVideoCodec(const char* Name, EVideoCodec& OutCodec)
+{
+	for (uint8 Codec = 0; Codec < (uint8)EVideoCodec::Num; ++Codec)
+	{
+		if (EqualsIgnoreCase(Name, CodecNames[Codec]) || EqualsIgnoreCase(Name, CodecAliases[Codec]))
+		{
+			OutCodec = (EVideoCodec)Codec;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* VideoCodecToString(EVideoCodec Codec)
+{
+	return Codec < EVideoCodec::Num ? CodecNames[(uint8)Codec] : CodecNames[(uint8)EVideoCodec::H264];
+}
@@ -0,0 +1,36 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "RTSPCoreTypes.h"
+
+// codecs a stream can be encoded and packetized with
+enum class EVideoCodec : uint8
+{
+	H264,				// Baseline profile, RFC 6184
+	H265,				// HEVC Main profile, RFC 7798
+	H265Main10,			// HEVC Main10 profile, keeps the precision of the 10 bit encoder input
+	Num
+};
+
+// parses "h264" (or "avc"), "hevc" (or "h265") or "hevc10" (or "h265main10"), case insensitive. Returns false if the name is unknown
+bool ParseVideoCodec(const char* Name, EVideoCodec& OutCodec);
+const char* VideoCodecToString(EVideoCodec Codec);
+
+inline bool IsH265(EVideoCodec Codec)
+{
+	return Codec == EVideoCodec::H265 || Codec == EVideoCodec::H265Main10;
+}
+
+// NAL unit types the core looks at
+#define H264_NAL_SPS		7
+#define H264_NAL_PPS		8
+#define H265_NAL_VPS		32
+#define H265_NAL_SPS		33
+#define H265_NAL_PPS		34
+
+// type of a NAL unit from its header, H.264 has a 1 byte header and H.265 a 2 byte one
+inline uint8 GetNalType(EVideoCodec Codec, const uint8* Nal)
+{
+	return IsH265(Codec) ? (Nal[0] >> 1) & 0x3F : Nal[0] & 0x1F;
+}
@@ -8,6 +8,9 @@
 #include "Engine/GameViewportClient.h"
 #include "Slate/SceneViewport.h"
 #include "Controller.h"
+#include "NvVideoEncoder.h"
+#include "ReplayVideoEncoder.h"
+#include "SoftwareVideoEncoder.h"
 #include "RenderingThread.h"
 #include "RendererInterface.h"
 #include "Rendering/SlateRenderer.h"
@@ -30,17 +33,28 @@ void FRTSPStreamingModule::StartupModule()
 		return;
 	}
 
+	//a recorded stream can be replayed instead of encoding, which needs neither D3D11 nor an NVIDIA GPU
+	FParse::Value(FCommandLine::Get(), TEXT("RTSPStreamingReplay="), ReplayFilename);
+
+	//the software encoder reads back through the RHI, so it works on any RHI
+	bSoftwareEncoderOnly = WITH_OPENH264 && FParse::Param(FCommandLine::Get(), TEXT("RTSPStreamingSoftwareEncoder"));
+
 	// detect hardware capabilities, init nvidia capture libs, etc
 	check(GDynamicRHI);
 	void* Device = GDynamicRHI->RHIGetNativeDevice();
 	// During cooking RHI device is invalid, skip error logging in this case as it causes the build to fail.
-	if (Device)
+	if (Device && ReplayFilename.IsEmpty() && !bSoftwareEncoderOnly)
 	{
 		FString RHIName = GDynamicRHI->GetName();
 		if (RHIName != TEXT("D3D11"))
 		{
+#if WITH_OPENH264
+			UE_LOG(RTSPStreaming, Warning, TEXT("NVENC needs DX11, RTSP Streaming uses the software encoder on %s"), *RHIName);
+			bSoftwareEncoderOnly = true;
+#else
 			UE_LOG(RTSPStreaming, Error, TEXT("Failed to initialise RTSP Streaming plugin because it only supports DX11"));
 			return;
+#endif
 		}
 	}
 
@@ -84,7 +98,28 @@ void FRTSPStreamingModule::OnBackBufferReady_RenderThread(SWindow& SlateWindow,
 		FParse::Value(FCommandLine::Get(), TEXT("RTSPStreamingPort="), ServerPort);
 
 		//creates new controller
-		Controller = MakeUnique<FController>(*ServerIP, ServerPort, BackBuffer);
+		FVideoEncoderFactory VideoEncoderFactory = &FNvVideoEncoder::Create;
+		FVideoEncoderFactory FallbackVideoEncoderFactory;
+#if WITH_OPENH264
+		if (bSoftwareEncoderOnly)
+		{
+			VideoEncoderFactory = &FSoftwareVideoEncoder::Create;
+		}
+		else
+		{
+			FallbackVideoEncoderFactory = &FSoftwareVideoEncoder::Create;
+		}
+#endif
+		if (!ReplayFilename.IsEmpty())
+		{
+			const FString Filename = ReplayFilename;
+			VideoEncoderFactory = [Filename](const FVideoEncoderSettings& Settings, const IVideoEncoder::FEncodedFrameReadyCallback& Callback) -> TUniquePtr<IVideoEncoder>
+			{
+				return MakeUnique<FReplayVideoEncoder>(Filename, Settings, Callback);
+			};
+			FallbackVideoEncoderFactory = FVideoEncoderFactory();
+		}
+		Controller = MakeUnique<FController>(*ServerIP, ServerPort, BackBuffer, VideoEncoderFactory, FallbackVideoEncoderFactory);
 	}
 
 	//passes buffer to controller
@@ -0,0 +1,203 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "ReplayVideoEncoder.h"
+#include "RTSPStreamingCommon.h"
+#include "RTSPCore/RTPPacketizer.h"
+#include "Utils.h"
+#include "HAL/PlatformFilemanager.h"
+#include "HAL/PlatformProcess.h"
+#include "Async/MappedFileHandle.h"
+
+#define H264_NAL_SLICE		1		// coded slice of a non-IDR picture
+#define H264_NAL_IDR		5		// coded slice of an IDR picture
+#define H264_NAL_SEI		6
+#define H264_NAL_AUD		9		// access unit delimiter
+
+// access units waiting for the delivery thread, captures are skipped beyond this rather than queueing without bound
+static const int32 MaxQueuedFrames = 8;
+
+FReplayVideoEncoder::FReplayVideoEncoder(const FString& InFilename, const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
+	: Filename(InFilename)
+	, Codec(InSettings.Codec)
+	, EncodedFrameReadyCallback(InEncodedFrameReadyCallback)
+	, FirstIdr(INDEX_NONE)
+	, NextAccessUnit(0)
+	, bForceIdrFrame(false)
+	, bResourcesInitialized(false)
+	, EncodedFramePool(16)
+	, FrameQueuedEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, bExitRequested(false)
+{}
+
+FReplayVideoEncoder::~FReplayVideoEncoder()
+{
+	if (DeliveryThread)
+	{
+		bExitRequested = true;
+		FrameQueuedEvent->Trigger();
+		DeliveryThread->Join();
+		DeliveryThread.Reset();
+	}
+	FPlatformProcess::ReturnSynchEventToPool(FrameQueuedEvent);
+
+	MappedRegion.Reset();
+	MappedFile.Reset();
+}
+
+bool FReplayVideoEncoder::Initialize()
+{
+	if (Codec != EVideoCodec::H264)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Replay files are H.264 only, can't replay %s"), ANSI_TO_TCHAR(VideoCodecToString(Codec)));
+		return false;
+	}
+
+	MappedFile.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Filename));
+	if (!MappedFile)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Failed to map replay file %s"), *Filename);
+		return false;
+	}
+
+	// the NAL scanner works on 32 bit sizes
+	const int64 FileSize = MappedFile->GetFileSize();
+	if (FileSize < 4 || FileSize > MAX_uint32)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Replay file %s has an unsupported size of %lld bytes"), *Filename, FileSize);
+		return false;
+	}
+
+	MappedRegion.Reset(MappedFile->MapRegion(0, FileSize));
+	const uint8* Data = MappedRegion ? MappedRegion->GetMappedPtr() : nullptr;
+	if (!Data || Data[0] != 0 || Data[1] != 0 || !(Data[2] == 1 || (Data[2] == 0 && Data[3] == 1)))
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Replay file %s is not an H.264 Annex-B elementary stream"), *Filename);
+		return false;
+	}
+
+	IndexAccessUnits(Data, FileSize);
+	FirstIdr = AccessUnits.IndexOfByPredicate([](const FAccessUnit& AccessUnit) { return AccessUnit.bIdr; });
+	if (FirstIdr == INDEX_NONE)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Replay file %s has no IDR frame"), *Filename);
+		return false;
+	}
+
+	NextAccessUnit = FirstIdr;
+	UE_LOG(RTSPStreaming, Log, TEXT("Replaying %s, %d access units"), *Filename, AccessUnits.Num());
+	return true;
+}
+
+void FReplayVideoEncoder::IndexAccessUnits(const uint8* Data, uint64 Size)
+{
+	TArray<uint8> Sps;
+	TArray<uint8> Pps;
+	bool bHasVcl = false;
+
+	ForEachAnnexBNal(Data, static_cast<uint32>(Size), [this, Data, &Sps, &Pps, &bHasVcl](const uint8* Nal, uint32 NalSize)
+	{
+		if (!NalSize)
+		{
+			return;
+		}
+
+		// an access unit ends before the first non-VCL NAL or the first slice of the next picture (first_mb_in_slice is 0)
+		const uint8 Type = Nal[0] & 0x1F;
+		const bool bVcl = Type >= H264_NAL_SLICE && Type <= H264_NAL_IDR;
+		const bool bFirstSlice = bVcl && NalSize > 1 && (Nal[1] & 0x80);
+		const bool bPrefix = (Type >= H264_NAL_SEI && Type <= H264_NAL_AUD) || (Type >= 14 && Type <= 18);
+		if (!AccessUnits.Num() || (bHasVcl && (bFirstSlice || bPrefix)))
+		{
+			const uint8* StartCode = Nal - 3;
+			if (StartCode > Data && StartCode[-1] == 0)
+			{
+				StartCode--;
+			}
+
+			const uint64 Offset = StartCode - Data;
+			if (AccessUnits.Num())
+			{
+				AccessUnits.Last().Size = static_cast<uint32>(Offset - AccessUnits.Last().Offset);
+			}
+			AccessUnits.Add({ Offset, 0, false });
+			bHasVcl = false;
+		}
+
+		bHasVcl |= bVcl;
+		AccessUnits.Last().bIdr |= Type == H264_NAL_IDR;
+
+		// the first parameter sets are what a client needs to start decoding
+		TArray<uint8>* ParameterSet = Type == H264_NAL_SPS ? &Sps : Type == H264_NAL_PPS ? &Pps : nullptr;
+		if (ParameterSet && !ParameterSet->Num())
+		{
+			static const uint8 StartCodePrefix[] = { 0, 0, 0, 1 };
+			ParameterSet->Append(StartCodePrefix, sizeof(StartCodePrefix));
+			ParameterSet->Append(Nal, NalSize);
+		}
+	});
+
+	if (AccessUnits.Num())
+	{
+		AccessUnits.Last().Size = static_cast<uint32>(Size - AccessUnits.Last().Offset);
+	}
+
+	SpsPpsHeader = MoveTemp(Sps);
+	SpsPpsHeader.Append(Pps);
+}
+
+void FReplayVideoEncoder::InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer)
+{
+	if (!DeliveryThread)
+	{
+		DeliveryThread = MakeUnique<FThread>(TEXT("RTSPStreaming Replay Send"), [this]() { DeliveryLoop(); }, FThreadSettings::FromConsoleVariables(TEXT("Encoder.CompletionThread")));
+	}
+	bResourcesInitialized = true;
+}
+
+void FReplayVideoEncoder::EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp)
+{
+	// the file isn't skipped ahead when the delivery thread falls behind, the stream just runs slower
+	if (QueuedFrames.GetValue() >= MaxQueuedFrames)
+	{
+		return;
+	}
+
+	if (bForceIdrFrame)
+	{
+		bForceIdrFrame = false;
+		while (!AccessUnits[NextAccessUnit].bIdr)
+		{
+			NextAccessUnit = NextAccessUnit + 1 < AccessUnits.Num() ? NextAccessUnit + 1 : FirstIdr;
+		}
+	}
+
+	QueuedFrames.Increment();
+	PendingFrames.Enqueue({ NextAccessUnit, Timestamp });
+	FrameQueuedEvent->Trigger();
+
+	// loops from the first IDR, the access units before it can't be decoded on their own
+	NextAccessUnit = NextAccessUnit + 1 < AccessUnits.Num() ? NextAccessUnit + 1 : FirstIdr;
+}
+
+void FReplayVideoEncoder::DeliveryLoop()
+{
+	const uint8* Data = MappedRegion->GetMappedPtr();
+	while (!bExitRequested)
+	{
+		FPendingFrame Frame;
+		while (PendingFrames.Dequeue(Frame))
+		{
+			const FAccessUnit& AccessUnit = AccessUnits[Frame.AccessUnit];
+			FEncodedFramePool::FBufferRef EncodedFrame = EncodedFramePool.Acquire();
+			EncodedFrame->SetNumUninitialized(AccessUnit.Size, false);
+			FMemory::Memcpy(EncodedFrame->GetData(), Data + AccessUnit.Offset, AccessUnit.Size);
+			QueuedFrames.Decrement();
+
+			FEncodedFrameInfo FrameInfo;
+			FrameInfo.Timestamp = Frame.Timestamp;
+			FrameInfo.bKeyframe = AccessUnit.bIdr;
+			EncodedFrameReadyCallback(FrameInfo, EncodedFrame);
+		}
+		FrameQueuedEvent->Wait();
+	}
+}
@@ -0,0 +1,94 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VideoEncoder.h"
+#include "EncodedFramePool.h"
+#include "Containers/Queue.h"
+#include "HAL/ThreadSafeBool.h"
+#include "HAL/ThreadSafeCounter.h"
+
+class FEvent;
+class FThread;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// plays back a recorded H.264 Annex-B elementary stream instead of encoding back buffers, for load testing the
+// server on machines without an NVIDIA GPU. See -RTSPStreamingReplay=
+// - the file is memory mapped and split into access units once, every EncodeFrame() sends the next one with the
+//   capture timestamp, so the stream runs at the capture rate and loops from the first IDR at the end of the file
+// - ForceIdrFrame() skips ahead to the next IDR access unit
+// - access units are copied into pooled buffers and handed to the server on a delivery thread, like encoded frames
+class FReplayVideoEncoder : public IVideoEncoder
+{
+public:
+	FReplayVideoEncoder(const FString& InFilename, const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
+	~FReplayVideoEncoder();
+
+	virtual FString GetName() const override
+	{ return TEXT("Annex-B Replay"); }
+
+	virtual bool IsSupported() const override
+	{ return bResourcesInitialized; }
+
+	/**
+	* Maps the file and indexes its access units.
+	*/
+	virtual bool Initialize() override;
+
+	/**
+	* Starts the delivery thread, no GPU resources are needed.
+	*/
+	virtual void InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer) override;
+
+	virtual const TArray<uint8>& GetSpsPpsHeader() const override
+	{ return SpsPpsHeader; }
+
+	/**
+	* Queues the next access unit of the file, the back buffer is ignored.
+	*/
+	virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp) override;
+
+	virtual void ForceIdrFrame() override
+	{ bForceIdrFrame = true; }
+
+	virtual bool IsAsyncEnabled() const override
+	{ return true; }
+
+private:
+	struct FAccessUnit
+	{
+		uint64	Offset;					// of its first start code in the file
+		uint32	Size;
+		bool	bIdr;
+	};
+
+	struct FPendingFrame
+	{
+		int32	AccessUnit;
+		uint64	Timestamp;
+	};
+
+	void IndexAccessUnits(const uint8* Data, uint64 Size);	// fills AccessUnits and SpsPpsHeader
+	void DeliveryLoop();									// copies queued access units and passes them on
+
+	const FString						Filename;
+	const EVideoCodec					Codec;					// the stream's, only H.264 can be replayed
+	FEncodedFrameReadyCallback			EncodedFrameReadyCallback;
+	TUniquePtr<IMappedFileHandle>		MappedFile;
+	TUniquePtr<IMappedFileRegion>		MappedRegion;			// the whole file, released before MappedFile
+	TArray<FAccessUnit>					AccessUnits;
+	int32								FirstIdr;				// where playback loops back to
+	int32								NextAccessUnit;			// render thread only
+	TArray<uint8>						SpsPpsHeader;			// first SPS and PPS of the file, with start codes
+	FThreadSafeBool						bForceIdrFrame;
+	bool								bResourcesInitialized;
+
+	TQueue<FPendingFrame, EQueueMode::Spsc>	PendingFrames;		// render thread -> delivery thread
+	FThreadSafeCounter					QueuedFrames;			// number of PendingFrames
+	FEncodedFramePool					EncodedFramePool;		// delivery thread only
+	FEvent*								FrameQueuedEvent;
+	FThreadSafeBool						bExitRequested;
+	TUniquePtr<FThread>					DeliveryThread;
+};
@@ -2,18 +2,119 @@
 
 #include "Server.h"
 
+DECLARE_DWORD_COUNTER_STAT(TEXT("EgressBudgetUsage"), STAT_RTSPStreaming_EgressBudgetUsage, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("EgressBudgetCommitted"), STAT_RTSPStreaming_EgressBudgetCommitted, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("AdmittedClients"), STAT_RTSPStreaming_AdmittedClients, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("PlayingClients"), STAT_RTSPStreaming_PlayingClients, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("EgressDroppedFrames"), STAT_RTSPStreaming_EgressDroppedFrames, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_COUNTER_STAT(TEXT("EgressTokens"), STAT_RTSPStreaming_EgressTokens, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("ClientLossReports"), STAT_RTSPStreaming_ClientLossReports, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("ClientPictureLossReports"), STAT_RTSPStreaming_ClientPictureLossReports, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("RenditionSwitches"), STAT_RTSPStreaming_RenditionSwitches, STATGROUP_RTSPStreaming);
+
+static TAutoConsoleVariable<int32> CVarStreamerEgressCapacity(
+	TEXT("Streamer.EgressCapacity"),
+	0,
+	TEXT("Egress link capacity shared by all clients, Kbps. 0 disables egress scheduling"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarStreamerEgressBurstMs(
+	TEXT("Streamer.EgressBurstMs"),
+	100,
+	TEXT("How many ms worth of egress capacity can be saved up for bursts such as keyframes, never less than the largest keyframe"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarStreamerNetworkThreadPriority(
+	TEXT("Streamer.NetworkThreadPriority"),
+	TEXT("Normal"),
+	TEXT("Priority of the listener/network thread and client session threads: Normal, AboveNormal, BelowNormal, Highest, Lowest, SlightlyBelowNormal or TimeCritical. Read when threads start"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarStreamerNetworkThreadAffinity(
+	TEXT("Streamer.NetworkThreadAffinity"),
+	TEXT(""),
+	TEXT("Hex mask of the cores the listener/network thread and client session threads may run on, empty for any. Read when threads start"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarStreamerTimerThreadPriority(
+	TEXT("Streamer.TimerThreadPriority"),
+	TEXT("Normal"),
+	TEXT("Priority of the timer thread of the blocking network backend, see Streamer.NetworkThreadPriority"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarStreamerTimerThreadAffinity(
+	TEXT("Streamer.TimerThreadAffinity"),
+	TEXT(""),
+	TEXT("Hex mask of the cores the timer thread of the blocking network backend may run on, empty for any"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarStreamerAdmissionBudget(
+	TEXT("Streamer.AdmissionBudget"),
+	0,
+	TEXT("Egress budget clients are admitted against at SETUP/PLAY, Kbps. 0 uses Streamer.EgressCapacity, admission control is off if both are 0"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarStreamerAdmissionHeadroom(
+	TEXT("Streamer.AdmissionHeadroom"),
+	20.0,
+	TEXT("Headroom reserved on top of the bitrate of the rendition every admitted client is sent, in per cent"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<FString> CVarStreamerAdmissionRedirect(
+	TEXT("Streamer.AdmissionRedirect"),
+	TEXT(""),
+	TEXT("RTSP URL of another instance clients are redirected to when the budget is exceeded, empty replies 453 Not Enough Bandwidth"),
+	ECVF_Default);
+
+// egress budget in Kbps, 0 if admission control is off
+static uint32 GetAdmissionBudgetKbps()
+{
+	int32 BudgetKbps = CVarStreamerAdmissionBudget.GetValueOnAnyThread();
+	if (BudgetKbps <= 0)
+	{
+		BudgetKbps = CVarStreamerEgressCapacity.GetValueOnAnyThread();
+	}
+	return static_cast<uint32>(FMath::Max(BudgetKbps, 0));
+}
+
+// egress reserved for a single client at the current bitrate of its rendition, Kbps
+static uint32 GetPerClientReservationKbps(uint32 AverageBitRate)
+{
+	return static_cast<uint32>(AverageBitRate / 1000.0 * (100.0 + CVarStreamerAdmissionHeadroom.GetValueOnAnyThread()) / 100.0);
+}
+
 FServer::FServer(const FString& IP, uint16 Port, FController& Controller) 
 	: Controller(Controller)
+	, AdmittedClients(0)
+	, PlayingClients(0)
+	, ListenerSocket(nullptr)
 	, ExitRequested(false)
-	, Thread(TEXT("Server Listener"), [this, IP, Port]() { Run(IP, Port); })
-{}
+	, Backend(CreateNetworkBackend())
+	, TimerWheel(FTimerWheel::GetTimeMs())
+	, TimerEvent(FPlatformProcess::GetSynchEventFromPool())
+	, Thread(TEXT("Server Listener"), [this, IP, Port]() { Run(IP, Port); }, FThreadSettings::FromConsoleVariables(TEXT("Streamer.NetworkThread")))
+{
+	//a completion based backend's network thread runs timers between polls, the listener thread of the blocking one sits in Accept()
+	if (!Backend->IsCompletionBased())
+	{
+		TimerThread = MakeUnique<FThread>(TEXT("Server Timers"), [this]() { RunTimerThread(); }, FThreadSettings::FromConsoleVariables(TEXT("Streamer.TimerThread")));
+	}
+}
 
 FServer::~FServer()
 {
 	ExitRequested = true;
 
-	//destroy listener socket
-	if (ListenerSocket) 
+	if (TimerThread)
+	{
+		TimerEvent->Trigger();
+		TimerThread->Join();
+	}
+	FPlatformProcess::ReturnSynchEventToPool(TimerEvent);
+
+	//destroy listener socket, unblocks Accept(). A completion based backend's network thread notices ExitRequested
+	//within one Poll() timeout and still needs the listener to cancel its accept
+	if (ListenerSocket && !Backend->IsCompletionBased())
 	{
 		FScopeLock Lock(&ListenerSocketMt);
 		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenerSocket);
@@ -22,6 +123,23 @@ FServer::~FServer()
 
 	//end thread
 	Thread.Join();
+
+	//streamers count themselves out of the playing clients on destruction, while the rest of the server is alive.
+	//They join their receive threads without ClientListMt held, which a receive thread may be waiting for in Admit()
+	{
+		TArray<TUniquePtr<FStreamer>> Clients;
+		{
+			FScopeLock Lock(&ClientListMt);
+			Clients = MoveTemp(ClientList);
+		}
+	}
+
+	if (ListenerSocket)
+	{
+		FScopeLock Lock(&ListenerSocketMt);
+		ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenerSocket);
+		ListenerSocket = nullptr;
+	}
 }
 
 void FServer::Run(const FString& ServerIP, uint16 ServerPort)
@@ -45,36 +163,41 @@ void FServer::Run(const FString& ServerIP, uint16 ServerPort)
 		check(ListenerSocket);
 	}
 
-	UE_LOG(RTSPStreaming, Log, TEXT("Waiting for connection from Client on %s:%d"), *ServerIP, ServerPort);
+	UE_LOG(RTSPStreaming, Log, TEXT("Waiting for connection from Client on %s:%d using %s network backend"), *ServerIP, ServerPort, Backend->GetName());
 
-	while (!ExitRequested)
+	if (Backend->IsCompletionBased())
 	{
-		//blocking call accepts incomming client connection
-		FSocket* ClientSocket = ListenerSocket->Accept(TEXT("Client"));
-		if (!ClientSocket) // usually happens on exit because Listener was closed in destructor
+		//accept and all client receives complete on this thread, the poll timeout drives the timers.
+		//timers added from other threads can fire up to one maximal timeout late
+		Backend->AcceptMultishot(ListenerSocket, [this, ServerIP](FSocket* ClientSocket) { AddClient(ClientSocket, ServerIP); });
+		while (!ExitRequested)
 		{
-			return;
+			int32 TimeoutMs;
+			{
+				FScopeLock Lock(&TimerWheelMt);
+				TimeoutMs = TimerWheel.GetTimeoutMs(FTimerWheel::GetTimeMs(), 100);
+			}
+			Backend->Poll(TimeoutMs);
+			RunTimers();
 		}
 
-		//gets client IP
-		TSharedPtr<FInternetAddr> ClientAddr = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
-		ClientSocket->GetPeerAddress(*ClientAddr);
-
+		//client streamers cancel their receives on destruction, which must happen on the network thread
+		Backend->Cancel(ListenerSocket);
+		FScopeLock Lock(&ClientListMt);
+		ClientList.Empty();
+	}
+	else
+	{
+		while (!ExitRequested)
 		{
-			FScopeLock Lock(&ClientListMt);
-			
-			//removes dead client streamers from active list
-			ClientList.RemoveAllSwap([](FStreamer& ClientStreamer3) { return ClientStreamer3.isDead() == 1; }, true);
-
-			//tells controller to stop passing data if no active clients exist
-			if (!ClientList.Num()) 
+			//blocking call accepts incomming client connection
+			FSocket* ClientSocket = ListenerSocket->Accept(TEXT("Client"));
+			if (!ClientSocket) // usually happens on exit because Listener was closed in destructor
 			{
-				Controller.StopStreaming();
+				return;
 			}
 
-			//adds new incomming connection streamer to active list
-			ClientList.Emplace(ClientSocket, ServerIP, ClientAddr, *this);
-			UE_LOG(RTSPStreaming, Log, TEXT("+%d Accepted connection from Client: %s"), ClientList.Num(), *ClientAddr->ToString(true));
+			AddClient(ClientSocket, ServerIP);
 		}
 	}
 
@@ -82,24 +205,340 @@ void FServer::Run(const FString& ServerIP, uint16 ServerPort)
 
 }
 
-bool FServer::Send(uint64 Timestamp, const uint8* Data, uint32 Size)
-{	
-	FScopeLock Lock(&ClientListMt);
+void FServer::AddClient(FSocket* ClientSocket, const FString& ServerIP)
+{
+	//gets client IP
+	TSharedPtr<FInternetAddr> ClientAddr = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
+	ClientSocket->GetPeerAddress(*ClientAddr);
+
+	TArray<TUniquePtr<FStreamer>> DeadClients;
+	{
+		FScopeLock Lock(&ClientListMt);
+
+		RemoveDeadClients(DeadClients);
+
+		//adds new incomming connection streamer to active list
+		ClientList.Add(MakeUnique<FStreamer>(ClientSocket, ServerIP, ClientAddr, *this));
+		UE_LOG(RTSPStreaming, Log, TEXT("+%d Accepted connection from Client: %s"), ClientList.Num(), *ClientAddr->ToString(true));
+	}
+
+	//destroys the dead streamers once ClientListMt is released, see RemoveDeadClients()
+	DeadClients.Empty();
+}
 
-	//iterates through client streamers
-	for (FStreamer& ClientStreamer2 : ClientList)
+void FServer::RemoveDeadClients(TArray<TUniquePtr<FStreamer>>& OutDeadClients)
+{
+	//moves dead client streamers out of the active list and releases their egress reservations. Their timers are
+	//cancelled while ClientListMt is held, but they are destroyed without it: destruction joins the receive thread,
+	//which may be waiting for ClientListMt in Admit()
+	for (int32 Index = ClientList.Num() - 1; Index >= 0; --Index)
 	{
-		//checks if streamer has set up sending sockets and if PLAY was received
-		if (ClientStreamer2.isReady())
+		TUniquePtr<FStreamer>& ClientStreamer3 = ClientList[Index];
+		if (ClientStreamer3->isDead())
 		{
-			//passes encoded frames to client streamers
-			if (!ClientStreamer2.Send(Timestamp, Data, Size))
+			if (ClientStreamer3->IsAdmitted())
 			{
-				return false;
+				AdmittedClients--;
 			}
+			ClientStreamer3->CancelTimers();
+			OutDeadClients.Add(MoveTemp(ClientStreamer3));
+			ClientList.RemoveAtSwap(Index, 1, false);
 		}
 	}
+	SET_DWORD_STAT(STAT_RTSPStreaming_AdmittedClients, AdmittedClients);
+}
+
+FTimerWheel::FTimerId FServer::AddTimer(uint32 DelayMs, FTimerWheel::FCallback&& Callback)
+{
+	FTimerWheel::FTimerId Id;
+	{
+		FScopeLock Lock(&TimerWheelMt);
+		Id = TimerWheel.Add(FTimerWheel::GetTimeMs() + DelayMs, MoveTemp(Callback));
+	}
+
+	//the timer thread recomputes its wait
+	if (TimerThread)
+	{
+		TimerEvent->Trigger();
+	}
+	return Id;
+}
+
+void FServer::CancelTimer(FTimerWheel::FTimerId Id)
+{
+	FScopeLock Lock(&TimerWheelMt);
+	TimerWheel.Cancel(Id);
+}
+
+void FServer::RunTimers()
+{
+	//callbacks of streamers are cancelled before they leave ClientList, which also happens with ClientListMt held,
+	//so a callback taken out of the wheel here can't outlive its streamer
+	TArray<TUniquePtr<FStreamer>> DeadClients;
+	{
+		FScopeLock Lock(&ClientListMt);
+
+		std::vector<FTimerWheel::FCallback> Expired;
+		{
+			FScopeLock TimerLock(&TimerWheelMt);
+			TimerWheel.Advance(FTimerWheel::GetTimeMs(), Expired);
+		}
+		for (FTimerWheel::FCallback& Callback : Expired)
+		{
+			Callback();
+		}
+
+		RemoveDeadClients(DeadClients);
+	}
+	DeadClients.Empty();
+}
+
+void FServer::RunTimerThread()
+{
+	while (!ExitRequested)
+	{
+		int32 TimeoutMs;
+		{
+			FScopeLock Lock(&TimerWheelMt);
+			TimeoutMs = TimerWheel.GetTimeoutMs(FTimerWheel::GetTimeMs(), 1000);
+		}
+		TimerEvent->Wait(TimeoutMs);
+		if (!ExitRequested)
+		{
+			RunTimers();
+		}
+	}
+}
+
+void FServer::SetClientPlaying(bool bPlaying)
+{
+	FScopeLock Lock(&PlayingClientsMt);
+
+	//every PLAY restarts streaming so the new client gets an IDR frame, the encoder stops with the last playing client
+	if (bPlaying)
+	{
+		PlayingClients++;
+		Controller.StartStreaming();
+	}
+	else
+	{
+		check(PlayingClients > 0);
+		if (--PlayingClients == 0)
+		{
+			Controller.StopStreaming();
+		}
+	}
+	SET_DWORD_STAT(STAT_RTSPStreaming_PlayingClients, PlayingClients);
+}
+
+void FServer::OnClientLoss(int32 Rendition, uint32 RtpTimestamp)
+{
+	INC_DWORD_STAT(STAT_RTSPStreaming_ClientLossReports);
+	Controller.ReportLoss(Rendition, RtpTimestamp);
+}
+
+void FServer::OnClientPictureLoss(int32 Rendition)
+{
+	INC_DWORD_STAT(STAT_RTSPStreaming_ClientPictureLossReports);
+
+	//a client that hasn't been sent a frame yet has nothing to recover, the IDR frame it starts with was forced when
+	//it started playing. INDEX_NONE would force one of every rendition
+	if (Rendition == INDEX_NONE)
+	{
+		return;
+	}
+	Controller.ForceIdrFrame(Rendition);
+}
+
+bool FServer::Admit(FStreamer& Streamer)
+{
+	FScopeLock Lock(&ClientListMt);
+
+	if (Streamer.IsAdmitted())
+	{
+		return true;
+	}
+
+	//operators are always admitted, the egress scheduler protects them at the cost of lower classes
+	const uint32 BudgetKbps = GetAdmissionBudgetKbps();
+	const uint32 ReservationKbps = GetReservationKbps(Streamer);
+	const uint32 CommittedKbps = GetCommittedKbps();
+	if (BudgetKbps && Streamer.GetPriority() != EClientPriority::Operator && CommittedKbps + ReservationKbps > BudgetKbps)
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("Rejected client %s:%d, %d Kbps on top of the %d Kbps of %d admitted clients would exceed egress budget of %d Kbps"),
+			*Streamer.GetIP(), Streamer.GetPort(), ReservationKbps, CommittedKbps, AdmittedClients, BudgetKbps);
+		return false;
+	}
+
+	Streamer.SetAdmitted();
+	AdmittedClients++;
+	SET_DWORD_STAT(STAT_RTSPStreaming_AdmittedClients, AdmittedClients);
 	return true;
 }
 
+uint32 FServer::GetReservationKbps(FStreamer& Streamer)
+{
+	//a client that hasn't been sent a frame yet reserves for the rendition it was described, renditions of the
+	//ladder differ a lot in bitrate
+	const int32 Rendition = Streamer.GetRendition() != INDEX_NONE ? Streamer.GetRendition() : Streamer.GetStartRendition();
+	return GetPerClientReservationKbps(Controller.GetAverageBitRate(Rendition));
+}
+
+uint32 FServer::GetCommittedKbps()
+{
+	uint32 CommittedKbps = 0;
+	for (TUniquePtr<FStreamer>& ClientStreamer : ClientList)
+	{
+		if (ClientStreamer->IsAdmitted())
+		{
+			CommittedKbps += GetReservationKbps(*ClientStreamer);
+		}
+	}
+	return CommittedKbps;
+}
+
+FString FServer::GetAdmissionRedirect() const
+{
+	return CVarStreamerAdmissionRedirect.GetValueOnAnyThread();
+}
+
+bool FServer::Send(int32 Rendition, const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame)
+{	
+	FScopeLock Lock(&ClientListMt);
+
+	//publishes live budget usage, bitrate can change at any frame
+	const uint32 BudgetKbps = GetAdmissionBudgetKbps();
+	const uint32 CommittedKbps = GetCommittedKbps();
+	SET_DWORD_STAT(STAT_RTSPStreaming_EgressBudgetCommitted, CommittedKbps);
+	SET_DWORD_STAT(STAT_RTSPStreaming_EgressBudgetUsage, BudgetKbps ? static_cast<uint32>(100ull * CommittedKbps / BudgetKbps) : 0);
+
+	//moves clients between renditions, any rendition's frame does it for all of them. A client switching renditions
+	//waits for an IDR frame of the new one, the renditions nobody is sent aren't encoded
+	const int32 NumRenditions = Controller.GetNumRenditions();
+	uint32 WatchedRenditions = 0;
+	for (TUniquePtr<FStreamer>& ClientStreamer2 : ClientList)
+	{
+		if (ClientStreamer2->isReady())
+		{
+			const int32 PreviousRendition = ClientStreamer2->GetRendition();
+			if (ClientStreamer2->UpdateRendition(NumRenditions) && PreviousRendition != INDEX_NONE)
+			{
+				FEgressClientState& State = ClientStreamer2->GetEgressState();
+				State.bWaitForKeyframe = true;
+				State.BrokenLayer = TemporalLayerNone;
+				State.bFrameInProgress = false;
+				Controller.ForceIdrFrame(ClientStreamer2->GetRendition());
+				INC_DWORD_STAT(STAT_RTSPStreaming_RenditionSwitches);
+				UE_LOG(RTSPStreaming, Log, TEXT("Client %s:%d switched from %s to %s"), *ClientStreamer2->GetIP(), ClientStreamer2->GetPort(),
+					*Controller.GetRenditionName(PreviousRendition), *Controller.GetRenditionName(ClientStreamer2->GetRendition()));
+			}
+			WatchedRenditions |= 1u << ClientStreamer2->GetRendition();
+		}
+	}
+	if (WatchedRenditions)
+	{
+		Controller.SetWatchedRenditions(WatchedRenditions);
+	}
+
+	//the other parts of a frame sent in parts follow its first part to the clients the scheduler picked for that one,
+	//a client that joined or was dropped in between waits for the next frame
+	if (!Info.bFirstPart)
+	{
+		bool bResult = true;
+		uint32 SentSize = 0;
+		for (TUniquePtr<FStreamer>& ClientStreamer2 : ClientList)
+		{
+			FEgressClientState& State = ClientStreamer2->GetEgressState();
+			if (State.bFrameInProgress && ClientStreamer2->isReady() && ClientStreamer2->GetRendition() == Rendition)
+			{
+				State.bFrameInProgress = !Info.bLastPart;
+				SentSize += Frame->Num();
+				if (!ClientStreamer2->Send(Info.Timestamp, Frame, Info.bLastPart))
+				{
+					bResult = false;
+				}
+			}
+		}
+		if (CVarStreamerEgressCapacity.GetValueOnAnyThread() > 0)
+		{
+			EgressScheduler.Consume(SentSize);
+		}
+		Backend->Flush();
+		return bResult;
+	}
+
+	//collects client streamers of this rendition which have set up sending sockets and received PLAY, with the temporal
+	//layers their frame rate allows
+	const uint32 StreamFrameRate = Controller.GetStreamFrameRate();
+	TArray<FEgressRequest, TInlineAllocator<16>> Requests;
+	TArray<FStreamer*, TInlineAllocator<16>> ReadyStreamers;
+	for (TUniquePtr<FStreamer>& ClientStreamer2 : ClientList)
+	{
+		if (ClientStreamer2->GetRendition() == Rendition)
+		{
+			ClientStreamer2->GetEgressState().bFrameInProgress = false;
+		}
+		if (ClientStreamer2->isReady() && ClientStreamer2->GetRendition() == Rendition)
+		{
+			const uint8 MaxTemporalLayer = GetMaxTemporalLayer(StreamFrameRate, ClientStreamer2->GetMaxFrameRate(), Info.NumTemporalLayers);
+			Requests.Add({ ClientStreamer2->GetPriority(), &ClientStreamer2->GetEgressState(), static_cast<uint32>(Frame->Num()), MaxTemporalLayer, false });
+			ReadyStreamers.Add(ClientStreamer2.Get());
+		}
+	}
 
+	if (!ReadyStreamers.Num())
+	{
+		return true;
+	}
+
+	//decides which clients get this frame when egress is congested, all renditions share the link. A frame sent in
+	//parts is decided on by the size of its first part
+	TArray<bool, TInlineAllocator<16>> bWaitedForKeyframe;
+	TArray<uint32, TInlineAllocator<16>> DroppedBefore;
+	for (const FEgressRequest& Request : Requests)
+	{
+		bWaitedForKeyframe.Add(Request.State->bWaitForKeyframe);
+		DroppedBefore.Add(Request.State->DroppedFrames);
+	}
+	const uint32 Dropped = EgressScheduler.Schedule(Requests.GetData(), Requests.Num(), Info.bKeyframe, Info.TemporalLayer, Info.NumTemporalLayers,
+		FPlatformTime::Seconds(), CVarStreamerEgressCapacity.GetValueOnAnyThread(), CVarStreamerEgressBurstMs.GetValueOnAnyThread());
+	INC_DWORD_STAT_BY(STAT_RTSPStreaming_EgressDroppedFrames, Dropped);
+
+	//a dropped client waits for the next IDR frame, which may never come by itself when the encoder recovers losses
+	//through long-term references instead of periodic IDR frames. If the IDR frame forced for it was dropped too,
+	//another one is forced once the link has saved up enough for it
+	for (int32 Index = 0; Index < Requests.Num(); ++Index)
+	{
+		if (Requests[Index].State->bWaitForKeyframe && (!bWaitedForKeyframe[Index] || EgressScheduler.HasTokensForKeyframe()))
+		{
+			Controller.ForceIdrFrame(Rendition);
+			break;
+		}
+	}
+
+	//a drop is congestion feedback for clients that leave the rendition to the server
+	for (int32 Index = 0; Index < Requests.Num(); ++Index)
+	{
+		if (Requests[Index].State->DroppedFrames != DroppedBefore[Index])
+		{
+			ReadyStreamers[Index]->OnEgressDrop();
+		}
+	}
+	SET_DWORD_STAT(STAT_RTSPStreaming_EgressTokens, static_cast<uint32>(FMath::Max(EgressScheduler.GetTokens(), 0.0)));
+
+	//passes encoded frames, all clients share the encoder's copy of the frame and zero-copy sends keep it alive past this call
+	bool bResult = true;
+	for (int32 Index = 0; Index < ReadyStreamers.Num(); ++Index)
+	{
+		if (Requests[Index].bSend && !ReadyStreamers[Index]->Send(Info.Timestamp, Frame, Info.bLastPart))
+		{
+			bResult = false;
+			break;
+		}
+		Requests[Index].State->bFrameInProgress = Requests[Index].bSend && !Info.bLastPart;
+	}
+
+	//submits the datagrams of this frame to all clients at once
+	Backend->Flush();
+	return bResult;
+}
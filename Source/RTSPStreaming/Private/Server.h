@@ -3,11 +3,15 @@
 #pragma once
 
 #include "HAL/ThreadSafeBool.h"
+#include "HAL/Event.h"
 #include "Misc/ScopeLock.h"
 #include "Templates/SharedPointer.h"
 #include "Utils.h"
 #include "Controller.h"
 #include "Streamer.h"
+#include "RTSPCore/EgressScheduler.h"
+#include "NetworkBackend.h"
+#include "RTSPCore/TimerWheel.h"
 #include "Engine/Engine.h"
 #include "Engine/GameViewportClient.h"
 #include "Common/TcpSocketBuilder.h"
@@ -32,19 +36,63 @@ public:
 	~FServer();
 
 	void Run(const FString& ServerIP, uint16 ServerPort);			// Server listener thread
-	bool Send(uint64 Timestamp, const uint8* Data, uint32 Size);	// passes data to client Sessions in ClientList
+	bool Send(int32 Rendition, const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame);	// passes a rendition's data to the client Sessions in ClientList sent it
 
-	void StartStreaming()					//tells controller to start streaming
+	bool Admit(FStreamer& Streamer);		// reserves egress budget for a client at SETUP/PLAY, false if it doesn't fit
+	FString GetAdmissionRedirect() const;	// URL rejected clients are redirected to, empty to reply 453
+
+	void SetClientPlaying(bool bPlaying);	// counts playing clients, streaming runs while there is at least one
+	void OnClientLoss(int32 Rendition, uint32 RtpTimestamp);	// a client lost the rendition's frame with this RTP timestamp, any thread
+	void OnClientPictureLoss(int32 Rendition);					// a client asked for an IDR frame of the rendition, any thread
+
+	int32 GetNumRenditions() const			// renditions of the simulcast ladder of each codec, fixed at startup
+	{
+		return Controller.GetNumRenditions();
+	}
+	int32 FindRendition(const FString& Name) const	// rendition of the ladder a client asked for by name, INDEX_NONE if there is none
 	{
-		Controller.StartStreaming();
+		return Controller.FindRendition(Name);
 	}
+	int32 FindMount(const FString& Path, EVideoCodec& OutCodec) const	// largest rendition of the stream mounted at Path, INDEX_NONE if none is
+	{
+		return Controller.FindMount(Path, OutCodec);
+	}
+	bool GetParameterSets(int32 Rendition, std::vector<uint8>& OutParameterSets) const	// of the rendition's last IDR frame
+	{
+		return Controller.GetParameterSets(Rendition, OutParameterSets);
+	}
+
+	INetworkBackend& GetNetworkBackend()	// I/O backend client streamers send and receive through
+	{
+		return *Backend;
+	}
+
+	// timers fire on the network thread, or the timer thread of the blocking backend, with ClientListMt held
+	FTimerWheel::FTimerId AddTimer(uint32 DelayMs, FTimerWheel::FCallback&& Callback);
+	void CancelTimer(FTimerWheel::FTimerId Id);
 
 private:
+	void AddClient(FSocket* ClientSocket, const FString& ServerIP);	// creates a streamer for an accepted connection
+	void RemoveDeadClients(TArray<TUniquePtr<FStreamer>>& OutDeadClients);	// takes out streamers which got TEARDOWN or disconnected, ClientListMt held
+	void RunTimers();												// fires due timers and destroys streamers they ended
+	void RunTimerThread();											// timer thread of the blocking network backend
+	uint32 GetReservationKbps(FStreamer& Streamer);					// egress a client reserves for the rendition it is sent, Kbps
+	uint32 GetCommittedKbps();										// egress reserved by all admitted clients, Kbps. ClientListMt held
+
 	FController&		Controller;		
 	FCriticalSection	ClientListMt;		// thread lock for ClientList
-	TArray<FStreamer>	ClientList;			// list of active client Sessions
+	TArray<TUniquePtr<FStreamer>> ClientList;	// list of active client Sessions, streamers don't move as their callbacks capture them
+	FEgressScheduler	EgressScheduler;	// decides which clients get a frame when egress is congested, guarded by ClientListMt
+	uint32				AdmittedClients;	// number of live clients holding an egress reservation, guarded by ClientListMt
+	FCriticalSection	PlayingClientsMt;	// thread lock for PlayingClients, taken with a streamer's StreamerMt held
+	int32				PlayingClients;		// number of clients frames are passed to
 	FCriticalSection	ListenerSocketMt;	// thread lock for ListenerSocket
 	FSocket*			ListenerSocket;		// socket Listener for incomming client connections
 	FThreadSafeBool		ExitRequested;		// true if thread should close
-	FThread				Thread;				// listener thread
+	TUniquePtr<INetworkBackend> Backend;	// blocking sockets or io_uring, see -RTSPStreamingNetworkBackend=
+	FCriticalSection	TimerWheelMt;		// thread lock for TimerWheel, taken with ClientListMt held when both are needed
+	FTimerWheel			TimerWheel;			// session timeouts and other timers of all clients
+	FEvent*				TimerEvent;			// wakes the timer thread when a timer is added or on exit
+	TUniquePtr<FThread>	TimerThread;		// drives TimerWheel, null if the network thread drives it from its poll timeout
+	FThread				Thread;				// listener thread, network thread polling the backend if it is completion based
 };
\ No newline at end of file
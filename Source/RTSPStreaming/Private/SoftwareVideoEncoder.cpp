@@ -0,0 +1,413 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "SoftwareVideoEncoder.h"
+
+#if WITH_OPENH264
+
+#include "BackBufferCopy.h"
+#include "CapturePacer.h"
+#include "ColorConversion.h"
+#include "RTSPStreamingCommon.h"
+#include "Utils.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformMisc.h"
+#include "HAL/PlatformProcess.h"
+
+THIRD_PARTY_INCLUDES_START
+#include "wels/codec_api.h"
+THIRD_PARTY_INCLUDES_END
+
+DECLARE_CYCLE_STAT(TEXT("Readback"), STAT_SoftwareEncoder_Readback, STATGROUP_SoftwareEncoder);
+DECLARE_CYCLE_STAT(TEXT("ConvertToI420"), STAT_SoftwareEncoder_ConvertToI420, STATGROUP_SoftwareEncoder);
+DECLARE_CYCLE_STAT(TEXT("Encode"), STAT_SoftwareEncoder_Encode, STATGROUP_SoftwareEncoder);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("DroppedFrames"), STAT_SoftwareEncoder_DroppedFrames, STATGROUP_SoftwareEncoder);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Threads"), STAT_SoftwareEncoder_Threads, STATGROUP_SoftwareEncoder);
+
+static TAutoConsoleVariable<int32> CVarEncoderSoftwareThreads(
+	TEXT("Encoder.SoftwareThreads"),
+	0,
+	TEXT("Threads of the software encoder, each encodes one slice of a frame. 0 uses half the physical cores, up to 4"),
+	ECVF_Default);
+
+static const int32 NumReadbacks = 3;		// staging textures, a readback is usually mapped one capture after it was copied
+static const int32 NumRawFrames = 3;		// frames queued for the encode thread, captures are dropped beyond this
+static const int32 MaxSlices = 4;			// threads OpenH264 slices a frame across
+
+// OpenH264 works on even sizes, the odd last row or column of the back buffer is cut off
+static uint32 EvenSize(uint32 Size)
+{
+	return Size & ~1u;
+}
+
+static void AppendBitstream(const SFrameBSInfo& Info, TArray<uint8>& OutBitstream)
+{
+	for (int32 LayerIndex = 0; LayerIndex < Info.iLayerNum; ++LayerIndex)
+	{
+		const SLayerBSInfo& Layer = Info.sLayerInfo[LayerIndex];
+		int32 LayerSize = 0;
+		for (int32 NalIndex = 0; NalIndex < Layer.iNalCount; ++NalIndex)
+		{
+			LayerSize += Layer.pNalLengthInByte[NalIndex];
+		}
+		// NAL units are written back to back with their start codes
+		OutBitstream.Append(Layer.pBsBuf, LayerSize);
+	}
+}
+
+TUniquePtr<IVideoEncoder> FSoftwareVideoEncoder::Create(const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
+{
+	return MakeUnique<FSoftwareVideoEncoder>(InSettings, InEncodedFrameReadyCallback);
+}
+
+FSoftwareVideoEncoder::FSoftwareVideoEncoder(const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback)
+	: InitialSettings(InSettings)
+	, EncodedFrameReadyCallback(InEncodedFrameReadyCallback)
+	, Encoder(nullptr)
+	, bForceIdrFrame(false)
+	, bResourcesInitialized(false)
+	, NextReadback(0)
+	, OldestReadback(0)
+	, EncodedFramePool(16)
+	, FrameQueuedEvent(FPlatformProcess::GetSynchEventFromPool(false))
+	, bExitRequested(false)
+{
+	EncoderSettings.Width = 0;
+	EncoderSettings.Height = 0;
+
+	RawFrames.SetNum(NumRawFrames);
+	for (int32 Index = 0; Index < NumRawFrames; ++Index)
+	{
+		FreeRawFrames.Enqueue(Index);
+	}
+}
+
+FSoftwareVideoEncoder::~FSoftwareVideoEncoder()
+{
+	if (EncodeThread)
+	{
+		bExitRequested = true;
+		FrameQueuedEvent->Trigger();
+		EncodeThread->Join();
+		EncodeThread.Reset();
+	}
+	FPlatformProcess::ReturnSynchEventToPool(FrameQueuedEvent);
+
+	if (Encoder)
+	{
+		Encoder->Uninitialize();
+		WelsDestroySVCEncoder(Encoder);
+	}
+}
+
+bool FSoftwareVideoEncoder::Initialize()
+{
+	if (InitialSettings.Codec != EVideoCodec::H264)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("OpenH264 can't encode %s"), ANSI_TO_TCHAR(VideoCodecToString(InitialSettings.Codec)));
+		return false;
+	}
+
+	if (WelsCreateSVCEncoder(&Encoder) != 0 || !Encoder)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Failed to create OpenH264 encoder"));
+		Encoder = nullptr;
+		return false;
+	}
+
+	if (!Configure(InitialSettings))
+	{
+		return false;
+	}
+
+	// started here rather than with the resources so EncodeBgraFrame() works without the RHI
+	EncodeThread = MakeUnique<FThread>(TEXT("RTSPStreaming Software Encode"), [this]() { EncodeLoop(); });
+	return true;
+}
+
+bool FSoftwareVideoEncoder::Configure(const FVideoEncoderSettings& Settings)
+{
+	int32 NumThreads = CVarEncoderSoftwareThreads.GetValueOnAnyThread();
+	if (NumThreads <= 0)
+	{
+		NumThreads = FPlatformMisc::NumberOfCores() / 2;
+	}
+	NumThreads = FMath::Clamp(NumThreads, 1, MaxSlices);
+
+	SEncParamExt Params;
+	Encoder->GetDefaultParams(&Params);
+	Params.iUsageType = CAMERA_VIDEO_REAL_TIME;
+	Params.iPicWidth = EvenSize(Settings.Width);
+	Params.iPicHeight = EvenSize(Settings.Height);
+	Params.iTargetBitrate = Settings.AverageBitRate;
+	Params.iMaxBitrate = UNSPECIFIED_BIT_RATE;
+	Params.iRCMode = RC_BITRATE_MODE;
+	Params.fMaxFrameRate = static_cast<float>(Settings.FrameRate);
+	Params.bEnableFrameSkip = false;				// the capture pacer already decides which frames are sent
+	Params.uiIntraPeriod = 0;						// IDR frames only on request, like the NVENC session
+	Params.eSpsPpsIdStrategy = CONSTANT_ID;
+	Params.iComplexityMode = LOW_COMPLEXITY;
+	Params.iEntropyCodingModeFlag = 0;				// CAVLC, the SDP announces constrained baseline
+	Params.iMultipleThreadIdc = NumThreads;
+	Params.iSpatialLayerNum = 1;
+	Params.iTemporalLayerNum = 1;
+
+	SSpatialLayerConfig& Layer = Params.sSpatialLayers[0];
+	Layer.iVideoWidth = Params.iPicWidth;
+	Layer.iVideoHeight = Params.iPicHeight;
+	Layer.fFrameRate = Params.fMaxFrameRate;
+	Layer.iSpatialBitrate = Params.iTargetBitrate;
+	Layer.iMaxSpatialBitrate = UNSPECIFIED_BIT_RATE;
+	Layer.uiProfileIdc = PRO_BASELINE;
+	Layer.uiLevelIdc = LEVEL_5_1;
+	Layer.sSliceArgument.uiSliceMode = SM_FIXEDSLCNUM_SLICE;	// one slice per thread
+	Layer.sSliceArgument.uiSliceNum = NumThreads;
+	Layer.bVideoSignalTypePresent = true;					// matches the coefficients of ConvertToI420()
+	Layer.uiVideoFormat = VF_UNDEF;
+	Layer.bFullRange = false;
+	Layer.bColorDescriptionPresent = true;
+	Layer.uiColorPrimaries = CP_BT709;
+	Layer.uiTransferCharacteristics = TRC_BT709;
+	Layer.uiColorMatrix = CM_BT709;
+
+	if (EncoderSettings.Width)
+	{
+		Encoder->Uninitialize();
+		EncoderSettings.Width = 0;
+	}
+
+	const int Result = Encoder->InitializeExt(&Params);
+	if (Result != cmResultSuccess)
+	{
+		UE_LOG(RTSPStreaming, Error, TEXT("Failed to initialize OpenH264 encoder for %dx%d, error %d"), Params.iPicWidth, Params.iPicHeight, Result);
+		return false;
+	}
+
+	int VideoFormat = videoFormatI420;
+	Encoder->SetOption(ENCODER_OPTION_DATAFORMAT, &VideoFormat);
+
+	// IDR frames repeat the parameter sets, these are for GetSpsPpsHeader()
+	SFrameBSInfo Info;
+	FMemory::Memzero(Info);
+	if (Encoder->EncodeParameterSets(&Info) == cmResultSuccess)
+	{
+		SpsPpsHeader.Reset();
+		AppendBitstream(Info, SpsPpsHeader);
+	}
+
+	I420.SetNumUninitialized(Params.iPicWidth * Params.iPicHeight * 3 / 2);
+	EncoderSettings = Settings;
+	SET_DWORD_STAT(STAT_SoftwareEncoder_Threads, NumThreads);
+	UE_LOG(RTSPStreaming, Log, TEXT("OpenH264 encoder configured for %dx%d %d FPS, %d threads"), Params.iPicWidth, Params.iPicHeight, Settings.FrameRate, NumThreads);
+	return true;
+}
+
+void FSoftwareVideoEncoder::InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer)
+{
+	CreateReadbacks(Settings);
+	bResourcesInitialized = true;
+}
+
+void FSoftwareVideoEncoder::CreateReadbacks(const FVideoEncoderSettings& Settings)
+{
+	// readbacks still in flight are dropped with their textures
+	Readbacks.Reset();
+	Readbacks.SetNum(NumReadbacks);
+	NextReadback = 0;
+	OldestReadback = 0;
+
+	FRHIResourceCreateInfo CreateInfo;
+	for (FReadback& Readback : Readbacks)
+	{
+		Readback.ResolvedBackBuffer = RHICreateTexture2D(EvenSize(Settings.Width), EvenSize(Settings.Height), EPixelFormat::PF_B8G8R8A8, 1, 1, TexCreate_RenderTargetable, CreateInfo);
+		Readback.StagingTexture = RHICreateTexture2D(EvenSize(Settings.Width), EvenSize(Settings.Height), EPixelFormat::PF_B8G8R8A8, 1, 1, TexCreate_CPUReadback, CreateInfo);
+		Readback.Fence = RHICreateGPUFence(TEXT("SoftwareEncoderReadback"));
+		Readback.Settings = Settings;
+		Readback.Timestamp = 0;
+		Readback.bInFlight = false;
+	}
+}
+
+void FSoftwareVideoEncoder::EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp)
+{
+	SCOPE_CYCLE_COUNTER(STAT_SoftwareEncoder_Readback);
+
+	MapReadbacks();
+
+	if (Readbacks[0].ResolvedBackBuffer->GetSizeX() != EvenSize(Settings.Width) || Readbacks[0].ResolvedBackBuffer->GetSizeY() != EvenSize(Settings.Height))
+	{
+		CreateReadbacks(Settings);
+	}
+
+	// the GPU is behind if the whole ring is still being copied
+	FReadback& Readback = Readbacks[NextReadback];
+	if (Readback.bInFlight)
+	{
+		INC_DWORD_STAT(STAT_SoftwareEncoder_DroppedFrames);
+		return;
+	}
+
+	FRHICommandListImmediate& RHICmdList = FRHICommandListExecutor::GetImmediateCommandList();
+	CopyBackBuffer(BackBuffer, Readback.ResolvedBackBuffer);
+	RHICmdList.CopyToResolveTarget(Readback.ResolvedBackBuffer, Readback.StagingTexture, FResolveParams());
+	Readback.Fence->Clear();
+	RHICmdList.WriteGPUFence(Readback.Fence);
+
+	Readback.Settings = Settings;
+	Readback.Timestamp = Timestamp;
+	Readback.bInFlight = true;
+	NextReadback = (NextReadback + 1) % Readbacks.Num();
+}
+
+void FSoftwareVideoEncoder::MapReadbacks()
+{
+	FRHICommandListImmediate& RHICmdList = FRHICommandListExecutor::GetImmediateCommandList();
+	while (Readbacks[OldestReadback].bInFlight && Readbacks[OldestReadback].Fence->Poll())
+	{
+		FReadback& Readback = Readbacks[OldestReadback];
+
+		// the pitch is returned in pixels
+		void* Data = nullptr;
+		int32 PitchPixels = 0;
+		int32 Height = 0;
+		RHICmdList.MapStagingSurface(Readback.StagingTexture, Data, PitchPixels, Height);
+		if (Data)
+		{
+			EncodeBgraFrame(Readback.Settings, static_cast<const uint8*>(Data), PitchPixels * 4, Readback.Timestamp);
+		}
+		RHICmdList.UnmapStagingSurface(Readback.StagingTexture);
+
+		Readback.bInFlight = false;
+		OldestReadback = (OldestReadback + 1) % Readbacks.Num();
+	}
+}
+
+bool FSoftwareVideoEncoder::EncodeBgraFrame(const FVideoEncoderSettings& Settings, const uint8* Bgra, int32 Pitch, uint64 Timestamp)
+{
+	int32 Index;
+	if (!FreeRawFrames.Dequeue(Index))
+	{
+		INC_DWORD_STAT(STAT_SoftwareEncoder_DroppedFrames);
+		return false;
+	}
+
+	// copied so the staging texture can be unmapped right away
+	FRawFrame& Frame = RawFrames[Index];
+	const int32 RowSize = EvenSize(Settings.Width) * 4;
+	const int32 Height = EvenSize(Settings.Height);
+	Frame.Bgra.SetNumUninitialized(RowSize * Height, false);
+	if (Pitch == RowSize)
+	{
+		FMemory::Memcpy(Frame.Bgra.GetData(), Bgra, RowSize * Height);
+	}
+	else
+	{
+		for (int32 Row = 0; Row < Height; ++Row)
+		{
+			FMemory::Memcpy(Frame.Bgra.GetData() + Row * RowSize, Bgra + Row * Pitch, RowSize);
+		}
+	}
+	Frame.Settings = Settings;
+	Frame.Timestamp = Timestamp;
+
+	QueuedRawFrames.Enqueue(Index);
+	FrameQueuedEvent->Trigger();
+	return true;
+}
+
+void FSoftwareVideoEncoder::EncodeLoop()
+{
+	while (!bExitRequested)
+	{
+		int32 Index;
+		while (QueuedRawFrames.Dequeue(Index))
+		{
+			EncodeRawFrame(RawFrames[Index]);
+			FreeRawFrames.Enqueue(Index);
+		}
+		FrameQueuedEvent->Wait();
+	}
+}
+
+void FSoftwareVideoEncoder::EncodeRawFrame(const FRawFrame& Frame)
+{
+	const int32 Width = EvenSize(Frame.Settings.Width);
+	const int32 Height = EvenSize(Frame.Settings.Height);
+
+	// a new resolution needs a new sequence, bitrate and frame rate are changed on the fly
+	if (Width != EvenSize(EncoderSettings.Width) || Height != EvenSize(EncoderSettings.Height))
+	{
+		if (!Configure(Frame.Settings))
+		{
+			return;
+		}
+	}
+	else
+	{
+		if (Frame.Settings.AverageBitRate != EncoderSettings.AverageBitRate)
+		{
+			SBitrateInfo Bitrate;
+			Bitrate.iLayer = SPATIAL_LAYER_ALL;
+			Bitrate.iBitrate = Frame.Settings.AverageBitRate;
+			Encoder->SetOption(ENCODER_OPTION_BITRATE, &Bitrate);
+		}
+		if (Frame.Settings.FrameRate != EncoderSettings.FrameRate)
+		{
+			float FrameRate = static_cast<float>(Frame.Settings.FrameRate);
+			Encoder->SetOption(ENCODER_OPTION_FRAME_RATE, &FrameRate);
+		}
+		EncoderSettings = Frame.Settings;
+	}
+
+	if (bForceIdrFrame.AtomicSet(false))
+	{
+		Encoder->ForceIntraFrame(true);
+	}
+
+	uint8* Y = I420.GetData();
+	uint8* U = Y + Width * Height;
+	uint8* V = U + Width * Height / 4;
+	{
+		SCOPE_CYCLE_COUNTER(STAT_SoftwareEncoder_ConvertToI420);
+		ConvertToI420(PF_B8G8R8A8, Frame.Bgra.GetData(), Width * 4, Width, Height, Y, U, V);
+	}
+
+	SSourcePicture Picture;
+	FMemory::Memzero(Picture);
+	Picture.iColorFormat = videoFormatI420;
+	Picture.iPicWidth = Width;
+	Picture.iPicHeight = Height;
+	Picture.iStride[0] = Width;
+	Picture.iStride[1] = Width / 2;
+	Picture.iStride[2] = Width / 2;
+	Picture.pData[0] = Y;
+	Picture.pData[1] = U;
+	Picture.pData[2] = V;
+	Picture.uiTimeStamp = static_cast<long long>(Frame.Timestamp * 1000 / RTP_VIDEO_CLOCK_RATE);
+
+	SFrameBSInfo Info;
+	FMemory::Memzero(Info);
+	{
+		SCOPE_CYCLE_COUNTER(STAT_SoftwareEncoder_Encode);
+		const int Result = Encoder->EncodeFrame(&Picture, &Info);
+		if (Result != cmResultSuccess)
+		{
+			UE_LOG(RTSPStreaming, Warning, TEXT("OpenH264 failed to encode a frame, error %d"), Result);
+			return;
+		}
+	}
+
+	if (Info.eFrameType == videoFrameTypeSkip || Info.eFrameType == videoFrameTypeInvalid)
+	{
+		return;
+	}
+
+	FEncodedFramePool::FBufferRef EncodedFrame = EncodedFramePool.Acquire();
+	EncodedFrame->Reset();
+	AppendBitstream(Info, *EncodedFrame);
+	FEncodedFrameInfo FrameInfo;
+	FrameInfo.Timestamp = Frame.Timestamp;
+	FrameInfo.bKeyframe = Info.eFrameType == videoFrameTypeIDR;
+	EncodedFrameReadyCallback(FrameInfo, EncodedFrame);
+}
+
+#endif
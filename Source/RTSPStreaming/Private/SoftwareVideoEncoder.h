@@ -0,0 +1,121 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "VideoEncoder.h"
+
+#if WITH_OPENH264
+
+#include "EncodedFramePool.h"
+#include "Containers/Queue.h"
+#include "HAL/ThreadSafeBool.h"
+
+DECLARE_STATS_GROUP(TEXT("SoftwareEncoder"), STATGROUP_SoftwareEncoder, STATCAT_Advanced);
+
+class FEvent;
+class FThread;
+class ISVCEncoder;
+
+// H.264 encoder on the CPU with OpenH264, used when NVENC is missing or out of sessions, see Encoder.SoftwareFallback
+// and -RTSPStreamingSoftwareEncoder. Built when OpenH264 is dropped into ThirdParty/openh264.
+// - back buffers are scaled into a render target and copied into a ring of staging textures, a staging texture is
+//   mapped once its GPU fence passed, so the render thread never waits for the GPU; captures are dropped while
+//   the whole ring is in flight
+// - the mapped BGRA pixels are copied into a raw frame and queued for the encode thread, which converts them to
+//   I420 and encodes in real-time mode with one slice per thread of OpenH264's own thread pool
+// - EncodeBgraFrame() is the same path without the RHI, e.g. for synthetic frames on machines without a GPU
+class FSoftwareVideoEncoder : public IVideoEncoder
+{
+public:
+	FSoftwareVideoEncoder(const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
+	~FSoftwareVideoEncoder();
+
+	/**
+	* Encoder factory for the controller.
+	*/
+	static TUniquePtr<IVideoEncoder> Create(const FVideoEncoderSettings& InSettings, const FEncodedFrameReadyCallback& InEncodedFrameReadyCallback);
+
+	virtual FString GetName() const override
+	{ return TEXT("OpenH264 Software Encoder"); }
+
+	virtual bool IsSupported() const override
+	{ return bResourcesInitialized; }
+
+	/**
+	* Creates and configures the OpenH264 encoder and starts the encode thread.
+	*/
+	virtual bool Initialize() override;
+
+	/**
+	* Creates the readback ring for the encoder size.
+	*/
+	virtual void InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer) override;
+
+	virtual const TArray<uint8>& GetSpsPpsHeader() const override
+	{ return SpsPpsHeader; }
+
+	/**
+	* Queues finished readbacks for encoding and starts reading back this back buffer.
+	*/
+	virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp) override;
+
+	virtual void ForceIdrFrame() override
+	{ bForceIdrFrame = true; }
+
+	virtual bool IsAsyncEnabled() const override
+	{ return true; }
+
+	/**
+	* Queues a BGRA frame of the settings' size for encoding, any single thread. Returns false if the frame was
+	* dropped because the encode thread is behind.
+	*/
+	bool EncodeBgraFrame(const FVideoEncoderSettings& Settings, const uint8* Bgra, int32 Pitch, uint64 Timestamp);
+
+private:
+	struct FReadback
+	{
+		FTexture2DRHIRef		ResolvedBackBuffer;		// back buffer scaled to the encoder size
+		FTexture2DRHIRef		StagingTexture;			// CPU readable copy of ResolvedBackBuffer
+		FGPUFenceRHIRef			Fence;					// written after the copy
+		FVideoEncoderSettings	Settings;
+		uint64					Timestamp;
+		bool					bInFlight;
+	};
+
+	struct FRawFrame
+	{
+		TArray<uint8>			Bgra;					// rows of Settings.Width * 4 bytes
+		FVideoEncoderSettings	Settings;
+		uint64					Timestamp;
+	};
+
+	bool Configure(const FVideoEncoderSettings& Settings);	// (re)initializes the OpenH264 encoder for the settings
+	void CreateReadbacks(const FVideoEncoderSettings& Settings);
+	void MapReadbacks();									// queues the readbacks the GPU is done with, oldest first
+	void EncodeLoop();										// encodes queued raw frames
+	void EncodeRawFrame(const FRawFrame& Frame);
+
+	FVideoEncoderSettings				InitialSettings;
+	FEncodedFrameReadyCallback			EncodedFrameReadyCallback;
+	ISVCEncoder*						Encoder;
+	FVideoEncoderSettings				EncoderSettings;		// what Encoder is configured for, encode thread only
+	TArray<uint8>						SpsPpsHeader;			// with start codes, updated on resolution changes
+	FThreadSafeBool						bForceIdrFrame;
+	bool								bResourcesInitialized;
+
+	TArray<FReadback>					Readbacks;				// render thread only
+	int32								NextReadback;			// copied into next
+	int32								OldestReadback;			// mapped next
+
+	TArray<FRawFrame>					RawFrames;
+	TQueue<int32, EQueueMode::Spsc>		FreeRawFrames;			// encode thread -> capturing thread
+	TQueue<int32, EQueueMode::Spsc>		QueuedRawFrames;		// capturing thread -> encode thread
+	TArray<uint8>						I420;					// conversion output, encode thread only
+	FEncodedFramePool					EncodedFramePool;		// encode thread only
+	FEvent*								FrameQueuedEvent;
+	FThreadSafeBool						bExitRequested;
+	TUniquePtr<FThread>					EncodeThread;
+};
+
+#endif
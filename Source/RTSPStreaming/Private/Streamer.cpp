@@ -10,6 +10,21 @@
 
 #define RTPBUFFERSIZE 1280 * 720 * 10
 
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("RTCPBytesReceived"), STAT_RTSPStreaming_RTCPBytesReceived, STATGROUP_RTSPStreaming);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("ExpiredSessions"), STAT_RTSPStreaming_ExpiredSessions, STATGROUP_RTSPStreaming);
+
+static TAutoConsoleVariable<int32> CVarStreamerMaxPayloadSize(
+	TEXT("Streamer.MaxPayloadSize"),
+	1400,
+	TEXT("Largest RTP payload, NAL units that don't fit are sent as fragmentation units, bytes"),
+	ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarStreamerSessionTimeout(
+	TEXT("Streamer.SessionTimeout"),
+	60,
+	TEXT("Seconds a client can go without an RTSP request or RTCP packet before its session is ended, announced in the Session header. 0 disables"),
+	ECVF_Default);
+
 FStreamer::FStreamer(FSocket* aRTSPSocket, const FString aServerIP, TSharedPtr<FInternetAddr> aClientAddr, FServer& aServer)
 	: RTPSocket(nullptr)
 	, RTCPSocket(nullptr)
@@ -19,30 +34,77 @@ FStreamer::FStreamer(FSocket* aRTSPSocket, const FString aServerIP, TSharedPtr<F
 	, ClientRTCPPort(0)
 	, ServerRTPPort(0)
 	, ServerRTCPPort(0)
-	, SequenceNumber(0)
+	, PartialTimestamp(0)
+	, PartialSequence(0)
+	, PartialPackets(0)
 	, bTCPTransport(false)
 	, ServerIP(aServerIP)
 	, ClientIP(*aClientAddr->ToString(false))
 	, bSocketsReady(false)
-	, RTSPSessionID(rand() << 16 | rand() | 0x80000000)
-	, bValid(0)
 	, Server(aServer)
+	, Priority(EClientPriority::Viewer)
+	, MaxFrameRate(0)
+	, FirstRendition(0)
+	, RequestedRendition(INDEX_NONE)
+	, Rendition(INDEX_NONE)
+	, bAdmitted(false)
+	, LastActivityMs(FTimerWheel::GetTimeMs())
+	, TimeoutTimer(0)
+	, Session(*this, static_cast<uint32>(rand() << 16 | rand() | 0x80000000))
 	, ExitReceive(false)
 	, bStreamerReady(false)
 	, bDestroyStreamer(false)
-	, Thread((TEXT("Client Session: %s"), *aClientAddr->ToString(true)), [this] { Run(); })
-{}
+{
+	//streamers are created with the server ClientListMt held
+	ScheduleTimeoutCheck();
+	RenditionSelector.Reset(Server.GetNumRenditions(), 0, FTimerWheel::GetTimeMs());
+
+	INetworkBackend& Backend = Server.GetNetworkBackend();
+	if (Backend.IsCompletionBased())
+	{
+		//RTSP messages arrive on the server network thread
+		Backend.RecvMultishot(RTSPSocket, [this](const uint8* Data, int32 Size) { ReceiveCompletion(Data, Size); });
+	}
+	else
+	{
+		Thread = MakeUnique<FThread>(*FString::Printf(TEXT("Client Session: %s"), *aClientAddr->ToString(true)), [this] { Run(); }, FThreadSettings::FromConsoleVariables(TEXT("Streamer.NetworkThread")));
+	}
+}
+
+void FStreamer::CancelTimers()
+{
+	if (TimeoutTimer)
+	{
+		Server.CancelTimer(TimeoutTimer);
+		TimeoutTimer = 0;
+	}
+}
 
 FStreamer::~FStreamer()
 {
+	//the server cancelled the timer with ClientListMt held when it took this out of its list, or the timers stopped
+	CancelTimers();
+
 	{
 		FScopeLock Lock(&StreamerMt);
 		ExitReceive = true;
 		//UE_LOG(RTSPStreaming, Log, TEXT("%d: ExitReceive(t) DTOR CALLED"), ClientRTSPPort);
 	}
 
-	//ends thread
-	Thread.Join();
+	//ends thread, or stops completions which run on the network thread this is destroyed on
+	if (Thread)
+	{
+		Thread->Join();
+	}
+	else
+	{
+		INetworkBackend& Backend = Server.GetNetworkBackend();
+		Backend.Cancel(RTSPSocket);
+		if (RTCPSocket)
+		{
+			Backend.Cancel(RTCPSocket);
+		}
+	}
 	
 	//destroys sending sockets
 	{
@@ -59,6 +121,7 @@ FStreamer::~FStreamer()
 			RTCPSocket = nullptr;
 		}
 
+		InterleavedWriter.Reset();
 		if (RTSPSocket)
 		{
 			ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(RTSPSocket);
@@ -69,7 +132,7 @@ FStreamer::~FStreamer()
 	//sets status flags
 	{
 		FScopeLock Lock(&StreamerMt);
-		bStreamerReady = false;
+		SetPlaying(false);
 		bDestroyStreamer = true;
 		//UE_LOG(RTSPStreaming, Log, TEXT("%d: bStreamerReady(f), bDestroyStreamer(t) DTOR CLOSED"), ClientRTSPPort);
 	}
@@ -82,29 +145,17 @@ bool FStreamer::operator==(const FStreamer& rhs) const
 		(this->ClientRTSPPort == rhs.ClientRTSPPort));
 }
 
-//resets parsing arrays
-void FStreamer::Init()
-{
-	RTSPCmdType = RTSP_UNKNOWN;
-	memset(URLPreSuffix, 0x00, sizeof(URLPreSuffix));
-	memset(URLSuffix, 0x00, sizeof(URLSuffix));
-	memset(CSeq, 0x00, sizeof(CSeq));
-	memset(URLHostPort, 0x00, sizeof(URLHostPort));
-	ContentLength = 0;
-}
-
 void FStreamer::Run()
 {
-	Init();
 	Receive();
 	//sets status flags
 	{
 		FScopeLock Lock(&StreamerMt);
-		bStreamerReady = false;
+		SetPlaying(false);
 		bDestroyStreamer = true;
 		//UE_LOG(RTSPStreaming, Log, TEXT("%d: bStreamerReady(f), bDestroyStreamer(t) THREAD CLOSED"), ClientRTSPPort);
 	}
-	while (!ExitReceive) {}
+	//Receive() only returns once ExitReceive is set, the destructor joins this thread
 }
 
 void FStreamer::Receive()
@@ -114,52 +165,26 @@ void FStreamer::Receive()
 		//creates sending buffer
 		uint8 BitBuf[2000];
 		int32 BytesRead = 0;
+		//receives RTSP message, without holding StreamerMt as the reaper needs it to end a quiet session.
+		//RTSPSocket is only destroyed after this thread is joined, a reaped session's socket is shut down to unblock Recv
+		if (!RTSPSocket->Recv(BitBuf, 2000, BytesRead) || BytesRead <= 0)
 		{
-			//receives RTSP message
-			FScopeLock Lock(&StreamerMt);
-			if (!RTSPSocket->Recv(BitBuf, 2000, BytesRead))
+			//sets status flags if streamer disconnects
+			UE_LOG(RTSPStreaming, Log, TEXT("Server couldn't Recv pending data"));
 			{
-				//sets status flags if streamer disconnects
-				UE_LOG(RTSPStreaming, Log, TEXT("Server couldn't Recv pending data"));
-				{
-					bStreamerReady = false;
-					bDestroyStreamer = true;
-					ExitReceive = true;
-				}
-				continue;
-			}
-		}
-
-		//Convert int8 array to char array
-		char* RecvBuf = reinterpret_cast<char*>(BitBuf);
-
-		//filter away everything which seems not to be an RTSP command: O-ption, D-escribe, S-etup, P-lay, T-eardown
-		if ((RecvBuf[0] == 'O') || (RecvBuf[0] == 'D') || (RecvBuf[0] == 'S') || (RecvBuf[0] == 'P') || (RecvBuf[0] == 'T'))
-		{
-			//handles message replies and setup
-			RTSP_CMD_TYPES C = Handle_RTSPRequest(RecvBuf, BytesRead);
-			if (C == RTSP_PLAY)
-			{
-				//signals server to start passing frames here
-				if (bSocketsReady)
-				{
-					FScopeLock Lock(&StreamerMt);
-					bStreamerReady = true;
-					Server.StartStreaming();
-				}
-			}
-			else if (C == RTSP_TEARDOWN)
-			{
-				//ends streaming
 				FScopeLock Lock(&StreamerMt);
+				SetPlaying(false);
+				bDestroyStreamer = true;
 				ExitReceive = true;
-				//UE_LOG(RTSPStreaming, Log, TEXT("%d: ExitReceive(t) TEARDOWN"), ClientRTSPPort);
 			}
+			continue;
 		}
+
+		HandleRTSPMessage(reinterpret_cast<char*>(BitBuf), BytesRead);
 	}
 	{
 		FScopeLock Lock(&StreamerMt);
-		bStreamerReady = false;
+		SetPlaying(false);
 		//UE_LOG(RTSPStreaming, Log, TEXT("%d: bStreamerReady(f) BROKE RECEIVE"), ClientRTSPPort);
 	}
 	if (!ExitReceive)
@@ -168,77 +193,277 @@ void FStreamer::Receive()
 	}
 }
 
-bool FStreamer::Send(uint64 Timestamp, const uint8* Data, uint32 Size)
+void FStreamer::ReceiveCompletion(const uint8* Data, int32 Size)
 {
-	int RTPPacketSize = Size + 12;
+	if (Size > 0)
+	{
+		HandleRTSPMessage(reinterpret_cast<const char*>(Data), Size);
+	}
+	else
+	{
+		UE_LOG(RTSPStreaming, Log, TEXT("Client disconnected"));
+	}
 
-	//creates send buffer
-	uint8* RTPBuf = new uint8[RTPBUFFERSIZE + 16];
-	TSharedRef<FInternetAddr> RecvAddr = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
+	//the server destroys the streamer on its next poll
+	if (Size <= 0 || ExitReceive)
+	{
+		FScopeLock Lock(&StreamerMt);
+		ExitReceive = true;
+		SetPlaying(false);
+		bDestroyStreamer = true;
+	}
+}
+
+void FStreamer::SetPlaying(bool bPlaying)
+{
+	FScopeLock Lock(&StreamerMt);
+	if (bStreamerReady == bPlaying)
+	{
+		return;
+	}
+	bStreamerReady = bPlaying;
+	Server.SetClientPlaying(bPlaying);
+}
+
+int32 FStreamer::GetStartRendition()
+{
+	FScopeLock Lock(&RTPSocketMt);
+	return FirstRendition + (RequestedRendition != INDEX_NONE ? RequestedRendition : RenditionSelector.GetRendition());
+}
+
+bool FStreamer::UpdateRendition(int32 NumRenditions)
+{
+	FScopeLock Lock(&RTPSocketMt);
+
+	//the selector steps up here, it steps down as congestion feedback comes in
+	int32 NewRendition = RequestedRendition;
+	if (NewRendition == INDEX_NONE)
+	{
+		RenditionSelector.Update(FTimerWheel::GetTimeMs());
+		NewRendition = RenditionSelector.GetRendition();
+	}
+	NewRendition = FirstRendition + FMath::Clamp(NewRendition, 0, NumRenditions - 1);
 
-	// get client address for UDP transport
+	if (NewRendition == Rendition.GetValue())
+	{
+		return false;
+	}
+	Rendition.Set(NewRendition);
+	return true;
+}
+
+void FStreamer::OnEgressDrop()
+{
+	FScopeLock Lock(&RTPSocketMt);
+	RenditionSelector.OnEgressDrop(FTimerWheel::GetTimeMs());
+}
+
+void FStreamer::OnClientActivity()
+{
+	LastActivityMs.Set(FTimerWheel::GetTimeMs());
+}
+
+void FStreamer::ScheduleTimeoutCheck()
+{
+	//activity doesn't touch the timer, it's pushed out when it fires early. Disabled timeouts are rechecked once a second
+	const int32 TimeoutSeconds = CVarStreamerSessionTimeout.GetValueOnAnyThread();
+	int64 DelayMs = 1000;
+	if (TimeoutSeconds > 0)
+	{
+		DelayMs = LastActivityMs.GetValue() + TimeoutSeconds * 1000ll - static_cast<int64>(FTimerWheel::GetTimeMs());
+	}
+	TimeoutTimer = Server.AddTimer(static_cast<uint32>(FMath::Max<int64>(DelayMs, 1)), [this]() { OnTimeoutTimer(); });
+}
+
+void FStreamer::OnTimeoutTimer()
+{
+	TimeoutTimer = 0;
+	if (bDestroyStreamer)
+	{
+		return;
+	}
+
+	const int32 TimeoutSeconds = CVarStreamerSessionTimeout.GetValueOnAnyThread();
+	const int64 QuietMs = static_cast<int64>(FTimerWheel::GetTimeMs()) - LastActivityMs.GetValue();
+	if (TimeoutSeconds <= 0 || QuietMs < TimeoutSeconds * 1000ll)
+	{
+		ScheduleTimeoutCheck();
+		return;
+	}
+
+	UE_LOG(RTSPStreaming, Log, TEXT("%d: Session %u timed out after %lld ms without RTSP or RTCP from the client"), ClientRTSPPort, Session.GetSessionId(), QuietMs);
+	INC_DWORD_STAT(STAT_RTSPStreaming_ExpiredSessions);
+	{
+		FScopeLock Lock(&StreamerMt);
+		SetPlaying(false);
+		ExitReceive = true;
+		bDestroyStreamer = true;
+	}
+
+	//unblocks the receive thread, the server joins it when it destroys this streamer
+	FScopeLock Lock(&RTSPSocketMt);
+	if (RTSPSocket)
+	{
+		RTSPSocket->Shutdown(ESocketShutdownMode::ReadWrite);
+	}
+}
+
+void FStreamer::ReceiveRTCP(const uint8* Data, int32 Size)
+{
+	INC_DWORD_STAT_BY(STAT_RTSPStreaming_RTCPBytesReceived, FMath::Max(Size, 0));
+	if (Size > 0)
+	{
+		OnClientActivity();
+	}
+
+	//receiver reports confirm path MTU probes, they and NACKs tell which frame the client lost
+	bool bLoss = false;
+	uint32 LostTimestamp = 0;
+	FRTCPReportBlock Block;
+	if (Size > 0 && ParseRTCPReportBlock(Data, Size, Packetizer.GetSSRC(), Block))
 	{
 		FScopeLock Lock(&RTPSocketMt);
-		if (!RTSPSocket) { return false; }
-		RTSPSocket->GetPeerAddress(*RecvAddr);
-	}
-	RecvAddr->SetPort(ClientRTPPort);
-	//sets buffer to 0x00
-	memset(RTPBuf, 0x00, sizeof(RTPBuf));
-
-	//builds packet
-	// Prepare the first 4 byte of the packet. This is the RTP over RTSP header in case of TCP based transport
-	RTPBuf[0] = '$';									// magic number
-	RTPBuf[1] = 0;										// RTP channel of RTSP connection
-	RTPBuf[2] = (RTPPacketSize & 0x0000FF00) >> 8;		// size of packet
-	RTPBuf[3] = (RTPPacketSize & 0x000000FF);			// size of packet
-	// Prepare the 12 byte RTP header
-	RTPBuf[4] = 0x80;									// RTP Version - 0b10, 0b0 - Padding, 0b0 - Extension, 0b0000 - CSRC count
-	RTPBuf[5] = 0xE0;									// Marker - 0b1, H.264 payload - 96 (dynamic)
-	RTPBuf[7] = SequenceNumber & 0x0FF;					// sequence counter
-	RTPBuf[6] = SequenceNumber >> 8;					// sequence counter
-	RTPBuf[8] = (Timestamp & 0x00000000FF000000) >> 24; // timestamp
-	RTPBuf[9] = (Timestamp & 0x0000000000FF0000) >> 16;	// timestamp
-	RTPBuf[10] = (Timestamp & 0x000000000000FF00) >> 8;	// timestamp
-	RTPBuf[11] = (Timestamp & 0x00000000000000FF);		// timestamp
-	RTPBuf[12] = 0x13;									// 4 byte SSRC (sychronization source identifier)
-	RTPBuf[13] = 0xf9;									// we just an arbitrary number here to keep it simple
-	RTPBuf[14] = 0x7e;
-	RTPBuf[15] = 0x67;
-
-	//appends frame to packet
-	memcpy(&RTPBuf[16], Data, Size);
-
-	//prepare the packet counter for the next packet
-	SequenceNumber++;                              
-
-	// RTP over RTSP - send the buffer + 4 byte additional header
+		PathMtu.OnReceiverReport(Block, FPlatformTime::Seconds());
+		bLoss = LossTracker.OnReceiverReport(Block, LostTimestamp);
+		RenditionSelector.OnReceiverReport(Block.FractionLost, FTimerWheel::GetTimeMs());
+	}
+
+	FRTCPFeedback Feedback;
+	if (Size > 0 && ParseRTCPFeedback(Data, Size, Packetizer.GetSSRC(), Feedback))
+	{
+		if (Feedback.bPictureLoss)
+		{
+			Server.OnClientPictureLoss(GetRendition());
+		}
+		if (!bLoss && !Feedback.LostSequences.empty())
+		{
+			FScopeLock Lock(&RTPSocketMt);
+			bLoss = LossTracker.OnNack(Feedback.LostSequences, LostTimestamp);
+		}
+	}
+
+	if (bLoss)
+	{
+		Server.OnClientLoss(GetRendition(), LostTimestamp);
+	}
+}
+
+void FStreamer::PollRTCP()
+{
+	FScopeLock Lock(&RTCPSocketMt);
+	if (!RTCPSocket)
+	{
+		return;
+	}
+
+	//the socket is non-blocking, reads whatever arrived since the last frame
+	TSharedRef<FInternetAddr> FromAddr = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
+	uint8 Buffer[1500];
+	int32 BytesRead = 0;
+	while (RTCPSocket->RecvFrom(Buffer, sizeof(Buffer), BytesRead, *FromAddr) && BytesRead > 0)
+	{
+		ReceiveRTCP(Buffer, BytesRead);
+	}
+}
+
+void FStreamer::HandleRTSPMessage(const char* RecvBuf, int32 BytesRead)
+{
+	//anything on the RTSP connection keeps the session alive, including interleaved RTCP
+	OnClientActivity();
+
+	//the session answers the request and starts or stops streaming through SetPlaying()
+	if (BytesRead > 0 && Session.HandleMessage(RecvBuf, static_cast<uint32>(BytesRead)) == ERTSPMethod::Teardown)
+	{
+		//ends streaming
+		FScopeLock Lock(&StreamerMt);
+		ExitReceive = true;
+		//UE_LOG(RTSPStreaming, Log, TEXT("%d: ExitReceive(t) TEARDOWN"), ClientRTSPPort);
+	}
+}
+
+bool FStreamer::Send(uint64 Timestamp, const FEncodedFrameRef& Frame, bool bEndOfFrame)
+{
+	const uint32 MaxPayloadSize = FMath::Max(CVarStreamerMaxPayloadSize.GetValueOnAnyThread(), 64);
+
+	// RTP over RTSP - frame goes out in one gather write with the 4 byte interleave headers
 	if (bTCPTransport) 
 	{
+		//splits the frame into RTP packets which reference the frame payload
+		Packetizer.Packetize(static_cast<uint32>(Timestamp), Frame->GetData(), Frame->Num(), MaxPayloadSize, Packets, bEndOfFrame);
+
 		FScopeLock Lock(&RTSPSocketMt);
-		if (RTSPSocket)
+		if (RTSPSocket && InterleavedWriter)
 		{
-			int BytesSent = 0;
-			int& sent = BytesSent;
-			RTSPSocket->Send(RTPBuf, RTPPacketSize + 4, sent);
-			delete[] RTPBuf;
-			return true;
+			return InterleavedWriter->Write(Packets, 0, Frame);
 		}
 	}
-	// UDP - send but skip the 4 byte RTP over RTSP header
+	// UDP - one datagram per RTP packet
 	else              
 	{
+		TSharedRef<FInternetAddr> RecvAddr = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
+
+		// get client address for UDP transport
+		{
+			FScopeLock Lock(&RTSPSocketMt);
+			if (!RTSPSocket) { return false; }
+			RTSPSocket->GetPeerAddress(*RecvAddr);
+		}
+		RecvAddr->SetPort(ClientRTPPort);
+
 		FScopeLock Lock(&RTPSocketMt);
 		if (RTPSocket)
 		{
-			int BytesSent = 0;
-			int& sent = BytesSent;
-			RTPSocket->SendTo(&RTPBuf[4], RTPPacketSize, sent, *RecvAddr);
-			delete[] RTPBuf;
+			INetworkBackend& Backend = Server.GetNetworkBackend();
+			const double Now = FPlatformTime::Seconds();
+
+			//RTCP keeps the session alive and confirms path MTU probes, ICMP feedback is taken in before packetizing
+			if (!Backend.IsCompletionBased())
+			{
+				PollRTCP();
+			}
+			if (PathMtu.IsEnabled())
+			{
+				PathMtu.ReceiveErrors(RTPSocket, Now);
+			}
+			//the loss tracker is told about a frame sent in parts once its last part went out, a frame whose last part
+			//never came is recorded as it is when the next one starts
+			if (PartialPackets && PartialTimestamp != static_cast<uint32>(Timestamp))
+			{
+				LossTracker.OnFrameSent(PartialTimestamp, PartialSequence, PartialPackets, 0);
+				PartialPackets = 0;
+			}
+			if (!PartialPackets)
+			{
+				PartialTimestamp = static_cast<uint32>(Timestamp);
+				PartialSequence = Packetizer.GetSequenceNumber();
+			}
+			Packetizer.Packetize(static_cast<uint32>(Timestamp), Frame->GetData(), Frame->Num(), PathMtu.IsEnabled() ? PathMtu.GetMaxPayloadSize() : MaxPayloadSize, Packets, bEndOfFrame);
+
+			//pads the access unit with a filler packet of the probed size
+			uint16 NumProbes = 0;
+			const uint32 ProbeSize = PathMtu.IsEnabled() && bEndOfFrame ? PathMtu.GetProbeSize(Now) : 0;
+			if (ProbeSize)
+			{
+				PathMtu.OnProbeSent(Packetizer.GetSequenceNumber(), Now);
+				Packetizer.AppendFiller(static_cast<uint32>(Timestamp), ProbeSize - IPV4_UDP_HEADER_SIZE - RTP_HEADER_SIZE, Packets);
+				NumProbes = 1;
+			}
+			PartialPackets += static_cast<uint16>(Packets.size());
+			if (bEndOfFrame)
+			{
+				LossTracker.OnFrameSent(PartialTimestamp, PartialSequence, PartialPackets, NumProbes);
+				PartialPackets = 0;
+			}
+
+			//the server flushes the backend once all clients queued the frame
+			for (FRTPPacket& Packet : Packets)
+			{
+				const FIoSlice Slices[2] = { { Packet.GetRTPHeader(), Packet.HeaderSize }, { Packet.Payload, Packet.PayloadSize } };
+				Backend.QueueSendTo(RTPSocket, *RecvAddr, Slices, 2);
+			}
 			return true;
 		}
 	}
-	delete[] RTPBuf;
 	return false;
 }
 
@@ -252,7 +477,17 @@ void FStreamer::InitTransport(uint16 aRTPPort, uint16 aRTCPPort, bool TCP)
 	ClientRTCPPort = aRTCPPort;
 	bTCPTransport = TCP;
 
-	if (!bTCPTransport)
+	if (bTCPTransport)
+	{   // RTP goes over the RTSP connection, no sockets to bind
+		FScopeLock Lock(&RTSPSocketMt);
+		if (RTSPSocket && !InterleavedWriter)
+		{
+			InterleavedWriter = MakeUnique<FInterleavedWriter>(RTSPSocket);
+			InterleavedWriter->Configure();
+		}
+		bSocketsReady = RTSPSocket != nullptr;
+	}
+	else
 	{   // allocate port pairs for RTP/RTCP ports in UDP transport mode
 		for (uint16 P = 6970; P < 0xFFFE; P += 2)
 		{
@@ -289,6 +524,20 @@ void FStreamer::InitTransport(uint16 aRTPPort, uint16 aRTCPPort, bool TCP)
 					ServerRTPPort = P;
 					ServerRTCPPort = P + 1;
 					bSocketsReady = true;
+
+					//starts at the globally configured packet size and probes upward from there
+					INetworkBackend& Backend = Server.GetNetworkBackend();
+					{
+						FScopeLock Lock(&RTPSocketMt);
+						const uint32 InitialMtu = FMath::Max(CVarStreamerMaxPayloadSize.GetValueOnAnyThread(), 64) + RTP_HEADER_SIZE + IPV4_UDP_HEADER_SIZE;
+						const uint32 MaxSupportedMtu = FMath::Min<uint32>(Backend.GetMaxDatagramSize(), RTP_HEADER_SIZE + RTP_MAX_FILLER_SIZE) + IPV4_UDP_HEADER_SIZE;
+						PathMtu.Start(RTPSocket, InitialMtu, MaxSupportedMtu);
+					}
+
+					if (Backend.IsCompletionBased())
+					{
+						Backend.RecvMultishot(RTCPSocket, [this](const uint8* Data, int32 Size) { ReceiveRTCP(Data, Size); });
+					}
 					break;
 				}
 
@@ -307,417 +556,129 @@ void FStreamer::InitTransport(uint16 aRTPPort, uint16 aRTCPPort, bool TCP)
 	}
 }
 
-bool FStreamer::ParseRTSPRequest(char const* aRequest, unsigned aRequestSize)
+bool FStreamer::DescribeStream(const char* Path, FRTSPStreamDescription& OutStream)
 {
-	char     CmdName[RTSP_PARAM_STRING_MAX];
-	char     CurRequest[RTSP_BUFFER_SIZE];
-	unsigned CurRequestSize;
-
-	Init();
-	CurRequestSize = aRequestSize;
-	memcpy(CurRequest, aRequest, aRequestSize);
-
-	// check whether the request contains information about the RTP/RTCP UDP client ports (SETUP command)
-	char* ClientPortPtr;
-	char* TmpPtr;
-	char  CP[1024];
-	char* pCP;
-
-	ClientPortPtr = strstr(CurRequest, "client_port");
-	if (ClientPortPtr != nullptr)
+	EVideoCodec Codec;
+	const int32 MountRendition = Server.FindMount(ANSI_TO_TCHAR(Path), Codec);
+	if (MountRendition == INDEX_NONE)
 	{
-		TmpPtr = strstr(ClientPortPtr, "\r\n");
-		if (TmpPtr != nullptr)
-		{
-			TmpPtr[0] = 0x00;
-			strcpy_s(CP, ClientPortPtr);
-			pCP = strstr(CP, "=");
-			if (pCP != nullptr)
-			{
-				pCP++;
-				strcpy_s(CP, pCP);
-				pCP = strstr(CP, "-");
-				if (pCP != nullptr)
-				{
-					pCP[0] = 0x00;
-					ClientRTPPort = atoi(CP);
-					ClientRTCPPort = ClientRTPPort + 1;
-				}
-			}
-		}
-	}
-
-	// Read everything up to the first space as the command name
-	bool parseSucceeded = false;
-	unsigned i;
-	for (i = 0; i < sizeof(CmdName) - 1 && i < CurRequestSize; ++i)
-	{
-		char c = CurRequest[i];
-		if (c == ' ' || c == '\t')
-		{
-			parseSucceeded = true;
-			break;
-		}
-		CmdName[i] = c;
-	}
-	CmdName[i] = '\0';
-	if (!parseSucceeded) return false;
-
-	// find out the command type
-	if (strstr(CmdName, "OPTIONS") != nullptr)			RTSPCmdType = RTSP_OPTIONS;			else
-	if (strstr(CmdName, "DESCRIBE") != nullptr)			RTSPCmdType = RTSP_DESCRIBE;		else
-	if (strstr(CmdName, "SETUP") != nullptr)			RTSPCmdType = RTSP_SETUP;			else
-	if (strstr(CmdName, "PLAY") != nullptr)				RTSPCmdType = RTSP_PLAY;			else
-	if (strstr(CmdName, "TEARDOWN") != nullptr)			RTSPCmdType = RTSP_TEARDOWN;		else
-	if (strstr(CmdName, "PAUSE") != nullptr)			RTSPCmdType = RTSP_PAUSE;			else
-	if (strstr(CmdName, "GET_PARAMETER") != nullptr)	RTSPCmdType = RTSP_GET_PARAMETER;	else
-	if (strstr(CmdName, "SET_PARAMETER") != nullptr)	RTSPCmdType = RTSP_SET_PARAMETER;
-
-	// check whether the request contains transport information (UDP or TCP)
-	if (RTSPCmdType == RTSP_SETUP)
-	{
-		TmpPtr = strstr(CurRequest, "RTP/AVP/TCP");
-		if (TmpPtr != nullptr) bTCPTransport = true; else bTCPTransport = false;
-	};
-
-	// Skip over the prefix of any "RTSP://" or "RTSP:/" URL that follows:
-	unsigned j = i + 1;
-	while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j; // skip over any additional white space
-	for (; (int)j < (int)(CurRequestSize - 8); ++j)
-	{
-		if ((CurRequest[j] == 'r' || CurRequest[j] == 'R') &&
-			(CurRequest[j + 1] == 't' || CurRequest[j + 1] == 'T') &&
-			(CurRequest[j + 2] == 's' || CurRequest[j + 2] == 'S') &&
-			(CurRequest[j + 3] == 'p' || CurRequest[j + 3] == 'P') &&
-			CurRequest[j + 4] == ':' && CurRequest[j + 5] == '/')
-		{
-			j += 6;
-			if (CurRequest[j] == '/')
-			{   // This is a "RTSP://" URL; skip over the host:port part that follows:
-				++j;
-				unsigned uidx = 0;
-				while (j < CurRequestSize && CurRequest[j] != '/' && CurRequest[j] != ' ')
-				{   // extract the host:port part of the URL here
-					URLHostPort[uidx] = CurRequest[j];
-					uidx++;
-					++j;
-				}
-			}
-			else --j;
-			i = j;
-			break;
-		}
-	}
-
-	// Look for the URL suffix (before the following "RTSP/"):
-	parseSucceeded = false;
-	for (unsigned k = i + 1; (int)k < (int)(CurRequestSize - 5); ++k)
-	{
-		if (CurRequest[k] == 'R' && CurRequest[k + 1] == 'T' &&
-			CurRequest[k + 2] == 'S' && CurRequest[k + 3] == 'P' &&
-			CurRequest[k + 4] == '/')
-		{
-			while (--k >= i && CurRequest[k] == ' ') {}
-			unsigned k1 = k;
-			while (k1 > i && CurRequest[k1] != '/') --k1;
-			if (k - k1 + 1 > sizeof(URLSuffix)) return false;
-			unsigned n = 0, k2 = k1 + 1;
-
-			while (k2 <= k) URLSuffix[n++] = CurRequest[k2++];
-			URLSuffix[n] = '\0';
-
-			if (k1 - i > sizeof(URLPreSuffix)) return false;
-			n = 0; k2 = i + 1;
-			while (k2 <= k1 - 1) URLPreSuffix[n++] = CurRequest[k2++];
-			URLPreSuffix[n] = '\0';
-			i = k + 7;
-			parseSucceeded = true;
-			break;
-		}
+		UE_LOG(RTSPStreaming, Log, TEXT("%d: No stream mounted at %s"), ClientRTSPPort, ANSI_TO_TCHAR(Path));
+		return false;
 	}
-	if (!parseSucceeded) return false;
 
-	// Look for "CSeq:", skip whitespace, then read everything up to the next \r or \n as 'CSeq':
-	parseSucceeded = false;
-	for (j = i; (int)j < (int)(CurRequestSize - 5); ++j)
+	// a playing client keeps the codec it is sent, the packetizer can't change under its frames
 	{
-		if (CurRequest[j] == 'C' && CurRequest[j + 1] == 'S' &&
-			CurRequest[j + 2] == 'e' && CurRequest[j + 3] == 'q' &&
-			CurRequest[j + 4] == ':')
+		FScopeLock Lock(&RTPSocketMt);
+		if (!bStreamerReady)
 		{
-			j += 5;
-			while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j;
-			unsigned n;
-			for (n = 0; n < sizeof(CSeq) - 1 && j < CurRequestSize; ++n, ++j)
-			{
-				char c = CurRequest[j];
-				if (c == '\r' || c == '\n')
-				{
-					parseSucceeded = true;
-					break;
-				}
-				CSeq[n] = c;
-			}
-			CSeq[n] = '\0';
-			break;
+			FirstRendition = MountRendition;
+			Packetizer.SetCodec(Codec);
 		}
 	}
-	if (!parseSucceeded) return false;
 
-	// Also: Look for "Content-Length:" (optional)
-	for (j = i; (int)j < (int)(CurRequestSize - 15); ++j)
-	{
-		if (CurRequest[j] == 'C' && CurRequest[j + 1] == 'o' &&
-			CurRequest[j + 2] == 'n' && CurRequest[j + 3] == 't' &&
-			CurRequest[j + 4] == 'e' && CurRequest[j + 5] == 'n' &&
-			CurRequest[j + 6] == 't' && CurRequest[j + 7] == '-' &&
-			(CurRequest[j + 8] == 'L' || CurRequest[j + 8] == 'l') &&
-			CurRequest[j + 9] == 'e' && CurRequest[j + 10] == 'n' &&
-			CurRequest[j + 11] == 'g' && CurRequest[j + 12] == 't' &&
-			CurRequest[j + 13] == 'h' && CurRequest[j + 14] == ':')
-		{
-			j += 15;
-			while (j < CurRequestSize && (CurRequest[j] == ' ' || CurRequest[j] == '\t')) ++j;
-			unsigned num;
-			if (sscanf_s(&CurRequest[j], "%u", &num) == 1) ContentLength = num;
-		}
-	}
+	// parameter sets of the rendition the client starts with, it's sent new ones in-band when it switches
+	OutStream.Codec = Packetizer.GetCodec();
+	Server.GetParameterSets(GetStartRendition(), OutStream.ParameterSets);
+	UE_LOG(RTSPStreaming, Log, TEXT("%d: Client described %s, %s"), ClientRTSPPort, ANSI_TO_TCHAR(Path), ANSI_TO_TCHAR(VideoCodecToString(OutStream.Codec)));
 	return true;
 }
 
-RTSP_CMD_TYPES FStreamer::Handle_RTSPRequest(char const* aRequest, unsigned aRequestSize)
+bool FStreamer::Admit()
 {
-	if (ParseRTSPRequest(aRequest, aRequestSize))
-	{
-		switch (RTSPCmdType)
-		{
-		case RTSP_OPTIONS:			{  Handle_RTSPOPTION();			break;	}
-		case RTSP_DESCRIBE:			{  Handle_RTSPDESCRIBE();		break;	}
-		case RTSP_SETUP:			{  Handle_RTSPSETUP();			break;	}
-		case RTSP_PLAY:				{  Handle_RTSPPLAY();			break;	}
-		case RTSP_PAUSE:			{  Handle_RTSPPAUSE();			break;	}
-		case RTSP_GET_PARAMETER:	{  Handle_RTSPGET_PARAMETER();  break;	}
-		case RTSP_SET_PARAMETER:	{  Handle_RTSPSET_PARAMETER();  break;	}
-		case RTSP_TEARDOWN:			{  Handle_RTSPTEARDOWN();		break;	}
-		default:					{										}
-		}
-	}
-	return RTSPCmdType;
+	return Server.Admit(*this);
 }
 
-void FStreamer::Handle_RTSPOPTION()
+std::string FStreamer::GetAdmissionRedirect()
 {
-	char Response[1024];
-	UpdateDateHeader();
-	_snprintf_s(Response, sizeof(Response),
-		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
-		"Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE\r\n"
-		"%s\r\n\r\n",
-		CSeq,
-		Date);
-
-	//send(RTSPSocket, Response, strlen(Response), 0);
-	int32 BytesSent = 0;
-	int& sent = BytesSent;
-	{
-		FScopeLock Lock(&RTSPSocketMt); 
-		if (!RTSPSocket) { return; }
-		RTSPSocket->Send(reinterpret_cast<uint8*>(Response), strlen(Response), sent);
-	}
+	return TCHAR_TO_ANSI(*Server.GetAdmissionRedirect());
 }
 
-void FStreamer::Handle_RTSPDESCRIBE()
+bool FStreamer::SetupTransport(FRTSPTransport& Transport)
 {
-	char Response[1024];
-	char   SDPBuf[1024];
-	char   URLBuf[1024];
-
-	// check whether we know a stream with the URL which is requested
-	bValid = 0;        // invalid URL
-	if ((strcmp(URLPreSuffix, "stream") == 0) && (strcmp(URLSuffix, "1") == 0)) bValid = 1;
-	if (!bValid)
-	{   // Stream not available
-		UpdateDateHeader();
-		_snprintf_s(Response, sizeof(Response),
-			"RTSP/1.0 404 Stream Not Found\r\nCSeq: %s\r\n%s\r\n",
-			CSeq,
-			Date);
-
-		//send(RTSPSocket, Response, strlen(Response), 0);
-		int32 BytesSent;
-		int& sent = BytesSent;
-		{
-			FScopeLock Lock(&RTSPSocketMt);
-			if (!RTSPSocket) { return; }
-			RTSPSocket->Send(reinterpret_cast<uint8*>(Response), strlen(Response), sent);
-		}
-		return;
-	}
-
-	// simulate DESCRIBE server response
-	char OBuf[256];
-	char* ColonPtr;
-	strcpy_s(OBuf, URLHostPort);
-	ColonPtr = strstr(OBuf, ":");
-	if (ColonPtr != nullptr) ColonPtr[0] = 0x00;
-
-	_snprintf_s(SDPBuf, sizeof(SDPBuf),
-		"v=0\r\n"
-		"o=- %d 1 IN IP4 %s\r\n"
-		"s=Session streamed with RTSPStreaming\r\n"
-		"i=RTSP-server\r\n"
-		"t=0 0\r\n"
-		"a=type:broadcast\r\n"
-		"a=range:npt=now-\r\n"
-		"m=video 0 RTP/AVP 96\r\n"
-		"c=IN IP4 0.0.0.0\r\n"
-		"a=rtpmap:96 H264/90000\r\n"
-		"a=fmtp:96 level-asymmetry-allowed=1;packetization mode=1;profile-level-id=42e033\r\n"
-		"a=framerate:60.000000\r\n",
-		rand(),
-		OBuf);
-	char StreamName[64];
-	strcpy_s(StreamName, "stream");
-	_snprintf_s(URLBuf, sizeof(URLBuf),
-		"RTSP://%s/%s",
-		URLHostPort,
-		StreamName);
-	UpdateDateHeader();
-	_snprintf_s(Response, sizeof(Response),
-		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
-		"Content-Type: application/sdp\r\n"
-		"Content-Base: %s/\r\n"
-		"Server: RTSPStreaming RTSP Server"
-		"%s\r\n"
-		"Content-Length: %zd\r\n\r\n"
-		"%s",
-		CSeq,
-		URLBuf,
-		Date,
-		strlen(SDPBuf),
-		SDPBuf);
-
-	//send(RTSPSocket, Response, strlen(Response), 0);
-	int32 BytesSent;
-	int& sent = BytesSent;
+	// a repeated SETUP keeps the sockets bound by the first one
+	if (!bSocketsReady || Transport.bTCP != bTCPTransport)
 	{
-		FScopeLock Lock(&RTSPSocketMt);
-		if (!RTSPSocket) { return; }
-		RTSPSocket->Send(reinterpret_cast<uint8*>(Response), strlen(Response), sent);
+		InitTransport(Transport.ClientRTPPort, Transport.ClientRTCPPort, Transport.bTCP);
 	}
+
+	Transport.ServerRTPPort = ServerRTPPort;
+	Transport.ServerRTCPPort = ServerRTCPPort;
+	Transport.ClientIP = TCHAR_TO_ANSI(*ClientIP);
+	Transport.ServerIP = TCHAR_TO_ANSI(*ServerIP);
+	return bSocketsReady;
 }
 
-void FStreamer::Handle_RTSPSETUP()
+int32 FStreamer::GetSessionTimeout()
 {
-	char Response[1024];
-	char Transport[255];
-
-	// init RTP streamer transport type (UDP or TCP) and ports for UDP transport
-	InitTransport(ClientRTPPort, ClientRTCPPort, bTCPTransport);
+	// clients keep alive at a fraction of this, announce the default when timeouts are disabled
+	const int32 TimeoutSeconds = CVarStreamerSessionTimeout.GetValueOnAnyThread();
+	return TimeoutSeconds > 0 ? TimeoutSeconds : 60;
+}
 
-	// simulate SETUP server response
-	if (bTCPTransport)
-	{
-		_snprintf_s(Transport, sizeof(Transport), "RTP/AVP/TCP;unicast;interleaved=0-1");
-	}
-	else
-	{
-		UpdateDateHeader();
-		_snprintf_s(Transport, sizeof(Transport),
-			"RTP/AVP;unicast;destination=%ls;source=%ls;client_port=%i-%i;server_port=%i-%i",
-			*ClientIP,
-			*ServerIP,
-			ClientRTPPort,
-			ClientRTCPPort,
-			ServerRTPPort,
-			ServerRTCPPort);
-	}
-
-	_snprintf_s(Response, sizeof(Response),
-		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
-		"%s\r\n"
-		"Transport: %s\r\n"
-		"Session: %i\r\n\r\n",
-		CSeq,
-		Date,
-		Transport,
-		RTSPSessionID);
-
-	//send(RTSPSocket, Response, strlen(Response), 0);
-	int32 BytesSent;
-	int& sent = BytesSent;
-	{
-		FScopeLock Lock(&RTSPSocketMt);
-		if (!RTSPSocket) { return; }
-		RTSPSocket->Send(reinterpret_cast<uint8*>(Response), strlen(Response), sent);
-	}
+void FStreamer::SendResponse(const char* Response, uint32 Size)
+{
+	int32 BytesSent = 0;
+	FScopeLock Lock(&RTSPSocketMt);
+	if (!RTSPSocket) { return; }
+	RTSPSocket->Send(reinterpret_cast<const uint8*>(Response), Size, BytesSent);
 }
 
-void FStreamer::Handle_RTSPPLAY()
+bool FStreamer::ApplyParameter(const char* Name, const char* Value)
 {
-	char Response[1024];
-	UpdateDateHeader();
-	// simulate SETUP server response
-	_snprintf_s(Response, sizeof(Response),
-		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
-		"%s\r\n"
-		"Range: npt=0.000-\r\n"
-		"Session: %i\r\n"
-		"RTP-Info: url=RTSP://127.0.0.1:8554/mjpeg/1/track1\r\n\r\n",
-		CSeq,
-		Date,
-		RTSPSessionID);
-
-	//send(RTSPSocket, Response, strlen(Response), 0);
-	int32 BytesSent;
-	int& sent = BytesSent;
+	if (FCStringAnsi::Stricmp(Name, "priority") == 0)
 	{
-		FScopeLock Lock(&RTSPSocketMt);
-		if (!RTSPSocket) { return; }
-		RTSPSocket->Send(reinterpret_cast<uint8*>(Response), strlen(Response), sent);
+		EClientPriority NewPriority;
+		if (!ParseClientPriority(Value, NewPriority))
+		{
+			return false;
+		}
+		if (NewPriority != Priority)
+		{
+			Priority = NewPriority;
+			UE_LOG(RTSPStreaming, Log, TEXT("%d: Client priority set to %s"), ClientRTSPPort, ANSI_TO_TCHAR(ClientPriorityToString(Priority)));
+		}
+		return true;
 	}
-}
-
-void FStreamer::Handle_RTSPTEARDOWN()
-{}
 
-void FStreamer::Handle_RTSPSET_PARAMETER()
-{}
-
-void FStreamer::Handle_RTSPPAUSE()
-{
-	char Response[1024];
-	UpdateDateHeader();
-	// simulate SETUP server response
-	_snprintf_s(Response, sizeof(Response),
-		"RTSP/1.0 200 OK\r\nCSeq: %s\r\n"
-		"%s\r\n",
-		CSeq,
-		Date);
-
-	//send(RTSPSocket, Response, strlen(Response), 0);
-	int32 BytesSent;
-	int& sent = BytesSent;
+	if (FCStringAnsi::Stricmp(Name, "framerate") == 0)
 	{
-		FScopeLock Lock(&RTSPSocketMt);
-		if (!RTSPSocket) { return; }
-		RTSPSocket->Send(reinterpret_cast<uint8*>(Response), strlen(Response), sent);
+		// served from the temporal layers of the stream, the full frame rate without them
+		if (!FCharAnsi::IsDigit(Value[0]))
+		{
+			return false;
+		}
+		const uint32 NewMaxFrameRate = static_cast<uint32>(FCStringAnsi::Atoi(Value));
+		if (NewMaxFrameRate != MaxFrameRate)
+		{
+			MaxFrameRate = NewMaxFrameRate;
+			UE_LOG(RTSPStreaming, Log, TEXT("%d: Client frame rate set to %d"), ClientRTSPPort, MaxFrameRate);
+		}
+		return true;
 	}
-}
 
-void FStreamer::Handle_RTSPGET_PARAMETER()
-{}
+	if (FCStringAnsi::Stricmp(Name, "rendition") == 0)
+	{
+		// "auto" leaves it to congestion feedback, starting from the rendition the client is sent
+		int32 NewRendition = INDEX_NONE;
+		if (FCStringAnsi::Stricmp(Value, "auto") != 0)
+		{
+			NewRendition = Server.FindRendition(ANSI_TO_TCHAR(Value));
+			if (NewRendition == INDEX_NONE)
+			{
+				return false;
+			}
+		}
 
-void FStreamer::UpdateDateHeader()
-{
-	time_t tt = time(NULL);
-	tm ts;
-	gmtime_s(&ts, &tt);
-	strftime(Date, sizeof Date, "Date: %a, %b %d %Y %H:%M:%S GMT", &ts);
-}
+		FScopeLock Lock(&RTPSocketMt);
+		if (NewRendition == INDEX_NONE && RequestedRendition != INDEX_NONE)
+		{
+			RenditionSelector.Reset(Server.GetNumRenditions(), FMath::Max(GetRendition() - FirstRendition, 0), FTimerWheel::GetTimeMs());
+		}
+		RequestedRendition = NewRendition;
+		UE_LOG(RTSPStreaming, Log, TEXT("%d: Client rendition set to %s"), ClientRTSPPort, ANSI_TO_TCHAR(Value));
+		return true;
+	}
 
-int FStreamer::isValidURL()
-{
-	return bValid;
+	UE_LOG(RTSPStreaming, Verbose, TEXT("%d: Ignoring unknown parameter %s"), ClientRTSPPort, ANSI_TO_TCHAR(Name));
+	return false;
 }
-
@@ -5,38 +5,32 @@
 #pragma once
 
 #include "Sockets.h"
+#include "HAL/ThreadSafeCounter64.h"
+#include "RTSPCore/TimerWheel.h"
 #include "Server.h"
-
-// supported RTSP command types
-enum RTSP_CMD_TYPES
-{
-	RTSP_OPTIONS,
-	RTSP_DESCRIBE,
-	RTSP_SETUP,
-	RTSP_PLAY,
-	RTSP_TEARDOWN,
-	RTSP_PAUSE,
-	RTSP_GET_PARAMETER,
-	RTSP_SET_PARAMETER,
-	RTSP_UNKNOWN
-};
-
-#define RTSP_BUFFER_SIZE       10000    // for incoming requests, and outgoing responses
-#define RTSP_PARAM_STRING_MAX  200		// for RTSP commands (OPTIONS, DESCRIBE, etc.)
-
-class FStreamer final
+#include "RTSPCore/EgressScheduler.h"
+#include "RTSPCore/RTPLossTracker.h"
+#include "RTSPCore/RTPPacketizer.h"
+#include "RTSPCore/RenditionSelector.h"
+#include "RTSPCore/RTSPSession.h"
+#include "InterleavedWriter.h"
+#include "PathMtu.h"
+
+// engine side of a client session: owns its sockets and receive thread and hosts the RTSP state machine of the core
+class FStreamer final : public IRTSPSessionHost
 {
 public:
 	FStreamer(FSocket* aRTSPSocket, const FString aServerIP, TSharedPtr<FInternetAddr> aClientAddr, FServer& aServer);
 	~FStreamer();
 	bool operator==(const FStreamer& rhs) const;						// compares client IP:Port to determine session equality
 
-	void Init();														// resets RTSP message parameters
 	void Receive();														// receive loop which receives RTSP messages from client
 	void Run();															// RTSP server thread loop
+	void ReceiveCompletion(const uint8* Data, int32 Size);				// RTSP data received by a completion based network backend
+	void ReceiveRTCP(const uint8* Data, int32 Size);					// RTCP datagram received from the client
 
 	void InitTransport(uint16 aRTPPort, uint16 aRTCPPort, bool TCP);	// initializes sending sockets
-	bool Send(uint64 Timestamp, const uint8* Data, uint32 Size);		// packetizes data and sends to client
+	bool Send(uint64 Timestamp, const FEncodedFrameRef& Frame, bool bEndOfFrame = true);	// packetizes data and sends to client, the frame can come in parts
 	
 	bool isReady()														// returns true when play is received
 	{
@@ -46,6 +40,7 @@ public:
 	{
 		return bDestroyStreamer;
 	}
+	void CancelTimers();												// before a dead streamer is destroyed, server ClientListMt held
 
 	FString GetIP()
 	{
@@ -55,24 +50,51 @@ public:
 	{
 		return ClientRTSPPort;
 	}
+	EClientPriority GetPriority() const									// egress priority class of this client
+	{
+		return Priority;
+	}
+	uint32 GetMaxFrameRate() const										// frame rate the client asked for, 0 for the stream's
+	{
+		return MaxFrameRate;
+	}
+	int32 GetRendition() const											// rendition of the codec's simulcast ladder sent, INDEX_NONE before the first frame
+	{
+		return Rendition.GetValue();
+	}
+	int32 GetStartRendition();											// rendition the client is described and would start with, asked for or picked
+	bool UpdateRendition(int32 NumRenditions);							// applies the rendition asked for or picked, true if it changed. Server ClientListMt held
+	void OnEgressDrop();												// the egress scheduler dropped a frame for this client
+	FEgressClientState& GetEgressState()								// scheduler bookkeeping, guarded by server ClientListMt
+	{
+		return EgressState;
+	}
+	bool IsAdmitted() const												// true once the server reserved egress budget for this client
+	{
+		return bAdmitted;
+	}
+	void SetAdmitted()													// called by the server, guarded by server ClientListMt
+	{
+		bAdmitted = true;
+	}
 
 
-private:
-	bool ParseRTSPRequest(char const* aRequest, unsigned aRequestSize);					// extracts initial information from message
-	RTSP_CMD_TYPES Handle_RTSPRequest(char const* aRequest, unsigned aRequestSize);		// RTSP message handler
-
-	void UpdateDateHeader();															// updates Date line information
-	int  isValidURL();																	// nonzero if the URL is valid (consider removing)
+	// IRTSPSessionHost, called from HandleRTSPMessage()
+	virtual void SendResponse(const char* Response, uint32 Size) override;					// sends RTSP response over RTSPSocket
+	virtual bool DescribeStream(const char* Path, FRTSPStreamDescription& OutStream) override;	// picks the codec of the mount the client asked for
+	virtual bool Admit() override;
+	virtual std::string GetAdmissionRedirect() override;
+	virtual bool SetupTransport(FRTSPTransport& Transport) override;
+	virtual void SetPlaying(bool bPlaying) override;											// starts or stops passing frames here, keeps the server's count of playing clients
+	virtual bool ApplyParameter(const char* Name, const char* Value) override;					// applies a session parameter, false if unknown
+	virtual int32 GetSessionTimeout() override;												// timeout announced in the Session header, seconds
 
-	// RTSP request command handlers
-	void Handle_RTSPOPTION();
-	void Handle_RTSPDESCRIBE();
-	void Handle_RTSPSETUP();
-	void Handle_RTSPPLAY();
-	void Handle_RTSPTEARDOWN();
-	void Handle_RTSPPAUSE();
-	void Handle_RTSPGET_PARAMETER();
-	void Handle_RTSPSET_PARAMETER();
+private:
+	void OnClientActivity();																	// any RTSP message or RTCP packet keeps the session alive
+	void ScheduleTimeoutCheck();																// arms the session timer for when the client would time out
+	void OnTimeoutTimer();																		// ends the session if the client went quiet, otherwise re-arms
+	void PollRTCP();																	// reads pending RTCP with the blocking network backend
+	void HandleRTSPMessage(const char* RecvBuf, int32 BytesRead);						// passes a received RTSP message to Session
 
 private:
 	FCriticalSection	RTPSocketMt;		// thread lock for RTPSocket
@@ -86,25 +108,31 @@ private:
 	uint16				ClientRTCPPort;		// RTCP client port
 	uint16				ServerRTPPort;		// RTP server port
 	uint16				ServerRTCPPort;		// RTCP server port
-	uint16				SequenceNumber;		// RTP packet number
+	FRTPPacketizer		Packetizer;			// splits frames into RTP packets, keeps RTP sequence number
+	FRTPPacketArray		Packets;			// packets of the frame being sent
+	TUniquePtr<FInterleavedWriter> InterleavedWriter;	// RTP over RTSP writer, guarded by RTSPSocketMt
+	FPathMtu			PathMtu;			// path MTU of UDP transport, guarded by RTPSocketMt
+	FRTPLossTracker		LossTracker;		// frames the client's losses hit, UDP transport, guarded by RTPSocketMt
+	uint32				PartialTimestamp;	// of the frame whose parts are being sent over UDP, guarded by RTPSocketMt
+	uint16				PartialSequence;	// of its first packet
+	uint16				PartialPackets;		// packets of its parts sent so far, 0 between frames
 	bool				bTCPTransport;		// true if client requests RTSP over TCP, false if over UDP
 	FString				ServerIP;			// IP address of server
 	FString				ClientIP;			// IP address of client
 	bool				bSocketsReady;		// true if server sockets are bound and ready to send
 	
-	char				Date[200];							// Date line in RTSP messages
-	int					RTSPSessionID;						// randomly assigned SessionID in RTSP message
-	bool				bValid;                             // true if the URL is valid
 	FServer&			Server;
-
-	// parameters of the last received RTSP request
-
-	RTSP_CMD_TYPES		RTSPCmdType;                            // RTSP type (OPTIONS, DESCRIBE, etc.)
-	char				URLPreSuffix[RTSP_PARAM_STRING_MAX];    // stream name pre suffix 
-	char				URLSuffix[RTSP_PARAM_STRING_MAX];       // stream name suffix
-	char				CSeq[RTSP_PARAM_STRING_MAX];            // RTSP command sequence number
-	char				URLHostPort[RTSP_BUFFER_SIZE];          // host:port part of the URL
-	unsigned			ContentLength;                          // SDP string size
+	EClientPriority		Priority;							// egress priority class, set by URL query or SET_PARAMETER
+	uint32				MaxFrameRate;						// temporal layers above it are skipped, set by URL query or SET_PARAMETER
+	int32				FirstRendition;						// largest rendition of the codec mounted where the client DESCRIBE-d, guarded by RTPSocketMt
+	int32				RequestedRendition;					// set by URL query or SET_PARAMETER, INDEX_NONE for RenditionSelector's pick. Guarded by RTPSocketMt
+	FRenditionSelector	RenditionSelector;					// picks a rendition from congestion feedback, guarded by RTPSocketMt
+	FThreadSafeCounter	Rendition;							// rendition sent, changed with server ClientListMt held
+	FEgressClientState	EgressState;						// egress scheduler state of this client
+	bool				bAdmitted;							// true once egress budget is reserved for this client
+	FThreadSafeCounter64 LastActivityMs;					// last time the client was heard from, FTimerWheel::GetTimeMs()
+	FTimerWheel::FTimerId TimeoutTimer;						// session timer, 0 if none. Guarded by server ClientListMt
+	FRTSPSession		Session;								// RTSP state machine, only touched by the thread receiving RTSP messages
 
 	bool				ExitReceive;							// true when the Session has ended and the thread should close
 	FCriticalSection	StreamerMt;								// thread lock for streamer flags
@@ -112,6 +140,6 @@ private:
 	FThreadSafeBool		bDestroyStreamer;						// true when streamer should be destroyed
 	// should be the last thing declared, otherwise the thread func can access other members that are not
 	// initialised yet
-	FThread				Thread;									// thread to accept RTSP messages
+	TUniquePtr<FThread>	Thread;									// thread to accept RTSP messages, null if the network backend is completion based
 
 };
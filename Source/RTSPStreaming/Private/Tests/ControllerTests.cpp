@@ -0,0 +1,265 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "Controller.h"
+#include "VideoEncoder.h"
+#include "RenderingThread.h"
+#include "Engine/Engine.h"
+#include "HAL/Event.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Async/TaskGraphInterfaces.h"
+
+namespace RTSPStreamingControllerTests
+{
+	static const double FrameInterval = 1.0 / 60;			// back buffers are presented at 60 FPS
+	static const double MaxFrameSeconds = 0.05;				// a render thread waiting on the encoder takes seconds, see InitTimeoutMs
+	static const uint32 InitTimeoutMs = 10000;				// a stub never released still lets the controller go
+
+	// what the test sees of the stub encoders one factory created
+	struct FStubEncoderState
+	{
+		FStubEncoderState(bool bInInitResult)
+			: InitReleased(FPlatformProcess::GetSynchEventFromPool(true))
+			, bInitResult(bInInitResult)
+			, bFirstFrameIdr(false)
+		{}
+
+		~FStubEncoderState()
+		{
+			FPlatformProcess::ReturnSynchEventToPool(InitReleased);
+		}
+
+		FEvent*					InitReleased;				// Initialize() blocks until triggered
+		const bool				bInitResult;				// what Initialize() returns
+		FThreadSafeCounter		NumCreated;
+		FThreadSafeCounter		NumInitialized;				// Initialize() returned
+		FThreadSafeCounter		NumResourcesInitialized;
+		FThreadSafeCounter		NumEncoded;
+		bool					bFirstFrameIdr;				// render thread only
+	};
+
+	// encoder backend standing in for NVENC or OpenH264, encodes nothing and counts what the controller asks of it
+	class FStubVideoEncoder : public IVideoEncoder
+	{
+	public:
+		explicit FStubVideoEncoder(FStubEncoderState& InState)
+			: State(InState)
+			, bResourcesInitialized(false)
+			, bForceIdrFrame(false)
+		{
+			State.NumCreated.Increment();
+		}
+
+		virtual FString GetName() const override
+		{ return TEXT("Stub Encoder"); }
+
+		virtual bool IsSupported() const override
+		{ return bResourcesInitialized; }
+
+		virtual bool Initialize() override
+		{
+			State.InitReleased->Wait(InitTimeoutMs);
+			State.NumInitialized.Increment();
+			return State.bInitResult;
+		}
+
+		virtual void InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer) override
+		{
+			State.NumResourcesInitialized.Increment();
+			bResourcesInitialized = true;
+		}
+
+		virtual const TArray<uint8>& GetSpsPpsHeader() const override
+		{ return SpsPpsHeader; }
+
+		virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp) override
+		{
+			if (State.NumEncoded.Increment() == 1)
+			{
+				State.bFirstFrameIdr = bForceIdrFrame;
+			}
+			bForceIdrFrame = false;
+		}
+
+		virtual void ForceIdrFrame() override
+		{ bForceIdrFrame = true; }
+
+		virtual bool IsAsyncEnabled() const override
+		{ return false; }
+
+	private:
+		FStubEncoderState&		State;
+		TArray<uint8>			SpsPpsHeader;
+		bool					bResourcesInitialized;
+		bool					bForceIdrFrame;
+	};
+
+	static FVideoEncoderFactory MakeStubFactory(FStubEncoderState& State)
+	{
+		return [&State](const FVideoEncoderSettings& Settings, const IVideoEncoder::FEncodedFrameReadyCallback& Callback) -> TUniquePtr<IVideoEncoder>
+		{
+			return MakeUnique<FStubVideoEncoder>(State);
+		};
+	}
+
+	static void RunOnRenderThread(TFunction<void()> Function)
+	{
+		ENQUEUE_RENDER_COMMAND(RTSPStreamingControllerTest)(
+			[Function](FRHICommandListImmediate& RHICmdList)
+			{
+				Function();
+			});
+		FlushRenderingCommands();
+	}
+
+	// a streaming controller on a back buffer of its own, created and destroyed on the render thread like the module's
+	class FControllerFixture
+	{
+	public:
+		FControllerFixture(const FVideoEncoderFactory& Factory, const FVideoEncoderFactory& FallbackFactory)
+			: PreviousMaxFPS(GEngine->GetMaxFPS())
+		{
+			RunOnRenderThread([this, &Factory, &FallbackFactory]()
+			{
+				FRHIResourceCreateInfo CreateInfo;
+				FrameBuffer = RHICreateTexture2D(1280, 720, EPixelFormat::PF_B8G8R8A8, 1, 1, TexCreate_None, CreateInfo);
+				// port 0 keeps clear of a stream this process may be serving
+				Controller = MakeUnique<FController>(TEXT("127.0.0.1"), 0, FrameBuffer, Factory, FallbackFactory);
+				Controller->StartStreaming();
+			});
+			// the controller sets the initial max FPS on the game thread, which must happen while it's alive
+			FTaskGraphInterface::Get().ProcessThreadUntilIdle(ENamedThreads::GameThread);
+		}
+
+		~FControllerFixture()
+		{
+			RunOnRenderThread([this]()
+			{
+				Controller.Reset();
+				FrameBuffer.SafeRelease();
+			});
+			GEngine->SetMaxFPS(PreviousMaxFPS);
+		}
+
+		// presents back buffers for up to Seconds or until Done() returns true, returns the longest OnFrameBufferReady()
+		double PresentFrames(double Seconds, TFunctionRef<bool()> Done)
+		{
+			double MaxFrameTime = 0;
+			const double EndTime = FPlatformTime::Seconds() + Seconds;
+			while (!Done() && FPlatformTime::Seconds() < EndTime)
+			{
+				RunOnRenderThread([this, &MaxFrameTime]()
+				{
+					const double StartTime = FPlatformTime::Seconds();
+					Controller->OnFrameBufferReady(FrameBuffer);
+					MaxFrameTime = FMath::Max(MaxFrameTime, FPlatformTime::Seconds() - StartTime);
+				});
+				FPlatformProcess::Sleep(FrameInterval);
+			}
+			return MaxFrameTime;
+		}
+
+	private:
+		float					PreviousMaxFPS;
+		FTexture2DRHIRef		FrameBuffer;
+		TUniquePtr<FController>	Controller;
+	};
+
+	// sets a console variable for the life of the scope
+	class FScopedConsoleVariable
+	{
+	public:
+		FScopedConsoleVariable(const TCHAR* Name, int32 Value)
+			: Variable(IConsoleManager::Get().FindConsoleVariable(Name))
+			, PreviousValue(Variable->GetInt())
+		{
+			Variable->Set(Value);
+			FlushRenderingCommands();
+		}
+
+		~FScopedConsoleVariable()
+		{
+			Variable->Set(PreviousValue);
+			FlushRenderingCommands();
+		}
+
+	private:
+		IConsoleVariable*		Variable;
+		int32					PreviousValue;
+	};
+}
+
+using namespace RTSPStreamingControllerTests;
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTSPStreamingControllerSkipsFramesDuringEncoderInitTest, "RTSPStreaming.Controller.SkipsFramesDuringEncoderInit",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FRTSPStreamingControllerSkipsFramesDuringEncoderInitTest::RunTest(const FString& Parameters)
+{
+	FScopedConsoleVariable WarmStandby(TEXT("Encoder.WarmStandby"), 0);
+	FStubEncoderState State(true);
+	{
+		FControllerFixture Fixture(MakeStubFactory(State), FVideoEncoderFactory());
+
+		// the encoder is created with the first captured frame and initializes on a worker thread the stub holds up
+		const double MaxInitFrameTime = Fixture.PresentFrames(0.5, []() { return false; });
+		TestEqual(TEXT("Encoders created while initializing"), State.NumCreated.GetValue(), 1);
+		TestEqual(TEXT("Encoders initialized while held up"), State.NumInitialized.GetValue(), 0);
+		TestEqual(TEXT("Resources registered before the worker thread finished"), State.NumResourcesInitialized.GetValue(), 0);
+		TestEqual(TEXT("Frames encoded while initializing"), State.NumEncoded.GetValue(), 0);
+		TestTrue(FString::Printf(TEXT("Frames skipped, not blocked, longest %.1f ms"), MaxInitFrameTime * 1000), MaxInitFrameTime < MaxFrameSeconds);
+
+		// the render thread registers the resources with the next frame after the worker thread is done
+		State.InitReleased->Trigger();
+		const double MaxFrameTime = Fixture.PresentFrames(2.0, [&State]() { return State.NumEncoded.GetValue() > 0; });
+		TestEqual(TEXT("Encoders initialized"), State.NumInitialized.GetValue(), 1);
+		TestEqual(TEXT("Resources registered"), State.NumResourcesInitialized.GetValue(), 1);
+		TestTrue(TEXT("Frames encoded once the encoder is ready"), State.NumEncoded.GetValue() > 0);
+		TestTrue(TEXT("First frame encoded is an IDR frame"), State.bFirstFrameIdr);
+		TestEqual(TEXT("Encoders created"), State.NumCreated.GetValue(), 1);
+		TestTrue(FString::Printf(TEXT("Frames while finishing initialization, longest %.1f ms"), MaxFrameTime * 1000), MaxFrameTime < MaxFrameSeconds);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTSPStreamingControllerFallsBackAfterFailedEncoderInitTest, "RTSPStreaming.Controller.FallsBackAfterFailedEncoderInit",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FRTSPStreamingControllerFallsBackAfterFailedEncoderInitTest::RunTest(const FString& Parameters)
+{
+	FScopedConsoleVariable WarmStandby(TEXT("Encoder.WarmStandby"), 0);
+	FScopedConsoleVariable SoftwareFallback(TEXT("Encoder.SoftwareFallback"), 1);
+	FStubEncoderState State(false);
+	FStubEncoderState FallbackState(true);
+	{
+		FControllerFixture Fixture(MakeStubFactory(State), MakeStubFactory(FallbackState));
+
+		// the failed encoder is swapped for the fallback one, which is held up in turn
+		State.InitReleased->Trigger();
+		double MaxFrameTime = Fixture.PresentFrames(2.0, [&FallbackState]() { return FallbackState.NumCreated.GetValue() > 0; });
+		MaxFrameTime = FMath::Max(MaxFrameTime, Fixture.PresentFrames(0.25, []() { return false; }));
+		TestEqual(TEXT("Encoders initialized"), State.NumInitialized.GetValue(), 1);
+		TestEqual(TEXT("Resources registered for the failed encoder"), State.NumResourcesInitialized.GetValue(), 0);
+		TestEqual(TEXT("Frames encoded by the failed encoder"), State.NumEncoded.GetValue(), 0);
+		TestEqual(TEXT("Fallback encoders created"), FallbackState.NumCreated.GetValue(), 1);
+		TestEqual(TEXT("Frames encoded while the fallback encoder initializes"), FallbackState.NumEncoded.GetValue(), 0);
+
+		FallbackState.InitReleased->Trigger();
+		MaxFrameTime = FMath::Max(MaxFrameTime, Fixture.PresentFrames(2.0, [&FallbackState]() { return FallbackState.NumEncoded.GetValue() > 0; }));
+		TestEqual(TEXT("Fallback resources registered"), FallbackState.NumResourcesInitialized.GetValue(), 1);
+		TestTrue(TEXT("Frames encoded by the fallback encoder"), FallbackState.NumEncoded.GetValue() > 0);
+		TestTrue(TEXT("First fallback frame is an IDR frame"), FallbackState.bFirstFrameIdr);
+		TestEqual(TEXT("Encoders created"), State.NumCreated.GetValue(), 1);
+		TestTrue(FString::Printf(TEXT("Frames skipped, not blocked, longest %.1f ms"), MaxFrameTime * 1000), MaxFrameTime < MaxFrameSeconds);
+	}
+	return true;
+}
+
+#endif
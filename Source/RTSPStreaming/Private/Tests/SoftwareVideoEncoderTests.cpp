@@ -0,0 +1,266 @@
+// Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS && WITH_OPENH264
+
+#include "SoftwareVideoEncoder.h"
+#include "CapturePacer.h"
+#include "HAL/Event.h"
+#include "HAL/PlatformProcess.h"
+#include "Misc/ScopeLock.h"
+#include "RTSPCore/RTPPacketizer.h"
+#include "RTSPCore/VideoCodec.h"
+
+THIRD_PARTY_INCLUDES_START
+#include "wels/codec_api.h"
+THIRD_PARTY_INCLUDES_END
+
+namespace RTSPStreamingSoftwareEncoderTests
+{
+	static const int32 Width = 321;					// odd, the encoder cuts off the last column and row
+	static const int32 Height = 181;
+	static const int32 EncodedWidth = 320;
+	static const int32 EncodedHeight = 180;
+	static const int32 Pitch = 336 * 4;				// wider than a row, as mapped staging textures are
+	static const int32 FrameRate = 30;
+	static const int32 NumFrames = 40;
+	static const int32 ColorChangeFrame = 20;		// the second half of the clip has another color
+	static const int32 ForcedIdrFrame = 30;
+	static const uint32 FrameTimeoutMs = 5000;
+	static const float MaxDeviation = 3.0f;			// of a decoded plane's average from the BT.709 value
+
+	static const uint8 NalTypeSlice = 1;			// H.264 slice of a non-IDR picture
+	static const uint8 NalTypeIdr = 5;				// H.264 slice of an IDR picture
+
+	struct FColor8
+	{
+		uint8 R, G, B;
+	};
+
+	static const FColor8 Colors[] = { { 128, 128, 128 }, { 200, 60, 40 } };
+
+	static const FColor8& GetFrameColor(int32 Frame)
+	{
+		return Colors[Frame < ColorChangeFrame ? 0 : 1];
+	}
+
+	// limited range BT.709 the encoder signals in the SPS, the reference the decoded planes are held against
+	static void GetExpectedYuv(const FColor8& Color, float& OutY, float& OutU, float& OutV)
+	{
+		const float Luma = 0.2126f * Color.R + 0.7152f * Color.G + 0.0722f * Color.B;
+		OutY = 16.0f + 219.0f * Luma / 255.0f;
+		OutU = 128.0f + 224.0f * (Color.B - Luma) / 1.8556f / 255.0f;
+		OutV = 128.0f + 224.0f * (Color.R - Luma) / 1.5748f / 255.0f;
+	}
+
+	static float GetPlaneAverage(const uint8* Plane, int32 Stride, int32 PlaneWidth, int32 PlaneHeight)
+	{
+		uint64 Sum = 0;
+		for (int32 Row = 0; Row < PlaneHeight; ++Row)
+		{
+			for (int32 Column = 0; Column < PlaneWidth; ++Column)
+			{
+				Sum += Plane[Row * Stride + Column];
+			}
+		}
+		return static_cast<float>(Sum) / (PlaneWidth * PlaneHeight);
+	}
+
+	static TArray<uint8> GetNalTypes(const TArray<uint8>& AccessUnit)
+	{
+		TArray<uint8> Types;
+		ForEachAnnexBNal(AccessUnit.GetData(), AccessUnit.Num(), [&Types](const uint8* Nal, uint32 NalSize)
+		{
+			Types.Add(GetNalType(EVideoCodec::H264, Nal));
+		});
+		return Types;
+	}
+
+	struct FEncodedOutput
+	{
+		FEncodedFrameInfo	Info;
+		TArray<uint8>		Data;					// copied, the encoder reuses its buffers
+	};
+
+	// collects the frames the encode thread hands over
+	class FEncodedOutputs
+	{
+	public:
+		FEncodedOutputs()
+			: FrameEncoded(FPlatformProcess::GetSynchEventFromPool(false))
+		{}
+
+		~FEncodedOutputs()
+		{
+			FPlatformProcess::ReturnSynchEventToPool(FrameEncoded);
+		}
+
+		void Add(const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame)
+		{
+			{
+				FScopeLock Lock(&OutputsMt);
+				FEncodedOutput& Output = Outputs[Outputs.AddDefaulted()];
+				Output.Info = Info;
+				Output.Data = *Frame;
+			}
+			FrameEncoded->Trigger();
+		}
+
+		// false if fewer than Count frames were encoded within the timeout
+		bool WaitFor(int32 Count)
+		{
+			while (Num() < Count)
+			{
+				if (!FrameEncoded->Wait(FrameTimeoutMs))
+				{
+					return Num() >= Count;
+				}
+			}
+			return true;
+		}
+
+		int32 Num() const
+		{
+			FScopeLock Lock(&OutputsMt);
+			return Outputs.Num();
+		}
+
+		TArray<FEncodedOutput> Get() const
+		{
+			FScopeLock Lock(&OutputsMt);
+			return Outputs;
+		}
+
+	private:
+		mutable FCriticalSection	OutputsMt;
+		TArray<FEncodedOutput>		Outputs;
+		FEvent*						FrameEncoded;
+	};
+}
+
+using namespace RTSPStreamingSoftwareEncoderTests;
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FRTSPStreamingSoftwareEncoderSyntheticFramesTest, "RTSPStreaming.SoftwareEncoder.EncodesSyntheticFrames",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FRTSPStreamingSoftwareEncoderSyntheticFramesTest::RunTest(const FString& Parameters)
+{
+	FVideoEncoderSettings Settings;
+	Settings.Width = Width;
+	Settings.Height = Height;
+	Settings.FrameRate = FrameRate;
+	Settings.AverageBitRate = 2000000;
+
+	FEncodedOutputs Outputs;
+	TArray<uint8> SpsPpsHeader;
+	{
+		// the encoder is never given a back buffer, EncodeBgraFrame() is the whole path after the readback
+		FSoftwareVideoEncoder Encoder(Settings, [&Outputs](const FEncodedFrameInfo& Info, const FEncodedFrameRef& Frame) { Outputs.Add(Info, Frame); });
+		if (!TestTrue(TEXT("Initialize"), Encoder.Initialize()))
+		{
+			return false;
+		}
+		SpsPpsHeader = Encoder.GetSpsPpsHeader();
+
+		// one frame at a time, the encode thread drops frames beyond its queue
+		TArray<uint8> Bgra;
+		Bgra.SetNumZeroed(Pitch * Height);
+		for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+		{
+			const FColor8& Color = GetFrameColor(Frame);
+			for (int32 Row = 0; Row < Height; ++Row)
+			{
+				uint8* Pixel = Bgra.GetData() + Row * Pitch;
+				for (int32 Column = 0; Column < Width; ++Column, Pixel += 4)
+				{
+					Pixel[0] = Color.B;
+					Pixel[1] = Color.G;
+					Pixel[2] = Color.R;
+					Pixel[3] = 255;
+				}
+			}
+
+			if (Frame == ForcedIdrFrame)
+			{
+				Encoder.ForceIdrFrame();
+			}
+			const uint64 Timestamp = static_cast<uint64>(Frame) * RTP_VIDEO_CLOCK_RATE / FrameRate;
+			TestTrue(FString::Printf(TEXT("Frame %d queued"), Frame), Encoder.EncodeBgraFrame(Settings, Bgra.GetData(), Pitch, Timestamp));
+			if (!TestTrue(FString::Printf(TEXT("Frame %d encoded"), Frame), Outputs.WaitFor(Frame + 1)))
+			{
+				return false;
+			}
+		}
+	}
+
+	const TArray<uint8> HeaderNalTypes = GetNalTypes(SpsPpsHeader);
+	TestTrue(TEXT("Parameter sets have an SPS"), HeaderNalTypes.Contains(H264_NAL_SPS));
+	TestTrue(TEXT("Parameter sets have a PPS"), HeaderNalTypes.Contains(H264_NAL_PPS));
+
+	ISVCDecoder* Decoder = nullptr;
+	if (!TestTrue(TEXT("Decoder created"), WelsCreateDecoder(&Decoder) == 0 && Decoder))
+	{
+		return false;
+	}
+	SDecodingParam DecodingParam;
+	FMemory::Memzero(DecodingParam);
+	DecodingParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
+	TestEqual(TEXT("Decoder initialized"), static_cast<int32>(Decoder->Initialize(&DecodingParam)), static_cast<int32>(cmResultSuccess));
+
+	const TArray<FEncodedOutput> Encoded = Outputs.Get();
+	TestEqual(TEXT("Frames encoded"), Encoded.Num(), NumFrames);
+	for (int32 Frame = 0; Frame < Encoded.Num(); ++Frame)
+	{
+		const FEncodedOutput& Output = Encoded[Frame];
+		const TArray<uint8> NalTypes = GetNalTypes(Output.Data);
+		const bool bIdrExpected = Frame == 0 || Frame == ForcedIdrFrame;
+		TestEqual(FString::Printf(TEXT("Frame %d timestamp"), Frame), Output.Info.Timestamp, static_cast<uint64>(Frame) * RTP_VIDEO_CLOCK_RATE / FrameRate);
+		TestTrue(FString::Printf(TEXT("Frame %d is %s"), Frame, bIdrExpected ? TEXT("a keyframe") : TEXT("no keyframe")), Output.Info.bKeyframe == bIdrExpected);
+		TestTrue(FString::Printf(TEXT("Frame %d starts with a start code"), Frame), Output.Data.Num() > 4 && Output.Data[0] == 0 && Output.Data[1] == 0
+			&& (Output.Data[2] == 1 || (Output.Data[2] == 0 && Output.Data[3] == 1)));
+		TestTrue(FString::Printf(TEXT("Frame %d slices"), Frame), NalTypes.Contains(bIdrExpected ? NalTypeIdr : NalTypeSlice));
+		if (bIdrExpected)
+		{
+			TestTrue(FString::Printf(TEXT("Frame %d repeats the SPS"), Frame), NalTypes.Contains(H264_NAL_SPS));
+		}
+
+		// the decoder works on the stream as a client gets it, the parameter sets of the SDP first
+		if (Frame == 0)
+		{
+			uint8* HeaderPlanes[3] = {};
+			SBufferInfo HeaderInfo;
+			FMemory::Memzero(HeaderInfo);
+			Decoder->DecodeFrameNoDelay(SpsPpsHeader.GetData(), SpsPpsHeader.Num(), HeaderPlanes, &HeaderInfo);
+		}
+		uint8* Planes[3] = {};
+		SBufferInfo BufferInfo;
+		FMemory::Memzero(BufferInfo);
+		const DECODING_STATE State = Decoder->DecodeFrameNoDelay(Output.Data.GetData(), Output.Data.Num(), Planes, &BufferInfo);
+		if (!TestTrue(FString::Printf(TEXT("Frame %d decoded, state %d"), Frame, static_cast<int32>(State)), State == dsErrorFree && BufferInfo.iBufferStatus == 1))
+		{
+			continue;
+		}
+
+		const SSysMEMBuffer& Picture = BufferInfo.UsrData.sSystemBuffer;
+		TestEqual(FString::Printf(TEXT("Frame %d width"), Frame), Picture.iWidth, EncodedWidth);
+		TestEqual(FString::Printf(TEXT("Frame %d height"), Frame), Picture.iHeight, EncodedHeight);
+
+		// the last frame of each color had time to converge
+		if (Frame == ColorChangeFrame - 1 || Frame == NumFrames - 1)
+		{
+			float Y, U, V;
+			GetExpectedYuv(GetFrameColor(Frame), Y, U, V);
+			TestEqual(FString::Printf(TEXT("Frame %d Y"), Frame), GetPlaneAverage(Planes[0], Picture.iStride[0], Picture.iWidth, Picture.iHeight), Y, MaxDeviation);
+			TestEqual(FString::Printf(TEXT("Frame %d U"), Frame), GetPlaneAverage(Planes[1], Picture.iStride[1], Picture.iWidth / 2, Picture.iHeight / 2), U, MaxDeviation);
+			TestEqual(FString::Printf(TEXT("Frame %d V"), Frame), GetPlaneAverage(Planes[2], Picture.iStride[1], Picture.iWidth / 2, Picture.iHeight / 2), V, MaxDeviation);
+		}
+	}
+
+	Decoder->Uninitialize();
+	WelsDestroyDecoder(Decoder);
+	return true;
+}
+
+#endif
@@ -4,17 +4,69 @@
 
 #include "HAL/Runnable.h"
 #include "HAL/RunnableThread.h"
+#include "HAL/IConsoleManager.h"
 #include <chrono>
 
+// scheduling of a plugin thread, lets encoder, network and timer threads be pinned away from the game and render threads
+struct FThreadSettings
+{
+	EThreadPriority		Priority = TPri_Normal;
+	uint64				AffinityMask = 0;		// cores the thread may run on, 0 for any
+	uint32				StackSize = 0;			// bytes, 0 for the platform default
+
+	// reads "<Prefix>Priority" (Normal, AboveNormal, BelowNormal, Highest, Lowest, SlightlyBelowNormal, TimeCritical)
+	// and "<Prefix>Affinity" (hex core mask) console variables, unset or unknown values keep the defaults
+	static FThreadSettings FromConsoleVariables(const TCHAR* Prefix)
+	{
+		FThreadSettings Settings;
+
+		if (IConsoleVariable* PriorityCVar = IConsoleManager::Get().FindConsoleVariable(*FString::Printf(TEXT("%sPriority"), Prefix)))
+		{
+			static const TPair<const TCHAR*, EThreadPriority> Priorities[] =
+			{
+				{ TEXT("Normal"), TPri_Normal },
+				{ TEXT("AboveNormal"), TPri_AboveNormal },
+				{ TEXT("BelowNormal"), TPri_BelowNormal },
+				{ TEXT("Highest"), TPri_Highest },
+				{ TEXT("Lowest"), TPri_Lowest },
+				{ TEXT("SlightlyBelowNormal"), TPri_SlightlyBelowNormal },
+				{ TEXT("TimeCritical"), TPri_TimeCritical },
+			};
+			const FString Priority = PriorityCVar->GetString();
+			for (const TPair<const TCHAR*, EThreadPriority>& Pair : Priorities)
+			{
+				if (Priority == Pair.Key)
+				{
+					Settings.Priority = Pair.Value;
+				}
+			}
+		}
+
+		if (IConsoleVariable* AffinityCVar = IConsoleManager::Get().FindConsoleVariable(*FString::Printf(TEXT("%sAffinity"), Prefix)))
+		{
+			Settings.AffinityMask = FCString::Strtoui64(*AffinityCVar->GetString(), nullptr, 16);
+		}
+
+		return Settings;
+	}
+};
+
 class FThread final : public FRunnable
 {
 public:
 	using FCallback = TFunction<void()>;
 
-	explicit FThread(TCHAR const* ThreadName, const FCallback& Callback) :
+	explicit FThread(TCHAR const* ThreadName, const FCallback& Callback, const FThreadSettings& Settings = FThreadSettings()) :
 		Callback(Callback)
 	{
-		Thread = FRunnableThread::Create(this, ThreadName);
+		Thread = FRunnableThread::Create(this, ThreadName, Settings.StackSize, Settings.Priority,
+			Settings.AffinityMask ? Settings.AffinityMask : FPlatformAffinity::GetNoAffinityMask());
+	}
+
+	~FThread()
+	{
+		// waits for the callback to return if the thread wasn't joined
+		delete Thread;
 	}
 
 	void Join()
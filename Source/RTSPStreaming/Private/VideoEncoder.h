@@ -4,6 +4,16 @@
 
 #include "RHI.h"
 #include "RHIResources.h"
+#include "RTSPCore/VideoCodec.h"
+
+// how the encoder spends AverageBitRate
+enum class EVideoRateControl : uint8
+{
+	CbrLowDelayHq,		// constant bitrate with the low-delay high quality rate control
+	Cbr,
+	Vbr,				// variable bitrate peaking at MaxBitRate
+	ConstQp,			// every frame at ConstQp whatever its size, for testing
+};
 
 struct FVideoEncoderSettings
 {
@@ -12,6 +22,11 @@ struct FVideoEncoderSettings
 		, FrameRate(60)
 		, Width(1920)
 		, Height(1080)
+		, Codec(EVideoCodec::H264)
+		, RateControl(EVideoRateControl::CbrLowDelayHq)
+		, MaxBitRate(0)
+		, ConstQp(28)
+		, VbvBufferSize(0)
 	{}
 
 	FORCEINLINE bool operator==(const FVideoEncoderSettings& Other) const
@@ -19,7 +34,12 @@ struct FVideoEncoderSettings
 		return (AverageBitRate == Other.AverageBitRate) 
 			&& (FrameRate == Other.FrameRate) 
 			&& (Width == Other.Width) 
-			&& (Height == Other.Height);
+			&& (Height == Other.Height)
+			&& (Codec == Other.Codec)
+			&& (RateControl == Other.RateControl)
+			&& (MaxBitRate == Other.MaxBitRate)
+			&& (ConstQp == Other.ConstQp)
+			&& (VbvBufferSize == Other.VbvBufferSize);
 	}
 
 	FORCEINLINE bool operator!=(const FVideoEncoderSettings& Other) const
@@ -27,19 +47,44 @@ struct FVideoEncoderSettings
 		return (AverageBitRate != Other.AverageBitRate) 
 			|| (FrameRate != Other.FrameRate) 
 			|| (Width != Other.Width) 
-			|| (Height != Other.Height);
+			|| (Height != Other.Height)
+			|| (Codec != Other.Codec)
+			|| (RateControl != Other.RateControl)
+			|| (MaxBitRate != Other.MaxBitRate)
+			|| (ConstQp != Other.ConstQp)
+			|| (VbvBufferSize != Other.VbvBufferSize);
 	}
 
 	uint32	AverageBitRate;
 	uint32	FrameRate;
 	uint32	Width;
 	uint32	Height;
+	EVideoCodec	Codec;		// fixed for the life of the encoder
+	EVideoRateControl	RateControl;
+	uint32	MaxBitRate;		// peak of Vbr, bps
+	uint32	ConstQp;		// QP of every frame with ConstQp
+	uint32	VbvBufferSize;	// VBV (HRD) buffer size and initial delay in bits, bounds the size of a frame. 0 for the encoder's default
+};
+
+// encoded access unit shared by all clients it is sent to, kept alive until the last zero-copy send completes
+using FEncodedFrameRef = TSharedRef<const TArray<uint8>, ESPMode::ThreadSafe>;
+
+// what an encoder reports about an encoded frame along with it. Encoders streaming slices hand a frame over in parts
+// of whole slices as they are encoded, the frame passed along with each part holds only that part
+struct FEncodedFrameInfo
+{
+	uint64	Timestamp = 0;				// as passed to EncodeFrame()
+	bool	bKeyframe = false;
+	uint8	TemporalLayer = 0;			// layer of the frame, see RTSPCore/TemporalLayers.h
+	uint8	NumTemporalLayers = 1;		// 1 if the encoder doesn't encode temporal layers
+	bool	bFirstPart = true;			// both for a whole frame
+	bool	bLastPart = true;
 };
 
 class IVideoEncoder
 {
 public:
-	using FEncodedFrameReadyCallback = TFunction<void(uint64, bool, const uint8*, uint32)>;
+	using FEncodedFrameReadyCallback = TFunction<void(const FEncodedFrameInfo&, const FEncodedFrameRef&)>;
 
 	virtual ~IVideoEncoder() = default;
 
@@ -49,10 +94,31 @@ public:
 	virtual FString GetName() const = 0;
 
 	/**
-	* If encoder is supported.
+	* If encoder is supported, true once both initialization phases succeeded.
 	*/
 	virtual bool IsSupported() const = 0;
 
+	/**
+	* First initialization phase, runs on a worker thread: loads the encoder runtime, opens a session and
+	* configures it. Must not touch the RHI. Returns false if the encoder can't be used.
+	*/
+	virtual bool Initialize() = 0;
+
+	/**
+	* Second initialization phase, runs on the render thread after Initialize() succeeded: creates and
+	* registers the resources back buffers are encoded from.
+	*/
+	virtual void InitializeResources(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer) = 0;
+
+	/**
+	* Codec frames are encoded with once Initialize() succeeded. Encoders that can't encode the codec they were created
+	* with fall back to one clients of it still decode, e.g. HEVC Main10 to Main, the default is the one asked for.
+	*/
+	virtual EVideoCodec GetCodec(EVideoCodec Requested) const
+	{
+		return Requested;
+	}
+
 	/**
 	* Get Sps/Pps header data.
 	*/
@@ -69,18 +135,30 @@ public:
 	virtual void PostResizeBackBuffer() {}
 
 	/**
-	* Encode an input back buffer.
+	* Encode an input back buffer, Timestamp is on the 90 kHz RTP clock and is passed back with the encoded frame.
 	*/
-	virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 CaptureMs) = 0;
+	virtual void EncodeFrame(const FVideoEncoderSettings& Settings, const FTexture2DRHIRef& BackBuffer, uint64 Timestamp) = 0;
 
 	/**
 	* Force the next frame to be an IDR frame.
 	*/
 	virtual void ForceIdrFrame() = 0;
 
+	/**
+	* A client lost the frame with the given RTP timestamp, the low 32 bits of the Timestamp passed to EncodeFrame(),
+	* and can't decode it or anything predicted from it. Encoders that can predict the next frame from one the client
+	* still has override this, the default is an IDR frame.
+	*/
+	virtual void ReportLoss(uint32 RtpTimestamp)
+	{
+		ForceIdrFrame();
+	}
+
 	/**
 	* If encoder is running in async/sync mode.
 	*/
 	virtual bool IsAsyncEnabled() const = 0;
 };
 
+// creates an encoder neither initialization phase has run on yet, lets the controller run on any encoder backend
+using FVideoEncoderFactory = TFunction<TUniquePtr<IVideoEncoder>(const FVideoEncoderSettings&, const IVideoEncoder::FEncodedFrameReadyCallback&)>;
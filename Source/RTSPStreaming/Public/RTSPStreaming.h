@@ -28,4 +28,6 @@ private:
 
 	TUniquePtr<FController>		Controller;
 	FTexture2DRHIRef			mResolvedFrameBuffer;
+	FString						ReplayFilename;			// H.264 Annex-B file streamed instead of the back buffer, see -RTSPStreamingReplay=
+	bool						bSoftwareEncoderOnly = false;	// NVENC isn't tried, see -RTSPStreamingSoftwareEncoder
 };
\ No newline at end of file
@@ -16,6 +16,9 @@ namespace UnrealBuildTool.Rules
             PrivateIncludePaths.Add(System.IO.Path.Combine(ModuleDirectory, "../ThirdParty"));
             PrivateIncludePaths.Add(System.IO.Path.Combine(ModuleDirectory, "./Public"));
 
+            // BSD socket internals, used to reach the native socket handle for gather writes and socket options
+            PrivateIncludePaths.Add(System.IO.Path.Combine(EngineDirectory, "Source/Runtime/Sockets/Private"));
+
             // NOTE: General rule is not to access the private folder of another module,
             // but to use the ISubmixBufferListener interface, we  need to include some private headers
             //PrivateIncludePaths.Add(System.IO.Path.Combine(Directory.GetCurrentDirectory(), "./Runtime/AudioMixer/Private"));
@@ -64,6 +67,41 @@ namespace UnrealBuildTool.Rules
                 AddEngineThirdPartyPrivateStaticDependencies(Target, "IntelMetricsDiscovery");
                 AddEngineThirdPartyPrivateStaticDependencies(Target, "NVAftermath");
             }
+
+            // io_uring network backend, only built when liburing is dropped into ThirdParty/liburing (include/, lib/liburing.a)
+            string LibUringDirectory = System.IO.Path.Combine(ModuleDirectory, "../ThirdParty/liburing");
+            if (Target.Platform == UnrealTargetPlatform.Linux && Directory.Exists(LibUringDirectory))
+            {
+                PrivateIncludePaths.Add(System.IO.Path.Combine(LibUringDirectory, "include"));
+                PublicAdditionalLibraries.Add(System.IO.Path.Combine(LibUringDirectory, "lib", "liburing.a"));
+                PublicDefinitions.Add("WITH_LIBURING=1");
+            }
+            else
+            {
+                PublicDefinitions.Add("WITH_LIBURING=0");
+            }
+
+            // software H.264 fallback encoder, only built when OpenH264 is dropped into ThirdParty/openh264
+            // (include/wels/, lib/openh264.lib and bin/openh264.dll on Windows, lib/libopenh264.a on Linux)
+            string OpenH264Directory = System.IO.Path.Combine(ModuleDirectory, "../ThirdParty/openh264");
+            if (Directory.Exists(OpenH264Directory))
+            {
+                PrivateIncludePaths.Add(System.IO.Path.Combine(OpenH264Directory, "include"));
+                if (Target.Platform == UnrealTargetPlatform.Win64)
+                {
+                    PublicAdditionalLibraries.Add(System.IO.Path.Combine(OpenH264Directory, "lib", "openh264.lib"));
+                    RuntimeDependencies.Add("$(BinaryOutputDir)/openh264.dll", System.IO.Path.Combine(OpenH264Directory, "bin", "openh264.dll"));
+                }
+                else
+                {
+                    PublicAdditionalLibraries.Add(System.IO.Path.Combine(OpenH264Directory, "lib", "libopenh264.a"));
+                }
+                PublicDefinitions.Add("WITH_OPENH264=1");
+            }
+            else
+            {
+                PublicDefinitions.Add("WITH_OPENH264=0");
+            }
         }
     }
 }